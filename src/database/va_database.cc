@@ -1,12 +1,17 @@
 #include "va_database.h"
 
+#include <chrono>
+#include <sstream>
+
+#include "va_trace.h"
+
 va::Database::Database(
 	std::string& url,
 	std::string& username, 
 	std::string& password, 
 	std::string& database,
 	bool sync
-) : m_database(database)  {
+) : m_url(url), m_username(username), m_password(password), m_database(database)  {
 	m_driver = get_driver_instance();
 	m_conn = m_driver->connect(url, username, password);
 
@@ -15,17 +20,65 @@ va::Database::Database(
 	}
 
 	m_conn->setSchema(database);
+	m_add_missing_indexes();
+	m_prepare_statements();
+}
+
+static auto bulk_insert_query(size_t rows) -> std::string {
+	std::string query { "INSERT INTO metadata(video_file, object_label, class_id, box_left, box_top, box_width, box_height, timestamp) VALUES " };
+	for (size_t i = 0; i < rows; ++i) {
+		query += (i == 0) ? "(?, ?, ?, ?, ?, ?, ?, ?)" : ", (?, ?, ?, ?, ?, ?, ?, ?)";
+	}
+	return query;
+}
 
+auto va::Database::m_prepare_statements() -> void {
 	m_insert_prep_statement = m_conn->prepareStatement("INSERT INTO metadata(video_file, object_label, class_id, box_left, box_top, box_width, box_height, timestamp) VALUES (?, ?, ?, ?, ?, ?, ?, ?)");
 	m_select_prep_statement = m_conn->prepareStatement("SELECT id, video_file, object_label, class_id, box_left, box_top, box_width, box_height, timestamp FROM metadata LIMIT ?");
+	m_select_range_prep_statement = m_conn->prepareStatement("SELECT object_label, class_id, box_left, box_top, box_width, box_height, timestamp FROM metadata WHERE video_file = ? AND timestamp BETWEEN ? AND ? ORDER BY timestamp");
+	m_bulk_insert_prep_statement = m_conn->prepareStatement(bulk_insert_query(DATABASE_BULK_INSERT_ROWS));
+}
+
+auto va::Database::m_delete_statements() -> void {
+	delete m_insert_prep_statement;
+	delete m_select_prep_statement;
+	delete m_select_range_prep_statement;
+	delete m_bulk_insert_prep_statement;
+	delete m_journal_offset_prep_statement;
+	m_insert_prep_statement = nullptr;
+	m_select_prep_statement = nullptr;
+	m_select_range_prep_statement = nullptr;
+	m_bulk_insert_prep_statement = nullptr;
+	m_journal_offset_prep_statement = nullptr;
+}
+
+/**
+ * Open a new connection after the server went away, prepared statements do
+ * not survive it
+ */
+auto va::Database::reconnect() -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	m_delete_statements();
+	delete m_res;
+	delete m_statement;
+	m_res = nullptr;
+	m_statement = nullptr;
+	delete m_conn;
+	m_conn = nullptr;
+
+	m_conn = m_driver->connect(m_url, m_username, m_password);
+	m_conn->setSchema(m_database);
+	m_prepare_statements();
+	if (m_journal) {
+		m_journal_offset_prep_statement = m_conn->prepareStatement("REPLACE INTO journal_offset(id, segment_id, segment_offset) VALUES (1, ?, ?)");
+	}
 }
 
 va::Database::~Database() {
 	std::cout << "start VA DATABASE deallocate" << std::endl;
 	delete m_res;
 	delete m_statement;
-	delete m_insert_prep_statement;
-	delete m_select_prep_statement;
+	m_delete_statements();
 	delete m_conn;
 	std::cout << "finish VA DATABASE deallocate" << std::endl;
 }
@@ -38,14 +91,214 @@ va::Database::~Database() {
 auto va::Database::create_table() -> void {
 	m_statement = m_conn->createStatement();
 	m_statement->execute("USE " + m_database);
-	m_statement->execute("DROP TABLE IF EXISTS metadata");
-	m_statement->execute("CREATE TABLE metadata(id INT AUTO_INCREMENT PRIMARY KEY, video_file TEXT(20), object_label TEXT(20), class_id INT, box_left FLOAT, box_top FLOAT, box_width FLOAT, box_height FLOAT, timestamp BIGINT)");
-	m_statement->execute("INSERT INTO metadata(video_file, object_label, class_id, box_left, box_top, box_width, box_height, timestamp) VALUES ('video file', 'Car', 0, 5.5, 5.5, 5.5, 5.5, 100000000000)");
+	/* existing rows are kept, the retention manager bounds the table */
+	m_statement->execute("CREATE TABLE IF NOT EXISTS metadata(id BIGINT AUTO_INCREMENT PRIMARY KEY, video_file TEXT(20), object_label TEXT(20), class_id INT, box_left FLOAT, box_top FLOAT, box_width FLOAT, box_height FLOAT, timestamp BIGINT, INDEX idx_timestamp(timestamp), INDEX idx_file_timestamp(video_file(63), timestamp))");
 
-	std::cout << "Created new table" << std::endl;
+	std::cout << "Created table" << std::endl;
+}
+
+/**
+ * Add the indexes the retention chunks (timestamp) and select_range (source
+ * and timestamp) walk to metadata tables created before them, on every start.
+ * The source prefix is all of TEXT(20) that fits a key under utf8mb4.
+ */
+auto va::Database::m_add_missing_indexes() -> void {
+	static const std::pair<const char*, const char*> indexes[] = {
+		{ "idx_timestamp", "timestamp" },
+		{ "idx_file_timestamp", "video_file(63), timestamp" },
+	};
+	std::unique_ptr<sql::Statement> statement { m_conn->createStatement() };
+	std::unique_ptr<sql::ResultSet> table { statement->executeQuery("SELECT COUNT(*) FROM information_schema.tables WHERE table_schema = DATABASE() AND table_name = 'metadata'") };
+	if (!table->next() || table->getInt(1) == 0) {
+		return;
+	}
+	for (const auto& index : indexes) {
+		std::unique_ptr<sql::ResultSet> res { statement->executeQuery(std::string { "SELECT COUNT(*) FROM information_schema.statistics WHERE table_schema = DATABASE() AND table_name = 'metadata' AND index_name = '" } + index.first + "'") };
+		if (res->next() && res->getInt(1) == 0) {
+			std::cout << "Adding index " << index.first << " to metadata, this takes a while on a large table" << std::endl;
+			statement->execute(std::string { "ALTER TABLE metadata ADD INDEX " } + index.first + "(" + index.second + ")");
+		}
+	}
+}
+
+/**
+ * Position of the last journal record committed to the metadata table, written
+ * in the same transaction as the rows
+ */
+auto va::Database::create_journal_table() -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	std::unique_ptr<sql::Statement> statement { m_conn->createStatement() };
+	statement->execute("CREATE TABLE IF NOT EXISTS journal_offset(id INT PRIMARY KEY, segment_id BIGINT UNSIGNED, segment_offset BIGINT UNSIGNED)");
+	if (!m_journal) {
+		m_journal_offset_prep_statement = m_conn->prepareStatement("REPLACE INTO journal_offset(id, segment_id, segment_offset) VALUES (1, ?, ?)");
+		m_journal = true;
+	}
+}
+
+/**
+ * Summary table that compacted raw rows are folded into, one row per source,
+ * class and time bucket
+ */
+auto va::Database::create_retention_tables() -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	std::unique_ptr<sql::Statement> statement { m_conn->createStatement() };
+	statement->execute("CREATE TABLE IF NOT EXISTS metadata_summary(video_file VARCHAR(255), class_id INT, bucket BIGINT, detections BIGINT, box_left FLOAT, box_top FLOAT, box_width FLOAT, box_height FLOAT, PRIMARY KEY(video_file, class_id, bucket), INDEX idx_bucket(bucket))");
+}
+
+/**
+ * Fold the oldest raw rows with a timestamp before the cutoff, at most rows of
+ * them, into metadata_summary and delete them, in one transaction. Buckets
+ * that already have a summary are merged into it. Returns the number of raw
+ * rows removed. Throws sql::SQLException.
+ */
+auto va::Database::compact_chunk(uint64_t before, uint64_t bucket_ns, size_t rows) -> size_t {
+	VA_TRACE_SCOPE("db.compact_chunk");
+	std::lock_guard<std::mutex> lock { m_mutex };
+	m_conn->setAutoCommit(false);
+	size_t removed = 0;
+	try {
+		std::unique_ptr<sql::PreparedStatement> summarize { m_conn->prepareStatement(
+			"INSERT INTO metadata_summary(video_file, class_id, bucket, detections, box_left, box_top, box_width, box_height) "
+			"SELECT * FROM ("
+				"SELECT video_file, class_id, timestamp - timestamp % ? AS bucket, COUNT(*) AS detections, "
+				"AVG(box_left) AS box_left, AVG(box_top) AS box_top, AVG(box_width) AS box_width, AVG(box_height) AS box_height "
+				"FROM (SELECT video_file, class_id, box_left, box_top, box_width, box_height, timestamp FROM metadata "
+				"WHERE timestamp < ? ORDER BY timestamp, id LIMIT ?) AS chunk "
+				"GROUP BY video_file, class_id, bucket"
+			") AS chunk_summary "
+			"ON DUPLICATE KEY UPDATE "
+			"box_left = (metadata_summary.box_left * metadata_summary.detections + chunk_summary.box_left * chunk_summary.detections) / (metadata_summary.detections + chunk_summary.detections), "
+			"box_top = (metadata_summary.box_top * metadata_summary.detections + chunk_summary.box_top * chunk_summary.detections) / (metadata_summary.detections + chunk_summary.detections), "
+			"box_width = (metadata_summary.box_width * metadata_summary.detections + chunk_summary.box_width * chunk_summary.detections) / (metadata_summary.detections + chunk_summary.detections), "
+			"box_height = (metadata_summary.box_height * metadata_summary.detections + chunk_summary.box_height * chunk_summary.detections) / (metadata_summary.detections + chunk_summary.detections), "
+			"detections = metadata_summary.detections + chunk_summary.detections"
+		) };
+		summarize->setUInt64(1, bucket_ns);
+		summarize->setUInt64(2, before);
+		summarize->setInt(3, rows);
+		summarize->execute();
+
+		/* same rows as the chunk above, the transaction holds them */
+		std::unique_ptr<sql::PreparedStatement> remove { m_conn->prepareStatement("DELETE FROM metadata WHERE timestamp < ? ORDER BY timestamp, id LIMIT ?") };
+		remove->setUInt64(1, before);
+		remove->setInt(2, rows);
+		removed = remove->executeUpdate();
+		m_conn->commit();
+	} catch (sql::SQLException& e) {
+		try {
+			m_conn->rollback();
+			m_conn->setAutoCommit(true);
+		} catch (sql::SQLException&) {
+			/* connection is gone, the caller reconnects */
+		}
+		throw;
+	}
+	m_conn->setAutoCommit(true);
+	return removed;
+}
+
+static auto purge_query(sql::Connection* conn, const std::string& query, uint64_t before, size_t rows) -> size_t {
+	VA_TRACE_SCOPE("db.purge_chunk");
+	std::unique_ptr<sql::PreparedStatement> statement { conn->prepareStatement(query) };
+	statement->setUInt64(1, before);
+	statement->setInt(2, rows);
+	return statement->executeUpdate();
+}
+
+/**
+ * Delete at most rows raw rows older than before, without summarizing them.
+ * Throws sql::SQLException.
+ */
+auto va::Database::purge_chunk(uint64_t before, size_t rows) -> size_t {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	return purge_query(m_conn, "DELETE FROM metadata WHERE timestamp < ? ORDER BY timestamp LIMIT ?", before, rows);
+}
+
+/**
+ * Delete at most rows summary rows of buckets older than before. Throws
+ * sql::SQLException.
+ */
+auto va::Database::purge_summary_chunk(uint64_t before, size_t rows) -> size_t {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	return purge_query(m_conn, "DELETE FROM metadata_summary WHERE bucket < ? ORDER BY bucket LIMIT ?", before, rows);
+}
+
+/**
+ * One row per thumbnail file, keyed like the metadata row of its detection
+ * (video_file, timestamp, class_id)
+ */
+auto va::Database::create_snapshot_table() -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	std::unique_ptr<sql::Statement> statement { m_conn->createStatement() };
+	statement->execute("CREATE TABLE IF NOT EXISTS snapshot(id BIGINT AUTO_INCREMENT PRIMARY KEY, video_file VARCHAR(255), timestamp BIGINT, class_id INT, object_label VARCHAR(32), object_id BIGINT UNSIGNED, confidence FLOAT, box_left FLOAT, box_top FLOAT, box_width FLOAT, box_height FLOAT, path VARCHAR(512), INDEX idx_detection(video_file, timestamp))");
+}
+
+/**
+ * Record a written thumbnail. Throws sql::SQLException.
+ */
+auto va::Database::insert_snapshot(const std::string& video_file, const va::ObjectMetadata& object_meta, uint64_t object_id, float confidence, const std::string& path) -> void {
+	VA_TRACE_SCOPE("db.insert_snapshot");
+	std::lock_guard<std::mutex> lock { m_mutex };
+	std::unique_ptr<sql::PreparedStatement> statement { m_conn->prepareStatement("INSERT INTO snapshot(video_file, timestamp, class_id, object_label, object_id, confidence, box_left, box_top, box_width, box_height, path) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)") };
+	statement->setString(1, video_file);
+	statement->setUInt64(2, object_meta.timestamp);
+	statement->setInt(3, object_meta.class_id);
+	statement->setString(4, object_meta.object_label);
+	statement->setUInt64(5, object_id);
+	statement->setDouble(6, confidence);
+	statement->setDouble(7, object_meta.left);
+	statement->setDouble(8, object_meta.top);
+	statement->setDouble(9, object_meta.width);
+	statement->setDouble(10, object_meta.height);
+	statement->setString(11, path);
+	statement->execute();
+}
+
+auto va::Database::create_heatmap_table() -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	std::unique_ptr<sql::Statement> statement { m_conn->createStatement() };
+	statement->execute("CREATE TABLE IF NOT EXISTS heatmap(id BIGINT AUTO_INCREMENT PRIMARY KEY, video_file VARCHAR(255), source_id INT UNSIGNED, width INT UNSIGNED, height INT UNSIGNED, from_ts BIGINT UNSIGNED, to_ts BIGINT UNSIGNED, frames BIGINT UNSIGNED, counts LONGBLOB, INDEX idx_heatmap(video_file, from_ts))");
+}
+
+/**
+ * Record the counts of one heatmap interval, row by row as little endian u32.
+ * Throws sql::SQLException.
+ */
+auto va::Database::insert_heatmap(const std::string& video_file, guint source_id, guint width, guint height, uint64_t from, uint64_t to, uint64_t frames, const std::vector<guint32>& counts) -> void {
+	VA_TRACE_SCOPE("db.insert_heatmap");
+	std::string bytes(counts.size() * 4, '\0');
+	for (size_t i = 0; i < counts.size(); ++i) {
+		bytes[i * 4] = static_cast<char>(counts[i] & 0xff);
+		bytes[i * 4 + 1] = static_cast<char>((counts[i] >> 8) & 0xff);
+		bytes[i * 4 + 2] = static_cast<char>((counts[i] >> 16) & 0xff);
+		bytes[i * 4 + 3] = static_cast<char>(counts[i] >> 24);
+	}
+	std::istringstream blob { bytes };
+	std::lock_guard<std::mutex> lock { m_mutex };
+	std::unique_ptr<sql::PreparedStatement> statement { m_conn->prepareStatement("INSERT INTO heatmap(video_file, source_id, width, height, from_ts, to_ts, frames, counts) VALUES (?, ?, ?, ?, ?, ?, ?, ?)") };
+	statement->setString(1, video_file);
+	statement->setUInt(2, source_id);
+	statement->setUInt(3, width);
+	statement->setUInt(4, height);
+	statement->setUInt64(5, from);
+	statement->setUInt64(6, to);
+	statement->setUInt64(7, frames);
+	statement->setBlob(8, &blob);
+	statement->execute();
+}
+
+auto va::Database::journal_offset() -> std::pair<uint64_t, uint64_t> {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	std::unique_ptr<sql::Statement> statement { m_conn->createStatement() };
+	std::unique_ptr<sql::ResultSet> res { statement->executeQuery("SELECT segment_id, segment_offset FROM journal_offset WHERE id = 1") };
+	if (!res->next()) {
+		return { 0, 0 };
+	}
+	return { res->getUInt64("segment_id"), res->getUInt64("segment_offset") };
 }
 
 auto va::Database::select(int limit) -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
 	try {
 		m_select_prep_statement->setInt(1, limit);
 		std::unique_ptr<sql::ResultSet> res { m_select_prep_statement->executeQuery() };
@@ -73,6 +326,9 @@ auto va::Database::select(int limit) -> void {
 }
 
 auto va::Database::insert(va::FrameMetadata* frame_meta) -> void {
+	VA_TRACE_SCOPE("db.insert");
+	auto start = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock { m_mutex };
 	m_insert_prep_statement->setString(1, frame_meta->video_file);
 	for (va::ObjectMetadata object_meta : frame_meta->va_object_meta_list) {
 		m_insert_prep_statement->setString(2, object_meta.object_label);
@@ -85,4 +341,104 @@ auto va::Database::insert(va::FrameMetadata* frame_meta) -> void {
 
 		m_insert_prep_statement->execute();
 	}
+	++m_insert_calls;
+	m_insert_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+auto va::Database::select_range(const std::string& video_file, uint64_t from, uint64_t to) -> std::vector<va::ObjectMetadata> {
+	VA_TRACE_SCOPE("db.select_range");
+	std::vector<va::ObjectMetadata> result;
+	std::lock_guard<std::mutex> lock { m_mutex };
+	try {
+		m_select_range_prep_statement->setString(1, video_file);
+		m_select_range_prep_statement->setUInt64(2, from);
+		m_select_range_prep_statement->setUInt64(3, to);
+		std::unique_ptr<sql::ResultSet> res { m_select_range_prep_statement->executeQuery() };
+
+		while (res->next()) {
+			result.emplace_back(
+				res->getString("object_label"),
+				res->getInt("class_id"),
+				res->getDouble("box_left"),
+				res->getDouble("box_top"),
+				res->getDouble("box_width"),
+				res->getDouble("box_height"),
+				res->getInt64("timestamp")
+			);
+		}
+	} catch (sql::SQLException& e) {
+		std::cout << "# ERR: SQLException in " << __FILE__;
+		std::cout << "(" << __FUNCTION__ << ")" << std::endl;
+		std::cout << "# ERR: " << e.what();
+		std::cout << " (MySQL error code: " << e.getErrorCode();
+		std::cout << ", SQLState: " << e.getSQLState() << " )" << std::endl;
+	}
+	return result;
+}
+
+auto va::Database::m_bind_rows(
+	sql::PreparedStatement* statement,
+	const std::vector<std::pair<const va::FrameMetadata*, const va::ObjectMetadata*>>& rows,
+	size_t first,
+	size_t count
+) -> void {
+	int column = 1;
+	for (size_t i = first; i < first + count; ++i) {
+		const va::FrameMetadata* frame_meta = rows[i].first;
+		const va::ObjectMetadata* object_meta = rows[i].second;
+		statement->setString(column++, frame_meta->video_file);
+		statement->setString(column++, object_meta->object_label);
+		statement->setInt(column++, object_meta->class_id);
+		statement->setDouble(column++, object_meta->left);
+		statement->setDouble(column++, object_meta->top);
+		statement->setDouble(column++, object_meta->width);
+		statement->setDouble(column++, object_meta->height);
+		statement->setInt64(column++, object_meta->timestamp);
+	}
+}
+
+/**
+ * Insert every object of frames with multi-row INSERTs and move the journal
+ * offset in the same transaction, so a batch is either fully applied with its
+ * offset or not at all. Throws sql::SQLException, the caller retries.
+ */
+auto va::Database::insert_batch(const std::vector<va::FrameMetadata>& frames, uint64_t journal_segment, uint64_t journal_offset) -> void {
+	VA_TRACE_SCOPE("db.insert_batch");
+	std::vector<std::pair<const va::FrameMetadata*, const va::ObjectMetadata*>> rows;
+	for (const va::FrameMetadata& frame_meta : frames) {
+		for (const va::ObjectMetadata& object_meta : frame_meta.va_object_meta_list) {
+			rows.emplace_back(&frame_meta, &object_meta);
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock { m_mutex };
+	m_conn->setAutoCommit(false);
+	try {
+		size_t first = 0;
+		for (; first + DATABASE_BULK_INSERT_ROWS <= rows.size(); first += DATABASE_BULK_INSERT_ROWS) {
+			m_bind_rows(m_bulk_insert_prep_statement, rows, first, DATABASE_BULK_INSERT_ROWS);
+			m_bulk_insert_prep_statement->execute();
+		}
+		if (first < rows.size()) {
+			std::unique_ptr<sql::PreparedStatement> statement { m_conn->prepareStatement(bulk_insert_query(rows.size() - first)) };
+			m_bind_rows(statement.get(), rows, first, rows.size() - first);
+			statement->execute();
+		}
+		m_journal_offset_prep_statement->setUInt64(1, journal_segment);
+		m_journal_offset_prep_statement->setUInt64(2, journal_offset);
+		m_journal_offset_prep_statement->execute();
+		m_conn->commit();
+	} catch (sql::SQLException& e) {
+		try {
+			m_conn->rollback();
+			m_conn->setAutoCommit(true);
+		} catch (sql::SQLException&) {
+			/* connection is gone, reconnect() starts over */
+		}
+		throw;
+	}
+	m_conn->setAutoCommit(true);
+	++m_insert_calls;
+	m_insert_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
 }
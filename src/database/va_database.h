@@ -8,8 +8,16 @@
 #include <cppconn/prepared_statement.h>
 #include <cppconn/driver.h>
 
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <vector>
+
 #include "va_object_meta.h"
 
+/* rows per multi-row INSERT when replaying the journal */
+#define DATABASE_BULK_INSERT_ROWS 128
+
 namespace va {
 struct Database {
 	sql::Connection* m_conn = nullptr;
@@ -17,16 +25,46 @@ struct Database {
 	sql::Statement* m_statement = nullptr;
 	sql::PreparedStatement* m_insert_prep_statement = nullptr;
 	sql::PreparedStatement* m_select_prep_statement = nullptr;
+	sql::PreparedStatement* m_select_range_prep_statement = nullptr;
+	sql::PreparedStatement* m_bulk_insert_prep_statement = nullptr;
+	sql::PreparedStatement* m_journal_offset_prep_statement = nullptr;
 	sql::ResultSet* m_res = nullptr;
+	std::string m_url;
+	std::string m_username;
+	std::string m_password;
 	std::string m_database;
+	bool m_journal = false;
+	/* the connection is shared by the probe and query callers */
+	std::mutex m_mutex;
+	/* calls to and time spent in insert() / insert_batch() */
+	std::atomic<uint64_t> m_insert_calls { 0 };
+	std::atomic<uint64_t> m_insert_us { 0 };
 
 	Database(std::string& url, std::string& username, std::string& password, std::string& database, bool sync);
 	~Database();
 
+	auto m_add_missing_indexes() -> void;
+	auto m_prepare_statements() -> void;
+	auto m_delete_statements() -> void;
+	auto m_bind_rows(sql::PreparedStatement* statement, const std::vector<std::pair<const va::FrameMetadata*, const va::ObjectMetadata*>>& rows, size_t first, size_t count) -> void;
+
 	auto create_table() -> void;
+	auto create_journal_table() -> void;
+	auto create_retention_tables() -> void;
+	auto create_snapshot_table() -> void;
+	auto create_heatmap_table() -> void;
+	auto reconnect() -> void;
 	auto create_database() -> void;
 	auto select(int limit) -> void;
 	auto insert(va::FrameMetadata* frame_meta) -> void;
+	auto insert_batch(const std::vector<va::FrameMetadata>& frames, uint64_t journal_segment, uint64_t journal_offset) -> void;
+	auto journal_offset() -> std::pair<uint64_t, uint64_t>;
+	auto select_range(const std::string& video_file, uint64_t from, uint64_t to) -> std::vector<va::ObjectMetadata>;
+	auto compact_chunk(uint64_t before, uint64_t bucket_ns, size_t rows) -> size_t;
+	auto purge_chunk(uint64_t before, size_t rows) -> size_t;
+	auto purge_summary_chunk(uint64_t before, size_t rows) -> size_t;
+	auto insert_snapshot(const std::string& video_file, const va::ObjectMetadata& object_meta, uint64_t object_id, float confidence, const std::string& path) -> void;
+	auto insert_heatmap(const std::string& video_file, guint source_id, guint width, guint height, uint64_t from, uint64_t to, uint64_t frames, const std::vector<guint32>& counts) -> void;
 };
 
 } // namespace va
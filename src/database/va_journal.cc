@@ -0,0 +1,538 @@
+#include "va_journal.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+#include <yaml-cpp/yaml.h>
+
+#include "va_thread_placement.h"
+#include "va_trace.h"
+
+/* record header: payload length and CRC32 of the payload, both 32 bit */
+#define JOURNAL_HEADER_SIZE 8
+#define JOURNAL_MAX_RECORD_SIZE (16 * 1024 * 1024)
+
+auto va::parse_journal_config(const char* cfg_file, const char* group) -> va::JournalConfig {
+	va::JournalConfig config {};
+	YAML::Node node = YAML::LoadFile(cfg_file)[group];
+	if (!node) {
+		return config;
+	}
+	config.enable = node["enable"].as<int>(config.enable) != 0;
+	config.directory = node["directory"].as<std::string>(config.directory);
+	config.segment_size_mb = node["segment-size-mb"].as<size_t>(config.segment_size_mb);
+	config.max_disk_mb = node["max-disk-mb"].as<size_t>(config.max_disk_mb);
+	config.max_memory_mb = node["max-memory-mb"].as<size_t>(config.max_memory_mb);
+	config.fsync_interval_ms = node["fsync-interval-ms"].as<unsigned>(config.fsync_interval_ms);
+	config.batch_rows = node["batch-rows"].as<unsigned>(config.batch_rows);
+	config.retry_interval_ms = node["retry-interval-ms"].as<unsigned>(config.retry_interval_ms);
+	return config;
+}
+
+auto va::journal_crc32(const char* data, size_t size) -> uint32_t {
+	static uint32_t table[256] = { };
+	static bool table_ready = [] {
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; ++bit) {
+				crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+			}
+			table[i] = crc;
+		}
+		return true;
+	}();
+	(void)table_ready;
+
+	uint32_t crc = 0xFFFFFFFFu;
+	for (size_t i = 0; i < size; ++i) {
+		crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+	}
+	return crc ^ 0xFFFFFFFFu;
+}
+
+template <typename T>
+static auto put(std::vector<char>* out, T value) -> void {
+	const char* bytes = reinterpret_cast<const char*>(&value);
+	out->insert(out->end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+static auto get(const char** data, const char* end, T* value) -> bool {
+	if (end - *data < static_cast<ptrdiff_t>(sizeof(T))) {
+		return false;
+	}
+	std::memcpy(value, *data, sizeof(T));
+	*data += sizeof(T);
+	return true;
+}
+
+/**
+ * Append one framed record. Fields are stored in host byte order, x86 and
+ * aarch64 (Jetson) are both little endian.
+ */
+auto va::journal_encode(const va::FrameMetadata& frame_meta, std::vector<char>* out) -> void {
+	size_t header = out->size();
+	out->resize(header + JOURNAL_HEADER_SIZE);
+
+	uint16_t file_length = static_cast<uint16_t>(std::min<size_t>(frame_meta.video_file.size(), UINT16_MAX));
+	put<uint16_t>(out, file_length);
+	out->insert(out->end(), frame_meta.video_file.data(), frame_meta.video_file.data() + file_length);
+	put<uint64_t>(out, frame_meta.timestamp);
+	put<uint32_t>(out, static_cast<uint32_t>(frame_meta.va_object_meta_list.size()));
+	for (const va::ObjectMetadata& object_meta : frame_meta.va_object_meta_list) {
+		uint8_t label_length = static_cast<uint8_t>(std::min<size_t>(object_meta.object_label.size(), UINT8_MAX));
+		put<uint8_t>(out, label_length);
+		out->insert(out->end(), object_meta.object_label.data(), object_meta.object_label.data() + label_length);
+		put<int32_t>(out, object_meta.class_id);
+		put<float>(out, object_meta.left);
+		put<float>(out, object_meta.top);
+		put<float>(out, object_meta.width);
+		put<float>(out, object_meta.height);
+		put<uint64_t>(out, object_meta.timestamp);
+	}
+
+	uint32_t length = static_cast<uint32_t>(out->size() - header - JOURNAL_HEADER_SIZE);
+	uint32_t crc = va::journal_crc32(out->data() + header + JOURNAL_HEADER_SIZE, length);
+	std::memcpy(out->data() + header, &length, sizeof(length));
+	std::memcpy(out->data() + header + 4, &crc, sizeof(crc));
+}
+
+/**
+ * Decode a record payload (without its header)
+ */
+auto va::journal_decode(const char* data, size_t size, va::FrameMetadata* frame_meta) -> bool {
+	const char* end = data + size;
+	uint16_t file_length;
+	if (!get(&data, end, &file_length) || end - data < file_length) {
+		return false;
+	}
+	frame_meta->video_file.assign(data, file_length);
+	data += file_length;
+
+	uint32_t count;
+	if (!get(&data, end, &frame_meta->timestamp) || !get(&data, end, &count)) {
+		return false;
+	}
+	frame_meta->va_object_meta_list.clear();
+	for (uint32_t i = 0; i < count; ++i) {
+		uint8_t label_length;
+		if (!get(&data, end, &label_length) || end - data < label_length) {
+			return false;
+		}
+		std::string label { data, label_length };
+		data += label_length;
+
+		int32_t class_id;
+		float left, top, width, height;
+		uint64_t timestamp;
+		if (!get(&data, end, &class_id) || !get(&data, end, &left) || !get(&data, end, &top) ||
+				!get(&data, end, &width) || !get(&data, end, &height) || !get(&data, end, &timestamp)) {
+			return false;
+		}
+		frame_meta->va_object_meta_list.emplace_back(label, class_id, left, top, width, height, timestamp);
+	}
+	return data == end;
+}
+
+/**
+ * Decode records of fd from offset up to end, stopping after max_rows objects.
+ * Returns the offset after the last good record, corrupt is set if a record
+ * failed its length or CRC check.
+ */
+static auto read_records(
+	int fd,
+	uint64_t offset,
+	uint64_t end,
+	size_t max_rows,
+	std::vector<va::FrameMetadata>* frames,
+	bool* corrupt
+) -> uint64_t {
+	std::vector<char> payload;
+	size_t rows = 0;
+	*corrupt = false;
+	while (offset + JOURNAL_HEADER_SIZE <= end && rows < max_rows) {
+		uint32_t header[2];
+		if (pread(fd, header, JOURNAL_HEADER_SIZE, offset) != JOURNAL_HEADER_SIZE) {
+			*corrupt = true;
+			break;
+		}
+		uint32_t length = header[0];
+		if (length > JOURNAL_MAX_RECORD_SIZE || offset + JOURNAL_HEADER_SIZE + length > end) {
+			*corrupt = true;
+			break;
+		}
+		payload.resize(length);
+		if (pread(fd, payload.data(), length, offset + JOURNAL_HEADER_SIZE) != static_cast<ssize_t>(length) ||
+				va::journal_crc32(payload.data(), length) != header[1]) {
+			*corrupt = true;
+			break;
+		}
+
+		if (frames) {
+			va::FrameMetadata frame_meta { std::string {}, 0 };
+			if (!va::journal_decode(payload.data(), length, &frame_meta)) {
+				*corrupt = true;
+				break;
+			}
+			rows += frame_meta.va_object_meta_list.size();
+			frames->push_back(std::move(frame_meta));
+		}
+		offset += JOURNAL_HEADER_SIZE + length;
+	}
+	if (!*corrupt && offset < end && offset + JOURNAL_HEADER_SIZE > end) {
+		*corrupt = true;
+	}
+	return offset;
+}
+
+static auto write_all(int fd, const char* data, size_t size) -> bool {
+	while (size > 0) {
+		ssize_t written = write(fd, data, size);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+va::Journal::Journal(const va::JournalConfig& config, va::Database* va_database) :
+	m_config(config),
+	m_va_database(va_database)
+{
+	if (!m_va_database) {
+		throw std::invalid_argument("Journal needs a database to replay into\n");
+	}
+	m_recover();
+	m_writer = std::thread { &va::Journal::m_write_loop, this };
+	m_replayer = std::thread { &va::Journal::m_replay_loop, this };
+}
+
+va::Journal::~Journal() {
+	std::cout << "start VA JOURNAL deallocate" << std::endl;
+	{
+		std::lock_guard<std::mutex> lock { m_mutex };
+		m_stop = true;
+	}
+	m_writer_cond.notify_all();
+	m_replayer_cond.notify_all();
+	m_writer.join();
+	m_replayer.join();
+	if (m_fd >= 0) {
+		close(m_fd);
+	}
+	std::cout << "journal: replayed " << m_replayed_rows << " rows, dropped " << m_dropped_frames
+		<< " frames, evicted " << m_evicted_bytes << " bytes" << std::endl;
+	std::cout << "finish VA JOURNAL deallocate" << std::endl;
+}
+
+auto va::Journal::m_segment_path(uint64_t segment) const -> std::string {
+	char name[32] = { };
+	snprintf(name, sizeof(name), "%020lu.wal", static_cast<unsigned long>(segment));
+	return m_config.directory + "/" + name;
+}
+
+/**
+ * Find existing segments, cut a torn write off the last one and start a new
+ * segment after it
+ */
+auto va::Journal::m_recover() -> void {
+	std::filesystem::create_directories(m_config.directory);
+	for (const auto& entry : std::filesystem::directory_iterator(m_config.directory)) {
+		if (entry.path().extension() == ".wal") {
+			m_segments.push_back(std::stoull(entry.path().stem().string()));
+			m_disk_bytes += entry.file_size();
+		}
+	}
+	std::sort(m_segments.begin(), m_segments.end());
+
+	uint64_t next_segment = 1;
+	if (!m_segments.empty()) {
+		std::string path = m_segment_path(m_segments.back());
+		uint64_t size = std::filesystem::file_size(path);
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw std::runtime_error("Unable to open journal segment " + path + "\n");
+		}
+		bool corrupt = false;
+		uint64_t valid = read_records(fd, 0, size, SIZE_MAX, nullptr, &corrupt);
+		close(fd);
+		if (valid < size) {
+			std::cout << "journal: truncating " << path << " from " << size << " to " << valid << " bytes" << std::endl;
+			std::filesystem::resize_file(path, valid);
+			m_disk_bytes -= size - valid;
+		}
+		next_segment = m_segments.back() + 1;
+		std::cout << "journal: recovered " << m_segments.size() << " segments, " << m_disk_bytes << " bytes" << std::endl;
+	}
+	m_open_segment(next_segment);
+}
+
+auto va::Journal::m_open_segment(uint64_t segment) -> void {
+	if (m_fd >= 0) {
+		fdatasync(m_fd);
+		close(m_fd);
+	}
+	std::string path = m_segment_path(segment);
+	m_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (m_fd < 0) {
+		throw std::runtime_error("Unable to create journal segment " + path + "\n");
+	}
+	/* make the new directory entry durable too */
+	int dir_fd = open(m_config.directory.c_str(), O_RDONLY | O_DIRECTORY);
+	if (dir_fd >= 0) {
+		fsync(dir_fd);
+		close(dir_fd);
+	}
+
+	std::lock_guard<std::mutex> lock { m_mutex };
+	m_segments.push_back(segment);
+	m_durable = { segment, 0 };
+}
+
+/**
+ * Keep the journal under max_disk_mb by dropping the oldest segments, the
+ * active one is never dropped
+ */
+auto va::Journal::m_evict() -> void {
+	uint64_t max_disk_bytes = static_cast<uint64_t>(m_config.max_disk_mb) * 1024 * 1024;
+	std::lock_guard<std::mutex> lock { m_mutex };
+	while (m_disk_bytes > max_disk_bytes && m_segments.size() > 1) {
+		std::string path = m_segment_path(m_segments.front());
+		std::error_code error;
+		uint64_t size = std::filesystem::file_size(path, error);
+		std::filesystem::remove(path, error);
+		if (!error) {
+			m_disk_bytes -= std::min(size, m_disk_bytes);
+			m_evicted_bytes += size;
+		}
+		std::cout << "# WARN: journal over " << m_config.max_disk_mb << " MB, dropped " << path << std::endl;
+		m_segments.erase(m_segments.begin());
+	}
+}
+
+/**
+ * Delete segments the replayer has moved past
+ */
+auto va::Journal::m_remove_replayed() -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	while (m_segments.size() > 1 && m_segments.front() < m_committed.segment) {
+		std::string path = m_segment_path(m_segments.front());
+		std::error_code error;
+		uint64_t size = std::filesystem::file_size(path, error);
+		std::filesystem::remove(path, error);
+		if (!error) {
+			m_disk_bytes -= std::min(size, m_disk_bytes);
+		}
+		m_segments.erase(m_segments.begin());
+	}
+}
+
+/**
+ * Memory append from the probe thread, never touches disk or the database
+ */
+auto va::Journal::append(const va::FrameMetadata& frame_meta) -> void {
+	VA_TRACE_SCOPE("journal.append");
+	if (frame_meta.va_object_meta_list.empty()) {
+		return;
+	}
+	thread_local std::vector<char> record;
+	record.clear();
+	va::journal_encode(frame_meta, &record);
+
+	std::lock_guard<std::mutex> lock { m_mutex };
+	if (m_pending.size() + record.size() > m_config.max_memory_mb * 1024 * 1024) {
+		++m_dropped_frames;
+		return;
+	}
+	m_pending.insert(m_pending.end(), record.begin(), record.end());
+	++m_pending_frames;
+}
+
+/**
+ * Bytes held by the journal, in memory and in segments not yet deleted
+ */
+auto va::Journal::backlog_bytes() -> uint64_t {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	return m_pending.size() + m_disk_bytes;
+}
+
+auto va::Journal::m_write_loop() -> void {
+	va::place_thread("journal-writer");
+	uint64_t segment_bytes = static_cast<uint64_t>(m_config.segment_size_mb) * 1024 * 1024;
+	std::vector<char> batch;
+	uint64_t batch_frames = 0;
+	bool stop = false;
+	while (!stop) {
+		{
+			std::unique_lock<std::mutex> lock { m_mutex };
+			m_writer_cond.wait_for(lock, std::chrono::milliseconds(m_config.fsync_interval_ms), [this] { return m_stop; });
+			batch.swap(m_pending);
+			batch_frames = m_pending_frames;
+			m_pending_frames = 0;
+			stop = m_stop;
+		}
+		if (batch.empty()) {
+			continue;
+		}
+
+		/* records never span segments, roll before the batch that would overflow */
+		if (m_durable.offset > 0 && m_durable.offset + batch.size() > segment_bytes) {
+			try {
+				m_open_segment(m_durable.segment + 1);
+			} catch (std::runtime_error& e) {
+				std::cout << "# ERR: " << e.what();
+			}
+		}
+
+		if (m_fd < 0 || !write_all(m_fd, batch.data(), batch.size()) || fdatasync(m_fd) != 0) {
+			std::cout << "# ERR: journal write failed: " << strerror(errno) << std::endl;
+			m_dropped_frames += batch_frames;
+			batch.clear();
+			/* cut what made it to disk so the next batch starts on a record, or
+			 * leave the torn tail behind in a sealed segment */
+			if (m_fd >= 0 && ftruncate(m_fd, m_durable.offset) != 0) {
+				try {
+					m_open_segment(m_durable.segment + 1);
+				} catch (std::runtime_error& e) {
+					std::cout << "# ERR: " << e.what();
+				}
+			}
+			continue;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock { m_mutex };
+			m_durable.offset += batch.size();
+			m_disk_bytes += batch.size();
+		}
+		m_replayer_cond.notify_one();
+		m_evict();
+		batch.clear();
+	}
+}
+
+/**
+ * Sleep for the retry interval, true if the journal is stopping
+ */
+auto va::Journal::m_wait_retry() -> bool {
+	std::unique_lock<std::mutex> lock { m_mutex };
+	return m_replayer_cond.wait_for(lock, std::chrono::milliseconds(m_config.retry_interval_ms), [this] { return m_stop; });
+}
+
+auto va::Journal::m_replay_loop() -> void {
+	va::place_thread("journal-replay");
+	/* resume right after the last committed transaction */
+	for (;;) {
+		try {
+			m_va_database->create_journal_table();
+			std::tie(m_committed.segment, m_committed.offset) = m_va_database->journal_offset();
+			break;
+		} catch (sql::SQLException& e) {
+			std::cout << "# ERR: journal cannot read committed offset: " << e.what() << std::endl;
+			if (m_wait_retry()) {
+				return;
+			}
+			try {
+				m_va_database->reconnect();
+			} catch (sql::SQLException&) { }
+		}
+	}
+
+	std::vector<va::FrameMetadata> frames;
+	for (;;) {
+		JournalPosition durable;
+		uint64_t first_segment;
+		bool stop;
+		{
+			std::unique_lock<std::mutex> lock { m_mutex };
+			/* a committed offset past the journal on disk is from before the
+			 * directory was emptied and numbering started over */
+			if (m_committed.segment > m_durable.segment
+					|| (m_committed.segment == m_durable.segment && m_committed.offset > m_durable.offset)) {
+				std::cout << "journal: committed offset " << m_committed.segment << ":" << m_committed.offset
+						<< " is past the journal, replaying from its start" << std::endl;
+				m_committed = { m_segments.empty() ? m_durable.segment : m_segments.front(), 0 };
+			}
+			if (m_committed.segment == m_durable.segment && m_committed.offset >= m_durable.offset && !m_stop) {
+				m_replayer_cond.wait_for(lock, std::chrono::milliseconds(m_config.retry_interval_ms));
+			}
+			durable = m_durable;
+			first_segment = m_segments.empty() ? durable.segment : m_segments.front();
+			stop = m_stop;
+		}
+
+		/* segments before the first one on disk were replayed or evicted */
+		if (m_committed.segment < first_segment) {
+			m_committed = { first_segment, 0 };
+		}
+		if (m_committed.segment == durable.segment && m_committed.offset >= durable.offset) {
+			if (stop) {
+				break;
+			}
+			continue;
+		}
+
+		bool sealed = m_committed.segment < durable.segment;
+		std::string path = m_segment_path(m_committed.segment);
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			if (sealed) {
+				/* evicted under us */
+				m_committed = { m_committed.segment + 1, 0 };
+			} else {
+				std::cout << "# ERR: journal cannot open " << path << ": " << strerror(errno) << std::endl;
+				if (stop || m_wait_retry()) {
+					break;
+				}
+			}
+			continue;
+		}
+		uint64_t end = sealed ? static_cast<uint64_t>(lseek(fd, 0, SEEK_END)) : durable.offset;
+		bool corrupt = false;
+		frames.clear();
+		uint64_t next_offset = read_records(fd, m_committed.offset, end, m_config.batch_rows, &frames, &corrupt);
+		close(fd);
+
+		if (corrupt) {
+			std::cout << "# ERR: journal record at " << path << ":" << next_offset << " is corrupt, skipping rest of segment" << std::endl;
+			next_offset = end;
+		}
+
+		if (!frames.empty() || next_offset != m_committed.offset) {
+			try {
+				m_va_database->insert_batch(frames, m_committed.segment, next_offset);
+				m_committed.offset = next_offset;
+				for (const va::FrameMetadata& frame_meta : frames) {
+					m_replayed_rows += frame_meta.va_object_meta_list.size();
+				}
+			} catch (sql::SQLException& e) {
+				std::cout << "# ERR: journal replay failed: " << e.what();
+				std::cout << " (MySQL error code: " << e.getErrorCode() << ")" << std::endl;
+				if (stop || m_wait_retry()) {
+					break;
+				}
+				try {
+					m_va_database->reconnect();
+				} catch (sql::SQLException&) { }
+				continue;
+			}
+		}
+
+		if (sealed && m_committed.offset >= end) {
+			m_committed = { m_committed.segment + 1, 0 };
+			m_remove_replayed();
+		}
+	}
+}
@@ -0,0 +1,102 @@
+#ifndef VA_DATABASE_JOURNAL_H_
+#define VA_DATABASE_JOURNAL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "va_database.h"
+#include "va_object_meta.h"
+
+namespace va {
+/**
+ * Journal settings, read from the "journal" group of the yml file
+ */
+struct JournalConfig {
+	bool enable = false;
+	std::string directory = "journal";
+	size_t segment_size_mb = 64;
+	size_t max_disk_mb = 4096;
+	size_t max_memory_mb = 64;
+	unsigned fsync_interval_ms = 100;
+	unsigned batch_rows = 1024;
+	unsigned retry_interval_ms = 1000;
+};
+
+auto parse_journal_config(const char* cfg_file, const char* group) -> JournalConfig;
+
+/**
+ * Byte position in the journal, a segment file id and an offset inside it
+ */
+struct JournalPosition {
+	uint64_t segment = 0;
+	uint64_t offset = 0;
+};
+
+/**
+ * Write-ahead journal in front of the database.
+ *
+ * append() only copies a serialized frame into memory. A writer thread moves it
+ * to append-only segment files ("<segment>.wal", records framed by length and
+ * CRC32) with one fdatasync per batch. A replayer thread reads durable records
+ * back, inserts them with Database::insert_batch and commits the journal
+ * position in the same transaction, so a restart resumes exactly after the
+ * last committed record. Replayed segments are deleted; when the journal grows
+ * past max_disk_mb the oldest segments are dropped even if not yet replayed.
+ */
+struct Journal {
+	JournalConfig m_config;
+	va::Database* m_va_database;
+
+	std::mutex m_mutex;
+	std::condition_variable m_writer_cond;
+	std::condition_variable m_replayer_cond;
+	std::vector<char> m_pending;
+	uint64_t m_pending_frames = 0;
+	std::vector<uint64_t> m_segments;
+	JournalPosition m_durable;
+	uint64_t m_disk_bytes = 0;
+	bool m_stop = false;
+
+	std::atomic<uint64_t> m_dropped_frames { 0 };
+	std::atomic<uint64_t> m_evicted_bytes { 0 };
+	std::atomic<uint64_t> m_replayed_rows { 0 };
+
+	/* owned by the writer thread */
+	int m_fd = -1;
+	/* owned by the replayer thread */
+	JournalPosition m_committed;
+
+	std::thread m_writer;
+	std::thread m_replayer;
+
+	Journal(const JournalConfig& config, va::Database* va_database);
+	~Journal();
+
+	Journal(const Journal& other) = delete;
+	Journal& operator=(const Journal& other) = delete;
+
+	auto append(const va::FrameMetadata& frame_meta) -> void;
+	auto backlog_bytes() -> uint64_t;
+
+	auto m_segment_path(uint64_t segment) const -> std::string;
+	auto m_recover() -> void;
+	auto m_open_segment(uint64_t segment) -> void;
+	auto m_evict() -> void;
+	auto m_remove_replayed() -> void;
+	auto m_wait_retry() -> bool;
+	auto m_write_loop() -> void;
+	auto m_replay_loop() -> void;
+};
+
+auto journal_crc32(const char* data, size_t size) -> uint32_t;
+auto journal_encode(const va::FrameMetadata& frame_meta, std::vector<char>* out) -> void;
+auto journal_decode(const char* data, size_t size, va::FrameMetadata* frame_meta) -> bool;
+
+} // namespace va
+
+#endif
@@ -0,0 +1,166 @@
+#include "va_retention.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <yaml-cpp/yaml.h>
+
+#include "va_thread_placement.h"
+
+#define NS_PER_DAY 86400000000000.0
+
+auto va::parse_retention_config(const char* cfg_file, const char* group) -> va::RetentionConfig {
+	va::RetentionConfig config {};
+	YAML::Node node = YAML::LoadFile(cfg_file)[group];
+	if (!node) {
+		return config;
+	}
+	config.enable = node["enable"].as<int>(config.enable) != 0;
+	config.raw_days = node["raw-days"].as<double>(config.raw_days);
+	config.horizon_days = node["horizon-days"].as<double>(config.horizon_days);
+	config.bucket_sec = node["bucket-sec"].as<unsigned>(config.bucket_sec);
+	config.chunk_rows = node["chunk-rows"].as<unsigned>(config.chunk_rows);
+	config.max_rows_per_sec = node["max-rows-per-sec"].as<unsigned>(config.max_rows_per_sec);
+	config.interval_sec = node["interval-sec"].as<unsigned>(config.interval_sec);
+	config.report_interval_sec = node["report-interval-sec"].as<unsigned>(config.report_interval_sec);
+	if (config.horizon_days < config.raw_days || config.chunk_rows == 0 || config.bucket_sec == 0) {
+		throw std::invalid_argument("Retention needs horizon-days >= raw-days and non zero chunk-rows, bucket-sec\n");
+	}
+	return config;
+}
+
+va::Retention::Retention(const va::RetentionConfig& config, va::Database* ingest) :
+	m_config(config),
+	m_ingest(ingest),
+	m_url(ingest->m_url),
+	m_username(ingest->m_username),
+	m_password(ingest->m_password),
+	m_database_name(ingest->m_database)
+{
+	m_worker = std::thread { &va::Retention::m_run, this };
+}
+
+va::Retention::~Retention() {
+	{
+		std::lock_guard<std::mutex> lock { m_mutex };
+		m_stop = true;
+	}
+	m_cond.notify_all();
+	m_worker.join();
+	std::cout << "Retention: compacted " << m_compacted_rows << " rows, purged " << m_purged_rows
+		<< " raw and " << m_purged_summary_rows << " summary rows" << std::endl;
+}
+
+/**
+ * Sleep unless stopped, returns false once stopping
+ */
+auto va::Retention::m_wait(std::chrono::milliseconds duration) -> bool {
+	std::unique_lock<std::mutex> lock { m_mutex };
+	return !m_cond.wait_for(lock, duration, [this] { return m_stop; });
+}
+
+/**
+ * Attribute the ingest inserts since the last sample to chunk time (busy) or
+ * to the time in between
+ */
+auto va::Retention::m_sample_ingest(bool busy) -> void {
+	uint64_t calls = m_ingest->m_insert_calls;
+	uint64_t us = m_ingest->m_insert_us;
+	(busy ? m_busy_calls : m_idle_calls) += calls - m_last_calls;
+	(busy ? m_busy_us : m_idle_us) += us - m_last_us;
+	m_last_calls = calls;
+	m_last_us = us;
+}
+
+auto va::Retention::m_report(bool force) -> void {
+	auto now = std::chrono::steady_clock::now();
+	double window_sec = std::chrono::duration<double>(now - m_window_start).count();
+	if (!force && window_sec < m_config.report_interval_sec) {
+		return;
+	}
+	if (m_window_rows > 0) {
+		auto average_ms = [](uint64_t us, uint64_t calls) { return calls ? us / 1000.0 / calls : 0.0; };
+		std::cout << "Retention: " << m_window_rows << " rows in " << window_sec << " s, "
+			<< (m_work_ms > 0.0 ? m_window_rows * 1000.0 / m_work_ms : 0.0) << " rows/s while working, "
+			<< m_window_rows / window_sec << " rows/s overall; insert latency "
+			<< average_ms(m_busy_us, m_busy_calls) << " ms during chunks vs "
+			<< average_ms(m_idle_us, m_idle_calls) << " ms otherwise" << std::endl;
+	}
+	m_window_start = now;
+	m_window_rows = 0;
+	m_work_ms = 0.0;
+	m_busy_calls = m_busy_us = m_idle_calls = m_idle_us = 0;
+}
+
+/**
+ * Run chunk until it comes back short, paced to max_rows_per_sec. Returns the
+ * rows it removed.
+ */
+template <typename F>
+auto va::Retention::m_drain(F chunk) -> uint64_t {
+	uint64_t total = 0;
+	for (;;) {
+		m_sample_ingest(false);
+		auto start = std::chrono::steady_clock::now();
+		size_t rows = chunk();
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		m_sample_ingest(true);
+
+		m_work_ms += std::chrono::duration<double, std::milli>(elapsed).count();
+		m_window_rows += rows;
+		total += rows;
+		m_report(false);
+		if (rows < m_config.chunk_rows) {
+			return total;
+		}
+
+		auto budget = std::chrono::microseconds(m_config.max_rows_per_sec ? rows * 1000000ull / m_config.max_rows_per_sec : 0);
+		auto pause = std::max(std::chrono::duration_cast<std::chrono::milliseconds>(budget - elapsed), std::chrono::milliseconds(1));
+		if (!m_wait(pause)) {
+			return total;
+		}
+	}
+}
+
+/**
+ * One pass over the tiers, oldest first so nothing is summarized only to be
+ * dropped right after
+ */
+auto va::Retention::m_pass() -> void {
+	uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	uint64_t horizon = now - static_cast<uint64_t>(m_config.horizon_days * NS_PER_DAY);
+	uint64_t raw_cutoff = now - static_cast<uint64_t>(m_config.raw_days * NS_PER_DAY);
+	uint64_t bucket_ns = m_config.bucket_sec * 1000000000ull;
+	size_t rows = m_config.chunk_rows;
+
+	m_purged_rows += m_drain([&] { return m_database->purge_chunk(horizon, rows); });
+	/* whole buckets only, a bucket straddling the cutoff waits for the next pass */
+	m_compacted_rows += m_drain([&] { return m_database->compact_chunk(raw_cutoff - raw_cutoff % bucket_ns, bucket_ns, rows); });
+	m_purged_summary_rows += m_drain([&] { return m_database->purge_summary_chunk(horizon, rows); });
+}
+
+auto va::Retention::m_run() -> void {
+	va::place_thread("retention");
+	m_window_start = std::chrono::steady_clock::now();
+	m_last_calls = m_ingest->m_insert_calls;
+	m_last_us = m_ingest->m_insert_us;
+	do {
+		try {
+			if (!m_database) {
+				m_database = std::make_unique<va::Database>(m_url, m_username, m_password, m_database_name, false);
+				m_database->create_retention_tables();
+			}
+			m_pass();
+		} catch (sql::SQLException& e) {
+			std::cout << "# ERR: SQLException in " << __FILE__;
+			std::cout << "(" << __FUNCTION__ << ")" << std::endl;
+			std::cout << "# ERR: " << e.what();
+			std::cout << " (MySQL error code: " << e.getErrorCode();
+			std::cout << ", SQLState: " << e.getSQLState() << " )" << std::endl;
+			/* start over on a fresh connection next pass */
+			m_database.reset();
+		}
+		m_sample_ingest(false);
+	} while (m_wait(std::chrono::seconds(m_config.interval_sec)));
+	m_report(true);
+}
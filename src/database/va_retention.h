@@ -0,0 +1,91 @@
+#ifndef VA_DATABASE_RETENTION_H_
+#define VA_DATABASE_RETENTION_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "va_database.h"
+
+namespace va {
+/**
+ * Retention settings, read from the "retention" group of the yml file
+ */
+struct RetentionConfig {
+	bool enable = false;
+	/* raw boxes are kept this long, then folded into per-bucket summaries */
+	double raw_days = 7.0;
+	/* summaries, and raw rows that somehow outlived raw_days, are dropped after this */
+	double horizon_days = 90.0;
+	unsigned bucket_sec = 60;
+	unsigned chunk_rows = 5000;
+	unsigned max_rows_per_sec = 20000;
+	unsigned interval_sec = 300;
+	unsigned report_interval_sec = 60;
+};
+
+auto parse_retention_config(const char* cfg_file, const char* group) -> RetentionConfig;
+
+/**
+ * Background retention of the metadata table, in three tiers: raw rows newer
+ * than raw_days, per-source per-class summaries of each bucket_sec bucket up
+ * to horizon_days, nothing beyond.
+ *
+ * A worker thread with its own database connection walks the table by
+ * timestamp in transactions of at most chunk_rows rows and sleeps between
+ * chunks to stay under max_rows_per_sec, so ingest never waits on a long
+ * lock. It periodically reports rows compacted per second and the insert
+ * latency of the ingest connection while chunks run versus in between.
+ */
+struct Retention {
+	RetentionConfig m_config;
+	va::Database* m_ingest;
+	std::string m_url;
+	std::string m_username;
+	std::string m_password;
+	std::string m_database_name;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	bool m_stop = false;
+
+	std::atomic<uint64_t> m_compacted_rows { 0 };
+	std::atomic<uint64_t> m_purged_rows { 0 };
+	std::atomic<uint64_t> m_purged_summary_rows { 0 };
+
+	/* owned by the worker thread */
+	std::unique_ptr<va::Database> m_database;
+	double m_work_ms = 0.0;
+	uint64_t m_window_rows = 0;
+	uint64_t m_busy_calls = 0;
+	uint64_t m_busy_us = 0;
+	uint64_t m_idle_calls = 0;
+	uint64_t m_idle_us = 0;
+	uint64_t m_last_calls = 0;
+	uint64_t m_last_us = 0;
+	std::chrono::steady_clock::time_point m_window_start;
+	std::thread m_worker;
+
+	Retention(const RetentionConfig& config, va::Database* ingest);
+	~Retention();
+
+	Retention(const Retention& other) = delete;
+	Retention& operator=(const Retention& other) = delete;
+
+	auto m_run() -> void;
+	auto m_pass() -> void;
+	template <typename F>
+	auto m_drain(F chunk) -> uint64_t;
+	auto m_sample_ingest(bool busy) -> void;
+	auto m_report(bool force) -> void;
+	auto m_wait(std::chrono::milliseconds duration) -> bool;
+};
+
+} // namespace va
+
+#endif
@@ -0,0 +1,478 @@
+#include "va_clip_recorder.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <stdexcept>
+
+#include <yaml-cpp/yaml.h>
+
+#include "va_thread_placement.h"
+#include "va_trace.h"
+
+/* stands in for the duration of packets that carry none */
+#define CLIP_DEFAULT_PACKET_NS (40 * GST_MSECOND)
+
+auto va::parse_clip_recorder_config(const char* cfg_file, const char* group) -> va::ClipRecorderConfig {
+	va::ClipRecorderConfig config {};
+	YAML::Node node = YAML::LoadFile(cfg_file)[group];
+	if (!node) {
+		return config;
+	}
+	config.enable = node["enable"].as<int>(config.enable) != 0;
+	config.directory = node["directory"].as<std::string>(config.directory);
+	config.format = node["format"].as<std::string>(config.format);
+	config.pre_sec = node["pre-sec"].as<guint>(config.pre_sec);
+	config.post_sec = node["post-sec"].as<guint>(config.post_sec);
+	config.max_clip_sec = node["max-clip-sec"].as<guint>(config.max_clip_sec);
+	config.ring_mb = node["ring-mb"].as<gsize>(config.ring_mb);
+	config.max_pending = node["max-pending"].as<guint>(config.max_pending);
+	for (const YAML::Node& rule_node : node["rules"]) {
+		va::ClipRule rule {};
+		rule.class_id = rule_node["class-id"].as<int>(rule.class_id);
+		rule.min_confidence = rule_node["min-confidence"].as<float>(rule.min_confidence);
+		rule.min_count = rule_node["min-count"].as<guint>(rule.min_count);
+		rule.label = rule_node["label"].as<std::string>("class-" + std::to_string(rule.class_id));
+		config.rules.push_back(rule);
+	}
+	if (config.format != "mp4" && config.format != "mkv") {
+		throw std::invalid_argument("clip-recorder format must be mp4 or mkv\n");
+	}
+	if (config.rules.size() > VA_CLIP_MAX_RULES) {
+		throw std::invalid_argument("clip-recorder takes at most " + std::to_string(VA_CLIP_MAX_RULES) + " rules\n");
+	}
+	return config;
+}
+
+va::ClipRecorder::Packet::Packet(GstBuffer* _buffer, guint64 _ts) :
+	buffer(gst_buffer_ref(_buffer)),
+	ts(_ts),
+	size(gst_buffer_get_size(_buffer)),
+	keyframe(!GST_BUFFER_FLAG_IS_SET(_buffer, GST_BUFFER_FLAG_DELTA_UNIT)) { }
+
+va::ClipRecorder::Packet::Packet(const Packet& other) :
+	buffer(gst_buffer_ref(other.buffer)), ts(other.ts), size(other.size), keyframe(other.keyframe) { }
+
+va::ClipRecorder::Packet::Packet(Packet&& other) noexcept :
+	buffer(other.buffer), ts(other.ts), size(other.size), keyframe(other.keyframe) {
+	other.buffer = nullptr;
+}
+
+va::ClipRecorder::Packet::~Packet() {
+	if (buffer) {
+		gst_buffer_unref(buffer);
+	}
+}
+
+va::ClipRecorder::Clip::~Clip() {
+	if (caps) {
+		gst_caps_unref(caps);
+	}
+}
+
+/**
+ * Parser output: packets for the ring, caps events for the writer
+ */
+static auto clip_packet_probe(GstPad* pad, GstPadProbeInfo* info, gpointer data) -> GstPadProbeReturn {
+	va::ClipRecorder::SourceRing* ring = static_cast<va::ClipRecorder::SourceRing*>(data);
+	if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+		ring->recorder->push(ring, GST_PAD_PROBE_INFO_BUFFER(info));
+	} else if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_CAPS) {
+		GstCaps* caps = nullptr;
+		gst_event_parse_caps(GST_PAD_PROBE_INFO_EVENT(info), &caps);
+		ring->recorder->set_caps(ring, caps);
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+va::ClipRecorder::ClipRecorder(const va::ClipRecorderConfig& config) :
+	m_config(config),
+	m_pre_ns(config.pre_sec * GST_SECOND),
+	m_post_ns(config.post_sec * GST_SECOND),
+	m_max_clip_ns(std::max(config.max_clip_sec, config.pre_sec + config.post_sec) * GST_SECOND),
+	m_ring_bytes(config.ring_mb * 1024 * 1024)
+{
+	if (g_mkdir_with_parents(m_config.directory.c_str(), 0755) != 0) {
+		throw std::runtime_error("Clip recorder: unable to create " + m_config.directory + ". Exiting.\n");
+	}
+	m_writer = std::thread { &va::ClipRecorder::m_write_loop, this };
+	g_print("Clip recorder: %u s before and %u s after each trigger into %s, %zu rules\n",
+			m_config.pre_sec, m_config.post_sec, m_config.directory.c_str(), m_config.rules.size());
+}
+
+va::ClipRecorder::~ClipRecorder() {
+	/* clips still recording are written with what they have */
+	std::vector<SourceRing*> rings;
+	{
+		std::lock_guard<std::mutex> lock { m_mutex };
+		for (auto& entry : m_sources) {
+			rings.push_back(entry.second.get());
+		}
+	}
+	for (SourceRing* ring : rings) {
+		m_finish(ring);
+	}
+	{
+		std::lock_guard<std::mutex> lock { m_mutex };
+		m_stop = true;
+	}
+	m_cond.notify_all();
+	m_writer.join();
+	for (auto& entry : m_sources) {
+		if (entry.second->caps) {
+			gst_caps_unref(entry.second->caps);
+		}
+	}
+	g_print("Clip recorder: %lu triggers, wrote %lu clips (%lu bytes), dropped %lu, failed %lu\n",
+			(unsigned long)m_triggers.load(), (unsigned long)m_clips_written.load(), (unsigned long)m_bytes_written.load(),
+			(unsigned long)m_clips_dropped.load(), (unsigned long)m_clips_failed.load());
+}
+
+auto va::ClipRecorder::m_source(guint source_id) -> SourceRing* {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	auto it = m_sources.find(source_id);
+	return it == m_sources.end() ? nullptr : it->second.get();
+}
+
+/**
+ * Record the packets leaving pad, the src pad of the parser of a source.
+ * A source attached again, after a rebuild, starts over with an empty ring.
+ */
+auto va::ClipRecorder::attach(GstPad* pad, guint source_id) -> void {
+	SourceRing* ring;
+	{
+		std::lock_guard<std::mutex> lock { m_mutex };
+		std::unique_ptr<SourceRing>& slot = m_sources[source_id];
+		if (!slot) {
+			slot = std::make_unique<SourceRing>();
+			slot->recorder = this;
+			slot->source_id = source_id;
+		}
+		ring = slot.get();
+	}
+	remove_source(source_id);
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, clip_packet_probe, ring, NULL);
+}
+
+/**
+ * Write out the clip in progress of a source and empty its ring
+ */
+auto va::ClipRecorder::remove_source(guint source_id) -> void {
+	SourceRing* ring = m_source(source_id);
+	if (!ring) {
+		return;
+	}
+	m_finish(ring);
+	std::lock_guard<std::mutex> lock { ring->mutex };
+	ring->packets.clear();
+	ring->keyframes.clear();
+	ring->bytes = 0;
+	if (ring->caps) {
+		gst_caps_unref(ring->caps);
+		ring->caps = nullptr;
+	}
+}
+
+auto va::ClipRecorder::set_caps(SourceRing* ring, GstCaps* caps) -> void {
+	std::lock_guard<std::mutex> lock { ring->mutex };
+	if (ring->caps) {
+		gst_caps_unref(ring->caps);
+	}
+	ring->caps = gst_caps_ref(caps);
+}
+
+/**
+ * Add a packet to the ring of a source, and to its clip if one is recording.
+ * Called from the streaming thread of the source, takes a reference only.
+ */
+auto va::ClipRecorder::push(SourceRing* ring, GstBuffer* buffer) -> void {
+	VA_TRACE_SCOPE("clip.push");
+	std::unique_ptr<Clip> done;
+	{
+		std::lock_guard<std::mutex> lock { ring->mutex };
+		guint64 ts = GST_CLOCK_TIME_IS_VALID(GST_BUFFER_DTS_OR_PTS(buffer)) ? GST_BUFFER_DTS_OR_PTS(buffer) : ring->next_ts;
+		/* a jump back is a seek or a looping file, what came before no longer
+		 * belongs in front of what comes next */
+		if (!ring->packets.empty() && ts + GST_SECOND < ring->packets.back().ts) {
+			done = std::move(ring->active);
+			ring->packets.clear();
+			ring->keyframes.clear();
+			ring->bytes = 0;
+		}
+		ring->next_ts = ts + (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_DURATION(buffer)) ? GST_BUFFER_DURATION(buffer) : CLIP_DEFAULT_PACKET_NS);
+
+		ring->packets.emplace_back(buffer, ts);
+		const Packet& packet = ring->packets.back();
+		if (packet.keyframe) {
+			ring->keyframes.emplace_back(ring->pushed, ts);
+		}
+		++ring->pushed;
+		ring->bytes += packet.size;
+
+		if (ring->active) {
+			ring->active->packets.push_back(packet);
+			ring->active->bytes += packet.size;
+			if (ts >= ring->active->end_ts) {
+				done = std::move(ring->active);
+			}
+		}
+		m_trim(ring);
+	}
+	if (done) {
+		m_submit(std::move(done));
+	}
+}
+
+/**
+ * Drop whole groups of pictures from the front of the ring while the next
+ * one still covers pre_sec, or while the ring is over its byte cap. Called
+ * with the ring mutex held.
+ */
+auto va::ClipRecorder::m_trim(SourceRing* ring) -> void {
+	auto pop_front = [ring] {
+		ring->bytes -= ring->packets.front().size;
+		ring->packets.pop_front();
+	};
+	/* nothing before the first key frame can be decoded */
+	while (!ring->packets.empty() && !ring->packets.front().keyframe) {
+		pop_front();
+	}
+	guint64 newest = ring->packets.empty() ? 0 : ring->packets.back().ts;
+	while (ring->keyframes.size() >= 2) {
+		bool covered = ring->keyframes[1].second + m_pre_ns <= newest;
+		if (!covered && ring->bytes <= m_ring_bytes) {
+			break;
+		}
+		guint64 front = ring->pushed - ring->packets.size();
+		for (guint64 seq = front; seq < ring->keyframes[1].first; ++seq) {
+			pop_front();
+		}
+		ring->keyframes.pop_front();
+	}
+	/* a single group of pictures over the cap is not kept at all */
+	if (ring->bytes > m_ring_bytes) {
+		ring->packets.clear();
+		ring->keyframes.clear();
+		ring->bytes = 0;
+	}
+}
+
+/**
+ * Count the objects of a frame that match each rule, on the probe thread
+ */
+auto va::ClipRecorder::count(int class_id, float confidence, guint hits[VA_CLIP_MAX_RULES]) const -> void {
+	for (size_t i = 0; i < m_config.rules.size(); ++i) {
+		const va::ClipRule& rule = m_config.rules[i];
+		if (rule.class_id == class_id && confidence >= rule.min_confidence) {
+			++hits[i];
+		}
+	}
+}
+
+/**
+ * Trigger a clip for the first rule the counted frame satisfies
+ */
+auto va::ClipRecorder::evaluate(guint source_id, const guint hits[VA_CLIP_MAX_RULES]) -> void {
+	for (size_t i = 0; i < m_config.rules.size(); ++i) {
+		if (hits[i] >= m_config.rules[i].min_count) {
+			trigger(source_id, m_config.rules[i].label);
+			return;
+		}
+	}
+}
+
+/**
+ * Start a clip of a source from what its ring holds, or extend the clip it is
+ * recording. Returns false while the source has no packets to record.
+ */
+auto va::ClipRecorder::trigger(guint source_id, const std::string& reason) -> bool {
+	VA_TRACE_SCOPE("clip.trigger");
+	SourceRing* ring = m_source(source_id);
+	if (!ring) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock { ring->mutex };
+	if (ring->packets.empty() || !ring->caps) {
+		return false;
+	}
+	++m_triggers;
+	guint64 newest = ring->packets.back().ts;
+	if (ring->active) {
+		ring->active->end_ts = std::min(std::max(ring->active->end_ts, newest + m_post_ns), ring->active->start_ts + m_max_clip_ns);
+		return true;
+	}
+
+	std::unique_ptr<Clip> clip = std::make_unique<Clip>();
+	clip->source_id = source_id;
+	clip->caps = gst_caps_ref(ring->caps);
+	clip->packets.reserve(ring->packets.size());
+	for (const Packet& packet : ring->packets) {
+		clip->packets.push_back(packet);
+	}
+	clip->bytes = ring->bytes;
+	clip->start_ts = ring->packets.front().ts;
+	clip->end_ts = std::min(newest + m_post_ns, clip->start_ts + m_max_clip_ns);
+
+	/* source-00-20220801-101500.123-person.mp4 */
+	auto now = std::chrono::system_clock::now();
+	time_t seconds = std::chrono::system_clock::to_time_t(now);
+	long millis = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+	struct tm local;
+	localtime_r(&seconds, &local);
+	char stamp[32];
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+	std::string label = reason;
+	std::replace_if(label.begin(), label.end(), [](char c) { return !std::isalnum(static_cast<unsigned char>(c)); }, '-');
+	gchar name[128];
+	g_snprintf(name, sizeof(name), "source-%02u-%s.%03ld-%s.%s", source_id, stamp, millis, label.c_str(), m_config.format.c_str());
+	clip->path = m_config.directory + "/" + name;
+
+	ring->active = std::move(clip);
+	return true;
+}
+
+/**
+ * Hand the clip a source is recording to the writer, as it is
+ */
+auto va::ClipRecorder::m_finish(SourceRing* ring) -> void {
+	std::unique_ptr<Clip> done;
+	{
+		std::lock_guard<std::mutex> lock { ring->mutex };
+		done = std::move(ring->active);
+	}
+	if (done) {
+		m_submit(std::move(done));
+	}
+}
+
+auto va::ClipRecorder::m_submit(std::unique_ptr<Clip> clip) -> void {
+	{
+		std::lock_guard<std::mutex> lock { m_mutex };
+		if (m_pending.size() >= m_config.max_pending) {
+			++m_clips_dropped;
+			g_printerr("Clip recorder: writer is behind, dropping %s\n", clip->path.c_str());
+			return;
+		}
+		m_pending.push_back(std::move(clip));
+	}
+	m_cond.notify_one();
+}
+
+/**
+ * Total bytes referenced by the rings, the pre-event memory cost
+ */
+auto va::ClipRecorder::ring_bytes() -> gsize {
+	gsize total = 0;
+	std::lock_guard<std::mutex> lock { m_mutex };
+	for (auto& entry : m_sources) {
+		std::lock_guard<std::mutex> ring_lock { entry.second->mutex };
+		total += entry.second->bytes;
+	}
+	return total;
+}
+
+auto va::ClipRecorder::m_write_loop() -> void {
+	va::place_thread("clip-writer");
+	for (;;) {
+		std::unique_ptr<Clip> clip;
+		{
+			std::unique_lock<std::mutex> lock { m_mutex };
+			m_cond.wait(lock, [this] { return m_stop || !m_pending.empty(); });
+			if (m_pending.empty()) {
+				break;
+			}
+			clip = std::move(m_pending.front());
+			m_pending.pop_front();
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		if (m_write(*clip)) {
+			++m_clips_written;
+			m_bytes_written += clip->bytes;
+			g_print("Clip recorder: wrote %s, %.1f s, %zu packets in %ld ms\n",
+					clip->path.c_str(), (clip->packets.back().ts - clip->start_ts) / 1e9, clip->packets.size(),
+					(long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+		} else {
+			++m_clips_failed;
+		}
+	}
+}
+
+/**
+ * Mux a clip to its file: appsrc ! <codec>parse ! mp4mux / matroskamux ! filesink.
+ * Timestamps are moved so the clip starts at 0.
+ */
+auto va::ClipRecorder::m_write(Clip& clip) -> bool {
+	VA_TRACE_SCOPE("clip.write");
+	const gchar* media = gst_structure_get_name(gst_caps_get_structure(clip.caps, 0));
+	const gchar* parser_name = nullptr;
+	if (g_strcmp0(media, "video/x-h264") == 0) {
+		parser_name = "h264parse";
+	} else if (g_strcmp0(media, "video/x-h265") == 0) {
+		parser_name = "h265parse";
+	} else {
+		g_printerr("Clip recorder: %s is not supported, skipping %s\n", media, clip.path.c_str());
+		return false;
+	}
+
+	GstElement* pipeline = gst_pipeline_new(nullptr);
+	GstElement* appsrc = gst_element_factory_make("appsrc", nullptr);
+	GstElement* parser = gst_element_factory_make(parser_name, nullptr);
+	GstElement* mux = gst_element_factory_make(m_config.format == "mkv" ? "matroskamux" : "mp4mux", nullptr);
+	GstElement* filesink = gst_element_factory_make("filesink", nullptr);
+	if (!pipeline || !appsrc || !parser || !mux || !filesink) {
+		g_printerr("Clip recorder: could not create the writer elements, skipping %s\n", clip.path.c_str());
+		for (GstElement* element : { pipeline, appsrc, parser, mux, filesink }) {
+			if (element) {
+				gst_object_unref(element);
+			}
+		}
+		return false;
+	}
+	g_object_set(G_OBJECT(appsrc), "caps", clip.caps, "format", GST_FORMAT_TIME, "block", TRUE, NULL);
+	g_object_set(G_OBJECT(filesink), "location", clip.path.c_str(), NULL);
+	gst_bin_add_many(GST_BIN(pipeline), appsrc, parser, mux, filesink, NULL);
+	if (!gst_element_link_many(appsrc, parser, mux, filesink, NULL)) {
+		g_printerr("Clip recorder: could not link the writer, skipping %s\n", clip.path.c_str());
+		gst_object_unref(pipeline);
+		return false;
+	}
+	gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+	GstFlowReturn flow = GST_FLOW_OK;
+	for (const Packet& packet : clip.packets) {
+		GstBuffer* buffer = gst_buffer_copy(packet.buffer);
+		GstClockTime pts = GST_BUFFER_PTS(packet.buffer);
+		GST_BUFFER_DTS(buffer) = packet.ts - clip.start_ts;
+		GST_BUFFER_PTS(buffer) = GST_CLOCK_TIME_IS_VALID(pts) ? (pts > clip.start_ts ? pts - clip.start_ts : 0) : GST_BUFFER_DTS(buffer);
+		g_signal_emit_by_name(appsrc, "push-buffer", buffer, &flow);
+		gst_buffer_unref(buffer);
+		if (flow != GST_FLOW_OK) {
+			break;
+		}
+	}
+	g_signal_emit_by_name(appsrc, "end-of-stream", &flow);
+
+	GstBus* bus = gst_element_get_bus(pipeline);
+	GstMessage* msg = gst_bus_timed_pop_filtered(bus, 30 * GST_SECOND, (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+	bool written = msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+	if (!msg) {
+		g_printerr("Clip recorder: timed out writing %s\n", clip.path.c_str());
+	} else if (!written) {
+		GError* error = nullptr;
+		gchar* debug = nullptr;
+		gst_message_parse_error(msg, &error, &debug);
+		g_printerr("Clip recorder: error writing %s: %s\n", clip.path.c_str(), error->message);
+		g_clear_error(&error);
+		g_free(debug);
+	}
+	if (msg) {
+		gst_message_unref(msg);
+	}
+	gst_object_unref(bus);
+	gst_element_set_state(pipeline, GST_STATE_NULL);
+	gst_object_unref(pipeline);
+	return written;
+}
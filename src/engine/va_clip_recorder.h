@@ -0,0 +1,159 @@
+#ifndef VA_ENGINE_CLIP_RECORDER_H_
+#define VA_ENGINE_CLIP_RECORDER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <gst/gst.h>
+#include <glib.h>
+
+/* rules are counted in a fixed array on the probe thread */
+#define VA_CLIP_MAX_RULES 8
+
+namespace va {
+/**
+ * Detections that start a clip: at least min_count objects of class_id with a
+ * confidence of min_confidence or more in one frame
+ */
+struct ClipRule {
+	int class_id = 0;
+	float min_confidence = 0.5f;
+	guint min_count = 1;
+	std::string label;
+};
+
+/**
+ * Clip recorder settings, read from the "clip-recorder" group of the yml file
+ */
+struct ClipRecorderConfig {
+	bool enable = false;
+	std::string directory = "clips";
+	/* mp4 or mkv */
+	std::string format = "mp4";
+	guint pre_sec = 5;
+	guint post_sec = 10;
+	/* a clip extended by later triggers is cut at this length */
+	guint max_clip_sec = 60;
+	/* cap on the pre-event ring of one source */
+	gsize ring_mb = 16;
+	/* clips waiting for the writer, more are dropped */
+	guint max_pending = 4;
+	std::vector<ClipRule> rules;
+};
+
+auto parse_clip_recorder_config(const char* cfg_file, const char* group) -> ClipRecorderConfig;
+
+/**
+ * Records the video around detections of interest without recording all of it.
+ *
+ * Every source keeps a ring of the compressed packets leaving its parser,
+ * before decode, so what it holds grows with bitrate and not resolution. The
+ * ring always starts on a key frame and covers at least pre_sec. A trigger
+ * copies the ring (buffer references, not data) into a clip that keeps taking
+ * packets for post_sec; later triggers extend it. Finished clips are muxed to
+ * mp4 or mkv by a writer thread, the streaming threads never touch the disk.
+ */
+struct ClipRecorder {
+	/**
+	 * One reference to a compressed packet, ts is the decode order timestamp
+	 */
+	struct Packet {
+		GstBuffer* buffer = nullptr;
+		guint64 ts = 0;
+		gsize size = 0;
+		bool keyframe = false;
+
+		Packet(GstBuffer* _buffer, guint64 _ts);
+		Packet(const Packet& other);
+		Packet& operator=(const Packet& other) = delete;
+		Packet(Packet&& other) noexcept;
+		Packet& operator=(Packet&& other) = delete;
+		~Packet();
+	};
+
+	struct Clip {
+		guint source_id;
+		std::string path;
+		GstCaps* caps = nullptr;
+		std::vector<Packet> packets;
+		guint64 start_ts;
+		guint64 end_ts;
+		gsize bytes = 0;
+
+		Clip() = default;
+		Clip(const Clip& other) = delete;
+		Clip& operator=(const Clip& other) = delete;
+		~Clip();
+	};
+
+	struct SourceRing {
+		ClipRecorder* recorder;
+		guint source_id;
+		std::mutex mutex;
+		GstCaps* caps = nullptr;
+		std::deque<Packet> packets;
+		/* sequence number and timestamp of every key frame in packets */
+		std::deque<std::pair<guint64, guint64>> keyframes;
+		/* packets ever pushed, the sequence number of the next one */
+		guint64 pushed = 0;
+		gsize bytes = 0;
+		/* timestamp given to the next packet that carries none */
+		guint64 next_ts = 0;
+		std::unique_ptr<Clip> active;
+	};
+
+	ClipRecorderConfig m_config;
+	guint64 m_pre_ns;
+	guint64 m_post_ns;
+	guint64 m_max_clip_ns;
+	gsize m_ring_bytes;
+
+	std::mutex m_mutex;
+	std::map<guint, std::unique_ptr<SourceRing>> m_sources;
+
+	/* clips waiting for the writer */
+	std::condition_variable m_cond;
+	std::deque<std::unique_ptr<Clip>> m_pending;
+	bool m_stop = false;
+	std::thread m_writer;
+
+	std::atomic<guint64> m_triggers { 0 };
+	std::atomic<guint64> m_clips_written { 0 };
+	std::atomic<guint64> m_clips_dropped { 0 };
+	std::atomic<guint64> m_clips_failed { 0 };
+	std::atomic<guint64> m_bytes_written { 0 };
+
+	ClipRecorder(const ClipRecorderConfig& config);
+	~ClipRecorder();
+
+	ClipRecorder(const ClipRecorder& other) = delete;
+	ClipRecorder& operator=(const ClipRecorder& other) = delete;
+
+	auto attach(GstPad* pad, guint source_id) -> void;
+	auto remove_source(guint source_id) -> void;
+	auto push(SourceRing* ring, GstBuffer* buffer) -> void;
+	auto set_caps(SourceRing* ring, GstCaps* caps) -> void;
+	auto count(int class_id, float confidence, guint hits[VA_CLIP_MAX_RULES]) const -> void;
+	auto evaluate(guint source_id, const guint hits[VA_CLIP_MAX_RULES]) -> void;
+	auto trigger(guint source_id, const std::string& reason) -> bool;
+	auto ring_bytes() -> gsize;
+
+	auto m_source(guint source_id) -> SourceRing*;
+	auto m_trim(SourceRing* ring) -> void;
+	auto m_finish(SourceRing* ring) -> void;
+	auto m_submit(std::unique_ptr<Clip> clip) -> void;
+	auto m_write_loop() -> void;
+	auto m_write(Clip& clip) -> bool;
+};
+
+} // namespace va
+
+#endif
@@ -0,0 +1,315 @@
+#include "va_cpu_pipeline.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "va_thread_placement.h"
+#include "va_trace.h"
+
+/* as nvinfer's labels for the same classes */
+static const gchar* cpu_classes[4] = { "Vehicle", "TwoWheeler", "Person", "RoadSign" };
+
+static auto on_new_sample(GstElement* sink, gpointer data) -> GstFlowReturn {
+	va::CpuPipeline::Source* source = static_cast<va::CpuPipeline::Source*>(data);
+	GstSample* sample = nullptr;
+	g_signal_emit_by_name(sink, "pull-sample", &sample);
+	if (!sample) {
+		return GST_FLOW_OK;
+	}
+	if (source->m_jitter) {
+		source->m_jitter->hold();
+	}
+	source->m_pipeline->push(source->m_index, gst_sample_get_buffer(sample));
+	gst_sample_unref(sample);
+	return GST_FLOW_OK;
+}
+
+/**
+ * Link the video pad of a decodebin to the converter of its source
+ */
+static auto cpu_pad_added(GstElement* decodebin, GstPad* decoder_src_pad, gpointer data) -> void {
+	va::CpuPipeline::Source* source = static_cast<va::CpuPipeline::Source*>(data);
+	GstCaps* caps = gst_pad_get_current_caps(decoder_src_pad);
+	if (!caps) {
+		caps = gst_pad_query_caps(decoder_src_pad, NULL);
+	}
+	const gchar* name = gst_structure_get_name(gst_caps_get_structure(caps, 0));
+	if (!strncmp(name, "video", 5)) {
+		GstPad* convert_sink_pad = gst_element_get_static_pad(source->m_convert, "sink");
+		if (!gst_pad_is_linked(convert_sink_pad) && gst_pad_link(decoder_src_pad, convert_sink_pad) != GST_PAD_LINK_OK) {
+			g_printerr("Source %u: failed to link the decoder to the converter\n", source->m_index);
+		}
+		gst_object_unref(convert_sink_pad);
+	}
+	gst_caps_unref(caps);
+}
+
+va::CpuPipeline::CpuPipeline(const va::DetectorConfig& config, va::UserData* user_data, guint frame_width, guint frame_height) :
+	m_config(config),
+	m_user_data(user_data),
+	m_frame_width(frame_width),
+	m_frame_height(frame_height)
+{
+	guint workers = m_config.workers;
+	if (workers == 0) {
+		workers = std::max(1u, std::thread::hardware_concurrency() / m_config.threads_per_worker);
+	}
+	for (guint i = 0; i < workers; ++i) {
+		m_detectors.push_back(va::make_cpu_detector(m_config));
+	}
+	g_print("CPU detector: %u workers of %u threads, batches of %u, %s kernels\n", workers, m_config.threads_per_worker,
+			m_config.batch_size, va::detector_kernels_by_name(m_config.kernels)->name);
+}
+
+va::CpuPipeline::~CpuPipeline() {
+	stop();
+}
+
+/**
+ * A pipeline of one source bin per uri, each ending in an appsink
+ */
+auto va::CpuPipeline::build(const std::vector<std::string>& uris) -> GstElement* {
+	m_pipeline = gst_pipeline_new("pipeline");
+	if (!m_pipeline) {
+		throw std::runtime_error("Pipeline element could not be created. Exiting.\n");
+	}
+	for (guint i = 0; i < uris.size(); ++i) {
+		if (!gst_bin_add(GST_BIN(m_pipeline), m_create_source(i, uris[i]))) {
+			throw std::runtime_error("Failed to add source bin to pipeline. Exiting.\n");
+		}
+	}
+	return m_pipeline;
+}
+
+/**
+ * decoder -> videoconvert -> videoscale -> RGBx at the network size -> appsink
+ */
+auto va::CpuPipeline::m_create_source(guint index, const std::string& uri) -> GstElement* {
+	gchar bin_name[16] = { };
+	g_snprintf(bin_name, 15, "source-bin-%02d", index);
+	GstElement* bin = gst_bin_new(bin_name);
+	GstElement* convert = gst_element_factory_make("videoconvert", nullptr);
+	GstElement* scale = gst_element_factory_make("videoscale", nullptr);
+	GstElement* capsfilter = gst_element_factory_make("capsfilter", nullptr);
+	GstElement* sink = gst_element_factory_make("appsink", "frames");
+	if (!bin || !convert || !scale || !capsfilter || !sink) {
+		throw std::runtime_error("One element in source bin could not be created.\n");
+	}
+
+	std::unique_ptr<Source> source = std::make_unique<Source>();
+	source->m_pipeline = this;
+	source->m_index = index;
+	source->m_convert = convert;
+
+	/* stretched to the network input, as nvinfer does without maintain-aspect-ratio */
+	g_object_set(G_OBJECT(scale), "add-borders", FALSE, NULL);
+	GstCaps* caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "RGBx",
+			"width", G_TYPE_INT, (gint)m_config.input_width, "height", G_TYPE_INT, (gint)m_config.input_height, NULL);
+	g_object_set(G_OBJECT(capsfilter), "caps", caps, NULL);
+	gst_caps_unref(caps);
+	g_object_set(G_OBJECT(sink), "emit-signals", TRUE, "sync", FALSE, "max-buffers", 2, "drop", FALSE, NULL);
+	g_signal_connect(G_OBJECT(sink), "new-sample", G_CALLBACK(on_new_sample), source.get());
+	gst_bin_add_many(GST_BIN(bin), convert, scale, capsfilter, sink, NULL);
+	if (!gst_element_link_many(convert, scale, capsfilter, sink, NULL)) {
+		throw std::runtime_error("Failed to link source bin. Exiting.\n");
+	}
+
+	std::string location = uri;
+	if (va::is_synthetic_uri(uri)) {
+		va::SyntheticSource synthetic = va::parse_synthetic_uri(uri);
+		if (synthetic.jitter_ms > 0) {
+			source->m_jitter = std::make_unique<va::SourceJitter>(synthetic.jitter_ms, index + 1);
+		}
+		if (synthetic.kind == "file") {
+			/* looping needs nvurisrcbin */
+			g_printerr("Source %u: synthetic file sources play once with the cpu detector\n", index);
+			location = synthetic.location;
+		} else {
+			GstElement* testsrc = gst_element_factory_make("videotestsrc", "test-source");
+			GstElement* raw_caps = gst_element_factory_make("capsfilter", nullptr);
+			if (!testsrc || !raw_caps) {
+				throw std::runtime_error("One element in source bin could not be created.\n");
+			}
+			g_object_set(G_OBJECT(testsrc), "is-live", TRUE, NULL);
+			gst_util_set_object_arg(G_OBJECT(testsrc), "pattern", synthetic.pattern.c_str());
+			caps = gst_caps_new_simple("video/x-raw", "width", G_TYPE_INT, (gint)synthetic.width,
+					"height", G_TYPE_INT, (gint)synthetic.height, "framerate", GST_TYPE_FRACTION, (gint)synthetic.fps, 1, NULL);
+			g_object_set(G_OBJECT(raw_caps), "caps", caps, NULL);
+			gst_caps_unref(caps);
+			gst_bin_add_many(GST_BIN(bin), testsrc, raw_caps, NULL);
+			if (!gst_element_link_many(testsrc, raw_caps, convert, NULL)) {
+				throw std::runtime_error("Failed to link synthetic source. Exiting.\n");
+			}
+			m_sources.push_back(std::move(source));
+			return bin;
+		}
+	}
+
+	/* decodebin picks software decoders where there is no nvidia one */
+	GstElement* uri_decode_bin = gst_element_factory_make("uridecodebin", "uri-decode-bin");
+	if (!uri_decode_bin) {
+		throw std::runtime_error("One element in source bin could not be created.\n");
+	}
+	g_object_set(G_OBJECT(uri_decode_bin), "uri", location.c_str(), NULL);
+	g_signal_connect(G_OBJECT(uri_decode_bin), "pad-added", G_CALLBACK(cpu_pad_added), source.get());
+	gst_bin_add(GST_BIN(bin), uri_decode_bin);
+	m_sources.push_back(std::move(source));
+	return bin;
+}
+
+auto va::CpuPipeline::start() -> void {
+	for (guint i = 0; i < m_detectors.size(); ++i) {
+		m_workers.emplace_back(&va::CpuPipeline::m_worker_loop, this, i);
+	}
+}
+
+/**
+ * Infer what is still queued and join the workers, once the pipeline stopped
+ */
+auto va::CpuPipeline::stop() -> void {
+	{
+		std::lock_guard<std::mutex> lock { m_mutex };
+		m_stop = true;
+	}
+	m_cond.notify_all();
+	for (std::thread& worker : m_workers) {
+		worker.join();
+	}
+	m_workers.clear();
+}
+
+/**
+ * Add a frame to the batch being formed. From the streaming thread of a
+ * source, which waits while every worker has batches queued.
+ */
+auto va::CpuPipeline::push(guint source_id, GstBuffer* buffer) -> void {
+	VA_TRACE_SCOPE("cpu.push");
+	Frame frame { source_id, static_cast<guint64>(g_get_real_time()) * 1000, {} };
+	size_t size = static_cast<size_t>(m_config.input_width) * m_config.input_height * 4;
+	GstMapInfo map;
+	if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+		return;
+	}
+	if (map.size >= size) {
+		frame.pixels.assign(map.data, map.data + size);
+	}
+	gst_buffer_unmap(buffer, &map);
+	if (frame.pixels.empty()) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock { m_mutex };
+	m_cond.wait(lock, [this] { return m_batches.size() < 2 * m_detectors.size() || m_stop; });
+	if (m_stop) {
+		return;
+	}
+	if (m_pending.empty()) {
+		m_pending_since = std::chrono::steady_clock::now();
+	}
+	m_pending.push_back(std::move(frame));
+	if (m_pending.size() >= m_config.batch_size) {
+		m_batches.push_back(Batch { m_next_sequence++, std::move(m_pending) });
+		m_pending.clear();
+	}
+	m_cond.notify_all();
+}
+
+/**
+ * Next full batch, or the partial one once it waited batch-timeout-ms.
+ * False when stopped and nothing is left.
+ */
+auto va::CpuPipeline::m_take_batch(Batch* batch) -> bool {
+	const std::chrono::milliseconds timeout { m_config.batch_timeout_ms };
+	std::unique_lock<std::mutex> lock { m_mutex };
+	for (;;) {
+		if (!m_batches.empty()) {
+			*batch = std::move(m_batches.front());
+			m_batches.pop_front();
+			m_cond.notify_all();
+			return true;
+		}
+		if (!m_pending.empty() && (m_stop || std::chrono::steady_clock::now() - m_pending_since >= timeout)) {
+			*batch = Batch { m_next_sequence++, std::move(m_pending) };
+			m_pending.clear();
+			return true;
+		}
+		if (m_stop) {
+			return false;
+		}
+		if (m_pending.empty()) {
+			m_cond.wait(lock);
+		} else {
+			m_cond.wait_until(lock, m_pending_since + timeout);
+		}
+	}
+}
+
+auto va::CpuPipeline::m_worker_loop(guint index) -> void {
+	va::place_thread("cpu-detector");
+	va::Detector* detector = m_detectors[index].get();
+	const double scale_x = static_cast<double>(m_frame_width) / m_config.input_width;
+	const double scale_y = static_cast<double>(m_frame_height) / m_config.input_height;
+	std::vector<const guint8*> pixels;
+	std::vector<std::vector<va::Detection>> detections;
+	Batch batch;
+	while (m_take_batch(&batch)) {
+		VA_TRACE_SCOPE("cpu.batch");
+		pixels.clear();
+		for (const Frame& frame : batch.frames) {
+			pixels.push_back(frame.pixels.data());
+		}
+		try {
+			detector->detect(pixels, &detections);
+		} catch (std::exception& e) {
+			g_printerr("CPU detector: %s\n", e.what());
+			detections.assign(pixels.size(), {});
+		}
+
+		std::vector<std::pair<guint, va::FrameMetadata>> frames;
+		guint64 objects = 0;
+		for (size_t i = 0; i < batch.frames.size(); ++i) {
+			const Frame& frame = batch.frames[i];
+			std::string video_file = m_user_data->source_uri(frame.source_id);
+			if (video_file.empty()) {
+				video_file = "test";
+			}
+			va::FrameMetadata frame_meta { video_file, frame.timestamp };
+			for (const va::Detection& detection : detections[i]) {
+				const gchar* label = detection.class_id >= 0 && detection.class_id < 4 ? cpu_classes[detection.class_id] : "Unknown";
+				frame_meta.va_object_meta_list.emplace_back(label, detection.class_id, detection.left * scale_x,
+						detection.top * scale_y, detection.width * scale_x, detection.height * scale_y, frame.timestamp);
+			}
+			objects += frame_meta.va_object_meta_list.size();
+			frames.emplace_back(frame.source_id, std::move(frame_meta));
+		}
+		m_sink(batch.sequence, std::move(frames));
+		m_frames += batch.frames.size();
+		m_objects += objects;
+		++m_batches_inferred;
+	}
+}
+
+/**
+ * Hand the frames of batch sequence to the sinks, after those of every
+ * earlier batch. The sinks see one thread at a time, as from the probe.
+ */
+auto va::CpuPipeline::m_sink(guint64 sequence, std::vector<std::pair<guint, va::FrameMetadata>> frames) -> void {
+	std::lock_guard<std::mutex> lock { m_sink_mutex };
+	m_done.emplace(sequence, std::move(frames));
+	for (auto it = m_done.find(m_next_sink); it != m_done.end(); it = m_done.find(m_next_sink)) {
+		for (auto& frame : it->second) {
+			m_user_data->sink_frame(frame.first, frame.second);
+			if (m_user_data->va_stream_stats) {
+				m_user_data->va_stream_stats->record(frame.first, frame.second.timestamp, frame.second.va_object_meta_list.size());
+			}
+		}
+		m_done.erase(it);
+		++m_next_sink;
+	}
+}
+
+auto va::CpuPipeline::print_stats() -> void {
+	g_print("CPU detector: %lu frames in %lu batches, %lu objects\n", (gulong)m_frames.load(),
+			(gulong)m_batches_inferred.load(), (gulong)m_objects.load());
+}
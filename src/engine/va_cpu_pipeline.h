@@ -0,0 +1,101 @@
+#ifndef VA_ENGINE_CPU_PIPELINE_H_
+#define VA_ENGINE_CPU_PIPELINE_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gst/gst.h>
+#include <glib.h>
+
+#include "va_detector.h"
+#include "va_synthetic_source.h"
+#include "va_user_data.h"
+
+namespace va {
+/**
+ * Detection without nvstreammux, nvinfer or a CUDA device. Every source is
+ * decoded in software and scaled to the network input by GStreamer, frames
+ * of all sources are batched the way nvstreammux does (batch-size, or what
+ * came in batch-timeout-ms), and a pool of workers, each with its own copy
+ * of the network, infers the batches. Detections are scaled to the frame
+ * size the muxer would output and go to the same sinks as those of the
+ * metadata probe, in batch order.
+ */
+struct CpuPipeline {
+	struct Frame {
+		guint source_id;
+		/* system time the frame came out of its source, as ntp_timestamp */
+		guint64 timestamp;
+		std::vector<guint8> pixels;
+	};
+
+	struct Batch {
+		guint64 sequence;
+		std::vector<Frame> frames;
+	};
+
+	/* data of the callbacks of one source */
+	struct Source {
+		CpuPipeline* m_pipeline;
+		guint m_index;
+		GstElement* m_convert = nullptr;
+		std::unique_ptr<va::SourceJitter> m_jitter;
+	};
+
+	va::DetectorConfig m_config;
+	va::UserData* m_user_data;
+	guint m_frame_width;
+	guint m_frame_height;
+	std::vector<std::string> m_uris;
+	GstElement* m_pipeline = nullptr;
+	std::vector<std::unique_ptr<Source>> m_sources;
+	std::vector<std::unique_ptr<va::Detector>> m_detectors;
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	/* frames of the batch being formed, since when the first of them waits */
+	std::vector<Frame> m_pending;
+	std::chrono::steady_clock::time_point m_pending_since;
+	std::deque<Batch> m_batches;
+	guint64 m_next_sequence = 0;
+	bool m_stop = false;
+
+	/* batches done before an earlier one, by sequence */
+	std::mutex m_sink_mutex;
+	std::map<guint64, std::vector<std::pair<guint, va::FrameMetadata>>> m_done;
+	guint64 m_next_sink = 0;
+
+	std::atomic<guint64> m_frames { 0 };
+	std::atomic<guint64> m_batches_inferred { 0 };
+	std::atomic<guint64> m_objects { 0 };
+
+	CpuPipeline(const va::DetectorConfig& config, va::UserData* user_data, guint frame_width, guint frame_height);
+	~CpuPipeline();
+
+	CpuPipeline(const CpuPipeline& other) = delete;
+	CpuPipeline& operator=(const CpuPipeline& other) = delete;
+
+	auto build(const std::vector<std::string>& uris) -> GstElement*;
+	auto start() -> void;
+	auto stop() -> void;
+	auto push(guint source_id, GstBuffer* buffer) -> void;
+	auto print_stats() -> void;
+
+	auto m_create_source(guint index, const std::string& uri) -> GstElement*;
+	auto m_take_batch(Batch* batch) -> bool;
+	auto m_worker_loop(guint index) -> void;
+	auto m_sink(guint64 sequence, std::vector<std::pair<guint, va::FrameMetadata>> frames) -> void;
+};
+
+} // namespace va
+
+#endif
@@ -0,0 +1,107 @@
+#include "va_decode_policy.h"
+
+#include <stdexcept>
+
+#include <yaml-cpp/yaml.h>
+
+static auto parse_policy(const YAML::Node& node, const va::DecodePolicy& fallback) -> va::DecodePolicy {
+	va::DecodePolicy policy = fallback;
+	if (!node) {
+		return policy;
+	}
+	policy.drop_frame_interval = node["drop-frame-interval"].as<guint>(policy.drop_frame_interval);
+	policy.keyframe_only = node["keyframe-only"].as<int>(policy.keyframe_only) != 0;
+	policy.max_fps = node["max-fps"].as<double>(policy.max_fps);
+	if (policy.max_fps < 0.0) {
+		throw std::invalid_argument("source-policy max-fps must not be negative\n");
+	}
+	return policy;
+}
+
+auto va::DecodePolicy::is_default() const -> bool {
+	return drop_frame_interval <= 1 && !keyframe_only && max_fps == 0.0;
+}
+
+auto va::DecodePolicy::operator==(const va::DecodePolicy& other) const -> bool {
+	return drop_frame_interval == other.drop_frame_interval && keyframe_only == other.keyframe_only && max_fps == other.max_fps;
+}
+
+auto va::DecodePolicy::operator!=(const va::DecodePolicy& other) const -> bool {
+	return !(*this == other);
+}
+
+auto va::DecodePolicyConfig::policy_for(const std::string& uri) const -> va::DecodePolicy {
+	auto it = m_sources.find(uri);
+	return it == m_sources.end() ? m_default : it->second;
+}
+
+auto va::parse_decode_policy_config(const char* cfg_file, const char* group) -> va::DecodePolicyConfig {
+	va::DecodePolicyConfig config {};
+	YAML::Node node = YAML::LoadFile(cfg_file)[group];
+	if (!node) {
+		return config;
+	}
+	config.m_default = parse_policy(node["default"], config.m_default);
+	for (const YAML::Node& source : node["sources"]) {
+		std::string uri = source["uri"].as<std::string>("");
+		if (uri.empty()) {
+			throw std::invalid_argument("source-policy sources need a uri\n");
+		}
+		config.m_sources[uri] = parse_policy(source, config.m_default);
+	}
+	return config;
+}
+
+va::DecodeGate::DecodeGate(const va::DecodePolicy& policy, guint index) : m_policy(policy), m_index(index) { }
+
+/**
+ * Before the decoder: with keyframe_only, delta frames never reach it
+ */
+auto va::DecodeGate::admit_compressed(bool delta_unit) -> bool {
+	if (m_policy.keyframe_only && delta_unit) {
+		++m_compressed_dropped;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * After the decoder: keep one of every drop_frame_interval frames
+ */
+auto va::DecodeGate::admit_decoded() -> bool {
+	++m_decoded;
+	if (m_policy.drop_frame_interval <= 1) {
+		return true;
+	}
+	guint phase = m_decoded_phase;
+	m_decoded_phase = (m_decoded_phase + 1) % m_policy.drop_frame_interval;
+	if (phase != 0) {
+		++m_interval_dropped;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Into the muxer: at most max_fps frames per second of stream time. Frames
+ * are kept on a fixed grid so the average rate is exact; after a gap or a
+ * jump back (seek, loop) the grid restarts at the current frame.
+ */
+auto va::DecodeGate::admit_output(bool pts_valid, guint64 pts) -> bool {
+	if (m_policy.max_fps <= 0.0 || !pts_valid) {
+		++m_passed;
+		return true;
+	}
+	guint64 interval = static_cast<guint64>(1e9 / m_policy.max_fps);
+	/* tolerate timestamp rounding and jitter of live sources */
+	guint64 slack = interval / 10;
+	if (m_have_pts && pts + slack < m_next_pts && m_next_pts - pts <= interval + slack) {
+		++m_rate_dropped;
+		return false;
+	}
+	bool on_grid = m_have_pts && pts + slack >= m_next_pts && pts < m_next_pts + interval;
+	m_next_pts = on_grid ? m_next_pts + interval : pts + interval;
+	m_have_pts = true;
+	++m_passed;
+	return true;
+}
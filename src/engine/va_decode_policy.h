@@ -0,0 +1,71 @@
+#ifndef VA_ENGINE_DECODE_POLICY_H_
+#define VA_ENGINE_DECODE_POLICY_H_
+
+#include <atomic>
+#include <map>
+#include <string>
+
+#include <glib.h>
+
+namespace va {
+/**
+ * How much of a source is decoded and handed to the muxer
+ */
+struct DecodePolicy {
+	/* output one of every drop_frame_interval decoded frames, 0 or 1 for all */
+	guint drop_frame_interval = 0;
+	/* decode key frames only */
+	bool keyframe_only = false;
+	/* upper bound on frames per second into the muxer, 0 for no limit */
+	double max_fps = 0.0;
+
+	auto is_default() const -> bool;
+	auto operator==(const DecodePolicy& other) const -> bool;
+	auto operator!=(const DecodePolicy& other) const -> bool;
+};
+
+/**
+ * Decode policies from the "source-policy" group of the yml file: a default,
+ * and overrides matched by source uri
+ */
+struct DecodePolicyConfig {
+	DecodePolicy m_default;
+	std::map<std::string, DecodePolicy> m_sources;
+
+	auto policy_for(const std::string& uri) const -> DecodePolicy;
+};
+
+auto parse_decode_policy_config(const char* cfg_file, const char* group) -> DecodePolicyConfig;
+
+/**
+ * Applies a policy to the buffers of one source, for decoders that cannot do it
+ * themselves. Each admit_* is called from one streaming thread; the counters
+ * are read from others.
+ */
+struct DecodeGate {
+	DecodePolicy m_policy;
+	guint m_index;
+	/* decoded frames seen, modulo drop_frame_interval */
+	guint m_decoded_phase = 0;
+	guint64 m_next_pts = 0;
+	bool m_have_pts = false;
+
+	std::atomic<guint64> m_compressed_dropped { 0 };
+	std::atomic<guint64> m_decoded { 0 };
+	std::atomic<guint64> m_interval_dropped { 0 };
+	std::atomic<guint64> m_rate_dropped { 0 };
+	std::atomic<guint64> m_passed { 0 };
+
+	DecodeGate(const DecodePolicy& policy, guint index);
+
+	DecodeGate(const DecodeGate& other) = delete;
+	DecodeGate& operator=(const DecodeGate& other) = delete;
+
+	auto admit_compressed(bool delta_unit) -> bool;
+	auto admit_decoded() -> bool;
+	auto admit_output(bool pts_valid, guint64 pts) -> bool;
+};
+
+} // namespace va
+
+#endif
@@ -0,0 +1,203 @@
+#include "va_detection_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <yaml-cpp/yaml.h>
+
+#include "va_trace.h"
+
+auto va::parse_detection_cache_config(const char* cfg_file, const char* group) -> va::DetectionCacheConfig {
+	va::DetectionCacheConfig config {};
+	YAML::Node node = YAML::LoadFile(cfg_file)[group];
+	if (!node) {
+		return config;
+	}
+	config.enable = node["enable"].as<int>(config.enable) != 0;
+	config.retention_sec = node["retention-sec"].as<guint64>(config.retention_sec);
+	config.memory_cap_mb = node["memory-cap-mb"].as<gsize>(config.memory_cap_mb);
+	config.max_sources = node["max-sources"].as<guint>(config.max_sources);
+	config.query_port = node["query-port"].as<guint>(config.query_port);
+	return config;
+}
+
+va::DetectionCache::DetectionCache(const va::DetectionCacheConfig& config) :
+	m_max_sources(config.max_sources),
+	m_retention_ns(config.retention_sec * 1000000000ULL)
+{
+	if (m_max_sources == 0) {
+		throw std::invalid_argument("Detection cache needs at least one source\n");
+	}
+
+	/* split the memory cap evenly between sources, rounded down to a power of
+	 * two so a slot is found with a mask instead of a division */
+	guint64 slots_per_source = config.memory_cap_mb * 1024 * 1024 / m_max_sources / sizeof(Slot);
+	if (slots_per_source < 2) {
+		throw std::invalid_argument("Detection cache memory cap is too small\n");
+	}
+	m_capacity = 1;
+	while (m_capacity * 2 <= slots_per_source) {
+		m_capacity *= 2;
+	}
+
+	m_rings = std::make_unique<SourceRing[]>(m_max_sources);
+	for (guint i = 0; i < m_max_sources; ++i) {
+		m_rings[i].slots = std::make_unique<Slot[]>(m_capacity);
+	}
+	g_print("Detection cache: %u sources x %lu detections, retention %lus\n",
+			m_max_sources, (unsigned long)m_capacity, (unsigned long)config.retention_sec);
+}
+
+va::DetectionCache::~DetectionCache() { }
+
+auto va::DetectionCache::set_database(va::Database* _va_database) -> void {
+	m_va_database = _va_database;
+}
+
+/**
+ * Name used to look a source up in the database, set before the source starts
+ * pushing
+ */
+auto va::DetectionCache::set_source_name(guint source_id, const std::string& source_name) -> void {
+	if (source_id < m_max_sources) {
+		std::atomic_store(&m_rings[source_id].source_name, std::shared_ptr<const std::string> { std::make_shared<std::string>(source_name) });
+	}
+}
+
+/**
+ * Append every detection of a frame. Only one thread may push to a given source.
+ */
+auto va::DetectionCache::push(guint source_id, const va::FrameMetadata& frame_meta) -> void {
+	VA_TRACE_SCOPE("cache.push");
+	if (source_id >= m_max_sources) {
+		return;
+	}
+	SourceRing& ring = m_rings[source_id];
+	guint64 head = ring.head.load(std::memory_order_relaxed);
+	if (head == 0 && ring.newest.load(std::memory_order_relaxed) == 0) {
+		ring.covered_from.store(frame_meta.timestamp, std::memory_order_release);
+	}
+
+	for (const va::ObjectMetadata& object_meta : frame_meta.va_object_meta_list) {
+		Slot& slot = ring.slots[head & (m_capacity - 1)];
+		if (head >= m_capacity) {
+			/* everything up to the record being overwritten is no longer complete */
+			ring.covered_from.store(slot.record.timestamp + 1, std::memory_order_release);
+		}
+
+		slot.sequence.store(2 * head + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		Record& record = slot.record;
+		record.timestamp = object_meta.timestamp;
+		record.class_id = object_meta.class_id;
+		record.left = object_meta.left;
+		record.top = object_meta.top;
+		record.width = object_meta.width;
+		record.height = object_meta.height;
+		g_strlcpy(record.object_label, object_meta.object_label.c_str(), sizeof(record.object_label));
+
+		slot.sequence.store(2 * head + 2, std::memory_order_release);
+		++head;
+	}
+
+	ring.head.store(head, std::memory_order_release);
+	ring.newest.store(frame_meta.timestamp, std::memory_order_release);
+}
+
+/**
+ * Copy the record at absolute position index, false if it was overwritten or is
+ * being written
+ */
+auto va::DetectionCache::m_read(const SourceRing& ring, guint64 index, Record* record) const -> bool {
+	const Slot& slot = ring.slots[index & (m_capacity - 1)];
+	guint64 sequence = slot.sequence.load(std::memory_order_acquire);
+	if (sequence != 2 * index + 2) {
+		return false;
+	}
+	std::memcpy(record, &slot.record, sizeof(Record));
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return slot.sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+/**
+ * First position in [tail, head) with a timestamp >= timestamp. Overwritten
+ * slots only ever sit at the old end of the ring, so they sort as "too old".
+ */
+auto va::DetectionCache::m_lower_bound(const SourceRing& ring, guint64 tail, guint64 head, guint64 timestamp) const -> guint64 {
+	Record record;
+	while (tail < head) {
+		guint64 middle = tail + (head - tail) / 2;
+		if (!m_read(ring, middle, &record) || record.timestamp < timestamp) {
+			tail = middle + 1;
+		} else {
+			head = middle;
+		}
+	}
+	return tail;
+}
+
+/**
+ * Oldest timestamp a query can be fully answered from memory for
+ */
+auto va::DetectionCache::covered_from(guint source_id) const -> guint64 {
+	if (source_id >= m_max_sources) {
+		return G_MAXUINT64;
+	}
+	const SourceRing& ring = m_rings[source_id];
+	guint64 newest = ring.newest.load(std::memory_order_acquire);
+	if (newest == 0) {
+		return G_MAXUINT64;
+	}
+	guint64 covered = ring.covered_from.load(std::memory_order_acquire);
+	if (newest > m_retention_ns) {
+		covered = std::max(covered, newest - m_retention_ns);
+	}
+	return covered;
+}
+
+/**
+ * Detections of a source with from <= timestamp <= to, oldest first. The part of
+ * the range the cache no longer covers falls through to the database.
+ */
+auto va::DetectionCache::query(guint source_id, guint64 from, guint64 to) -> std::vector<va::ObjectMetadata> {
+	VA_TRACE_SCOPE("cache.query");
+	std::vector<va::ObjectMetadata> result;
+	if (source_id >= m_max_sources || from > to) {
+		return result;
+	}
+	const SourceRing& ring = m_rings[source_id];
+	guint64 covered = covered_from(source_id);
+
+	std::shared_ptr<const std::string> source_name = std::atomic_load(&ring.source_name);
+	if (from < covered && m_va_database && source_name && !source_name->empty()) {
+		guint64 db_to = (covered == G_MAXUINT64) ? to : std::min(to, covered - 1);
+		result = m_va_database->select_range(*source_name, from, db_to);
+	}
+	if (covered == G_MAXUINT64 || to < covered) {
+		return result;
+	}
+
+	guint64 head = ring.head.load(std::memory_order_acquire);
+	guint64 tail = (head > m_capacity) ? head - m_capacity : 0;
+	Record record;
+	for (guint64 i = m_lower_bound(ring, tail, head, std::max(from, covered)); i < head; ++i) {
+		if (!m_read(ring, i, &record)) {
+			continue;
+		}
+		if (record.timestamp > to) {
+			break;
+		}
+		result.emplace_back(
+			record.object_label,
+			record.class_id,
+			record.left,
+			record.top,
+			record.width,
+			record.height,
+			record.timestamp
+		);
+	}
+	return result;
+}
@@ -0,0 +1,92 @@
+#ifndef VA_ENGINE_DETECTION_CACHE_H_
+#define VA_ENGINE_DETECTION_CACHE_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+#include "va_database.h"
+#include "va_object_meta.h"
+
+namespace va {
+/**
+ * Detection cache settings, read from the "detection-cache" group of the yml file
+ */
+struct DetectionCacheConfig {
+	bool enable = false;
+	guint64 retention_sec = 300;
+	gsize memory_cap_mb = 256;
+	guint max_sources = 16;
+	/* loopback port of the query server, 0 for none, see va_query_server.h */
+	guint query_port = 0;
+};
+
+auto parse_detection_cache_config(const char* cfg_file, const char* group) -> DetectionCacheConfig;
+
+/**
+ * In-memory, time-indexed store of the most recent detections of every source.
+ *
+ * Each source owns a ring of fixed-size records written only by the probe
+ * thread. Readers never take a lock: every slot is guarded by a sequence number
+ * (seqlock), so a reader either copies a consistent record or detects that the
+ * writer overwrote it and skips it. Records are appended in timestamp order,
+ * which lets a query binary search the ring for the start of its range.
+ *
+ * Ranges older than what the ring (or the retention window) still covers are
+ * read from the database, if one is set.
+ */
+struct DetectionCache {
+	struct Record {
+		guint64 timestamp;
+		gint32 class_id;
+		gfloat left;
+		gfloat top;
+		gfloat width;
+		gfloat height;
+		gchar object_label[20];
+	};
+
+	struct Slot {
+		std::atomic<guint64> sequence { 0 };
+		Record record;
+	};
+
+	struct SourceRing {
+		std::unique_ptr<Slot[]> slots;
+		std::atomic<guint64> head { 0 };
+		/* oldest timestamp the ring still holds every detection for */
+		std::atomic<guint64> covered_from { 0 };
+		/* timestamp of the newest frame pushed, with or without detections */
+		std::atomic<guint64> newest { 0 };
+		/* swapped with std::atomic_store, a reload renames sources while queries run */
+		std::shared_ptr<const std::string> source_name;
+	};
+
+	std::unique_ptr<SourceRing[]> m_rings;
+	guint m_max_sources;
+	guint64 m_capacity;
+	guint64 m_retention_ns;
+	va::Database* m_va_database = nullptr;
+
+	DetectionCache(const DetectionCacheConfig& config);
+	~DetectionCache();
+
+	DetectionCache(const DetectionCache& other) = delete;
+	DetectionCache& operator=(const DetectionCache& other) = delete;
+
+	auto set_database(va::Database* _va_database) -> void;
+	auto set_source_name(guint source_id, const std::string& source_name) -> void;
+	auto push(guint source_id, const va::FrameMetadata& frame_meta) -> void;
+	auto query(guint source_id, guint64 from, guint64 to) -> std::vector<va::ObjectMetadata>;
+	auto covered_from(guint source_id) const -> guint64;
+
+	auto m_read(const SourceRing& ring, guint64 index, Record* record) const -> bool;
+	auto m_lower_bound(const SourceRing& ring, guint64 tail, guint64 head, guint64 timestamp) const -> guint64;
+};
+
+} // namespace va
+
+#endif
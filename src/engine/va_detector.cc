@@ -0,0 +1,302 @@
+#include "va_detector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <yaml-cpp/yaml.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VA_DETECTOR_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define VA_DETECTOR_NEON 1
+#endif
+
+#ifdef VA_WITH_OPENCV
+#include <opencv2/core.hpp>
+#include <opencv2/dnn.hpp>
+#endif
+
+#include "va_trace.h"
+
+auto va::parse_detector_config(const char* cfg_file, const char* group) -> va::DetectorConfig {
+	va::DetectorConfig config {};
+	YAML::Node node = YAML::LoadFile(cfg_file)[group];
+	if (!node) {
+		return config;
+	}
+	config.backend = node["backend"].as<std::string>(config.backend);
+	if (config.backend != "nvinfer" && config.backend != "cpu" && config.backend != "none") {
+		throw std::invalid_argument("Unknown detector backend: " + config.backend + "\n");
+	}
+	config.proto_file = node["proto-file"].as<std::string>(config.proto_file);
+	config.model_file = node["model-file"].as<std::string>(config.model_file);
+	config.input_width = std::max(16u, node["input-width"].as<guint>(config.input_width));
+	config.input_height = std::max(16u, node["input-height"].as<guint>(config.input_height));
+	config.net_scale_factor = node["net-scale-factor"].as<double>(config.net_scale_factor);
+	config.num_classes = std::max(1u, node["num-classes"].as<guint>(config.num_classes));
+	config.threshold = node["threshold"].as<double>(config.threshold);
+	config.nms_iou = node["nms-iou"].as<double>(config.nms_iou);
+	config.topk = std::max(1u, node["topk"].as<guint>(config.topk));
+	config.batch_size = std::max(1u, node["batch-size"].as<guint>(config.batch_size));
+	config.batch_timeout_ms = node["batch-timeout-ms"].as<guint>(config.batch_timeout_ms);
+	config.workers = node["workers"].as<guint>(config.workers);
+	config.threads_per_worker = std::max(1u, node["threads-per-worker"].as<guint>(config.threads_per_worker));
+	config.kernels = node["kernels"].as<std::string>(config.kernels);
+	return config;
+}
+
+static auto rgbx_to_planes_scalar(const guint8* rgbx, size_t pixels, float scale, float* r, float* g, float* b) -> void {
+	for (size_t i = 0; i < pixels; ++i) {
+		r[i] = rgbx[4 * i] * scale;
+		g[i] = rgbx[4 * i + 1] * scale;
+		b[i] = rgbx[4 * i + 2] * scale;
+	}
+}
+
+static const va::DetectorKernels scalar_kernels { "scalar", rgbx_to_planes_scalar };
+
+#ifdef VA_DETECTOR_X86
+/* 4 pixels to floats, one per register, then transposed to one channel each */
+static auto rgbx_to_planes_sse2(const guint8* rgbx, size_t pixels, float scale, float* r, float* g, float* b) -> void {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 factor = _mm_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 4 <= pixels; i += 4) {
+		__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgbx + 4 * i));
+		__m128i low = _mm_unpacklo_epi8(bytes, zero);
+		__m128i high = _mm_unpackhi_epi8(bytes, zero);
+		__m128 p0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero));
+		__m128 p1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero));
+		__m128 p2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero));
+		__m128 p3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero));
+		_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+		_mm_storeu_ps(r + i, _mm_mul_ps(p0, factor));
+		_mm_storeu_ps(g + i, _mm_mul_ps(p1, factor));
+		_mm_storeu_ps(b + i, _mm_mul_ps(p2, factor));
+	}
+	rgbx_to_planes_scalar(rgbx + 4 * i, pixels - i, scale, r + i, g + i, b + i);
+}
+
+/* 8 pixels: bytes grouped by channel in each lane, then the lanes' groups side by side */
+__attribute__((target("avx2")))
+static auto rgbx_to_planes_avx2(const guint8* rgbx, size_t pixels, float scale, float* r, float* g, float* b) -> void {
+	const __m256i by_channel = _mm256_setr_epi8(
+		0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+		0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+	const __m256i by_lane = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	const __m256 factor = _mm256_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 8 <= pixels; i += 8) {
+		__m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rgbx + 4 * i));
+		bytes = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(bytes, by_channel), by_lane);
+		__m128i rg = _mm256_castsi256_si128(bytes);
+		__m128i bx = _mm256_extracti128_si256(bytes, 1);
+		_mm256_storeu_ps(r + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(rg)), factor));
+		_mm256_storeu_ps(g + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(rg, 8))), factor));
+		_mm256_storeu_ps(b + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bx)), factor));
+	}
+	rgbx_to_planes_sse2(rgbx + 4 * i, pixels - i, scale, r + i, g + i, b + i);
+}
+
+static const va::DetectorKernels sse2_kernels { "sse2", rgbx_to_planes_sse2 };
+static const va::DetectorKernels avx2_kernels { "avx2", rgbx_to_planes_avx2 };
+#endif
+
+#ifdef VA_DETECTOR_NEON
+static auto rgbx_to_planes_neon(const guint8* rgbx, size_t pixels, float scale, float* r, float* g, float* b) -> void {
+	size_t i = 0;
+	for (; i + 8 <= pixels; i += 8) {
+		uint8x8x4_t channels = vld4_u8(rgbx + 4 * i);
+		float* planes[3] = { r + i, g + i, b + i };
+		for (int c = 0; c < 3; ++c) {
+			uint16x8_t wide = vmovl_u8(channels.val[c]);
+			vst1q_f32(planes[c], vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(wide))), scale));
+			vst1q_f32(planes[c] + 4, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(wide))), scale));
+		}
+	}
+	rgbx_to_planes_scalar(rgbx + 4 * i, pixels - i, scale, r + i, g + i, b + i);
+}
+
+static const va::DetectorKernels neon_kernels { "neon", rgbx_to_planes_neon };
+#endif
+
+auto va::detector_kernels_available() -> std::vector<const va::DetectorKernels*> {
+	std::vector<const va::DetectorKernels*> available { &scalar_kernels };
+#ifdef VA_DETECTOR_X86
+	available.push_back(&sse2_kernels);
+	if (__builtin_cpu_supports("avx2")) {
+		available.push_back(&avx2_kernels);
+	}
+#endif
+#ifdef VA_DETECTOR_NEON
+	available.push_back(&neon_kernels);
+#endif
+	return available;
+}
+
+auto va::detector_kernels_by_name(const std::string& name) -> const va::DetectorKernels* {
+	std::vector<const va::DetectorKernels*> available = detector_kernels_available();
+	if (name == "auto") {
+		return available.back();
+	}
+	for (const va::DetectorKernels* kernels : available) {
+		if (name == kernels->name) {
+			return kernels;
+		}
+	}
+	return nullptr;
+}
+
+auto va::parse_detectnet(const float* cov, const float* bbox, guint grid_width, guint grid_height,
+		const va::DetectorConfig& config, std::vector<va::Detection>* detections) -> void {
+	/* the offsets are normalized by 35 pixels around the cell centers */
+	const float bbox_norm = 35.0f;
+	const guint grid_size = grid_width * grid_height;
+	const float stride_x = std::ceil(static_cast<float>(config.input_width) / grid_width);
+	const float stride_y = std::ceil(static_cast<float>(config.input_height) / grid_height);
+	const float max_x = config.input_width - 1.0f;
+	const float max_y = config.input_height - 1.0f;
+
+	for (guint c = 0; c < config.num_classes; ++c) {
+		const float* class_cov = cov + c * grid_size;
+		const float* x1 = bbox + c * 4 * grid_size;
+		const float* y1 = x1 + grid_size;
+		const float* x2 = y1 + grid_size;
+		const float* y2 = x2 + grid_size;
+		for (guint h = 0; h < grid_height; ++h) {
+			float center_y = (h * stride_y + 0.5f) / bbox_norm;
+			for (guint w = 0; w < grid_width; ++w) {
+				guint i = w + h * grid_width;
+				if (class_cov[i] < config.threshold) {
+					continue;
+				}
+				float center_x = (w * stride_x + 0.5f) / bbox_norm;
+				float left = std::clamp((x1[i] - center_x) * -bbox_norm, 0.0f, max_x);
+				float top = std::clamp((y1[i] - center_y) * -bbox_norm, 0.0f, max_y);
+				float right = std::clamp((x2[i] + center_x) * bbox_norm, 0.0f, max_x);
+				float bottom = std::clamp((y2[i] + center_y) * bbox_norm, 0.0f, max_y);
+				if (right <= left || bottom <= top) {
+					continue;
+				}
+				detections->push_back(va::Detection { static_cast<int>(c), class_cov[i], left, top, right - left, bottom - top });
+			}
+		}
+	}
+}
+
+static auto iou(const va::Detection& a, const va::Detection& b) -> float {
+	float width = std::min(a.left + a.width, b.left + b.width) - std::max(a.left, b.left);
+	float height = std::min(a.top + a.height, b.top + b.height) - std::max(a.top, b.top);
+	if (width <= 0 || height <= 0) {
+		return 0.0f;
+	}
+	float overlap = width * height;
+	return overlap / (a.width * a.height + b.width * b.height - overlap);
+}
+
+auto va::non_max_suppression(std::vector<va::Detection>* detections, double max_iou, guint topk) -> void {
+	std::sort(detections->begin(), detections->end(), [](const va::Detection& a, const va::Detection& b) {
+		return a.class_id != b.class_id ? a.class_id < b.class_id : a.confidence > b.confidence;
+	});
+	std::vector<va::Detection> kept;
+	int class_id = -1;
+	size_t class_start = 0;
+	for (const va::Detection& detection : *detections) {
+		if (detection.class_id != class_id) {
+			class_id = detection.class_id;
+			class_start = kept.size();
+		}
+		if (kept.size() - class_start >= topk) {
+			continue;
+		}
+		bool suppressed = false;
+		for (size_t k = class_start; k < kept.size() && !suppressed; ++k) {
+			suppressed = iou(kept[k], detection) > max_iou;
+		}
+		if (!suppressed) {
+			kept.push_back(detection);
+		}
+	}
+	*detections = std::move(kept);
+}
+
+#ifdef VA_WITH_OPENCV
+/**
+ * The caffe model through OpenCV DNN. The batch is laid out as the NCHW
+ * blob by the preprocessing kernels, straight from the decoded frames.
+ */
+struct OpenCvDetector : va::Detector {
+	va::DetectorConfig m_config;
+	const va::DetectorKernels* m_kernels;
+	cv::dnn::Net m_net;
+	std::vector<cv::String> m_outputs { "conv2d_bbox", "conv2d_cov/Sigmoid" };
+	std::vector<float> m_blob;
+
+	OpenCvDetector(const va::DetectorConfig& config, const va::DetectorKernels* kernels) :
+		m_config(config),
+		m_kernels(kernels)
+	{
+		try {
+			m_net = cv::dnn::readNetFromCaffe(config.proto_file, config.model_file);
+		} catch (cv::Exception& e) {
+			throw std::runtime_error("Unable to load " + config.model_file + ": " + e.what() + "Exiting.\n");
+		}
+		if (m_net.empty()) {
+			throw std::runtime_error("Unable to load " + config.model_file + ". Exiting.\n");
+		}
+		m_net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+		m_net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+	}
+
+	auto detect(const std::vector<const guint8*>& frames, std::vector<std::vector<va::Detection>>* detections) -> void override {
+		const size_t plane = static_cast<size_t>(m_config.input_width) * m_config.input_height;
+		m_blob.resize(frames.size() * 3 * plane);
+		{
+			VA_TRACE_SCOPE("detector.preprocess");
+			for (size_t i = 0; i < frames.size(); ++i) {
+				float* r = m_blob.data() + i * 3 * plane;
+				m_kernels->rgbx_to_planes(frames[i], plane, static_cast<float>(m_config.net_scale_factor), r, r + plane, r + 2 * plane);
+			}
+		}
+
+		std::vector<cv::Mat> outputs;
+		{
+			VA_TRACE_SCOPE("detector.forward");
+			int dims[4] = { static_cast<int>(frames.size()), 3, static_cast<int>(m_config.input_height), static_cast<int>(m_config.input_width) };
+			m_net.setInput(cv::Mat(4, dims, CV_32F, m_blob.data()));
+			m_net.forward(outputs, m_outputs);
+		}
+
+		VA_TRACE_SCOPE("detector.parse");
+		const cv::Mat& bbox = outputs[0];
+		const cv::Mat& cov = outputs[1];
+		guint grid_height = cov.size[2];
+		guint grid_width = cov.size[3];
+		size_t grid_size = static_cast<size_t>(grid_width) * grid_height;
+		detections->resize(frames.size());
+		for (size_t i = 0; i < frames.size(); ++i) {
+			std::vector<va::Detection>& found = (*detections)[i];
+			found.clear();
+			va::parse_detectnet(cov.ptr<float>() + i * cov.size[1] * grid_size, bbox.ptr<float>() + i * bbox.size[1] * grid_size,
+					grid_width, grid_height, m_config, &found);
+			va::non_max_suppression(&found, m_config.nms_iou, m_config.topk);
+		}
+	}
+};
+#endif
+
+auto va::make_cpu_detector(const va::DetectorConfig& config) -> std::unique_ptr<va::Detector> {
+	const va::DetectorKernels* kernels = va::detector_kernels_by_name(config.kernels);
+	if (!kernels) {
+		throw std::invalid_argument("Detector: no " + config.kernels + " kernels on this cpu. Exiting.\n");
+	}
+#ifdef VA_WITH_OPENCV
+	cv::setNumThreads(static_cast<int>(config.threads_per_worker));
+	return std::make_unique<OpenCvDetector>(config, kernels);
+#else
+	throw std::runtime_error("The cpu detector needs a build with WITH_OPENCV=1. Exiting.\n");
+#endif
+}
@@ -0,0 +1,97 @@
+#ifndef VA_ENGINE_DETECTOR_H_
+#define VA_ENGINE_DETECTOR_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+namespace va {
+/**
+ * Detector settings, read from the "detector" group of the yml file
+ */
+struct DetectorConfig {
+	/* nvinfer; cpu for the network below on the cpu, without nvstreammux,
+	 * nvinfer or a CUDA device; or none to pass frames through without
+	 * objects, e.g. to load test the rest of the pipeline */
+	std::string backend = "nvinfer";
+
+	/* the rest is for the cpu backend: the caffe model of the pgie config */
+	std::string proto_file = "models/Primary_Detector/resnet10.prototxt";
+	std::string model_file = "models/Primary_Detector/resnet10.caffemodel";
+	guint input_width = 640;
+	guint input_height = 368;
+	double net_scale_factor = 0.0039215697906911373;
+	guint num_classes = 4;
+	double threshold = 0.2;
+	double nms_iou = 0.5;
+	/* most objects kept per class and frame */
+	guint topk = 20;
+	/* frames inferred together, and how long a partial batch waits */
+	guint batch_size = 4;
+	guint batch_timeout_ms = 40;
+	/* inference workers, each with its own copy of the network, 0 for one
+	 * per core; and the threads of each */
+	guint workers = 0;
+	guint threads_per_worker = 1;
+	/* auto, scalar, sse2, avx2 or neon */
+	std::string kernels = "auto";
+};
+
+/* throws std::invalid_argument on an unknown backend */
+auto parse_detector_config(const char* cfg_file, const char* group) -> DetectorConfig;
+
+/**
+ * Object found in a frame, in network input pixels
+ */
+struct Detection {
+	int class_id;
+	float confidence;
+	float left;
+	float top;
+	float width;
+	float height;
+};
+
+/**
+ * Finds objects in batches of frames already scaled to the network input,
+ * packed RGBx. One instance is used by one thread at a time.
+ */
+struct Detector {
+	virtual ~Detector() = default;
+
+	/* detections[i] for frames[i] */
+	virtual auto detect(const std::vector<const guint8*>& frames, std::vector<std::vector<Detection>>* detections) -> void = 0;
+};
+
+/* the cpu backend, throws std::runtime_error when it is not built in or the
+ * model does not load */
+auto make_cpu_detector(const DetectorConfig& config) -> std::unique_ptr<Detector>;
+
+/**
+ * Packed RGBx to the three float planes of a network input, times scale.
+ * One set per instruction set.
+ */
+struct DetectorKernels {
+	const char* name;
+	void (*rgbx_to_planes)(const guint8* rgbx, size_t pixels, float scale, float* r, float* g, float* b);
+};
+
+auto detector_kernels_available() -> std::vector<const DetectorKernels*>;
+/* "auto" for the fastest, nullptr for a set this cpu does not run */
+auto detector_kernels_by_name(const std::string& name) -> const DetectorKernels*;
+
+/**
+ * Boxes of a DetectNet output (ResNet10 of models/Primary_Detector) over
+ * threshold, as nvinfer's default parser reads them: cov is the
+ * num_classes x grid coverage, bbox the 4 x num_classes x grid offsets.
+ */
+auto parse_detectnet(const float* cov, const float* bbox, guint grid_width, guint grid_height,
+		const DetectorConfig& config, std::vector<Detection>* detections) -> void;
+/* greedy per class, by confidence, at most topk per class */
+auto non_max_suppression(std::vector<Detection>* detections, double iou, guint topk) -> void;
+
+} // namespace va
+
+#endif
@@ -1,10 +1,17 @@
 #include "va_engine.h"
 
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <cstring>
 #include <memory>
 #include <tuple>
 
+#include <glib-unix.h>
+
 #include "va_object_meta.h"
+#include "va_trace.h"
 #include "va_user_data.h"
 
 static gchar pgie_classes[4][32] = { "Vehicle", "TwoWheeler", "Person", "RoadSign" };
@@ -22,6 +29,7 @@ static auto is_using_config_file(char* argv) -> bool {
  * Extract metadata, NvDsBatchMeta -> NvDsFrameMeta -> (....) 
  */
 static auto tiler_src_pad_buffer_probe(GstPad* pad, GstPadProbeInfo* info, void* user_data) -> GstPadProbeReturn {
+	VA_TRACE_SCOPE("probe");
 	guint num_rects = 0; 
 	guint vehicle_count = 0;
 	guint person_count = 0;
@@ -32,26 +40,69 @@ static auto tiler_src_pad_buffer_probe(GstPad* pad, GstPadProbeInfo* info, void*
 	NvDsFrameMeta* frame_meta = nullptr;
 
 	va::UserData* va_user_data = static_cast<va::UserData*>(user_data);
-	va::Database* va_database = static_cast<va::Database*>(va_user_data->va_database);
+	bool has_sink = va_user_data->has_sink();
+	va::ClipRecorder* va_clip_recorder = va_user_data->va_clip_recorder;
+	va::Thumbnailer* va_thumbnailer = va_user_data->va_thumbnailer;
+	va::SceneGate* va_scene_gate = va_user_data->va_scene_gate;
+	va::StreamStats* va_stream_stats = va_user_data->va_stream_stats;
+	va::ChunkMerger* va_chunk_merger = va_user_data->va_chunk_merger;
 
 	GstBuffer* buf = static_cast<GstBuffer*>(info->data);
 	NvDsBatchMeta* batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+	/* the batched frames, for thumbnail crops */
+	GstMapInfo map;
+	NvBufSurface* surface = nullptr;
+	if (va_thumbnailer && gst_buffer_map(buf, &map, GST_MAP_READ)) {
+		surface = reinterpret_cast<NvBufSurface*>(map.data);
+	}
+	guint64 last_timestamp = 0;
 	for (l_frame = batch_meta->frame_meta_list; l_frame != nullptr; l_frame = l_frame->next) {
+		VA_TRACE_SCOPE("probe.frame");
 		frame_meta = static_cast<NvDsFrameMeta*>(l_frame->data);
 		
-		std::string video_file = { "test" };
+		std::string video_file = va_user_data->source_uri(frame_meta->source_id);
+		if (video_file.empty()) {
+			video_file = "test";
+		}
+		/* chunks of a recorded file are stamped with their time in the file */
+		guint64 timestamp = va_chunk_merger ?
+			va_chunk_merger->timestamp(frame_meta->source_id, frame_meta->buf_pts, frame_meta->ntp_timestamp) : frame_meta->ntp_timestamp;
 		va::FrameMetadata va_frame_meta {
 			video_file,
-			frame_meta->ntp_timestamp // frame timestamp
+			timestamp // frame timestamp
 		};
+		guint clip_hits[VA_CLIP_MAX_RULES] = { };
+		std::unique_ptr<va::SurfaceFrame> surface_frame;
+		if (surface && frame_meta->obj_meta_list) {
+			surface_frame = std::make_unique<va::SurfaceFrame>(surface, frame_meta->batch_id);
+		}
+		last_timestamp = frame_meta->ntp_timestamp;
 		for (l_obj = frame_meta->obj_meta_list; l_obj != nullptr; l_obj = l_obj->next) {
 			object_meta = static_cast<NvDsObjectMeta*>(l_obj->data);
 
-			if (va_database) {
+			if (va_clip_recorder) {
+				va_clip_recorder->count(object_meta->class_id, object_meta->confidence, clip_hits);
+			}
+
+			if (surface_frame && surface_frame->m_valid) {
+				va::ThumbnailCandidate candidate;
+				candidate.object_id = object_meta->object_id;
+				candidate.class_id = object_meta->class_id;
+				candidate.label = pgie_classes[object_meta->class_id];
+				candidate.confidence = object_meta->confidence;
+				candidate.left = object_meta->rect_params.left;
+				candidate.top = object_meta->rect_params.top;
+				candidate.width = object_meta->rect_params.width;
+				candidate.height = object_meta->rect_params.height;
+				candidate.timestamp = frame_meta->ntp_timestamp;
+				va_thumbnailer->offer(frame_meta->source_id, video_file, surface_frame->m_view, candidate);
+			}
+
+			if (has_sink) {
 				va_frame_meta.va_object_meta_list.emplace_back(
 					object_meta, 
 					pgie_classes[object_meta->class_id], 
-					frame_meta->ntp_timestamp
+					timestamp
 				);
 				// std::cout << va_frame_meta.va_object_meta_list.size() << std::endl;
 			}
@@ -66,14 +117,19 @@ static auto tiler_src_pad_buffer_probe(GstPad* pad, GstPadProbeInfo* info, void*
 			}
 		}
 
-		/* count the frame and reset the count to 0 if it reachs save_interval */
-		++va_user_data->frame_count;
-		if (va_user_data->frame_count == va_user_data->save_interval) {
-			if (va_database) {
-				va_database->insert(&va_frame_meta);
-			}
-			// std::cout << "save at: " << va_user_data->frame_count << std::endl;
-			va_user_data->frame_count = 0;
+		/* with the scene gate, frames it skipped go to the sinks in between */
+		if (va_scene_gate) {
+			va_scene_gate->sink_inferred(frame_meta->source_id, frame_meta->buf_pts, va_frame_meta);
+		} else if (va_chunk_merger) {
+			va_chunk_merger->push(frame_meta->source_id, va_frame_meta);
+		} else {
+			va_user_data->sink_frame(frame_meta->source_id, va_frame_meta);
+		}
+		if (va_clip_recorder) {
+			va_clip_recorder->evaluate(frame_meta->source_id, clip_hits);
+		}
+		if (va_stream_stats) {
+			va_stream_stats->record(frame_meta->source_id, frame_meta->ntp_timestamp, frame_meta->num_obj_meta);
 		}
 
 		/* g_print(
@@ -116,11 +172,104 @@ static auto tiler_src_pad_buffer_probe(GstPad* pad, GstPadProbeInfo* info, void*
 #endif
 	}
 
+	if (va_thumbnailer) {
+		if (surface) {
+			gst_buffer_unmap(buf, &map);
+		}
+		va_thumbnailer->sweep(last_timestamp);
+	}
+
 	return GST_PAD_PROBE_OK;
 }
 
+/**
+ * Mark the first inferred batch in the startup timeline, then get out of the way
+ */
+static auto first_batch_probe(GstPad* pad, GstPadProbeInfo* info, gpointer data) -> GstPadProbeReturn {
+	static_cast<va::Engine*>(data)->m_startup_milestone("first-batch");
+	return GST_PAD_PROBE_REMOVE;
+}
+
+/**
+ * The muxer's end of one stream, in order behind the last batch of it
+ */
+static auto chunk_eos_probe(GstPad* pad, GstPadProbeInfo* info, gpointer data) -> GstPadProbeReturn {
+	GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+	if (GST_EVENT_TYPE(event) == (GstEventType)GST_NVEVENT_STREAM_EOS) {
+		guint source_id = 0;
+		gst_nvevent_parse_stream_eos(event, &source_id);
+		static_cast<va::ChunkMerger*>(data)->finish(source_id);
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+/**
+ * Role of a streaming thread: the name of the element that owns it, prefixed
+ * with its source bin
+ */
+static auto streaming_role(GstElement* owner) -> std::string {
+	std::string role = GST_OBJECT_NAME(owner);
+	for (GstObject* parent = GST_OBJECT_PARENT(owner); parent; parent = GST_OBJECT_PARENT(parent)) {
+		if (g_str_has_prefix(GST_OBJECT_NAME(parent), "source-bin-")) {
+			return std::string(GST_OBJECT_NAME(parent)) + "/" + role;
+		}
+	}
+	return role;
+}
+
+/**
+ * Runs on the thread that posted msg, which for STREAM_STATUS enter and leave
+ * is the streaming thread itself
+ */
+static auto bus_sync_handler(GstBus* bus, GstMessage* msg, gpointer data) -> GstBusSyncReply {
+	if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_STREAM_STATUS) {
+		return GST_BUS_PASS;
+	}
+	GstStreamStatusType type;
+	GstElement* owner = nullptr;
+	gst_message_parse_stream_status(msg, &type, &owner);
+	if (type == GST_STREAM_STATUS_TYPE_ENTER && owner) {
+		va::place_thread(streaming_role(owner));
+	} else if (type == GST_STREAM_STATUS_TYPE_LEAVE) {
+		va::leave_thread();
+	}
+	return GST_BUS_PASS;
+}
+
+/**
+ * SIGHUP: re-read the yml config and apply what changed
+ */
+static auto reload_signal_handler(gpointer data) -> gboolean {
+	va::Engine* engine = static_cast<va::Engine*>(data);
+	g_print("SIGHUP received, reloading %s\n", engine->m_argv[1]);
+	engine->reload();
+	return G_SOURCE_CONTINUE;
+}
+
+#ifdef VA_ENABLE_TRACE
+/**
+ * Write the trace buffers to va-trace-<pid>-<suffix>.json
+ */
+static auto export_trace(const std::string& suffix) -> void {
+	std::string path = "va-trace-" + std::to_string(getpid()) + "-" + suffix + ".json";
+	size_t events = VA_TRACE_EXPORT(path);
+	g_print("Wrote %zu trace events to %s\n", events, path.c_str());
+}
+
+/**
+ * SIGUSR1: export what the trace buffers hold, the engine keeps running
+ */
+static auto trace_signal_handler(gpointer data) -> gboolean {
+	static guint count = 0;
+	export_trace(std::to_string(count++));
+	return G_SOURCE_CONTINUE;
+}
+#endif
+
 static auto bus_call(GstBus* bus, GstMessage* msg, gpointer data) -> gboolean {
-	GMainLoop* loop = (GMainLoop*)data;
+	VA_TRACE_SCOPE("bus_call");
+	va::Engine* engine = static_cast<va::Engine*>(data);
+	GMainLoop* loop = engine->m_loop;
 	switch (GST_MESSAGE_TYPE(msg)) {
 		case GST_MESSAGE_EOS:
 			g_print("End of stream\n");
@@ -146,9 +295,25 @@ static auto bus_call(GstBus* bus, GstMessage* msg, gpointer data) -> gboolean {
 			}
 			g_free(debug);
 			g_error_free(error);
+			/* a failed chunk is restarted instead of failing the job */
+			if (engine->m_chunk_merger && engine->m_retry_chunk(msg->src)) {
+				break;
+			}
 			g_main_loop_quit(loop);
 			break;
 		}
+		case GST_MESSAGE_STATE_CHANGED: {
+			VA_TRACE_INSTANT("state-changed");
+			if (engine->m_startup_pending <= 0) {
+				break;
+			}
+			GstState new_state;
+			gst_message_parse_state_changed(msg, nullptr, &new_state, nullptr);
+			if (GST_MESSAGE_SRC(msg) == GST_OBJECT(engine->m_pipeline) && new_state == GST_STATE_PLAYING) {
+				engine->m_startup_milestone("pipeline-playing");
+			}
+			break;
+		}
 		case GST_MESSAGE_ELEMENT: {
 			if (gst_nvmessage_is_stream_eos(msg)) {
 				guint stream_id;
@@ -164,7 +329,38 @@ static auto bus_call(GstBus* bus, GstMessage* msg, gpointer data) -> gboolean {
 	return TRUE;
 }
 
+/**
+ * Software decoders output system memory, which nvstreammux does not take.
+ * Bridge the decoder pad to the ghost pad through nvvideoconvert.
+ */
+static auto link_through_nvvideoconvert(GstElement* source_bin, GstPad* decoder_src_pad) -> bool {
+	GstElement* convert = gst_element_factory_make("nvvideoconvert", nullptr);
+	GstElement* capsfilter = gst_element_factory_make("capsfilter", nullptr);
+	if (!convert || !capsfilter) {
+		return false;
+	}
+	GstCaps* nvmm_caps = gst_caps_from_string("video/x-raw(" GST_CAPS_FEATURES_NVMM "), format=NV12");
+	g_object_set(G_OBJECT(capsfilter), "caps", nvmm_caps, NULL);
+	gst_caps_unref(nvmm_caps);
+
+	gst_bin_add_many(GST_BIN(source_bin), convert, capsfilter, NULL);
+	gst_element_sync_state_with_parent(convert);
+	gst_element_sync_state_with_parent(capsfilter);
+	GstPad* convert_sink_pad = gst_element_get_static_pad(convert, "sink");
+	GstPad* capsfilter_src_pad = gst_element_get_static_pad(capsfilter, "src");
+	GstPad* bin_ghost_pad = gst_element_get_static_pad(source_bin, "src");
+	bool linked = gst_element_link(convert, capsfilter) &&
+		gst_pad_link(decoder_src_pad, convert_sink_pad) == GST_PAD_LINK_OK &&
+		gst_ghost_pad_set_target(GST_GHOST_PAD(bin_ghost_pad), capsfilter_src_pad);
+	gst_object_unref(convert_sink_pad);
+	gst_object_unref(capsfilter_src_pad);
+	gst_object_unref(bin_ghost_pad);
+	g_print("Decodebin picked a software decoder, converting to NVMM\n");
+	return linked;
+}
+
 static auto cb_pad_added(GstElement* decodebin, GstPad* decoder_src_pad, gpointer data) -> void {
+	VA_TRACE_SCOPE("cb_pad_added");
 	GstCaps* caps = gst_pad_get_current_caps(decoder_src_pad);
 	if (!caps) {
 		caps = gst_pad_query_caps(decoder_src_pad, NULL);
@@ -187,13 +383,177 @@ static auto cb_pad_added(GstElement* decodebin, GstPad* decoder_src_pad, gpointe
 				g_printerr("Failed to link decoder src pad to source bin ghost pad\n");
 			}
 			gst_object_unref(bin_ghost_pad);
-		} else {
-			g_printerr("Error: Decodebin did not pick nvidia decoder plugin.\n");
+		} else if (!link_through_nvvideoconvert(source_bin, decoder_src_pad)) {
+			g_printerr("Error: Decodebin did not pick nvidia decoder plugin and its output could not be converted.\n");
 		}
 	}
+	gst_caps_unref(caps);
+}
+
+/**
+ * Keyframe-only for decoders that cannot skip frames themselves, delta frames
+ * are dropped before they reach the decoder
+ */
+static auto decoder_sink_probe(GstPad* pad, GstPadProbeInfo* info, gpointer data) -> GstPadProbeReturn {
+	va::DecodeGate* gate = static_cast<va::DecodeGate*>(data);
+	GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	return gate->admit_compressed(GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+}
+
+/**
+ * Drop-frame-interval for decoders without the property
+ */
+static auto decoder_src_probe(GstPad* pad, GstPadProbeInfo* info, gpointer data) -> GstPadProbeReturn {
+	va::DecodeGate* gate = static_cast<va::DecodeGate*>(data);
+	return gate->admit_decoded() ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+}
+
+/**
+ * Whether the scene gate finds the decoded NVMM frame in buffer static
+ */
+static auto scene_gate_skips(va::SourceHooks* hooks, GstBuffer* buffer) -> bool {
+	GstMapInfo map;
+	if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+		return false;
+	}
+	va::SceneGate::Decision decision;
+	{
+		va::SurfaceFrame frame { reinterpret_cast<NvBufSurface*>(map.data), 0 };
+		decision = hooks->m_scene_gate->decide(hooks->m_index, frame.m_view,
+				GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer)), GST_BUFFER_PTS(buffer));
+	}
+	gst_buffer_unmap(buffer, &map);
+	return decision == va::SceneGate::Decision::SKIP;
+}
+
+/**
+ * Max fps and the scene gate, on the source bin output right before the muxer
+ */
+static auto source_output_probe(GstPad* pad, GstPadProbeInfo* info, gpointer data) -> GstPadProbeReturn {
+	va::SourceHooks* hooks = static_cast<va::SourceHooks*>(data);
+	GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	if (hooks->m_decode_gate &&
+			!hooks->m_decode_gate->admit_output(GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer)), GST_BUFFER_PTS(buffer))) {
+		return GST_PAD_PROBE_DROP;
+	}
+	if (hooks->m_scene_gate && scene_gate_skips(hooks, buffer)) {
+		return GST_PAD_PROBE_DROP;
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+/**
+ * Jitter of a synthetic source, on the source bin output
+ */
+static auto synthetic_jitter_probe(GstPad* pad, GstPadProbeInfo* info, gpointer data) -> GstPadProbeReturn {
+	static_cast<va::SourceHooks*>(data)->m_jitter->hold();
+	return GST_PAD_PROBE_OK;
+}
+
+/**
+ * A seek of a chunk:// source, from the main loop
+ */
+struct ChunkSeek {
+	GstPad* m_pad;
+	std::shared_ptr<va::ChunkSource> m_source;
+};
+
+static auto chunk_seek(gpointer data) -> gboolean {
+	std::unique_ptr<ChunkSeek> seek { static_cast<ChunkSeek*>(data) };
+	const va::FileChunk& chunk = seek->m_source->m_chunk;
+	bool to_end = chunk.stop_ns == G_MAXUINT64;
+	GstEvent* event = gst_event_new_seek(1.0, GST_FORMAT_TIME,
+			(GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE),
+			GST_SEEK_TYPE_SET, chunk.start_ns, to_end ? GST_SEEK_TYPE_NONE : GST_SEEK_TYPE_SET, to_end ? GST_CLOCK_TIME_NONE : chunk.stop_ns);
+	if (!gst_pad_send_event(seek->m_pad, event)) {
+		g_printerr("Chunk of %s at %.1f s: seek failed, decoding from the start of the file\n",
+				chunk.location.c_str(), chunk.start_ns / 1e9);
+		seek->m_source->m_phase = va::ChunkSource::Phase::RUNNING;
+	}
+	gst_object_unref(seek->m_pad);
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * Cut a chunk:// source to its range, on the source bin output. The first
+ * buffer has the source seek to the start of the range. The flushes and the
+ * new segment of the seek stay in the source bin, the muxer keeps the segment
+ * the stream started with, as with deepstream-app's file loop. Buffers
+ * outside of the range never reach the muxer.
+ */
+static auto chunk_range_probe(GstPad* pad, GstPadProbeInfo* info, gpointer data) -> GstPadProbeReturn {
+	using Phase = va::ChunkSource::Phase;
+	const std::shared_ptr<va::ChunkSource>& source = static_cast<va::SourceHooks*>(data)->m_chunk;
+	if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+		Phase phase = source->m_phase.load();
+		if (phase == Phase::PREROLL && source->m_phase.compare_exchange_strong(phase, Phase::SEEKING)) {
+			g_idle_add(chunk_seek, new ChunkSeek { GST_PAD(gst_object_ref(pad)), source });
+			return GST_PAD_PROBE_DROP;
+		}
+		if (phase != Phase::RUNNING) {
+			return GST_PAD_PROBE_DROP;
+		}
+		GstClockTime pts = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+		bool in_range = !GST_CLOCK_TIME_IS_VALID(pts) || (pts >= source->m_chunk.start_ns && pts < source->m_chunk.stop_ns);
+		return in_range ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+	}
+
+	switch (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info))) {
+		case GST_EVENT_FLUSH_START:
+			return GST_PAD_PROBE_DROP;
+		case GST_EVENT_FLUSH_STOP:
+			source->m_phase = Phase::RUNNING;
+			return GST_PAD_PROBE_DROP;
+		case GST_EVENT_SEGMENT:
+			return source->m_phase == Phase::PREROLL ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+		default:
+			return GST_PAD_PROBE_OK;
+	}
+}
+
+/**
+ * Whether element is a video element of the given klass, e.g. Decoder or Parser
+ */
+static auto is_element_of_klass(GstElement* element, const gchar* kind) -> bool {
+	GstElementFactory* factory = gst_element_get_factory(element);
+	const gchar* klass = factory ? gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS) : nullptr;
+	return klass && g_strrstr(klass, kind) && g_strrstr(klass, "Video");
+}
+
+/**
+ * Apply the decode policy of a source to a decoder decodebin just plugged.
+ * nvv4l2decoder skips and drops frames itself, other decoders get pad probes.
+ */
+static auto apply_decode_policy(GstElement* decoder, const gchar* name, va::DecodeGate* gate) -> void {
+	const va::DecodePolicy& policy = gate->m_policy;
+	if (g_strrstr(name, "nvv4l2decoder") == name) {
+		if (policy.drop_frame_interval > 1) {
+			g_object_set(G_OBJECT(decoder), "drop-frame-interval", policy.drop_frame_interval, NULL);
+		}
+		if (policy.keyframe_only) {
+			/* 2: decode key frames only */
+			g_object_set(G_OBJECT(decoder), "skip-frames", 2, NULL);
+		}
+		return;
+	}
+	if (!is_element_of_klass(decoder, "Decoder")) {
+		return;
+	}
+	g_print("Source %u: applying decode policy to %s with pad probes\n", gate->m_index, name);
+	if (policy.keyframe_only) {
+		GstPad* sink_pad = gst_element_get_static_pad(decoder, "sink");
+		gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, decoder_sink_probe, gate, NULL);
+		gst_object_unref(sink_pad);
+	}
+	if (policy.drop_frame_interval > 1) {
+		GstPad* src_pad = gst_element_get_static_pad(decoder, "src");
+		gst_pad_add_probe(src_pad, GST_PAD_PROBE_TYPE_BUFFER, decoder_src_probe, gate, NULL);
+		gst_object_unref(src_pad);
+	}
 }
 
 static auto cb_decodebin_child_added(GstChildProxy* child_proxy, GObject* object, gchar* name, gpointer user_data) -> void {
+	VA_TRACE_SCOPE("cb_decodebin_child_added");
 	g_print("Decodebin child added: %s\n", name);
 	if (g_strrstr(name, "decodebin") == name) {
 		g_signal_connect(G_OBJECT(object), "child-added", G_CALLBACK(cb_decodebin_child_added), user_data);
@@ -201,6 +561,16 @@ static auto cb_decodebin_child_added(GstChildProxy* child_proxy, GObject* object
 	if (g_strrstr(name, "source") == name) {
 		g_object_set(G_OBJECT(object), "drop-on-latency", true, NULL);
 	}
+	va::SourceHooks* hooks = static_cast<va::SourceHooks*>(user_data);
+	if (hooks->m_decode_gate) {
+		apply_decode_policy(GST_ELEMENT(object), name, hooks->m_decode_gate.get());
+	}
+	/* the pre-event ring takes the parsed, still compressed stream */
+	if (hooks->m_clip_recorder && is_element_of_klass(GST_ELEMENT(object), "Parser")) {
+		GstPad* parser_src_pad = gst_element_get_static_pad(GST_ELEMENT(object), "src");
+		hooks->m_clip_recorder->attach(parser_src_pad, hooks->m_index);
+		gst_object_unref(parser_src_pad);
+	}
 }
 
 inline auto va::Engine::m_create_pipeline() -> GstElement* {
@@ -227,110 +597,316 @@ inline auto va::Engine::m_create_streamux() -> GstElement* {
 inline auto va::Engine::m_create_source_bin(guint index, gchar* uri) -> GstElement* {
 	GstElement *bin = nullptr, *uri_decode_bin = nullptr;
 	gchar bin_name[16] = { };
+	/* synthetic:// sources are made up for load tests */
+	bool synthetic = va::is_synthetic_uri(uri);
+	va::SyntheticSource synthetic_source {};
+	if (synthetic) {
+		synthetic_source = va::parse_synthetic_uri(uri);
+	}
+	/* chunk:// sources are time ranges of a recorded file */
+	bool chunk = va::is_chunk_uri(uri);
 
 	g_snprintf(bin_name, 15, "source-bin-%02d", index);
 	/* Create a source GstBin to abstract this bin's content from the rest of the
 	 * pipeline */
 	bin = gst_bin_new(bin_name);
 
-	/* Source element for reading from the uri.
-	 * We will use decodebin and let it figure out the container format of the
-	 * stream and the codec and plug the appropriate demux and decode plugins. */
-	if (PERF_MODE) {
-		uri_decode_bin = gst_element_factory_make("nvurisrcbin", "uri-decode-bin");
-		g_object_set(G_OBJECT(uri_decode_bin), "file-loop", TRUE, NULL);
-	} else {
-		uri_decode_bin = gst_element_factory_make("uridecodebin", "uri-decode-bin");
+	std::unique_ptr<va::SourceHooks>& hooks = m_source_hooks[index];
+	hooks = std::make_unique<va::SourceHooks>();
+	hooks->m_index = index;
+	hooks->m_clip_recorder = m_va_clip_recorder;
+	hooks->m_scene_gate = m_va_scene_gate;
+	va::DecodePolicy policy = m_decode_policies.policy_for(uri);
+	if (!policy.is_default()) {
+		hooks->m_decode_gate = std::make_unique<va::DecodeGate>(policy, index);
+		g_print("Source %u: drop-frame-interval %u, keyframe-only %d, max-fps %.2f\n",
+				index, policy.drop_frame_interval, policy.keyframe_only, policy.max_fps);
 	}
-
-	if (!bin || !uri_decode_bin) {
-		throw std::runtime_error("One element in source bin could not be created.\n");
+	if (synthetic_source.jitter_ms > 0) {
+		hooks->m_jitter = std::make_unique<va::SourceJitter>(synthetic_source.jitter_ms, index + 1);
+	}
+	if (chunk) {
+		hooks->m_chunk = std::make_shared<va::ChunkSource>();
+		hooks->m_chunk->m_chunk = va::parse_chunk_uri(uri);
+		if (!m_chunk_merger) {
+			m_chunk_merger = std::make_unique<va::ChunkMerger>(g_get_tmp_dir());
+		}
+		/* again for a restart, which then skips what the chunk already handed over */
+		m_chunk_merger->add_chunk(index, hooks->m_chunk->m_chunk);
+		g_print("Source %u: chunk of %s from %.1f s\n", index, hooks->m_chunk->m_chunk.location.c_str(),
+				hooks->m_chunk->m_chunk.start_ns / 1e9);
 	}
-
-	/* We set the input uri to the source element */
-	g_object_set(G_OBJECT(uri_decode_bin), "uri", uri, NULL);
-
-	/* Connect to the "pad-added" signal of the decodebin which generates a
-	 * callback once a new pad for raw data has beed created by the decodebin */
-	g_signal_connect(G_OBJECT(uri_decode_bin), "pad-added", G_CALLBACK(cb_pad_added), bin);
-	g_signal_connect(G_OBJECT(uri_decode_bin), "child-added", G_CALLBACK(cb_decodebin_child_added), bin);
-	gst_bin_add(GST_BIN(bin), uri_decode_bin);
 
 	/* We need to create a ghost pad for the source bin which will act as a proxy
 	 * for the video decoder src pad. The ghost pad will not have a target right
 	 * now. Once the decode bin creates the video decoder and generates the
 	 * cb_pad_added callback, we will set the ghost pad target to the video decoder
 	 * src pad. */
-	if (!gst_element_add_pad(bin, gst_ghost_pad_new_no_target("src", GST_PAD_SRC))) {
+	GstPad* ghost_pad = gst_ghost_pad_new_no_target("src", GST_PAD_SRC);
+	if (!bin || !gst_element_add_pad(bin, ghost_pad)) {
 		throw std::runtime_error("Failed to add ghost pad in source bin\n");
 	}
 
+	if (synthetic && synthetic_source.kind == "testsrc") {
+		m_create_test_source(bin, synthetic_source);
+	} else {
+		/* Source element for reading from the uri.
+		 * We will use decodebin and let it figure out the container format of the
+		 * stream and the codec and plug the appropriate demux and decode plugins. */
+		if (!chunk && (PERF_MODE || synthetic)) {
+			uri_decode_bin = gst_element_factory_make("nvurisrcbin", "uri-decode-bin");
+			if (uri_decode_bin) {
+				g_object_set(G_OBJECT(uri_decode_bin), "file-loop", TRUE, NULL);
+			}
+		} else {
+			uri_decode_bin = gst_element_factory_make("uridecodebin", "uri-decode-bin");
+		}
+
+		if (!uri_decode_bin) {
+			throw std::runtime_error("One element in source bin could not be created.\n");
+		}
+
+		/* We set the input uri to the source element */
+		const gchar* location = uri;
+		if (synthetic) {
+			location = synthetic_source.location.c_str();
+		} else if (chunk) {
+			location = hooks->m_chunk->m_chunk.location.c_str();
+		}
+		g_object_set(G_OBJECT(uri_decode_bin), "uri", location, NULL);
+
+		/* Connect to the "pad-added" signal of the decodebin which generates a
+		 * callback once a new pad for raw data has beed created by the decodebin */
+		g_signal_connect(G_OBJECT(uri_decode_bin), "pad-added", G_CALLBACK(cb_pad_added), bin);
+		g_signal_connect(G_OBJECT(uri_decode_bin), "child-added", G_CALLBACK(cb_decodebin_child_added), hooks.get());
+		gst_bin_add(GST_BIN(bin), uri_decode_bin);
+	}
+
+	/* a chunk from the start of the file to its end plays as it is */
+	if (hooks->m_chunk && (hooks->m_chunk->m_chunk.start_ns > 0 || hooks->m_chunk->m_chunk.stop_ns != G_MAXUINT64)) {
+		gst_pad_add_probe(ghost_pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM |
+				GST_PAD_PROBE_TYPE_EVENT_FLUSH), chunk_range_probe, hooks.get(), NULL);
+	} else if (hooks->m_chunk) {
+		hooks->m_chunk->m_phase = va::ChunkSource::Phase::RUNNING;
+	}
+	/* frames over max-fps, or static, never reach the muxer */
+	if (hooks->m_decode_gate || hooks->m_scene_gate) {
+		gst_pad_add_probe(ghost_pad, GST_PAD_PROBE_TYPE_BUFFER, source_output_probe, hooks.get(), NULL);
+	}
+	if (hooks->m_jitter) {
+		gst_pad_add_probe(ghost_pad, GST_PAD_PROBE_TYPE_BUFFER, synthetic_jitter_probe, hooks.get(), NULL);
+	}
+
 	return bin;
 }
 
-inline auto va::Engine::m_add_source_bin_to_pipeline() -> void {
-	GList* src_list = nullptr;
+/**
+ * Fill a source bin with a live videotestsrc of the size and rate of source,
+ * converted to NVMM NV12 for the muxer
+ */
+inline auto va::Engine::m_create_test_source(GstElement* bin, const va::SyntheticSource& source) -> void {
+	GstElement* testsrc = gst_element_factory_make("videotestsrc", "test-source");
+	GstElement* raw_caps = gst_element_factory_make("capsfilter", nullptr);
+	GstElement* convert = gst_element_factory_make("nvvideoconvert", nullptr);
+	GstElement* nvmm_caps = gst_element_factory_make("capsfilter", nullptr);
+	if (!testsrc || !raw_caps || !convert || !nvmm_caps) {
+		throw std::runtime_error("One element in source bin could not be created.\n");
+	}
+	g_object_set(G_OBJECT(testsrc), "is-live", TRUE, NULL);
+	gst_util_set_object_arg(G_OBJECT(testsrc), "pattern", source.pattern.c_str());
+
+	GstCaps* caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "NV12",
+			"width", G_TYPE_INT, (gint)source.width, "height", G_TYPE_INT, (gint)source.height,
+			"framerate", GST_TYPE_FRACTION, (gint)source.fps, 1, NULL);
+	g_object_set(G_OBJECT(raw_caps), "caps", caps, NULL);
+	gst_caps_unref(caps);
+	caps = gst_caps_from_string("video/x-raw(" GST_CAPS_FEATURES_NVMM "), format=NV12");
+	g_object_set(G_OBJECT(nvmm_caps), "caps", caps, NULL);
+	gst_caps_unref(caps);
+
+	gst_bin_add_many(GST_BIN(bin), testsrc, raw_caps, convert, nvmm_caps, NULL);
+	if (!gst_element_link_many(testsrc, raw_caps, convert, nvmm_caps, NULL)) {
+		throw std::runtime_error("Failed to link synthetic source. Exiting.\n");
+	}
+	GstPad* nvmm_src_pad = gst_element_get_static_pad(nvmm_caps, "src");
+	GstPad* bin_ghost_pad = gst_element_get_static_pad(bin, "src");
+	bool linked = gst_ghost_pad_set_target(GST_GHOST_PAD(bin_ghost_pad), nvmm_src_pad);
+	gst_object_unref(nvmm_src_pad);
+	gst_object_unref(bin_ghost_pad);
+	if (!linked) {
+		throw std::runtime_error("Failed to link synthetic source to source bin ghost pad. Exiting.\n");
+	}
+}
 
+/**
+ * Uris of the yml source-list, or of the command line
+ */
+inline auto va::Engine::m_read_source_uris() -> std::vector<std::string> {
+	std::vector<std::string> uris;
 	if (is_using_config_file(m_argv[1])) {
+		GList* src_list = nullptr;
 		nvds_parse_source_list(&src_list, m_argv[1], "source-list");
-		GList* temp_src_list = src_list;
-		while (temp_src_list) {
-			++m_num_sources;
-			temp_src_list = temp_src_list->next;
+		for (GList* temp_src_list = src_list; temp_src_list; temp_src_list = temp_src_list->next) {
+			g_print("Now playing : %s\n", (char*)temp_src_list->data);
+			uris.emplace_back((char*)temp_src_list->data);
 		}
-		g_list_free(temp_src_list);
+		g_list_free(src_list);
 	} else {
-		m_num_sources = m_argc - 1;
+		for (int i = 1; i < m_argc; ++i) {
+			uris.emplace_back(m_argv[i]);
+		}
+	}
+	return uris;
+}
+
+inline auto va::Engine::m_add_source_bin_to_pipeline() -> void {
+	std::vector<std::string> uris = m_read_source_uris();
+	if (is_using_config_file(m_argv[1])) {
+		m_decode_policies = va::parse_decode_policy_config(m_argv[1], "source-policy");
 	}
+	m_num_sources = uris.size();
 
 	for (guint i = 0; i < m_num_sources; ++i) {
-		GstPad *sinkpad, *srcpad;
-		gchar pad_name[16] = { };
+		m_link_source(i, uris[i]);
+	}
+}
 
-		GstElement* source_bin = nullptr;
-		if (is_using_config_file(m_argv[1])) {
-			g_print("Now playing : %s\n", (char*)(src_list)->data);
-			source_bin = m_create_source_bin(i, (char*)(src_list)->data);
-		} else {
-			source_bin = m_create_source_bin(i, m_argv[i + 1]);
-		}
-		if (!source_bin) {
-			throw std::runtime_error("Failed to create source bin. Exiting.\n");
-		}
+/**
+ * Build the source bin for source id index and link it to the muxer
+ */
+inline auto va::Engine::m_link_source(guint index, const std::string& uri) -> GstElement* {
+	VA_TRACE_SCOPE("link_source");
+	GstPad *sinkpad, *srcpad;
+	gchar pad_name[16] = { };
 
-		if (!gst_bin_add(GST_BIN(m_pipeline), source_bin)) {
-			throw std::runtime_error("Failed to add source bin to pipeline. Exiting.\n");
-		}
+	if (m_source_uris.size() <= index) {
+		m_source_uris.resize(index + 1);
+	}
+	m_source_uris[index] = uri;
+	GstElement* source_bin = m_create_source_bin(index, (gchar*)m_source_uris[index].c_str());
+	if (m_va_detection_cache) {
+		m_va_detection_cache->set_source_name(index, va::is_chunk_uri(uri) ? va::parse_chunk_uri(uri).location : uri);
+	}
+	if (!source_bin) {
+		throw std::runtime_error("Failed to create source bin. Exiting.\n");
+	}
 
-		g_snprintf(pad_name, 15, "sink_%u", i);
-		sinkpad = gst_element_get_request_pad(m_streammux, pad_name);
-		if (!sinkpad) {
-			throw std::runtime_error("Streammux request sink pad failed. Exiting.\n");
-		}
+	if (!gst_bin_add(GST_BIN(m_pipeline), source_bin)) {
+		throw std::runtime_error("Failed to add source bin to pipeline. Exiting.\n");
+	}
 
-		srcpad = gst_element_get_static_pad(source_bin, "src");
-		if (!srcpad) {
-			throw std::runtime_error("Failed to get src pad of source bin. Exiting.\n");
-		}
+	g_snprintf(pad_name, 15, "sink_%u", index);
+	sinkpad = gst_element_get_request_pad(m_streammux, pad_name);
+	if (!sinkpad) {
+		throw std::runtime_error("Streammux request sink pad failed. Exiting.\n");
+	}
 
-		if (gst_pad_link(srcpad, sinkpad) != GST_PAD_LINK_OK) {
-			throw std::runtime_error("Failed to link source bin to stream muxer. Exiting.\n");
-		}
+	srcpad = gst_element_get_static_pad(source_bin, "src");
+	if (!srcpad) {
+		throw std::runtime_error("Failed to get src pad of source bin. Exiting.\n");
+	}
+
+	if (gst_pad_link(srcpad, sinkpad) != GST_PAD_LINK_OK) {
+		throw std::runtime_error("Failed to link source bin to stream muxer. Exiting.\n");
+	}
 
-		gst_object_unref(srcpad);
+	gst_object_unref(srcpad);
+	gst_object_unref(sinkpad);
+	return source_bin;
+}
+
+/**
+ * Stop the source bin of source id index, release its muxer pad and drop it
+ * from the pipeline. The rest of the pipeline keeps running.
+ */
+inline auto va::Engine::m_unlink_source(guint index) -> void {
+	VA_TRACE_SCOPE("unlink_source");
+	gchar bin_name[16] = { };
+	gchar pad_name[16] = { };
+
+	g_snprintf(bin_name, 15, "source-bin-%02d", index);
+	GstElement* source_bin = gst_bin_get_by_name(GST_BIN(m_pipeline), bin_name);
+	if (!source_bin) {
+		return;
+	}
+
+	/* the bin is stopped before its pad is released so no buffer is in flight
+	 * into the muxer */
+	if (gst_element_set_state(source_bin, GST_STATE_NULL) == GST_STATE_CHANGE_ASYNC) {
+		gst_element_get_state(source_bin, nullptr, nullptr, GST_CLOCK_TIME_NONE);
+	}
+
+	g_snprintf(pad_name, 15, "sink_%u", index);
+	GstPad* sinkpad = gst_element_get_static_pad(m_streammux, pad_name);
+	if (sinkpad) {
+		gst_pad_send_event(sinkpad, gst_event_new_flush_stop(FALSE));
+		gst_element_release_request_pad(m_streammux, sinkpad);
 		gst_object_unref(sinkpad);
+	}
 
-		if (is_using_config_file(m_argv[1])) {
-			src_list = src_list->next;
-		}
+	gst_bin_remove(GST_BIN(m_pipeline), source_bin);
+	gst_object_unref(source_bin);
+	if (m_va_clip_recorder) {
+		m_va_clip_recorder->remove_source(index);
+	}
+	if (m_va_scene_gate) {
+		m_va_scene_gate->remove_source(index);
+	}
+	m_source_hooks.erase(index);
+	if (index < m_source_uris.size()) {
+		m_source_uris[index].clear();
 	}
+}
 
-	if (is_using_config_file(m_argv[1])) {
-		g_list_free(src_list);
+/**
+ * Restart the chunk:// source an error came from, while it has retries left.
+ * True when the error is taken care of, which includes errors that were still
+ * queued from a source bin already replaced.
+ */
+auto va::Engine::m_retry_chunk(GstObject* src) -> bool {
+	GstObject* bin = src;
+	while (bin && !g_str_has_prefix(GST_OBJECT_NAME(bin), "source-bin-")) {
+		bin = GST_OBJECT_PARENT(bin);
+	}
+	if (!bin) {
+		return false;
+	}
+	guint index = std::strtoul(GST_OBJECT_NAME(bin) + strlen("source-bin-"), nullptr, 10);
+	auto hooks = m_source_hooks.find(index);
+	if (hooks == m_source_hooks.end() || !hooks->second->m_chunk) {
+		return false;
+	}
+	GstElement* current = gst_bin_get_by_name(GST_BIN(m_pipeline), GST_OBJECT_NAME(bin));
+	if (current) {
+		gst_object_unref(current);
 	}
+	if (GST_OBJECT(current) != bin) {
+		return true;
+	}
+
+	guint& retries = m_chunk_retries[index];
+	if (retries >= hooks->second->m_chunk->m_chunk.retries) {
+		g_printerr("Chunk %u: failed %u times, giving up\n", index, retries + 1);
+		return false;
+	}
+	++retries;
+	g_printerr("Chunk %u: restarting, retry %u of %u\n", index, retries, hooks->second->m_chunk->m_chunk.retries);
+	const std::string uri = m_source_uris[index];
+	m_unlink_source(index);
+	gst_element_sync_state_with_parent(m_link_source(index, uri));
+	return true;
 }
 
 inline auto va::Engine::m_create_nvinfer() -> GstElement* {
+	/* batches pass through without objects, the probe still sees every frame */
+	if (m_detector.backend == "none") {
+		GstElement* stub = gst_element_factory_make("identity", "detector-stub");
+		if (!stub) {
+			throw std::runtime_error("Detector stub could not be created. Exiting.\n");
+		}
+		g_print("Detector stub created\n");
+		return stub;
+	}
 	GstElement* infer = gst_element_factory_make("nvinfer", "primary-nvinference-engine");
 	if (!infer) {
 		throw std::runtime_error("NvInfer element could not be created. Exiting.\n");
@@ -418,18 +994,16 @@ inline auto va::Engine::m_setup_element_config() -> void {
 	m_tiler_columns = (guint)ceil(1.0 * m_num_sources / m_tiler_rows);
 	if (is_using_config_file(m_argv[1])) {
 		nvds_parse_streammux(m_streammux, m_argv[1], "streammux");
-		g_object_set(G_OBJECT(m_nvinfer), "config-file-path", "configs/pgie_config.yml", NULL);
-		g_object_get(G_OBJECT(m_nvinfer), "batch-size", &m_nvinfer_batch_size, NULL);
-		if (m_nvinfer_batch_size != m_num_sources) {
-			g_printerr("WARNING: Overriding infer-config batch-size (%d) with number of sources (%d)\n", m_nvinfer_batch_size, m_num_sources);
-			g_object_set(G_OBJECT(m_nvinfer), "batch-size", m_num_sources, NULL);
-		}
+		m_apply_nvinfer_config(PGIE_CONFIG_FILE_YML);
 
 		nvds_parse_osd(m_nvosd, m_argv[1], "osd");
 		g_object_set(G_OBJECT(m_tiler), "rows", m_tiler_rows, "columns", m_tiler_columns, NULL);
 
 		nvds_parse_tiler(m_tiler, m_argv[1], "tiler");
 		nvds_parse_egl_sink(m_sink, m_argv[1], "sink");
+
+		m_running_config = va::load_config_snapshot(m_argv[1], PGIE_CONFIG_FILE_YML);
+		m_running_config.m_sources = m_source_uris;
 	} else {
 		g_object_set(G_OBJECT(m_streammux), "batch-size", m_num_sources, NULL);
 		g_object_set(
@@ -444,14 +1018,7 @@ inline auto va::Engine::m_setup_element_config() -> void {
 		);
 
 		/* Configure the nvinfer element using the nvinfer config file. */
-		g_object_set(G_OBJECT(m_nvinfer), "config-file-path", "configs/pgie_config.txt", NULL);
-
-		/* Override the batch-size set in the config file with the number of sources. */
-		g_object_get (G_OBJECT(m_nvinfer), "batch-size", &m_nvinfer_batch_size, NULL);
-		if (m_nvinfer_batch_size != m_num_sources) {
-			g_printerr("WARNING: Overriding infer-config batch-size (%d) with number of sources (%d)\n", m_nvinfer_batch_size, m_num_sources);
-			g_object_set(G_OBJECT(m_nvinfer), "batch-size", m_num_sources, NULL);
-		}
+		m_apply_nvinfer_config(PGIE_CONFIG_FILE_TXT);
 
 		/* we set the tiler properties here */
 		g_object_set(
@@ -472,6 +1039,48 @@ inline auto va::Engine::m_setup_element_config() -> void {
 	}
 }
 
+/**
+ * Point nvinfer at its config file. Setting the path again while playing makes
+ * nvinfer re-read the file and swap the model in place; the network and the
+ * batch size stay those of startup.
+ */
+inline auto va::Engine::m_apply_nvinfer_config(const gchar* config_file) -> void {
+	if (m_detector.backend == "none") {
+		return;
+	}
+	g_object_set(G_OBJECT(m_nvinfer), "config-file-path", config_file, NULL);
+
+	/* Override the batch-size set in the config file with the number of sources. */
+	g_object_get(G_OBJECT(m_nvinfer), "batch-size", &m_nvinfer_batch_size, NULL);
+	if (m_nvinfer_batch_size != m_num_sources) {
+		g_printerr("WARNING: Overriding infer-config batch-size (%d) with number of sources (%d)\n", m_nvinfer_batch_size, m_num_sources);
+		g_object_set(G_OBJECT(m_nvinfer), "batch-size", m_num_sources, NULL);
+	}
+}
+
+/**
+ * Batch at least every source linked since startup, the yml batch-size is a
+ * floor; freed slots are reused so the batch never shrinks
+ */
+inline auto va::Engine::m_apply_streammux_batch_size() -> void {
+	guint batch_size = 0;
+	g_object_get(G_OBJECT(m_streammux), "batch-size", &batch_size, NULL);
+	if (batch_size < m_num_sources) {
+		g_print("Reload: streammux batch-size %u -> %u\n", batch_size, m_num_sources);
+		g_object_set(G_OBJECT(m_streammux), "batch-size", m_num_sources, NULL);
+	}
+}
+
+/**
+ * Size the tiler grid for the source ids in use
+ */
+inline auto va::Engine::m_apply_tiler_grid() -> void {
+	guint tiles = std::max<guint>(m_source_uris.size(), 1);
+	m_tiler_rows = (guint)sqrt(tiles);
+	m_tiler_columns = (guint)ceil(1.0 * tiles / m_tiler_rows);
+	g_object_set(G_OBJECT(m_tiler), "rows", m_tiler_rows, "columns", m_tiler_columns, NULL);
+}
+
 inline auto va::Engine::m_add_elements_to_pipeline() -> void {
 	if (m_transform) {
 		gst_bin_add_many(GST_BIN(m_pipeline), m_queue1, m_nvinfer, m_queue2, m_nvdslogger, m_tiler,
@@ -502,7 +1111,10 @@ inline auto va::Engine::m_add_elements_to_pipeline() -> void {
 
 inline auto va::Engine::m_create_message_handler() -> guint {
 	GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(m_pipeline));
-	guint bus_watch_id = gst_bus_add_watch(bus, bus_call, m_loop);
+	guint bus_watch_id = gst_bus_add_watch(bus, bus_call, this);
+	if (m_va_thread_placement) {
+		gst_bus_set_sync_handler(bus, bus_sync_handler, this, nullptr);
+	}
 	gst_object_unref(bus);
 	return bus_watch_id;
 }
@@ -513,17 +1125,235 @@ inline auto va::Engine::m_add_tiler_src_pad_buffer_probe(va::UserData* va_user_d
 		throw std::runtime_error("Unable to get NvInfer src pad\n");
 	} else {
 		gst_pad_add_probe(tiler_src_pad, GST_PAD_PROBE_TYPE_BUFFER, tiler_src_pad_buffer_probe, (void*)va_user_data, NULL);
+		if (m_chunk_merger) {
+			gst_pad_add_probe(tiler_src_pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, chunk_eos_probe, m_chunk_merger.get(), NULL);
+		}
 	}
 	gst_object_unref(tiler_src_pad);
 }
 
+inline auto va::Engine::m_add_first_batch_probe() -> void {
+	GstPad* nvinfer_src_pad = gst_element_get_static_pad(m_nvinfer, "src");
+	if (!nvinfer_src_pad) {
+		throw std::runtime_error("Unable to get NvInfer src pad\n");
+	}
+	gst_pad_add_probe(nvinfer_src_pad, GST_PAD_PROBE_TYPE_BUFFER, first_batch_probe, this, NULL);
+	gst_object_unref(nvinfer_src_pad);
+}
+
+/**
+ * End a startup phase that completes asynchronously, the startup report is
+ * printed once all of them are in
+ */
+auto va::Engine::m_startup_milestone(const std::string& phase) -> void {
+	m_startup.mark(phase);
+	if (--m_startup_pending == 0) {
+		m_startup.report();
+		if (m_va_thread_placement) {
+			m_va_thread_placement->print_report();
+		}
+	}
+}
+
+/**
+ * Diff the yml config against the running one and apply the difference without
+ * stopping the pipeline: property changes are set on the live elements, nvinfer
+ * re-reads its config file, and only the source bins of added, removed or
+ * changed uris are built or torn down. Groups that are only read at startup
+ * are reported and left alone.
+ */
+auto va::Engine::reload() -> void {
+	VA_TRACE_SCOPE("reload");
+	if (!is_using_config_file(m_argv[1])) {
+		g_printerr("Reload needs a yml config, ignoring\n");
+		return;
+	}
+	/* the elements it changes are those of the nvinfer pipeline */
+	if (m_detector.backend == "cpu") {
+		g_printerr("Reload is not supported with the cpu detector, ignoring\n");
+		return;
+	}
+
+	va::PhaseTimer timer { "Reload" };
+	va::ConfigSnapshot next;
+	try {
+		next = va::load_config_snapshot(m_argv[1], PGIE_CONFIG_FILE_YML);
+	} catch (std::exception& e) {
+		g_printerr("Reload: unable to read %s: %s\n", m_argv[1], e.what());
+		return;
+	}
+	va::ReloadPlan plan = va::plan_reload(m_running_config, next);
+	timer.mark("parse-and-diff");
+	if (plan.empty()) {
+		g_print("Reload: no changes\n");
+		return;
+	}
+	for (const std::string& group : plan.m_restart_groups) {
+		g_printerr("Reload: changes to %s apply on the next restart\n", group.c_str());
+	}
+
+	try {
+		if (plan.m_source_policy) {
+			va::DecodePolicyConfig previous = std::move(m_decode_policies);
+			m_decode_policies = va::parse_decode_policy_config(m_argv[1], "source-policy");
+			/* kept sources are rebuilt under their new policy, new ones pick it up below */
+			for (guint index = 0; index < m_source_uris.size(); ++index) {
+				const std::string uri = m_source_uris[index];
+				/* trailing slots removed by this reload are not in the plan */
+				if (uri.empty() || index >= plan.m_sources.size() || plan.m_sources[index] != uri ||
+					m_decode_policies.policy_for(uri) == previous.policy_for(uri)) {
+					continue;
+				}
+				g_print("Reload: new decode policy for source %u: %s\n", index, uri.c_str());
+				m_unlink_source(index);
+				gst_element_sync_state_with_parent(m_link_source(index, uri));
+			}
+			timer.mark("source-policy");
+		}
+		if (plan.m_streammux) {
+			nvds_parse_streammux(m_streammux, m_argv[1], "streammux");
+			m_apply_streammux_batch_size();
+		}
+		if (plan.m_osd) {
+			nvds_parse_osd(m_nvosd, m_argv[1], "osd");
+		}
+		if (plan.m_sink) {
+			nvds_parse_egl_sink(m_sink, m_argv[1], "sink");
+		}
+		if (plan.m_tiler) {
+			nvds_parse_tiler(m_tiler, m_argv[1], "tiler");
+		}
+		timer.mark("properties");
+
+		if (plan.m_pgie) {
+			m_apply_nvinfer_config(PGIE_CONFIG_FILE_YML);
+			timer.mark("nvinfer");
+		}
+
+		for (guint index : plan.m_removed_sources) {
+			g_print("Reload: removing source %u: %s\n", index, m_source_uris[index].c_str());
+			m_unlink_source(index);
+		}
+		for (const auto& source : plan.m_added_sources) {
+			g_print("Reload: adding source %u: %s\n", source.first, source.second.c_str());
+			GstElement* source_bin = m_link_source(source.first, source.second);
+			gst_element_sync_state_with_parent(source_bin);
+		}
+	} catch (std::exception& e) {
+		g_printerr("Reload: %s", e.what());
+	}
+
+	/* removed ids at the end free their tiles */
+	while (!m_source_uris.empty() && m_source_uris.back().empty()) {
+		m_source_uris.pop_back();
+	}
+	if (m_source_uris.size() > m_num_sources) {
+		m_num_sources = m_source_uris.size();
+		m_apply_streammux_batch_size();
+	}
+	if (!plan.m_removed_sources.empty() || !plan.m_added_sources.empty()) {
+		m_va_user_data->set_source_uris(m_source_uris);
+		timer.mark("sources");
+	}
+	if (plan.m_tiler || !plan.m_removed_sources.empty() || !plan.m_added_sources.empty()) {
+		m_apply_tiler_grid();
+	}
+
+	next.m_sources = m_source_uris;
+	m_running_config = std::move(next);
+	timer.mark("done");
+	timer.report();
+}
+
+/**
+ * GStreamer and the main loop run() and stop() work with
+ */
+auto va::Engine::m_start_loop() -> void {
+	gst_init(&m_argc, &m_argv);
+	{
+		std::lock_guard<std::mutex> lock { m_loop_mutex };
+		m_loop = g_main_loop_new(NULL, FALSE);
+	}
+	m_startup.mark("gst-init");
+}
+
+/**
+ * Point the frame sinks at the modules set on the engine, for both
+ * backends. Clip recording, thumbnails and the scene gate work on NVMM
+ * buffers and stay off with the cpu detector.
+ */
+auto va::Engine::m_setup_user_data(va::UserData& va_user_data) -> void {
+	va_user_data.va_detection_cache = m_va_detection_cache;
+	va_user_data.va_journal = m_va_journal;
+	va_user_data.va_publisher = m_va_publisher;
+	va_user_data.va_heatmap = m_va_heatmap;
+	va_user_data.va_stream_stats = m_va_stream_stats;
+	if (m_va_heatmap) {
+		m_va_heatmap->set_frame_size(MUXER_OUTPUT_WIDTH, MUXER_OUTPUT_HEIGHT);
+	}
+	if (m_detector.backend != "cpu") {
+		va_user_data.va_clip_recorder = m_va_clip_recorder;
+		va_user_data.va_thumbnailer = m_va_thumbnailer;
+		va_user_data.va_scene_gate = m_va_scene_gate;
+	} else if (m_va_clip_recorder || m_va_thumbnailer || m_va_scene_gate) {
+		g_printerr("WARNING: clip-recorder, thumbnails and scene-gate need nvinfer, disabled with the cpu detector\n");
+	}
+
+	va::ChunkMerger* chunk_merger = m_chunk_merger.get();
+	va_user_data.va_chunk_merger = chunk_merger;
+	if (chunk_merger) {
+		chunk_merger->set_sink([&va_user_data](guint source_id, va::FrameMetadata& frame_meta) {
+			va_user_data.sink_frame(source_id, frame_meta);
+		});
+	}
+	if (va_user_data.va_scene_gate) {
+		va_user_data.va_scene_gate->set_sink([&va_user_data, chunk_merger](guint source_id, va::FrameMetadata& frame_meta) {
+			if (chunk_merger) {
+				chunk_merger->push(source_id, frame_meta);
+			} else {
+				va_user_data.sink_frame(source_id, frame_meta);
+			}
+		});
+	}
+	va_user_data.set_source_uris(m_source_uris);
+	m_va_user_data = &va_user_data;
+}
+
+auto va::Engine::m_add_signal_watches() -> void {
+	/* kill -HUP <pid> applies config changes without a restart */
+	m_reload_watch_id = g_unix_signal_add(SIGHUP, reload_signal_handler, this);
+#ifdef VA_ENABLE_TRACE
+	/* kill -USR1 <pid> writes a trace file */
+	m_trace_watch_id = g_unix_signal_add(SIGUSR1, trace_signal_handler, this);
+#endif
+}
+
+/**
+ * Once the pipeline is gone: drop the watches and the main loop
+ */
+auto va::Engine::m_finish_loop() -> void {
+	g_source_remove(m_bus_watch_id);
+	g_source_remove(m_reload_watch_id);
+#ifdef VA_ENABLE_TRACE
+	g_source_remove(m_trace_watch_id);
+	export_trace("exit");
+#endif
+	std::lock_guard<std::mutex> lock { m_loop_mutex };
+	g_main_loop_unref(m_loop);
+	m_loop = nullptr;
+}
+
 auto va::Engine::run() -> void {
+	if (m_detector.backend == "cpu") {
+		m_run_cpu();
+		return;
+	}
 	int save_interval = 60;
 	va::UserData va_user_data { m_va_database, save_interval };
 
-	/* Standard GStreamer initialization */
-	gst_init(&m_argc, &m_argv);
-	m_loop = g_main_loop_new(NULL, FALSE);
+	m_start_loop();
+	/* read before the source bins and the sink are made */
+	PERF_MODE = g_getenv("PERF_MODE") && !g_strcmp0(g_getenv("PERF_MODE"), "1");
 
 	/* Create gstreamer elements */
 	/* Create Pipeline element that will form a connection of other elements */
@@ -532,6 +1362,7 @@ auto va::Engine::run() -> void {
 	m_streammux = m_create_streamux();
 	/* Create a list of sources bin and add it to pipeline for batching input. */
 	m_add_source_bin_to_pipeline();
+	m_startup.mark("source-bins");
 	/* Use nvinfer to infer on batched frame. */
 	m_nvinfer = m_create_nvinfer();
 	/* Create queue elements to add between every two elements */
@@ -548,19 +1379,25 @@ auto va::Engine::run() -> void {
 	m_transform = m_create_transform();
 	/* Create sink */
 	m_sink = m_create_sink();
+	m_startup.mark("create-elements");
 	/* Load config for elements after creating them */
 	m_setup_element_config();
+	m_startup.mark("element-config");
 	/* we add a message handler */
 	m_bus_watch_id = m_create_message_handler();
 
 	/* Set up the pipeline */
 	/* we add all elements into the pipeline */
 	m_add_elements_to_pipeline();
+	m_startup.mark("link");
 
 	/* Lets add probe to get informed of the meta data generated, we add probe to
 	 * the sink pad of the osd element, since by that time, the buffer would have
 	 * had got all the metadata. */
+	m_setup_user_data(va_user_data);
 	m_add_tiler_src_pad_buffer_probe(&va_user_data);
+	m_add_first_batch_probe();
+	m_add_signal_watches();
 
 	/* Set the pipeline to "playing" state */
 	if (is_using_config_file(m_argv[1])) {
@@ -572,10 +1409,16 @@ auto va::Engine::run() -> void {
 		}
 		g_print("\n");
 	}
-	PERF_MODE = g_getenv("PERF_MODE") && !g_strcmp0(g_getenv("PERF_MODE"), "1");
 
-	/* Start playing */
+	/* Start playing, a state at a time: nvinfer deserializes or builds its
+	 * TensorRT engine in its READY -> PAUSED change, on this thread */
+	VA_TRACE_INSTANT("set-state-playing");
+	gst_element_set_state(m_pipeline, GST_STATE_READY);
+	m_startup.mark("set-state-ready");
+	gst_element_set_state(m_pipeline, GST_STATE_PAUSED);
+	m_startup.mark("nvinfer-start");
 	gst_element_set_state(m_pipeline, GST_STATE_PLAYING);
+	m_startup.mark("set-state");
 
 	/* Wait till pipeline encounters an error or EOS */
 	g_print("Running...\n");
@@ -583,17 +1426,148 @@ auto va::Engine::run() -> void {
 
 	/* Out of the main loop, clean up nicely */
 	g_print("Returned, stopping playback\n");
+	VA_TRACE_INSTANT("set-state-null");
 	gst_element_set_state(m_pipeline, GST_STATE_NULL);
 	g_print("Deleting pipeline\n");
 	gst_object_unref(GST_OBJECT(m_pipeline));
-	g_source_remove(m_bus_watch_id);
-	g_main_loop_unref(m_loop);
+	m_print_decode_stats();
+	if (m_va_scene_gate) {
+		m_va_scene_gate->print_stats();
+		m_va_scene_gate->set_sink(nullptr);
+	}
+	if (m_chunk_merger) {
+		/* what is still spooled goes out in order, also when the run was cut short */
+		m_chunk_merger->flush();
+		m_chunk_merger->print_stats();
+		m_chunk_merger.reset();
+		m_chunk_retries.clear();
+	}
+	m_va_user_data = nullptr;
+	m_finish_loop();
+}
+
+/**
+ * Make run() return, from any thread, once it is in the main loop. The
+ * pipeline is torn down by run() on its own thread.
+ */
+auto va::Engine::stop() -> void {
+	GMainLoop* loop = nullptr;
+	{
+		std::lock_guard<std::mutex> lock { m_loop_mutex };
+		if (m_loop) {
+			loop = g_main_loop_ref(m_loop);
+		}
+	}
+	if (loop) {
+		g_main_loop_quit(loop);
+		g_main_loop_unref(loop);
+	}
+}
+
+/**
+ * run() with the cpu detector: software decode into a CpuPipeline instead of
+ * nvstreammux, nvinfer and the display branch. Clip recording, thumbnails
+ * and the scene gate work on NVMM buffers and are left out.
+ */
+auto va::Engine::m_run_cpu() -> void {
+	int save_interval = 60;
+	va::UserData va_user_data { m_va_database, save_interval };
+
+	m_start_loop();
+	m_source_uris = m_read_source_uris();
+	m_num_sources = m_source_uris.size();
+	for (const std::string& uri : m_source_uris) {
+		if (va::is_chunk_uri(uri)) {
+			throw std::invalid_argument("chunk:// sources need the nvinfer pipeline. Exiting.\n");
+		}
+	}
+	for (guint i = 0; i < m_num_sources && m_va_detection_cache; ++i) {
+		m_va_detection_cache->set_source_name(i, m_source_uris[i]);
+	}
+	m_setup_user_data(va_user_data);
+
+	/* detections in the coordinates nvinfer would report them in */
+	va::CpuPipeline cpu_pipeline { m_detector, &va_user_data, MUXER_OUTPUT_WIDTH, MUXER_OUTPUT_HEIGHT };
+	m_startup.mark("detector-load");
+	m_pipeline = cpu_pipeline.build(m_source_uris);
+	m_startup.mark("source-bins");
+	m_bus_watch_id = m_create_message_handler();
+	/* no batch probe here, playing is the last startup phase */
+	--m_startup_pending;
+	m_add_signal_watches();
+
+	cpu_pipeline.start();
+	VA_TRACE_INSTANT("set-state-playing");
+	gst_element_set_state(m_pipeline, GST_STATE_PLAYING);
+	m_startup.mark("set-state");
+	g_print("Running on the cpu...\n");
+	g_main_loop_run(m_loop);
+
+	g_print("Returned, stopping playback\n");
+	VA_TRACE_INSTANT("set-state-null");
+	gst_element_set_state(m_pipeline, GST_STATE_NULL);
+	cpu_pipeline.stop();
+	gst_object_unref(GST_OBJECT(m_pipeline));
+	cpu_pipeline.print_stats();
+	m_va_user_data = nullptr;
+	m_finish_loop();
+}
+
+/**
+ * Frames each decode gate let through or dropped, per source
+ */
+auto va::Engine::m_print_decode_stats() -> void {
+	for (const auto& entry : m_source_hooks) {
+		if (!entry.second->m_decode_gate) {
+			continue;
+		}
+		const va::DecodeGate& gate = *entry.second->m_decode_gate;
+		g_print("Source %u decode policy: %lu delta frames skipped, %lu decoded, %lu dropped by interval, %lu dropped by max-fps, %lu to muxer\n",
+				entry.first, (gulong)gate.m_compressed_dropped, (gulong)gate.m_decoded, (gulong)gate.m_interval_dropped,
+				(gulong)gate.m_rate_dropped, (gulong)gate.m_passed);
+	}
 }
 
 auto va::Engine::set_database(va::Database* _va_database) -> void {
 	m_va_database = _va_database;
 }
 
+auto va::Engine::set_detection_cache(va::DetectionCache* _va_detection_cache) -> void {
+	m_va_detection_cache = _va_detection_cache;
+}
+
+auto va::Engine::set_journal(va::Journal* _va_journal) -> void {
+	m_va_journal = _va_journal;
+}
+
+auto va::Engine::set_publisher(va::Publisher* _va_publisher) -> void {
+	m_va_publisher = _va_publisher;
+}
+
+auto va::Engine::set_clip_recorder(va::ClipRecorder* _va_clip_recorder) -> void {
+	m_va_clip_recorder = _va_clip_recorder;
+}
+
+auto va::Engine::set_thumbnailer(va::Thumbnailer* _va_thumbnailer) -> void {
+	m_va_thumbnailer = _va_thumbnailer;
+}
+
+auto va::Engine::set_scene_gate(va::SceneGate* _va_scene_gate) -> void {
+	m_va_scene_gate = _va_scene_gate;
+}
+
+auto va::Engine::set_heatmap(va::Heatmap* _va_heatmap) -> void {
+	m_va_heatmap = _va_heatmap;
+}
+
+auto va::Engine::set_stream_stats(va::StreamStats* _va_stream_stats) -> void {
+	m_va_stream_stats = _va_stream_stats;
+}
+
+auto va::Engine::set_thread_placement(va::ThreadPlacement* _va_thread_placement) -> void {
+	m_va_thread_placement = _va_thread_placement;
+}
+
 va::Engine::Engine(int argc, char** argv) : m_argc(argc), m_argv(argv) {
 	/* Check input arguments */
 	if (m_argc < 2) {
@@ -602,10 +1576,19 @@ va::Engine::Engine(int argc, char** argv) : m_argc(argc), m_argv(argv) {
 		throw std::invalid_argument("invalid argument\n");
 	}
 
+	if (is_using_config_file(m_argv[1])) {
+		m_detector = va::parse_detector_config(m_argv[1], "detector");
+	}
+	/* the cpu detector runs without a CUDA device */
+	m_cuda_prop = {};
+	if (m_detector.backend == "cpu") {
+		return;
+	}
 	int current_device = -1; // automatically find CUDA device
 	cudaGetDevice(&current_device);
 	cudaGetDeviceProperties(&m_cuda_prop, current_device);
 	g_print("current CUDA device: %d\n", current_device);
+	m_startup.mark("cuda-init");
 }
 
 va::Engine::~Engine() {
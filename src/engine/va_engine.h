@@ -6,8 +6,14 @@
 #include <sys/time.h>
 #include <stdio.h>
 
+#include <atomic>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <gst/gst.h>
 #include <glib.h>
@@ -15,8 +21,25 @@
 #include "gstnvdsmeta.h"
 #include "nvds_yml_parser.h"
 #include "gst-nvmessage.h"
+#include "gst-nvevent.h"
 
+#include "va_clip_recorder.h"
+#include "va_cpu_pipeline.h"
 #include "va_database.h"
+#include "va_decode_policy.h"
+#include "va_detection_cache.h"
+#include "va_detector.h"
+#include "va_file_chunks.h"
+#include "va_heatmap.h"
+#include "va_journal.h"
+#include "va_phase_timer.h"
+#include "va_publisher.h"
+#include "va_reload.h"
+#include "va_scene_gate.h"
+#include "va_stream_stats.h"
+#include "va_synthetic_source.h"
+#include "va_thread_placement.h"
+#include "va_thumbnailer.h"
 #include "va_user_data.h"
 
 #define MAX_DISPLAY_LEN 64
@@ -46,20 +69,51 @@
 #define TILED_OUTPUT_WIDTH 1280
 #define TILED_OUTPUT_HEIGHT 720
 
+/* nvinfer config used with a yml config / with uris on the command line */
+#define PGIE_CONFIG_FILE_YML "configs/pgie_config.yml"
+#define PGIE_CONFIG_FILE_TXT "configs/pgie_config.txt"
+
 /* NVIDIA Decoder source pad memory feature. This feature signifies that source
  * pads having this capability will push GstBuffers containing cuda buffers. */
 #define GST_CAPS_FEATURES_NVMM "memory:NVMM"
 
 namespace va {
+/**
+ * A chunk:// source, and how far it got in seeking to the start of its range
+ */
+struct ChunkSource {
+	enum class Phase { PREROLL, SEEKING, RUNNING };
+
+	va::FileChunk m_chunk;
+	std::atomic<Phase> m_phase { Phase::PREROLL };
+};
+
+/**
+ * Per source state the decodebin callbacks of a source bin work with
+ */
+struct SourceHooks {
+	guint m_index = 0;
+	/* set when the source has a decode policy */
+	std::unique_ptr<va::DecodeGate> m_decode_gate;
+	va::ClipRecorder* m_clip_recorder = nullptr;
+	va::SceneGate* m_scene_gate = nullptr;
+	/* set for synthetic sources with jitter */
+	std::unique_ptr<va::SourceJitter> m_jitter;
+	/* set for chunk:// sources, shared with a seek in flight */
+	std::shared_ptr<va::ChunkSource> m_chunk;
+};
+
 /**
  * Video analytic engine using GStreamer and TensorRT
  */
 struct Engine {
-	GMainLoop* m_loop;
+	GMainLoop* m_loop = nullptr;
+	/* m_loop is set and cleared by run(), stop() comes from other threads */
+	std::mutex m_loop_mutex;
 	GstElement* m_pipeline;
 	GstElement* m_streammux;
 	GstElement* m_sink;
-	GstElement* m_nvinfer;
+	GstElement* m_nvinfer = nullptr;
 	GstElement* m_queue1;
 	GstElement* m_queue2;
 	GstElement* m_queue3;
@@ -75,7 +129,37 @@ struct Engine {
 	guint m_tiler_rows, m_tiler_columns;
 	guint m_nvinfer_batch_size;
 	struct cudaDeviceProp m_cuda_prop;
-	va::Database* m_va_database;
+	va::Database* m_va_database = nullptr;
+	va::DetectionCache* m_va_detection_cache = nullptr;
+	va::Journal* m_va_journal = nullptr;
+	va::Publisher* m_va_publisher = nullptr;
+	va::ClipRecorder* m_va_clip_recorder = nullptr;
+	va::Thumbnailer* m_va_thumbnailer = nullptr;
+	va::SceneGate* m_va_scene_gate = nullptr;
+	va::Heatmap* m_va_heatmap = nullptr;
+	va::StreamStats* m_va_stream_stats = nullptr;
+	/* pins streaming threads when set */
+	va::ThreadPlacement* m_va_thread_placement = nullptr;
+	/* uri per source id, empty for the ids of removed sources */
+	std::vector<std::string> m_source_uris;
+	va::UserData* m_va_user_data = nullptr;
+	/* detector backend from the yml config */
+	va::DetectorConfig m_detector;
+	/* decode policies from the yml config */
+	va::DecodePolicyConfig m_decode_policies;
+	/* by source id, owned here for as long as the source bin exists */
+	std::map<guint, std::unique_ptr<va::SourceHooks>> m_source_hooks;
+	/* frames of chunk:// sources to the sinks in file order, and the restarts
+	 * of each so far */
+	std::unique_ptr<va::ChunkMerger> m_chunk_merger;
+	std::map<guint, guint> m_chunk_retries;
+	/* config as last applied, diffed against the file on reload */
+	va::ConfigSnapshot m_running_config;
+	guint m_reload_watch_id = 0;
+	guint m_trace_watch_id = 0;
+	/* startup is reported once the pipeline plays and the first batch is inferred */
+	va::PhaseTimer m_startup { "Startup" };
+	std::atomic<int> m_startup_pending { 2 };
 
 	int m_argc;
 	char** m_argv;
@@ -86,7 +170,12 @@ struct Engine {
 	auto m_create_pipeline() -> GstElement*;
 	auto m_create_streamux() -> GstElement*;
 	auto m_create_source_bin(guint index, gchar* uri) -> GstElement*;
+	auto m_create_test_source(GstElement* bin, const va::SyntheticSource& source) -> void;
+	auto m_read_source_uris() -> std::vector<std::string>;
 	auto m_add_source_bin_to_pipeline() -> void;
+	auto m_link_source(guint index, const std::string& uri) -> GstElement*;
+	auto m_unlink_source(guint index) -> void;
+	auto m_retry_chunk(GstObject* src) -> bool;
 	auto m_create_nvinfer() -> GstElement*;
 	auto m_create_queue() -> std::tuple<GstElement*, GstElement*, GstElement*, GstElement*, GstElement*>;
 	auto m_create_nvdslogger() -> GstElement*;
@@ -96,12 +185,34 @@ struct Engine {
 	auto m_create_transform() -> GstElement*;
 	auto m_create_sink() -> GstElement*;
 	auto m_setup_element_config() -> void;
+	auto m_apply_nvinfer_config(const gchar* config_file) -> void;
+	auto m_apply_streammux_batch_size() -> void;
+	auto m_apply_tiler_grid() -> void;
 	auto m_add_elements_to_pipeline() -> void;
 	auto m_create_message_handler() -> guint;
 	auto m_add_tiler_src_pad_buffer_probe(va::UserData* va_user_data) -> void;
+	auto m_add_first_batch_probe() -> void;
+	auto m_startup_milestone(const std::string& phase) -> void;
+	auto m_print_decode_stats() -> void;
+	auto m_start_loop() -> void;
+	auto m_setup_user_data(va::UserData& va_user_data) -> void;
+	auto m_add_signal_watches() -> void;
+	auto m_finish_loop() -> void;
+	auto m_run_cpu() -> void;
 
 	auto run() -> void;
+	auto stop() -> void;
+	auto reload() -> void;
 	auto set_database(va::Database* _va_database) -> void;
+	auto set_detection_cache(va::DetectionCache* _va_detection_cache) -> void;
+	auto set_journal(va::Journal* _va_journal) -> void;
+	auto set_publisher(va::Publisher* _va_publisher) -> void;
+	auto set_clip_recorder(va::ClipRecorder* _va_clip_recorder) -> void;
+	auto set_thumbnailer(va::Thumbnailer* _va_thumbnailer) -> void;
+	auto set_scene_gate(va::SceneGate* _va_scene_gate) -> void;
+	auto set_heatmap(va::Heatmap* _va_heatmap) -> void;
+	auto set_stream_stats(va::StreamStats* _va_stream_stats) -> void;
+	auto set_thread_placement(va::ThreadPlacement* _va_thread_placement) -> void;
 };
 } // namespace va
 
@@ -0,0 +1,603 @@
+#include "va_file_chunks.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "va_journal.h"
+#include "va_trace.h"
+
+#define CHUNK_SCHEME "chunk://"
+/* seconds from 1904, where MP4 times start, to 1970 */
+#define MP4_EPOCH_OFFSET 2082844800ull
+/* length and crc before each journal record */
+#define SPOOL_HEADER_SIZE 8
+/* spooled frames handed over per file on each push */
+#define REPLAY_SLICE_FRAMES 32
+
+static auto be32(const guint8* data) -> guint32 {
+	return (guint32)data[0] << 24 | (guint32)data[1] << 16 | (guint32)data[2] << 8 | data[3];
+}
+
+static auto be64(const guint8* data) -> guint64 {
+	return (guint64)be32(data) << 32 | be32(data + 4);
+}
+
+/* value in units of 1 / timescale s to ns, without overflowing */
+static auto to_ns(guint64 value, guint32 timescale) -> guint64 {
+	return value / timescale * 1000000000ull + value % timescale * 1000000000ull / timescale;
+}
+
+/**
+ * A box in memory: its type and payload, past the header
+ */
+struct Mp4Box {
+	guint32 type;
+	const guint8* data;
+	size_t size;
+};
+
+static constexpr auto fourcc(const char* name) -> guint32 {
+	return (guint32)(guint8)name[0] << 24 | (guint32)(guint8)name[1] << 16 | (guint32)(guint8)name[2] << 8 | (guint8)name[3];
+}
+
+/* the children of a box, a truncated last one is left out */
+static auto mp4_children(const guint8* data, size_t size) -> std::vector<Mp4Box> {
+	std::vector<Mp4Box> boxes;
+	size_t offset = 0;
+	while (size - offset >= 8) {
+		guint64 box_size = be32(data + offset);
+		size_t header = 8;
+		if (box_size == 1) {
+			if (size - offset < 16) {
+				break;
+			}
+			box_size = be64(data + offset + 8);
+			header = 16;
+		} else if (box_size == 0) {
+			box_size = size - offset;
+		}
+		if (box_size < header || box_size > size - offset) {
+			break;
+		}
+		boxes.push_back(Mp4Box { be32(data + offset + 4), data + offset + header, static_cast<size_t>(box_size - header) });
+		offset += box_size;
+	}
+	return boxes;
+}
+
+/* the first child of a type, without data when there is none */
+static auto mp4_child(const Mp4Box& parent, const char* name) -> Mp4Box {
+	for (const Mp4Box& box : mp4_children(parent.data, parent.size)) {
+		if (box.type == fourcc(name)) {
+			return box;
+		}
+	}
+	return Mp4Box { 0, nullptr, 0 };
+}
+
+/* mvhd and mdhd share the layout of these */
+struct Mp4Header {
+	guint64 creation_time = 0;
+	guint32 timescale = 0;
+	guint64 duration = 0;
+};
+
+static auto mp4_header(const Mp4Box& box) -> Mp4Header {
+	Mp4Header header;
+	if (box.size >= 32 && box.data[0] == 1) {
+		header.creation_time = be64(box.data + 4);
+		header.timescale = be32(box.data + 20);
+		header.duration = be64(box.data + 24);
+	} else if (box.size >= 20) {
+		header.creation_time = be32(box.data + 4);
+		header.timescale = be32(box.data + 12);
+		header.duration = be32(box.data + 16);
+	}
+	return header;
+}
+
+/**
+ * Runs of (count, value) of stts and ctts, for samples in increasing order
+ */
+struct Mp4Runs {
+	const guint8* m_entries = nullptr;
+	guint32 m_count = 0;
+	guint32 m_entry = 0;
+	guint64 m_entry_first = 0;
+	/* sum of count * value of the entries before m_entry */
+	guint64 m_sum = 0;
+
+	Mp4Runs(const Mp4Box& box) {
+		if (box.data && box.size >= 8) {
+			m_count = std::min<guint64>(be32(box.data + 4), (box.size - 8) / 8);
+			m_entries = box.data + 8;
+		}
+	}
+
+	auto samples() const -> guint64 {
+		guint64 total = 0;
+		for (guint32 i = 0; i < m_count; ++i) {
+			total += be32(m_entries + i * 8);
+		}
+		return total;
+	}
+
+	/* sum of the values of the samples before sample */
+	auto sum_before(guint64 sample) -> guint64 {
+		for (; m_entry < m_count; ++m_entry) {
+			guint32 count = be32(m_entries + m_entry * 8);
+			if (sample < m_entry_first + count) {
+				break;
+			}
+			m_entry_first += count;
+			m_sum += static_cast<guint64>(count) * be32(m_entries + m_entry * 8 + 4);
+		}
+		return m_entry < m_count ? m_sum + (sample - m_entry_first) * be32(m_entries + m_entry * 8 + 4) : m_sum;
+	}
+
+	/* the value of sample itself */
+	auto value_of(guint64 sample) -> gint64 {
+		sum_before(sample);
+		return m_entry < m_count ? static_cast<gint32>(be32(m_entries + m_entry * 8 + 4)) : 0;
+	}
+};
+
+/**
+ * Keyframes of a video trak, in presentation time as qtdemux puts it on the
+ * buffers: decode time plus composition offset, moved by the edit list
+ */
+static auto index_track(const Mp4Box& trak, guint32 movie_timescale, va::KeyframeIndex* index) -> bool {
+	Mp4Box mdia = mp4_child(trak, "mdia");
+	Mp4Box hdlr = mp4_child(mdia, "hdlr");
+	if (!hdlr.data || hdlr.size < 12 || be32(hdlr.data + 8) != fourcc("vide")) {
+		return false;
+	}
+	Mp4Box mdhd = mp4_child(mdia, "mdhd");
+	Mp4Header header = mdhd.data ? mp4_header(mdhd) : Mp4Header {};
+	if (header.timescale == 0) {
+		return false;
+	}
+	index->duration_ns = to_ns(header.duration, header.timescale);
+
+	/* an empty edit delays the track, the first real one skips into it */
+	guint64 delay_ns = 0;
+	guint64 media_time = 0;
+	Mp4Box elst = mp4_child(mp4_child(trak, "edts"), "elst");
+	if (elst.data && elst.size >= 8 && movie_timescale) {
+		bool wide = elst.data[0] == 1;
+		size_t entry_size = wide ? 20 : 12;
+		guint32 entries = std::min<guint64>(be32(elst.data + 4), (elst.size - 8) / entry_size);
+		for (guint32 i = 0; i < entries; ++i) {
+			const guint8* entry = elst.data + 8 + i * entry_size;
+			gint64 entry_media_time = wide ? static_cast<gint64>(be64(entry + 8)) : static_cast<gint32>(be32(entry + 4));
+			if (entry_media_time < 0) {
+				delay_ns += to_ns(wide ? be64(entry) : be32(entry), movie_timescale);
+				continue;
+			}
+			media_time = entry_media_time;
+			break;
+		}
+	}
+
+	Mp4Box stbl = mp4_child(mp4_child(mdia, "minf"), "stbl");
+	Mp4Runs decode_times { mp4_child(stbl, "stts") };
+	Mp4Runs composition_offsets { mp4_child(stbl, "ctts") };
+	Mp4Box stss = mp4_child(stbl, "stss");
+	guint64 samples = decode_times.samples();
+
+	/* every sample is a sync sample without stss */
+	std::vector<guint64> sync_samples;
+	if (stss.data && stss.size >= 8) {
+		guint32 count = std::min<guint64>(be32(stss.data + 4), (stss.size - 8) / 4);
+		for (guint32 i = 0; i < count; ++i) {
+			guint32 number = be32(stss.data + 8 + i * 4);
+			if (number >= 1 && number <= samples) {
+				sync_samples.push_back(number - 1);
+			}
+		}
+	} else {
+		for (guint64 sample = 0; sample < samples; ++sample) {
+			sync_samples.push_back(sample);
+		}
+	}
+	std::sort(sync_samples.begin(), sync_samples.end());
+	for (guint64 sample : sync_samples) {
+		gint64 time = static_cast<gint64>(decode_times.sum_before(sample)) + composition_offsets.value_of(sample) - static_cast<gint64>(media_time);
+		index->keyframes_ns.push_back(to_ns(std::max<gint64>(time, 0), header.timescale) + delay_ns);
+	}
+	std::sort(index->keyframes_ns.begin(), index->keyframes_ns.end());
+	return true;
+}
+
+/**
+ * Only moov is read, wherever it is, the media data is skipped
+ */
+auto va::index_keyframes(const std::string& path) -> va::KeyframeIndex {
+	VA_TRACE_SCOPE("index_keyframes");
+	std::ifstream file { path, std::ios::binary };
+	if (!file) {
+		throw std::runtime_error("Unable to open " + path + "\n");
+	}
+	file.seekg(0, std::ios::end);
+	guint64 file_size = file.tellg();
+	std::vector<guint8> moov;
+	for (guint64 offset = 0; offset + 8 <= file_size;) {
+		guint8 header[16];
+		file.seekg(offset);
+		if (!file.read(reinterpret_cast<char*>(header), 8)) {
+			break;
+		}
+		guint64 size = be32(header);
+		guint64 header_size = 8;
+		if (size == 1) {
+			if (!file.read(reinterpret_cast<char*>(header + 8), 8)) {
+				break;
+			}
+			size = be64(header + 8);
+			header_size = 16;
+		} else if (size == 0) {
+			size = file_size - offset;
+		}
+		if (size < header_size || size > file_size - offset) {
+			break;
+		}
+		if (be32(header + 4) == fourcc("moov")) {
+			moov.resize(size - header_size);
+			if (!file.read(reinterpret_cast<char*>(moov.data()), moov.size())) {
+				throw std::runtime_error("Unable to read the moov box of " + path + "\n");
+			}
+			break;
+		}
+		offset += size;
+	}
+	if (moov.empty()) {
+		throw std::runtime_error(path + " is not an MP4 or QuickTime file, or has no moov box\n");
+	}
+
+	va::KeyframeIndex index;
+	Mp4Box root { fourcc("moov"), moov.data(), moov.size() };
+	Mp4Box mvhd_box = mp4_child(root, "mvhd");
+	Mp4Header mvhd = mvhd_box.data ? mp4_header(mvhd_box) : Mp4Header {};
+	if (mvhd.creation_time > MP4_EPOCH_OFFSET) {
+		index.creation_time_ns = (mvhd.creation_time - MP4_EPOCH_OFFSET) * 1000000000ull;
+	}
+	bool video = false;
+	for (const Mp4Box& box : mp4_children(root.data, root.size)) {
+		if (box.type == fourcc("trak") && index_track(box, mvhd.timescale, &index)) {
+			video = true;
+			break;
+		}
+	}
+	if (!video) {
+		throw std::runtime_error(path + " has no video track\n");
+	}
+
+	/* fragmented: the length is in mvhd, or in mehd of mvex */
+	if (index.duration_ns == 0 && mvhd.timescale) {
+		guint64 duration = mvhd.duration;
+		Mp4Box mehd = mp4_child(mp4_child(root, "mvex"), "mehd");
+		if (mehd.data && mehd.size >= 8) {
+			duration = mehd.data[0] == 1 && mehd.size >= 12 ? be64(mehd.data + 4) : be32(mehd.data + 4);
+		}
+		index.duration_ns = to_ns(duration, mvhd.timescale);
+	}
+	return index;
+}
+
+auto va::is_chunk_uri(const std::string& uri) -> bool {
+	return uri.compare(0, sizeof(CHUNK_SCHEME) - 1, CHUNK_SCHEME) == 0;
+}
+
+static auto parse_time(const std::string& uri, const std::string& key, const std::string& value) -> guint64 {
+	size_t end = 0;
+	unsigned long long time = 0;
+	try {
+		time = std::stoull(value, &end);
+	} catch (std::exception&) {
+		end = 0;
+	}
+	if (end == 0 || end != value.size() || value[0] == '-') {
+		throw std::invalid_argument("Invalid " + key + " in " + uri + "\n");
+	}
+	return static_cast<guint64>(time);
+}
+
+auto va::parse_chunk_uri(const std::string& uri) -> va::FileChunk {
+	if (!is_chunk_uri(uri)) {
+		throw std::invalid_argument("Not a file chunk: " + uri + "\n");
+	}
+	va::FileChunk chunk {};
+	std::string rest = uri.substr(sizeof(CHUNK_SCHEME) - 1);
+	size_t query = rest.find('?');
+	if (query != 0) {
+		throw std::invalid_argument("Invalid file chunk: " + uri + "\n");
+	}
+
+	std::stringstream stream { rest.substr(query + 1) };
+	std::string item;
+	while (std::getline(stream, item, '&')) {
+		if (item.empty()) {
+			continue;
+		}
+		size_t equals = item.find('=');
+		std::string key = item.substr(0, equals);
+		std::string value = equals == std::string::npos ? std::string {} : item.substr(equals + 1);
+		if (key == "location" && !value.empty()) {
+			chunk.location = value;
+		} else if (key == "start-ns") {
+			chunk.start_ns = parse_time(uri, key, value);
+		} else if (key == "stop-ns") {
+			chunk.stop_ns = parse_time(uri, key, value);
+		} else if (key == "base-ns") {
+			chunk.base_ns = parse_time(uri, key, value);
+		} else if (key == "retries") {
+			chunk.retries = static_cast<guint>(std::min<guint64>(parse_time(uri, key, value), G_MAXUINT));
+		} else {
+			throw std::invalid_argument("Invalid " + key + " in " + uri + "\n");
+		}
+	}
+	if (chunk.location.empty()) {
+		throw std::invalid_argument("File chunk without a location: " + uri + "\n");
+	}
+	if (chunk.stop_ns <= chunk.start_ns) {
+		throw std::invalid_argument("File chunk that stops before it starts: " + uri + "\n");
+	}
+	return chunk;
+}
+
+auto va::format_chunk_uri(const va::FileChunk& chunk) -> std::string {
+	std::ostringstream uri;
+	uri << CHUNK_SCHEME << "?location=" << chunk.location << "&start-ns=" << chunk.start_ns;
+	if (chunk.stop_ns != G_MAXUINT64) {
+		uri << "&stop-ns=" << chunk.stop_ns;
+	}
+	uri << "&base-ns=" << chunk.base_ns << "&retries=" << chunk.retries;
+	return uri.str();
+}
+
+/**
+ * Cut at the last keyframe before each of the even splits, a cut that would
+ * not move forward is dropped
+ */
+auto va::split_file(const std::string& location, const va::KeyframeIndex& index, guint chunks, guint64 base_ns) -> std::vector<va::FileChunk> {
+	std::vector<guint64> cuts { 0 };
+	for (guint i = 1; i < chunks && index.duration_ns; ++i) {
+		guint64 cut = index.duration_ns / chunks * i;
+		if (!index.keyframes_ns.empty()) {
+			auto keyframe = std::upper_bound(index.keyframes_ns.begin(), index.keyframes_ns.end(), cut);
+			if (keyframe == index.keyframes_ns.begin()) {
+				continue;
+			}
+			cut = *(keyframe - 1);
+		}
+		if (cut > cuts.back()) {
+			cuts.push_back(cut);
+		}
+	}
+
+	std::vector<va::FileChunk> file_chunks;
+	for (size_t i = 0; i < cuts.size(); ++i) {
+		va::FileChunk chunk {};
+		chunk.location = location;
+		chunk.start_ns = cuts[i];
+		chunk.stop_ns = i + 1 < cuts.size() ? cuts[i + 1] : G_MAXUINT64;
+		chunk.base_ns = base_ns;
+		file_chunks.push_back(chunk);
+	}
+	return file_chunks;
+}
+
+va::ChunkMerger::ChunkMerger(std::string spool_dir) : m_spool_dir(std::move(spool_dir)) { }
+
+va::ChunkMerger::~ChunkMerger() {
+	for (auto& entry : m_chunks) {
+		Chunk& chunk = entry.second;
+		if (!chunk.m_spool_path.empty()) {
+			g_printerr("Chunks: %lu spooled frames of source %u never handed over\n",
+					(gulong)(chunk.m_spooled - chunk.m_replayed), entry.first);
+			chunk.m_replay.close();
+			chunk.m_spool.close();
+			std::remove(chunk.m_spool_path.c_str());
+		}
+	}
+}
+
+auto va::ChunkMerger::set_sink(Sink sink) -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	m_sink = std::move(sink);
+}
+
+auto va::ChunkMerger::add_chunk(guint source_id, const va::FileChunk& chunk) -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	auto it = m_chunks.find(source_id);
+	if (it != m_chunks.end()) {
+		++it->second.m_restarts;
+		it->second.m_finished = false;
+		it->second.m_restarting = true;
+		return;
+	}
+	m_chunks[source_id].m_chunk = chunk;
+	std::vector<guint>& order = m_files[chunk.location];
+	order.push_back(source_id);
+	std::stable_sort(order.begin(), order.end(), [this](guint a, guint b) {
+		return m_chunks[a].m_chunk.start_ns < m_chunks[b].m_chunk.start_ns;
+	});
+	m_heads[chunk.location] = 0;
+}
+
+auto va::ChunkMerger::timestamp(guint source_id, guint64 pts, guint64 fallback) -> guint64 {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	auto it = m_chunks.find(source_id);
+	return it == m_chunks.end() ? fallback : it->second.m_chunk.base_ns + pts;
+}
+
+/**
+ * From the metadata probe, for every frame of every source
+ */
+auto va::ChunkMerger::push(guint source_id, va::FrameMetadata& frame_meta) -> void {
+	VA_TRACE_SCOPE("chunks.push");
+	std::lock_guard<std::mutex> lock { m_mutex };
+	auto it = m_chunks.find(source_id);
+	if (it == m_chunks.end()) {
+		if (m_sink) {
+			m_sink(source_id, frame_meta);
+		}
+		return;
+	}
+	Chunk& chunk = it->second;
+	chunk.m_restarting = false;
+	if (chunk.m_has_last && frame_meta.timestamp <= chunk.m_last) {
+		return;
+	}
+	chunk.m_has_last = true;
+	chunk.m_last = frame_meta.timestamp;
+	++chunk.m_frames;
+	size_t position = m_position(source_id, chunk);
+	size_t head = m_heads[chunk.m_chunk.location];
+	if (position < head) {
+		/* held back by the scene gate past the end of the chunk, or a restart */
+		if (chunk.m_late++ == 0) {
+			g_printerr("Chunks: frames of source %u after its chunk was done, handed over out of order\n", source_id);
+		}
+		if (m_sink) {
+			m_sink(source_id, frame_meta);
+		}
+	} else if (position == head && chunk.m_spool_path.empty()) {
+		if (m_sink) {
+			m_sink(source_id, frame_meta);
+		}
+	} else {
+		if (chunk.m_spool_path.empty()) {
+			chunk.m_spool_path = m_spool_dir + "/va-chunk-" + std::to_string(getpid()) + "-" + std::to_string(source_id) + ".spool";
+			chunk.m_spool.open(chunk.m_spool_path, std::ios::binary | std::ios::trunc);
+			if (!chunk.m_spool) {
+				g_printerr("Chunks: unable to open %s, frames of source %u are lost\n", chunk.m_spool_path.c_str(), source_id);
+			}
+		}
+		thread_local std::vector<char> record;
+		record.clear();
+		va::journal_encode(frame_meta, &record);
+		chunk.m_spool.write(record.data(), record.size());
+		++chunk.m_spooled;
+	}
+
+	for (const auto& file : m_files) {
+		m_advance(file.first, REPLAY_SLICE_FRAMES);
+	}
+}
+
+/**
+ * The muxer saw the end of the chunk of source_id, after its last frame
+ */
+auto va::ChunkMerger::finish(guint source_id) -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	auto it = m_chunks.find(source_id);
+	if (it == m_chunks.end() || it->second.m_finished || it->second.m_restarting) {
+		return;
+	}
+	it->second.m_finished = true;
+	g_print("Chunks: source %u done, %lu frames\n", source_id, (gulong)it->second.m_frames);
+	m_advance(it->second.m_chunk.location, REPLAY_SLICE_FRAMES);
+}
+
+/**
+ * Everything still spooled, in file order, unfinished chunks included. Once
+ * the pipeline stopped, off the streaming threads.
+ */
+auto va::ChunkMerger::flush() -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	for (auto& file : m_files) {
+		size_t& head = m_heads[file.first];
+		for (; head < file.second.size(); ++head) {
+			m_replay(file.second[head], m_chunks[file.second[head]], G_MAXUINT64);
+		}
+	}
+}
+
+auto va::ChunkMerger::print_stats() -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	for (const auto& entry : m_chunks) {
+		const Chunk& chunk = entry.second;
+		std::string stop = chunk.m_chunk.stop_ns == G_MAXUINT64 ? "end" : std::to_string(chunk.m_chunk.stop_ns / 1000000000ull) + " s";
+		g_print("Chunk %u: %lu s - %s of %s, %lu frames, %lu spooled, %lu late, %u restarts%s\n", entry.first,
+				(gulong)(chunk.m_chunk.start_ns / 1000000000ull), stop.c_str(), chunk.m_chunk.location.c_str(), (gulong)chunk.m_frames,
+				(gulong)chunk.m_spooled, (gulong)chunk.m_late, chunk.m_restarts, chunk.m_finished ? "" : ", unfinished");
+	}
+}
+
+auto va::ChunkMerger::m_position(guint source_id, const Chunk& chunk) -> size_t {
+	const std::vector<guint>& order = m_files[chunk.m_chunk.location];
+	return std::find(order.begin(), order.end(), source_id) - order.begin();
+}
+
+/**
+ * Hand over up to budget spooled frames of the head chunk of a file, and
+ * move past it once it finished and its spool is empty
+ */
+auto va::ChunkMerger::m_advance(const std::string& location, guint64 budget) -> void {
+	const std::vector<guint>& order = m_files[location];
+	size_t& head = m_heads[location];
+	while (head < order.size()) {
+		Chunk& chunk = m_chunks[order[head]];
+		guint64 replayed = chunk.m_replayed;
+		bool drained = m_replay(order[head], chunk, budget);
+		budget -= std::min(budget, chunk.m_replayed - replayed);
+		if (!drained || !chunk.m_finished) {
+			break;
+		}
+		++head;
+	}
+}
+
+/**
+ * Up to budget frames from where the last replay of the spool stopped, true
+ * once the spool is empty and removed
+ */
+auto va::ChunkMerger::m_replay(guint source_id, Chunk& chunk, guint64 budget) -> bool {
+	if (chunk.m_spool_path.empty()) {
+		return true;
+	}
+	VA_TRACE_SCOPE("chunks.replay");
+	chunk.m_spool.flush();
+	if (!chunk.m_replay.is_open()) {
+		chunk.m_replay.open(chunk.m_spool_path, std::ios::binary);
+	}
+	chunk.m_replay.clear();
+	thread_local std::vector<char> payload;
+	bool damaged = false;
+	for (; budget > 0; --budget) {
+		char header[SPOOL_HEADER_SIZE];
+		if (!chunk.m_replay.read(header, sizeof(header))) {
+			break;
+		}
+		guint32 length;
+		guint32 crc;
+		std::memcpy(&length, header, sizeof(length));
+		std::memcpy(&crc, header + 4, sizeof(crc));
+		payload.resize(length);
+		if (!chunk.m_replay.read(payload.data(), length) || va::journal_crc32(payload.data(), length) != crc) {
+			g_printerr("Chunks: %s is damaged after %lu frames\n", chunk.m_spool_path.c_str(), (gulong)chunk.m_replayed);
+			damaged = true;
+			break;
+		}
+		va::FrameMetadata frame_meta { std::string {}, 0 };
+		if (va::journal_decode(payload.data(), length, &frame_meta) && m_sink) {
+			m_sink(source_id, frame_meta);
+		}
+		++chunk.m_replayed;
+	}
+	/* whole records only are ever written, the spool ends on a record */
+	if (!damaged && chunk.m_replay) {
+		return false;
+	}
+	chunk.m_replay.close();
+	chunk.m_spool.close();
+	std::remove(chunk.m_spool_path.c_str());
+	chunk.m_spool_path.clear();
+	return true;
+}
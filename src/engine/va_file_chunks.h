@@ -0,0 +1,129 @@
+#ifndef VA_ENGINE_FILE_CHUNKS_H_
+#define VA_ENGINE_FILE_CHUNKS_H_
+
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+#include "va_object_meta.h"
+
+namespace va {
+/**
+ * Where the video track of an MP4 or QuickTime file can be cut: the
+ * presentation times of its sync samples, read from the sample tables
+ * without touching the media data. Fragmented files have no sample tables
+ * and come back without keyframes.
+ */
+struct KeyframeIndex {
+	guint64 duration_ns = 0;
+	/* creation time of the movie in ns since the epoch, 0 when not set */
+	guint64 creation_time_ns = 0;
+	/* ascending */
+	std::vector<guint64> keyframes_ns;
+};
+
+/* throws std::runtime_error when path is not an MP4 with a video track */
+auto index_keyframes(const std::string& path) -> KeyframeIndex;
+
+/**
+ * A time range of a recorded file, run as a source of its own:
+ *
+ *   chunk://?location=file:///recordings/cam-1.mp4&start-ns=0&stop-ns=3600000000000&base-ns=0&retries=2
+ *
+ * Frames from start-ns up to before stop-ns, stamped base-ns plus their
+ * position in the file instead of the time they were decoded. A chunk whose
+ * source fails is restarted up to retries times.
+ */
+struct FileChunk {
+	std::string location;
+	guint64 start_ns = 0;
+	/* G_MAXUINT64 for the end of the file */
+	guint64 stop_ns = G_MAXUINT64;
+	guint64 base_ns = 0;
+	guint retries = 2;
+};
+
+auto is_chunk_uri(const std::string& uri) -> bool;
+/* throws std::invalid_argument on an unknown key or value */
+auto parse_chunk_uri(const std::string& uri) -> FileChunk;
+auto format_chunk_uri(const FileChunk& chunk) -> std::string;
+
+/**
+ * Up to chunks ranges of about the same length that start on keyframes,
+ * fewer when the file has fewer keyframes. Without keyframes the ranges are
+ * cut anywhere and each chunk decodes from the keyframe before its start.
+ */
+auto split_file(const std::string& location, const KeyframeIndex& index, guint chunks, guint64 base_ns) -> std::vector<FileChunk>;
+
+/**
+ * Frames of the chunks of a file to the sinks in file order. The earliest
+ * unfinished chunk of each file goes straight through, later ones are
+ * spooled to disk. Once every chunk before one has finished, its spool is
+ * handed over a slice at a time on each push, so a long replay never stalls
+ * the streaming thread; what is left when the pipeline stops goes in flush().
+ * A restarted chunk skips the frames it already handed over, and frames of a
+ * chunk the head already moved past go straight through, out of order.
+ */
+struct ChunkMerger {
+	using Sink = std::function<void(guint source_id, va::FrameMetadata& frame_meta)>;
+
+	struct Chunk {
+		va::FileChunk m_chunk;
+		bool m_finished = false;
+		/* file time of the last frame taken, what comes again after a restart is skipped */
+		bool m_has_last = false;
+		guint64 m_last = 0;
+		std::string m_spool_path;
+		std::ofstream m_spool;
+		/* reads the spool back while later frames are still appended */
+		std::ifstream m_replay;
+		guint64 m_spooled = 0;
+		guint64 m_replayed = 0;
+		guint64 m_frames = 0;
+		/* after the head moved past the chunk */
+		guint64 m_late = 0;
+		guint m_restarts = 0;
+		/* until the first frame after a restart, an end of stream is that of
+		 * the source bin replaced */
+		bool m_restarting = false;
+	};
+
+	std::mutex m_mutex;
+	Sink m_sink;
+	std::string m_spool_dir;
+	/* by source id */
+	std::map<guint, Chunk> m_chunks;
+	/* source ids of the chunks of each file by start, and the first unfinished */
+	std::map<std::string, std::vector<guint>> m_files;
+	std::map<std::string, size_t> m_heads;
+
+	explicit ChunkMerger(std::string spool_dir);
+	~ChunkMerger();
+
+	ChunkMerger(const ChunkMerger& other) = delete;
+	ChunkMerger& operator=(const ChunkMerger& other) = delete;
+
+	auto set_sink(Sink sink) -> void;
+	/* again for the same source id when its chunk is restarted */
+	auto add_chunk(guint source_id, const va::FileChunk& chunk) -> void;
+	/* base-ns + pts for the frames of a chunk, fallback for other sources */
+	auto timestamp(guint source_id, guint64 pts, guint64 fallback) -> guint64;
+	auto push(guint source_id, va::FrameMetadata& frame_meta) -> void;
+	auto finish(guint source_id) -> void;
+	/* what is still spooled, in order, once the pipeline stopped */
+	auto flush() -> void;
+	auto print_stats() -> void;
+
+	auto m_position(guint source_id, const Chunk& chunk) -> size_t;
+	auto m_advance(const std::string& location, guint64 budget) -> void;
+	auto m_replay(guint source_id, Chunk& chunk, guint64 budget) -> bool;
+};
+
+} // namespace va
+
+#endif
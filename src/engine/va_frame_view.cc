@@ -0,0 +1,64 @@
+#include "va_frame_view.h"
+
+#include <cstring>
+
+#include <cuda_runtime_api.h>
+
+va::SurfaceFrame::SurfaceFrame(NvBufSurface* surface, guint index) : m_surface(surface), m_index(index) {
+	if (index >= surface->numFilled) {
+		return;
+	}
+	const NvBufSurfaceParams& params = surface->surfaceList[index];
+	if (params.colorFormat == NVBUF_COLOR_FORMAT_NV12) {
+		m_view.format = va::FrameView::Format::NV12;
+	} else if (params.colorFormat == NVBUF_COLOR_FORMAT_RGBA) {
+		m_view.format = va::FrameView::Format::RGBA;
+	} else {
+		return;
+	}
+	m_view.width = params.width;
+	m_view.height = params.height;
+
+	const guint8* base = nullptr;
+	switch (surface->memType) {
+		case NVBUF_MEM_DEFAULT:
+		case NVBUF_MEM_CUDA_DEVICE:
+			/* only the crop is copied to the host, with cudaMemcpy2D */
+			base = static_cast<const guint8*>(params.dataPtr);
+			m_view.device = true;
+			break;
+		case NVBUF_MEM_CUDA_PINNED:
+		case NVBUF_MEM_CUDA_UNIFIED:
+		case NVBUF_MEM_SYSTEM:
+			base = static_cast<const guint8*>(params.dataPtr);
+			break;
+		default:
+			if (NvBufSurfaceMap(surface, m_index, -1, NVBUF_MAP_READ) != 0) {
+				return;
+			}
+			m_mapped = true;
+			NvBufSurfaceSyncForCpu(surface, m_index, -1);
+			break;
+	}
+	for (guint plane = 0; plane < params.planeParams.num_planes && plane < 3; ++plane) {
+		m_view.planes[plane] = m_mapped ? static_cast<const guint8*>(params.mappedAddr.addr[plane]) : base + params.planeParams.offset[plane];
+		m_view.pitches[plane] = params.planeParams.pitch[plane];
+	}
+	m_valid = m_view.planes[0] != nullptr;
+}
+
+va::SurfaceFrame::~SurfaceFrame() {
+	if (m_mapped) {
+		NvBufSurfaceUnMap(m_surface, m_index, -1);
+	}
+}
+
+auto va::copy_plane(guint8* dst, const guint8* src, gsize pitch, gsize row_bytes, guint rows, bool device) -> bool {
+	if (device) {
+		return cudaMemcpy2D(dst, row_bytes, src, pitch, row_bytes, rows, cudaMemcpyDeviceToHost) == cudaSuccess;
+	}
+	for (guint row = 0; row < rows; ++row) {
+		memcpy(dst + row * row_bytes, src + row * pitch, row_bytes);
+	}
+	return true;
+}
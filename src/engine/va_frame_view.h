@@ -0,0 +1,49 @@
+#ifndef VA_ENGINE_FRAME_VIEW_H_
+#define VA_ENGINE_FRAME_VIEW_H_
+
+#include <glib.h>
+#include "nvbufsurface.h"
+
+namespace va {
+/**
+ * One video frame the CPU side stages read from: NV12, I420 or RGBA, in host
+ * or in CUDA device memory
+ */
+struct FrameView {
+	enum class Format { NV12, I420, RGBA };
+
+	Format format = Format::NV12;
+	bool device = false;
+	guint width = 0;
+	guint height = 0;
+	const guint8* planes[3] = { };
+	guint pitches[3] = { };
+};
+
+/**
+ * FrameView of one frame of a batched NvBufSurface. Memory the CPU cannot read
+ * directly (Jetson surface arrays) stays mapped while this lives.
+ */
+struct SurfaceFrame {
+	NvBufSurface* m_surface;
+	int m_index;
+	bool m_mapped = false;
+	bool m_valid = false;
+	FrameView m_view;
+
+	SurfaceFrame(NvBufSurface* surface, guint index);
+	~SurfaceFrame();
+
+	SurfaceFrame(const SurfaceFrame& other) = delete;
+	SurfaceFrame& operator=(const SurfaceFrame& other) = delete;
+};
+
+/**
+ * Copy rows of row_bytes, pitch apart in src, to host memory packed in dst.
+ * src may be device memory.
+ */
+auto copy_plane(guint8* dst, const guint8* src, gsize pitch, gsize row_bytes, guint rows, bool device) -> bool;
+
+} // namespace va
+
+#endif
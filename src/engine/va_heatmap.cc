@@ -0,0 +1,480 @@
+#include "va_heatmap.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+#include <yaml-cpp/yaml.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VA_HEATMAP_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define VA_HEATMAP_NEON 1
+#endif
+
+#include "va_thread_placement.h"
+#include "va_trace.h"
+
+auto va::parse_heatmap_config(const char* cfg_file, const char* group) -> va::HeatmapConfig {
+	va::HeatmapConfig config {};
+	YAML::Node node = YAML::LoadFile(cfg_file)[group];
+	if (!node) {
+		return config;
+	}
+	config.enable = node["enable"].as<int>(config.enable) != 0;
+	config.width = std::max(1u, node["width"].as<guint>(config.width));
+	config.height = std::max(1u, node["height"].as<guint>(config.height));
+	if (node["classes"]) {
+		config.classes = node["classes"].as<std::vector<int>>();
+	}
+	config.footprint = std::clamp(node["footprint"].as<double>(config.footprint), 0.0, 1.0);
+	config.max_sources = node["max-sources"].as<guint>(config.max_sources);
+	config.snapshot_ms = node["snapshot-ms"].as<guint>(config.snapshot_ms);
+	config.flush_interval_sec = std::max(1u, node["flush-interval-sec"].as<guint>(config.flush_interval_sec));
+	config.store = node["store"].as<std::string>(config.store);
+	config.directory = node["directory"].as<std::string>(config.directory);
+	config.kernels = node["kernels"].as<std::string>(config.kernels);
+	return config;
+}
+
+static auto add_span_scalar(guint32* counts, guint n, guint32 value) -> void {
+	for (guint i = 0; i < n; ++i) {
+		counts[i] += value;
+	}
+}
+
+static const va::HeatmapKernels scalar_kernels { "scalar", add_span_scalar };
+
+#ifdef VA_HEATMAP_X86
+static auto add_span_sse2(guint32* counts, guint n, guint32 value) -> void {
+	const __m128i add = _mm_set1_epi32(static_cast<int>(value));
+	guint i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i* cell = reinterpret_cast<__m128i*>(counts + i);
+		_mm_storeu_si128(cell, _mm_add_epi32(_mm_loadu_si128(cell), add));
+	}
+	add_span_scalar(counts + i, n - i, value);
+}
+
+__attribute__((target("avx2")))
+static auto add_span_avx2(guint32* counts, guint n, guint32 value) -> void {
+	const __m256i add = _mm256_set1_epi32(static_cast<int>(value));
+	guint i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i* cell = reinterpret_cast<__m256i*>(counts + i);
+		_mm256_storeu_si256(cell, _mm256_add_epi32(_mm256_loadu_si256(cell), add));
+	}
+	add_span_sse2(counts + i, n - i, value);
+}
+
+static const va::HeatmapKernels sse2_kernels { "sse2", add_span_sse2 };
+static const va::HeatmapKernels avx2_kernels { "avx2", add_span_avx2 };
+#endif
+
+#ifdef VA_HEATMAP_NEON
+static auto add_span_neon(guint32* counts, guint n, guint32 value) -> void {
+	const uint32x4_t add = vdupq_n_u32(value);
+	guint i = 0;
+	for (; i + 4 <= n; i += 4) {
+		vst1q_u32(counts + i, vaddq_u32(vld1q_u32(counts + i), add));
+	}
+	add_span_scalar(counts + i, n - i, value);
+}
+
+static const va::HeatmapKernels neon_kernels { "neon", add_span_neon };
+#endif
+
+auto va::heatmap_kernels_available() -> std::vector<const va::HeatmapKernels*> {
+	std::vector<const va::HeatmapKernels*> available { &scalar_kernels };
+#ifdef VA_HEATMAP_X86
+	available.push_back(&sse2_kernels);
+	if (__builtin_cpu_supports("avx2")) {
+		available.push_back(&avx2_kernels);
+	}
+#endif
+#ifdef VA_HEATMAP_NEON
+	available.push_back(&neon_kernels);
+#endif
+	return available;
+}
+
+auto va::heatmap_kernels_by_name(const std::string& name) -> const va::HeatmapKernels* {
+	std::vector<const va::HeatmapKernels*> available = heatmap_kernels_available();
+	if (name == "auto") {
+		return available.back();
+	}
+	for (const va::HeatmapKernels* kernels : available) {
+		if (name == kernels->name) {
+			return kernels;
+		}
+	}
+	return nullptr;
+}
+
+va::Heatmap::Heatmap(const va::HeatmapConfig& config) :
+	m_config(config),
+	m_kernels(va::heatmap_kernels_by_name(config.kernels))
+{
+	if (!m_kernels) {
+		throw std::invalid_argument("Heatmap: no " + config.kernels + " kernels on this cpu. Exiting.\n");
+	}
+	if (m_config.store != "file" && m_config.store != "database" && m_config.store != "both" && m_config.store != "none") {
+		throw std::invalid_argument("Heatmap: store is file, database, both or none. Exiting.\n");
+	}
+	if ((m_config.store == "file" || m_config.store == "both") && g_mkdir_with_parents(m_config.directory.c_str(), 0755) != 0) {
+		throw std::runtime_error("Heatmap: unable to create " + m_config.directory + ". Exiting.\n");
+	}
+	for (int class_id : m_config.classes) {
+		if (class_id >= 0) {
+			m_class_mask.resize(std::max<size_t>(m_class_mask.size(), class_id + 1), false);
+			m_class_mask[class_id] = true;
+		}
+	}
+	for (guint i = 0; i < m_config.max_sources; ++i) {
+		m_sources.push_back(std::make_unique<Source>());
+	}
+	m_flushed.resize(m_config.max_sources);
+	m_flusher = std::thread { &va::Heatmap::m_run, this };
+	g_print("Heatmap: %ux%u cells per source, %s kernels, flushed every %u s to %s\n",
+			m_config.width, m_config.height, m_kernels->name, m_config.flush_interval_sec, m_config.store.c_str());
+}
+
+/**
+ * Publishes what was added last and flushes it. The pipeline is stopped by
+ * now, so the writer side is ours.
+ */
+va::Heatmap::~Heatmap() {
+	{
+		std::lock_guard<std::mutex> lock { m_mutex };
+		m_stop = true;
+	}
+	m_cond.notify_all();
+	m_flusher.join();
+	for (std::unique_ptr<Source>& source : m_sources) {
+		if (source->m_active) {
+			m_publish(*source);
+		}
+	}
+	m_flush();
+	g_print("Heatmap: %lu intervals written, %lu failed, %lu frames of sources over max-sources\n",
+			(gulong)m_flushes.load(), (gulong)m_flush_failures.load(), (gulong)m_frames_dropped.load());
+}
+
+auto va::Heatmap::set_database(va::Database* _va_database) -> void {
+	if (m_config.store != "database" && m_config.store != "both") {
+		return;
+	}
+	try {
+		_va_database->create_heatmap_table();
+	} catch (sql::SQLException& e) {
+		std::cout << "# ERR: SQLException in " << __FILE__;
+		std::cout << "(" << __FUNCTION__ << ")" << std::endl;
+		std::cout << "# ERR: " << e.what();
+		std::cout << " (MySQL error code: " << e.getErrorCode();
+		std::cout << ", SQLState: " << e.getSQLState() << " )" << std::endl;
+	}
+	std::lock_guard<std::mutex> lock { m_mutex };
+	m_va_database = _va_database;
+}
+
+auto va::Heatmap::set_frame_size(guint width, guint height) -> void {
+	m_frame_width = width;
+	m_frame_height = height;
+}
+
+auto va::Heatmap::counts_class(int class_id) const -> bool {
+	if (m_class_mask.empty()) {
+		return true;
+	}
+	return class_id >= 0 && static_cast<size_t>(class_id) < m_class_mask.size() && m_class_mask[class_id];
+}
+
+/**
+ * The cells under the footprint of box, one span per grid row
+ */
+auto va::Heatmap::m_rasterize(std::vector<guint32>& counts, const va::HeatmapBox& box) -> void {
+	const float width = m_config.width;
+	const float height = m_config.height;
+	float bottom = box.top + box.height;
+	float top = bottom - box.height * static_cast<float>(m_config.footprint);
+	float x0 = std::floor(box.left * width);
+	float x1 = std::ceil((box.left + box.width) * width);
+	float y0 = std::floor(top * height);
+	float y1 = std::ceil(bottom * height);
+	/* a box smaller than a cell still marks the cell it is in */
+	x1 = std::fmax(x1, x0 + 1.0f);
+	y1 = std::fmax(y1, y0 + 1.0f);
+	/* fmin/fmax also turn NaN into an empty span */
+	x0 = std::fmax(0.0f, std::fmin(width, x0));
+	x1 = std::fmax(0.0f, std::fmin(width, x1));
+	y0 = std::fmax(0.0f, std::fmin(height, y0));
+	y1 = std::fmax(0.0f, std::fmin(height, y1));
+	if (x1 <= x0 || y1 <= y0) {
+		return;
+	}
+	guint columns = static_cast<guint>(x1 - x0);
+	guint rows = static_cast<guint>(y1 - y0);
+	guint32* cell = counts.data() + static_cast<gsize>(y0) * m_config.width + static_cast<gsize>(x0);
+	for (guint row = 0; row < rows; ++row, cell += m_config.width) {
+		m_kernels->add_span(cell, columns, 1);
+	}
+}
+
+/**
+ * Count one frame of source_id and its boxes. Runs on the thread that sinks
+ * detections.
+ */
+auto va::Heatmap::add_frame(guint source_id, const std::string& video_file, guint64 timestamp, const va::HeatmapBox* boxes, gsize count) -> void {
+	VA_TRACE_SCOPE("heatmap.add_frame");
+	if (source_id >= m_sources.size()) {
+		++m_frames_dropped;
+		return;
+	}
+	Source& source = *m_sources[source_id];
+	auto now = std::chrono::steady_clock::now();
+	if (!source.m_active.load(std::memory_order_relaxed)) {
+		gsize cells = static_cast<gsize>(m_config.width) * m_config.height;
+		source.m_live.assign(cells, 0);
+		source.m_buffers[0].counts.assign(cells, 0);
+		source.m_buffers[1].counts.assign(cells, 0);
+		source.m_video_file = video_file;
+		{
+			std::lock_guard<std::mutex> lock { source.m_mutex };
+			source.m_shared_video_file = video_file;
+		}
+		source.m_published = now;
+		source.m_active.store(true, std::memory_order_release);
+	} else if (source.m_video_file != video_file) {
+		/* the source id was given to another uri, its counts start over */
+		std::fill(source.m_live.begin(), source.m_live.end(), 0);
+		source.m_frames = 0;
+		++source.m_generation;
+		source.m_video_file = video_file;
+		std::lock_guard<std::mutex> lock { source.m_mutex };
+		source.m_shared_video_file = video_file;
+	}
+
+	if (source.m_frames == 0) {
+		source.m_first_timestamp = timestamp;
+	}
+	source.m_last_timestamp = timestamp;
+	++source.m_frames;
+	for (gsize i = 0; i < count; ++i) {
+		m_rasterize(source.m_live, boxes[i]);
+	}
+	if (now - source.m_published >= std::chrono::milliseconds(m_config.snapshot_ms)) {
+		m_publish(source);
+		source.m_published = now;
+	}
+}
+
+/**
+ * add_frame() for the detections of a sunk frame, in pixels of the muxer
+ * output
+ */
+auto va::Heatmap::add_frame(guint source_id, const va::FrameMetadata& frame_meta) -> void {
+	m_boxes.clear();
+	for (const va::ObjectMetadata& object_meta : frame_meta.va_object_meta_list) {
+		if (counts_class(object_meta.class_id)) {
+			m_boxes.push_back({
+				static_cast<float>(object_meta.left / m_frame_width),
+				static_cast<float>(object_meta.top / m_frame_height),
+				static_cast<float>(object_meta.width / m_frame_width),
+				static_cast<float>(object_meta.height / m_frame_height)
+			});
+		}
+	}
+	add_frame(source_id, frame_meta.video_file, frame_meta.timestamp, m_boxes.data(), m_boxes.size());
+}
+
+/**
+ * Copy the live grid to the back buffer and make it the front
+ */
+auto va::Heatmap::m_publish(Source& source) -> void {
+	VA_TRACE_SCOPE("heatmap.publish");
+	int back = 1 - source.m_front.load(std::memory_order_relaxed);
+	Buffer& buffer = source.m_buffers[back];
+	guint64 sequence = buffer.sequence.load(std::memory_order_relaxed);
+	buffer.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	buffer.generation = source.m_generation;
+	buffer.frames = source.m_frames;
+	buffer.first_timestamp = source.m_first_timestamp;
+	buffer.last_timestamp = source.m_last_timestamp;
+	std::copy(source.m_live.begin(), source.m_live.end(), buffer.counts.begin());
+	buffer.sequence.store(sequence + 2, std::memory_order_release);
+	source.m_front.store(back, std::memory_order_release);
+}
+
+/**
+ * Latest published counts of source_id, false when it has none. Never blocks
+ * the writer; retries when the writer overwrote the buffer while it was copied.
+ */
+auto va::Heatmap::snapshot(guint source_id, va::HeatmapSnapshot& out) -> bool {
+	if (source_id >= m_sources.size() || !m_sources[source_id]->m_active.load(std::memory_order_acquire)) {
+		return false;
+	}
+	Source& source = *m_sources[source_id];
+	for (;;) {
+		const Buffer& buffer = source.m_buffers[source.m_front.load(std::memory_order_acquire)];
+		guint64 sequence = buffer.sequence.load(std::memory_order_acquire);
+		if (sequence & 1) {
+			std::this_thread::yield();
+			continue;
+		}
+		out.generation = buffer.generation;
+		out.frames = buffer.frames;
+		out.first_timestamp = buffer.first_timestamp;
+		out.last_timestamp = buffer.last_timestamp;
+		out.counts.assign(buffer.counts.begin(), buffer.counts.end());
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (buffer.sequence.load(std::memory_order_relaxed) == sequence) {
+			break;
+		}
+	}
+	out.source_id = source_id;
+	std::lock_guard<std::mutex> lock { source.m_mutex };
+	out.video_file = source.m_shared_video_file;
+	return true;
+}
+
+auto va::Heatmap::m_wait(std::chrono::milliseconds duration) -> bool {
+	std::unique_lock<std::mutex> lock { m_mutex };
+	return !m_cond.wait_for(lock, duration, [this] { return m_stop; });
+}
+
+auto va::Heatmap::m_run() -> void {
+	va::place_thread("heatmap-flush");
+	while (m_wait(std::chrono::seconds(m_config.flush_interval_sec))) {
+		m_flush();
+	}
+}
+
+/**
+ * Write what every source counted since its last flush. An interval that
+ * fails to be written is folded into the next one.
+ */
+auto va::Heatmap::m_flush() -> void {
+	VA_TRACE_SCOPE("heatmap.flush");
+	if (m_config.store == "none") {
+		return;
+	}
+	va::HeatmapSnapshot current;
+	for (guint source_id = 0; source_id < m_sources.size(); ++source_id) {
+		if (!snapshot(source_id, current)) {
+			continue;
+		}
+		va::HeatmapSnapshot& last = m_flushed[source_id];
+		if (last.generation != current.generation || last.counts.size() != current.counts.size()) {
+			last = va::HeatmapSnapshot {};
+			last.generation = current.generation;
+			last.counts.assign(current.counts.size(), 0);
+		}
+		if (current.frames == last.frames) {
+			continue;
+		}
+		if (m_write(last, current)) {
+			++m_flushes;
+			std::swap(last, current);
+		} else {
+			++m_flush_failures;
+		}
+	}
+}
+
+/**
+ * <directory>/source-00/<from>-<to>.heatmap: a text header line, then the
+ * counts as little endian u32, row by row. A .pgm next to it scales them to
+ * 8 bits for a quick look.
+ */
+static auto write_heatmap_file(const std::string& directory, const va::HeatmapSnapshot& interval, guint width, guint height) -> bool {
+	gchar dir_name[32];
+	g_snprintf(dir_name, sizeof(dir_name), "source-%02u", interval.source_id);
+	std::string dir = directory + "/" + dir_name;
+	if (g_mkdir_with_parents(dir.c_str(), 0755) != 0) {
+		return false;
+	}
+	std::string base = dir + "/" + std::to_string(interval.first_timestamp) + "-" + std::to_string(interval.last_timestamp);
+	std::string path = base + ".heatmap";
+	std::string part = path + ".part";
+	FILE* file = fopen(part.c_str(), "wb");
+	if (!file) {
+		g_printerr("Heatmap: unable to open %s\n", part.c_str());
+		return false;
+	}
+	fprintf(file, "VAHEATMAP 1 %u %u %lu %lu %lu %s\n", width, height, (gulong)interval.frames,
+			(gulong)interval.first_timestamp, (gulong)interval.last_timestamp, interval.video_file.c_str());
+	std::vector<guint8> bytes(interval.counts.size() * 4);
+	for (gsize i = 0; i < interval.counts.size(); ++i) {
+		guint32 count = interval.counts[i];
+		bytes[i * 4] = count & 0xff;
+		bytes[i * 4 + 1] = (count >> 8) & 0xff;
+		bytes[i * 4 + 2] = (count >> 16) & 0xff;
+		bytes[i * 4 + 3] = count >> 24;
+	}
+	bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+	written = fclose(file) == 0 && written && rename(part.c_str(), path.c_str()) == 0;
+	if (!written) {
+		remove(part.c_str());
+		return false;
+	}
+
+	guint32 peak = std::max(1u, *std::max_element(interval.counts.begin(), interval.counts.end()));
+	std::string preview = base + ".pgm";
+	file = fopen(preview.c_str(), "wb");
+	if (file) {
+		fprintf(file, "P5\n%u %u\n255\n", width, height);
+		for (gsize i = 0; i < interval.counts.size(); ++i) {
+			bytes[i] = static_cast<guint8>(static_cast<guint64>(interval.counts[i]) * 255 / peak);
+		}
+		fwrite(bytes.data(), 1, interval.counts.size(), file);
+		fclose(file);
+	}
+	return true;
+}
+
+auto va::Heatmap::m_write(const va::HeatmapSnapshot& from, const va::HeatmapSnapshot& to) -> bool {
+	va::HeatmapSnapshot interval;
+	interval.source_id = to.source_id;
+	interval.video_file = to.video_file;
+	interval.generation = to.generation;
+	interval.frames = to.frames - from.frames;
+	interval.first_timestamp = from.frames ? from.last_timestamp : to.first_timestamp;
+	interval.last_timestamp = to.last_timestamp;
+	interval.counts.resize(to.counts.size());
+	for (gsize i = 0; i < to.counts.size(); ++i) {
+		interval.counts[i] = to.counts[i] - from.counts[i];
+	}
+
+	if ((m_config.store == "file" || m_config.store == "both") &&
+			!write_heatmap_file(m_config.directory, interval, m_config.width, m_config.height)) {
+		return false;
+	}
+	if (m_config.store == "database" || m_config.store == "both") {
+		va::Database* database = nullptr;
+		{
+			std::lock_guard<std::mutex> lock { m_mutex };
+			database = m_va_database;
+		}
+		if (!database) {
+			return false;
+		}
+		try {
+			database->insert_heatmap(interval.video_file, interval.source_id, m_config.width, m_config.height,
+					interval.first_timestamp, interval.last_timestamp, interval.frames, interval.counts);
+		} catch (sql::SQLException& e) {
+			std::cout << "# ERR: SQLException in " << __FILE__;
+			std::cout << "(" << __FUNCTION__ << ")" << std::endl;
+			std::cout << "# ERR: " << e.what();
+			std::cout << " (MySQL error code: " << e.getErrorCode();
+			std::cout << ", SQLState: " << e.getSQLState() << " )" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,166 @@
+#ifndef VA_ENGINE_HEATMAP_H_
+#define VA_ENGINE_HEATMAP_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glib.h>
+
+#include "va_database.h"
+#include "va_object_meta.h"
+
+namespace va {
+/**
+ * Heatmap settings, read from the "heatmap" group of the yml file
+ */
+struct HeatmapConfig {
+	bool enable = false;
+	/* cells of the grid of every source */
+	guint width = 192;
+	guint height = 108;
+	/* classes counted, all when empty */
+	std::vector<int> classes { 0, 2 };
+	/* part of the box, from its bottom edge, that is its footprint: 1 for the
+	 * whole box, 0.1 for the ground under a person */
+	double footprint = 1.0;
+	guint max_sources = 64;
+	/* how often readers get a fresh snapshot */
+	guint snapshot_ms = 1000;
+	/* how often the counts of the last interval are written out */
+	guint flush_interval_sec = 300;
+	/* file, database, both, or none to only keep snapshots in memory */
+	std::string store = "file";
+	std::string directory = "heatmaps";
+	/* auto, scalar, sse2, avx2 or neon */
+	std::string kernels = "auto";
+};
+
+auto parse_heatmap_config(const char* cfg_file, const char* group) -> HeatmapConfig;
+
+/**
+ * Box in frame coordinates normalized to 0..1
+ */
+struct HeatmapBox {
+	float left;
+	float top;
+	float width;
+	float height;
+};
+
+/**
+ * Adds value to n counts, one set per instruction set
+ */
+struct HeatmapKernels {
+	const char* name;
+	void (*add_span)(guint32* counts, guint n, guint32 value);
+};
+
+auto heatmap_kernels_available() -> std::vector<const HeatmapKernels*>;
+/* "auto" for the fastest, nullptr for a set this cpu does not run */
+auto heatmap_kernels_by_name(const std::string& name) -> const HeatmapKernels*;
+
+/**
+ * Counts of one source at one point in time
+ */
+struct HeatmapSnapshot {
+	guint source_id = 0;
+	std::string video_file;
+	/* bumped when the source id gets another uri and the counts restart */
+	guint64 generation = 0;
+	guint64 frames = 0;
+	guint64 first_timestamp = 0;
+	guint64 last_timestamp = 0;
+	std::vector<guint32> counts;
+};
+
+/**
+ * Per source occupancy grids, accumulated from every detection.
+ *
+ * add_frame() runs where detections are sunk, so frames the scene gate
+ * skipped count with the detections they were given. Each box is clipped to
+ * the grid and rasterized as one span per grid row, the spans added with
+ * SIMD. Every snapshot_ms the live grid of a source is published to the back
+ * of two snapshot buffers, which then becomes the front. Readers copy the
+ * front under a sequence number and retry when the writer came around to it
+ * meanwhile, so they never block the sink. A flusher thread writes the counts
+ * of every flush interval, the difference of two snapshots, as a file and/or
+ * a row of the heatmap table.
+ */
+struct Heatmap {
+	struct Buffer {
+		std::atomic<guint64> sequence { 0 };
+		guint64 generation = 0;
+		guint64 frames = 0;
+		guint64 first_timestamp = 0;
+		guint64 last_timestamp = 0;
+		std::vector<guint32> counts;
+	};
+
+	struct Source {
+		/* owned by the thread calling add_frame() */
+		std::vector<guint32> m_live;
+		guint64 m_frames = 0;
+		guint64 m_first_timestamp = 0;
+		guint64 m_last_timestamp = 0;
+		guint64 m_generation = 0;
+		std::string m_video_file;
+		std::chrono::steady_clock::time_point m_published;
+
+		Buffer m_buffers[2];
+		std::atomic<int> m_front { 0 };
+		std::atomic<bool> m_active { false };
+		/* m_shared_video_file under it, for readers */
+		std::mutex m_mutex;
+		std::string m_shared_video_file;
+	};
+
+	HeatmapConfig m_config;
+	const HeatmapKernels* m_kernels;
+	std::vector<bool> m_class_mask;
+	/* the frame the boxes of add_frame(FrameMetadata) are in */
+	double m_frame_width = 1920.0;
+	double m_frame_height = 1080.0;
+	std::vector<std::unique_ptr<Source>> m_sources;
+	std::vector<HeatmapBox> m_boxes;
+	std::atomic<guint64> m_frames_dropped { 0 };
+	va::Database* m_va_database = nullptr;
+
+	/* owned by the flusher thread: the snapshot each interval started from */
+	std::vector<HeatmapSnapshot> m_flushed;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	bool m_stop = false;
+	std::thread m_flusher;
+	std::atomic<guint64> m_flushes { 0 };
+	std::atomic<guint64> m_flush_failures { 0 };
+
+	Heatmap(const HeatmapConfig& config);
+	~Heatmap();
+
+	Heatmap(const Heatmap& other) = delete;
+	Heatmap& operator=(const Heatmap& other) = delete;
+
+	auto set_database(va::Database* _va_database) -> void;
+	auto set_frame_size(guint width, guint height) -> void;
+	auto counts_class(int class_id) const -> bool;
+	auto add_frame(guint source_id, const std::string& video_file, guint64 timestamp, const HeatmapBox* boxes, gsize count) -> void;
+	auto add_frame(guint source_id, const va::FrameMetadata& frame_meta) -> void;
+	auto snapshot(guint source_id, HeatmapSnapshot& out) -> bool;
+
+	auto m_rasterize(std::vector<guint32>& counts, const HeatmapBox& box) -> void;
+	auto m_publish(Source& source) -> void;
+	auto m_run() -> void;
+	auto m_wait(std::chrono::milliseconds duration) -> bool;
+	auto m_flush() -> void;
+	auto m_write(const HeatmapSnapshot& from, const HeatmapSnapshot& to) -> bool;
+};
+
+} // namespace va
+
+#endif
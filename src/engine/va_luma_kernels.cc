@@ -0,0 +1,253 @@
+#include "va_luma_kernels.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VA_LUMA_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define VA_LUMA_NEON 1
+#endif
+
+static auto accumulate_rows_scalar(const guint8* src, gsize pitch, guint width, guint rows, guint16* acc) -> void {
+	for (guint r = 0; r < rows; ++r) {
+		const guint8* row = src + r * pitch;
+		for (guint x = 0; x < width; ++x) {
+			acc[x] += row[x];
+		}
+	}
+}
+
+static auto count_changed_scalar(const guint8* a, const guint8* b, gsize n, guint8 threshold) -> gsize {
+	gsize changed = 0;
+	for (gsize i = 0; i < n; ++i) {
+		changed += std::abs(a[i] - b[i]) > threshold;
+	}
+	return changed;
+}
+
+static auto sad_scalar(const guint8* a, const guint8* b, gsize n) -> guint64 {
+	guint64 sum = 0;
+	for (gsize i = 0; i < n; ++i) {
+		sum += std::abs(a[i] - b[i]);
+	}
+	return sum;
+}
+
+static const va::LumaKernels scalar_kernels { "scalar", accumulate_rows_scalar, count_changed_scalar, sad_scalar };
+
+#ifdef VA_LUMA_X86
+/* SSE2 is part of x86-64, no check needed */
+static auto accumulate_rows_sse2(const guint8* src, gsize pitch, guint width, guint rows, guint16* acc) -> void {
+	const __m128i zero = _mm_setzero_si128();
+	guint x = 0;
+	for (; x + 16 <= width; x += 16) {
+		__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + x));
+		__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + x + 8));
+		for (guint r = 0; r < rows; ++r) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + r * pitch + x));
+			lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+			hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(acc + x), lo);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(acc + x + 8), hi);
+	}
+	if (x < width) {
+		accumulate_rows_scalar(src + x, pitch, width - x, rows, acc + x);
+	}
+}
+
+static auto count_changed_sse2(const guint8* a, const guint8* b, gsize n, guint8 threshold) -> gsize {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i limit = _mm_set1_epi8(static_cast<char>(threshold));
+	gsize changed = 0;
+	gsize i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+		__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+		__m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+		/* lanes at or under the threshold saturate to 0 */
+		int same = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(diff, limit), zero));
+		changed += 16 - __builtin_popcount(same);
+	}
+	return changed + count_changed_scalar(a + i, b + i, n - i, threshold);
+}
+
+static auto sad_sse2(const guint8* a, const guint8* b, gsize n) -> guint64 {
+	__m128i sum = _mm_setzero_si128();
+	gsize i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+		__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+	}
+	guint64 lanes[2];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sum);
+	return lanes[0] + lanes[1] + sad_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static auto accumulate_rows_avx2(const guint8* src, gsize pitch, guint width, guint rows, guint16* acc) -> void {
+	guint x = 0;
+	for (; x + 32 <= width; x += 32) {
+		__m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + x));
+		__m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + x + 16));
+		for (guint r = 0; r < rows; ++r) {
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + r * pitch + x));
+			lo = _mm256_add_epi16(lo, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+			hi = _mm256_add_epi16(hi, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + x), lo);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + x + 16), hi);
+	}
+	if (x < width) {
+		accumulate_rows_sse2(src + x, pitch, width - x, rows, acc + x);
+	}
+}
+
+__attribute__((target("avx2")))
+static auto count_changed_avx2(const guint8* a, const guint8* b, gsize n, guint8 threshold) -> gsize {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i limit = _mm256_set1_epi8(static_cast<char>(threshold));
+	gsize changed = 0;
+	gsize i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+		__m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+		__m256i diff = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+		unsigned same = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_subs_epu8(diff, limit), zero)));
+		changed += 32 - __builtin_popcount(same);
+	}
+	return changed + count_changed_sse2(a + i, b + i, n - i, threshold);
+}
+
+__attribute__((target("avx2")))
+static auto sad_avx2(const guint8* a, const guint8* b, gsize n) -> guint64 {
+	__m256i sum = _mm256_setzero_si256();
+	gsize i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+		__m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+		sum = _mm256_add_epi64(sum, _mm256_sad_epu8(va, vb));
+	}
+	guint64 lanes[4];
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), sum);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sad_sse2(a + i, b + i, n - i);
+}
+
+static const va::LumaKernels sse2_kernels { "sse2", accumulate_rows_sse2, count_changed_sse2, sad_sse2 };
+static const va::LumaKernels avx2_kernels { "avx2", accumulate_rows_avx2, count_changed_avx2, sad_avx2 };
+#endif
+
+#ifdef VA_LUMA_NEON
+/* NEON is part of aarch64 (Jetson), no check needed */
+static auto accumulate_rows_neon(const guint8* src, gsize pitch, guint width, guint rows, guint16* acc) -> void {
+	guint x = 0;
+	for (; x + 16 <= width; x += 16) {
+		uint16x8_t lo = vld1q_u16(acc + x);
+		uint16x8_t hi = vld1q_u16(acc + x + 8);
+		for (guint r = 0; r < rows; ++r) {
+			uint8x16_t v = vld1q_u8(src + r * pitch + x);
+			lo = vaddw_u8(lo, vget_low_u8(v));
+			hi = vaddw_u8(hi, vget_high_u8(v));
+		}
+		vst1q_u16(acc + x, lo);
+		vst1q_u16(acc + x + 8, hi);
+	}
+	if (x < width) {
+		accumulate_rows_scalar(src + x, pitch, width - x, rows, acc + x);
+	}
+}
+
+static auto count_changed_neon(const guint8* a, const guint8* b, gsize n, guint8 threshold) -> gsize {
+	const uint8x16_t limit = vdupq_n_u8(threshold);
+	gsize changed = 0;
+	gsize i = 0;
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t diff = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+		changed += vaddvq_u8(vshrq_n_u8(vcgtq_u8(diff, limit), 7));
+	}
+	return changed + count_changed_scalar(a + i, b + i, n - i, threshold);
+}
+
+static auto sad_neon(const guint8* a, const guint8* b, gsize n) -> guint64 {
+	guint64 total = 0;
+	gsize i = 0;
+	while (i + 16 <= n) {
+		/* 16 MB at most per round, so no u32 lane wraps */
+		gsize end = i + std::min<gsize>((n - i) & ~gsize(15), gsize(1) << 24);
+		uint32x4_t sum = vdupq_n_u32(0);
+		for (; i < end; i += 16) {
+			uint8x16_t diff = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+			sum = vpadalq_u16(sum, vpaddlq_u8(diff));
+		}
+		total += vaddlvq_u32(sum);
+	}
+	return total + sad_scalar(a + i, b + i, n - i);
+}
+
+static const va::LumaKernels neon_kernels { "neon", accumulate_rows_neon, count_changed_neon, sad_neon };
+#endif
+
+auto va::luma_kernels_scalar() -> const va::LumaKernels& {
+	return scalar_kernels;
+}
+
+auto va::luma_kernels() -> const va::LumaKernels& {
+	return *luma_kernels_available().back();
+}
+
+auto va::luma_kernels_available() -> std::vector<const va::LumaKernels*> {
+	std::vector<const va::LumaKernels*> available { &scalar_kernels };
+#ifdef VA_LUMA_X86
+	available.push_back(&sse2_kernels);
+	if (__builtin_cpu_supports("avx2")) {
+		available.push_back(&avx2_kernels);
+	}
+#endif
+#ifdef VA_LUMA_NEON
+	available.push_back(&neon_kernels);
+#endif
+	return available;
+}
+
+auto va::luma_kernels_by_name(const std::string& name) -> const va::LumaKernels* {
+	if (name == "auto") {
+		return &luma_kernels();
+	}
+	for (const va::LumaKernels* kernels : luma_kernels_available()) {
+		if (name == kernels->name) {
+			return kernels;
+		}
+	}
+	return nullptr;
+}
+
+auto va::luma_sampling(guint height, guint sig_height, guint rows_per_block) -> va::LumaSampling {
+	guint rows = std::min(height, sig_height * rows_per_block);
+	guint step = std::max(1u, height / std::max(1u, rows));
+	/* centered, so the top and bottom margins match */
+	guint first = (height - ((rows - 1) * step + 1)) / 2;
+	return { first, step, rows };
+}
+
+auto va::luma_signature(const va::LumaKernels& kernels, const guint8* rows, gsize pitch, guint width,
+		guint sig_width, guint sig_height, guint rows_per_block, guint16* acc, guint8* out) -> void {
+	for (guint band = 0; band < sig_height; ++band) {
+		std::fill(acc, acc + width, 0);
+		kernels.accumulate_rows(rows + band * rows_per_block * pitch, pitch, width, rows_per_block, acc);
+		/* sig_width sums over width accumulated columns, cheap next to the rows */
+		for (guint block = 0; block < sig_width; ++block) {
+			guint x0 = block * width / sig_width;
+			guint x1 = (block + 1) * width / sig_width;
+			guint32 sum = 0;
+			for (guint x = x0; x < x1; ++x) {
+				sum += acc[x];
+			}
+			guint32 count = (x1 - x0) * rows_per_block;
+			out[band * sig_width + block] = count ? (sum + count / 2) / count : 0;
+		}
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef VA_ENGINE_LUMA_KERNELS_H_
+#define VA_ENGINE_LUMA_KERNELS_H_
+
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+namespace va {
+/**
+ * The inner loops of the luma signature, one set per instruction set. Every
+ * set gives the same results as the scalar one.
+ */
+struct LumaKernels {
+	const char* name;
+	/* acc[x] += src[r * pitch + x] for rows rows, at most 255 of them */
+	void (*accumulate_rows)(const guint8* src, gsize pitch, guint width, guint rows, guint16* acc);
+	/* number of positions where a and b differ by more than threshold */
+	gsize (*count_changed)(const guint8* a, const guint8* b, gsize n, guint8 threshold);
+	/* sum of absolute differences */
+	guint64 (*sad)(const guint8* a, const guint8* b, gsize n);
+};
+
+auto luma_kernels_scalar() -> const LumaKernels&;
+/* the fastest set this cpu runs */
+auto luma_kernels() -> const LumaKernels&;
+/* every set this cpu runs, scalar first */
+auto luma_kernels_available() -> std::vector<const LumaKernels*>;
+/* "auto" for luma_kernels(), nullptr for a set this cpu does not run */
+auto luma_kernels_by_name(const std::string& name) -> const LumaKernels*;
+
+/**
+ * Rows of a height tall frame a signature of sig_height x rows_per_block rows
+ * reads: first, first + step, ... evenly spread over the frame
+ */
+struct LumaSampling {
+	guint first;
+	guint step;
+	guint rows;
+};
+
+auto luma_sampling(guint height, guint sig_height, guint rows_per_block) -> LumaSampling;
+
+/**
+ * Downscale sig_height x rows_per_block sampled rows, pitch apart, to
+ * sig_width x sig_height block means. acc holds width entries.
+ */
+auto luma_signature(const LumaKernels& kernels, const guint8* rows, gsize pitch, guint width,
+		guint sig_width, guint sig_height, guint rows_per_block, guint16* acc, guint8* out) -> void;
+
+} // namespace va
+
+#endif
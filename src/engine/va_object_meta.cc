@@ -2,12 +2,15 @@
 
 #include <iostream>
 
+#include "va_trace.h"
+
 va::ObjectMetadata::ObjectMetadata() : object_label("a"), class_id(0), left(0.0), top(0.0), width(0.0), height(0.0), timestamp(0) {}
 
 va::ObjectMetadata::ObjectMetadata(NvDsObjectMeta* _metadata, std::string _object_label, guint64 _timestamp) :
 	object_label(_object_label),
 	timestamp(_timestamp)
 {
+	VA_TRACE_SCOPE("object_meta");
 	NvOSD_RectParams rect = _metadata->rect_params;
 	class_id = _metadata->class_id;
 	left = rect.left;
@@ -25,6 +28,24 @@ va::ObjectMetadata::ObjectMetadata(NvDsObjectMeta* _metadata, std::string _objec
 	height = rect.height;
 }
 
+va::ObjectMetadata::ObjectMetadata(
+	std::string _object_label,
+	int _class_id,
+	double _left,
+	double _top,
+	double _width,
+	double _height,
+	guint64 _timestamp
+) :
+	object_label(_object_label),
+	class_id(_class_id),
+	left(_left),
+	top(_top),
+	width(_width),
+	height(_height),
+	timestamp(_timestamp)
+{}
+
 va::ObjectMetadata::~ObjectMetadata() {
 	// std::cout << "object metadata deallocated" << std::endl;
 }
@@ -32,6 +32,7 @@ struct ObjectMetadata {
 	ObjectMetadata();
 	ObjectMetadata(NvDsObjectMeta* _metadata, std::string _object_label, guint64 _timestamp);
 	ObjectMetadata(NvDsObjectMeta* _metadata, std::string _object_label);
+	ObjectMetadata(std::string _object_label, int _class_id, double _left, double _top, double _width, double _height, guint64 _timestamp);
 	~ObjectMetadata();
 	friend auto operator<<(std::ostream& os, const ObjectMetadata& bbox) -> std::ostream&;
 };
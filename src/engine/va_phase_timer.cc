@@ -0,0 +1,46 @@
+#include "va_phase_timer.h"
+
+#include <glib.h>
+
+static auto ms_between(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) -> double {
+	return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+va::PhaseTimer::PhaseTimer(std::string name) : m_name(std::move(name)) {
+	restart();
+}
+
+auto va::PhaseTimer::restart() -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	m_start = m_last = std::chrono::steady_clock::now();
+	m_phases.clear();
+}
+
+/**
+ * End the current phase, returns its duration in ms
+ */
+auto va::PhaseTimer::mark(const std::string& phase) -> double {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	auto now = std::chrono::steady_clock::now();
+	double duration = ms_between(m_last, now);
+	m_phases.emplace_back(phase, duration);
+	m_last = now;
+	return duration;
+}
+
+auto va::PhaseTimer::elapsed_ms() -> double {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	return ms_between(m_start, std::chrono::steady_clock::now());
+}
+
+auto va::PhaseTimer::report() -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	double total = ms_between(m_start, m_last);
+	g_print("%s: %.1f ms\n", m_name.c_str(), total);
+	double at = 0.0;
+	for (const auto& phase : m_phases) {
+		at += phase.second;
+		g_print("  %-28s %10.1f ms  (at %10.1f ms, %5.1f%%)\n", phase.first.c_str(), phase.second, at,
+				total > 0.0 ? 100.0 * phase.second / total : 0.0);
+	}
+}
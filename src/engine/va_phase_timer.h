@@ -0,0 +1,37 @@
+#ifndef VA_ENGINE_PHASE_TIMER_H_
+#define VA_ENGINE_PHASE_TIMER_H_
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace va {
+/**
+ * Wall clock time spent in consecutive phases of a longer operation, such as
+ * engine startup or a config reload. mark() ends the current phase and may
+ * be called from any thread, e.g. the bus watch or a streaming thread.
+ */
+struct PhaseTimer {
+	std::string m_name;
+	std::mutex m_mutex;
+	std::chrono::steady_clock::time_point m_start;
+	std::chrono::steady_clock::time_point m_last;
+	/* phase name and its duration in ms */
+	std::vector<std::pair<std::string, double>> m_phases;
+
+	PhaseTimer(std::string name);
+
+	PhaseTimer(const PhaseTimer& other) = delete;
+	PhaseTimer& operator=(const PhaseTimer& other) = delete;
+
+	auto restart() -> void;
+	auto mark(const std::string& phase) -> double;
+	auto elapsed_ms() -> double;
+	auto report() -> void;
+};
+
+} // namespace va
+
+#endif
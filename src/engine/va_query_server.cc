@@ -0,0 +1,202 @@
+#include "va_query_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "va_thread_placement.h"
+#include "va_trace.h"
+
+/* beyond this many open connections new ones are closed right away */
+#define VA_QUERY_MAX_CONNECTIONS 64
+/* a request line longer than this closes the connection */
+#define VA_QUERY_MAX_LINE 256
+
+va::QueryServer::QueryServer(va::DetectionCache* cache, guint port) : m_cache(cache) {
+	m_listener = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	/* no authentication, never reachable from another host */
+	struct sockaddr_in address = { };
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+	if (m_listener < 0 || bind(m_listener, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0
+			|| listen(m_listener, 16) != 0) {
+		std::string error = strerror(errno);
+		if (m_listener >= 0) {
+			close(m_listener);
+		}
+		throw std::runtime_error("Unable to listen for detection queries on port " + std::to_string(port) + ": " + error + "\n");
+	}
+	m_acceptor = std::thread { &va::QueryServer::m_accept_loop, this };
+	g_print("Detection queries on 127.0.0.1:%u\n", this->port());
+}
+
+va::QueryServer::~QueryServer() {
+	std::map<int, std::thread> connections;
+	{
+		std::lock_guard<std::mutex> lock { m_mutex };
+		m_stop = true;
+		for (auto& connection : m_connections) {
+			shutdown(connection.first, SHUT_RDWR);
+		}
+		connections.swap(m_connections);
+	}
+	/* wakes the blocked accept() */
+	shutdown(m_listener, SHUT_RDWR);
+	m_acceptor.join();
+	close(m_listener);
+	for (auto& connection : connections) {
+		connection.second.join();
+	}
+	g_print("Detection queries: %lu answered\n", (unsigned long)m_queries.load());
+}
+
+auto va::QueryServer::port() const -> guint {
+	struct sockaddr_in address = { };
+	socklen_t length = sizeof(address);
+	getsockname(m_listener, reinterpret_cast<struct sockaddr*>(&address), &length);
+	return ntohs(address.sin_port);
+}
+
+auto va::QueryServer::m_accept_loop() -> void {
+	va::place_thread("cache-query");
+	for (;;) {
+		int fd = accept(m_listener, nullptr, nullptr);
+		std::lock_guard<std::mutex> lock { m_mutex };
+		if (m_stop) {
+			if (fd >= 0) {
+				close(fd);
+			}
+			break;
+		}
+		if (fd < 0) {
+			continue;
+		}
+		if (m_connections.size() >= VA_QUERY_MAX_CONNECTIONS) {
+			close(fd);
+			continue;
+		}
+		m_connections[fd] = std::thread { &va::QueryServer::m_serve, this, fd };
+	}
+	va::leave_thread();
+}
+
+static auto send_all(int fd, const std::string& data) -> bool {
+	const char* cursor = data.data();
+	size_t left = data.size();
+	while (left > 0) {
+		ssize_t sent = send(fd, cursor, left, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		cursor += sent;
+		left -= sent;
+	}
+	return true;
+}
+
+auto va::QueryServer::m_serve(int fd) -> void {
+	va::place_thread("cache-query");
+	std::string buffer;
+	char chunk[4096];
+	for (bool open = true; open;) {
+		ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+		if (received <= 0) {
+			break;
+		}
+		buffer.append(chunk, received);
+		size_t end;
+		while (open && (end = buffer.find('\n')) != std::string::npos) {
+			open = send_all(fd, m_answer(buffer.substr(0, end)));
+			buffer.erase(0, end + 1);
+		}
+		open = open && buffer.size() <= VA_QUERY_MAX_LINE;
+	}
+	va::leave_thread();
+
+	std::lock_guard<std::mutex> lock { m_mutex };
+	/* on stop the destructor joins what is left in the map it took */
+	if (!m_stop) {
+		m_connections[fd].detach();
+		m_connections.erase(fd);
+	}
+	close(fd);
+}
+
+static auto append_json_string(std::string* out, const std::string& value) -> void {
+	out->push_back('"');
+	for (char c : value) {
+		if (c == '"' || c == '\\') {
+			out->push_back('\\');
+			out->push_back(c);
+		} else if (static_cast<unsigned char>(c) >= 0x20) {
+			out->push_back(c);
+		}
+	}
+	out->push_back('"');
+}
+
+/**
+ * Answer one request line, the reply ends with a newline
+ */
+auto va::QueryServer::m_answer(const std::string& request) -> std::string {
+	VA_TRACE_SCOPE("cache.serve");
+	std::istringstream words { request };
+	guint source_id = 0;
+	std::string from_word;
+	guint64 from = 0;
+	guint64 to = 0;
+	if (!(words >> source_id >> from_word)) {
+		return "{\"error\":\"expected <source id> <from ns> <to ns> or <source id> last <seconds>\"}\n";
+	}
+	try {
+		if (from_word == "last") {
+			guint64 seconds = 0;
+			if (!(words >> seconds)) {
+				return "{\"error\":\"expected <source id> last <seconds>\"}\n";
+			}
+			to = static_cast<guint64>(g_get_real_time()) * 1000;
+			from = to > seconds * 1000000000ULL ? to - seconds * 1000000000ULL : 0;
+		} else if (!(words >> to)) {
+			return "{\"error\":\"expected <source id> <from ns> <to ns>\"}\n";
+		} else {
+			from = std::stoull(from_word);
+		}
+	} catch (std::exception&) {
+		return "{\"error\":\"bad timestamp\"}\n";
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<va::ObjectMetadata> detections = m_cache->query(source_id, from, to);
+	double query_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	++m_queries;
+
+	char number[160];
+	snprintf(number, sizeof(number), "{\"source\":%u,\"from\":%lu,\"to\":%lu,\"query_us\":%.1f,\"count\":%zu,\"detections\":[",
+			source_id, (unsigned long)from, (unsigned long)to, query_us, detections.size());
+	std::string reply { number };
+	reply.reserve(reply.size() + detections.size() * 128);
+	for (size_t i = 0; i < detections.size(); ++i) {
+		const va::ObjectMetadata& object_meta = detections[i];
+		reply += i ? ",{\"label\":" : "{\"label\":";
+		append_json_string(&reply, object_meta.object_label);
+		snprintf(number, sizeof(number), ",\"class_id\":%d,\"left\":%.1f,\"top\":%.1f,\"width\":%.1f,\"height\":%.1f,\"timestamp\":%lu}",
+				object_meta.class_id, object_meta.left, object_meta.top, object_meta.width, object_meta.height,
+				(unsigned long)object_meta.timestamp);
+		reply += number;
+	}
+	reply += "]}\n";
+	return reply;
+}
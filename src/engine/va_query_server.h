@@ -0,0 +1,55 @@
+#ifndef VA_ENGINE_QUERY_SERVER_H_
+#define VA_ENGINE_QUERY_SERVER_H_
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <glib.h>
+
+#include "va_detection_cache.h"
+
+namespace va {
+/**
+ * Answers detection queries of other processes from the detection cache, on
+ * a loopback TCP port. One request per line, one JSON object per line back:
+ *
+ *   <source id> <from ns> <to ns>      detections with from <= timestamp <= to
+ *   <source id> last <seconds>         detections of the last seconds
+ *
+ *   {"source":0,"from":...,"to":...,"query_us":4.1,"count":2,"detections":[
+ *    {"label":"Car","class_id":2,"left":..,"top":..,"width":..,"height":..,"timestamp":..},...]}
+ *   {"error":"..."}
+ *
+ * query_us is the time the cache took, database fallback included.
+ */
+struct QueryServer {
+	va::DetectionCache* m_cache;
+	int m_listener = -1;
+	std::thread m_acceptor;
+
+	std::mutex m_mutex;
+	bool m_stop = false;
+	/* open connections by socket, shut down on stop */
+	std::map<int, std::thread> m_connections;
+	std::atomic<guint64> m_queries { 0 };
+
+	/* port 0 takes any free port, see port() */
+	QueryServer(va::DetectionCache* cache, guint port);
+	~QueryServer();
+
+	QueryServer(const QueryServer& other) = delete;
+	QueryServer& operator=(const QueryServer& other) = delete;
+
+	auto port() const -> guint;
+
+	auto m_accept_loop() -> void;
+	auto m_serve(int fd) -> void;
+	auto m_answer(const std::string& request) -> std::string;
+};
+
+} // namespace va
+
+#endif
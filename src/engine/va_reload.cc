@@ -0,0 +1,121 @@
+#include "va_reload.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <sstream>
+
+#include <yaml-cpp/yaml.h>
+
+/**
+ * Split the semicolon separated uri list of the source-list group
+ */
+static auto split_source_list(const std::string& list) -> std::vector<std::string> {
+	std::vector<std::string> uris;
+	std::stringstream stream { list };
+	std::string uri;
+	while (std::getline(stream, uri, ';')) {
+		uri.erase(0, uri.find_first_not_of(" \t\r\n"));
+		uri.erase(uri.find_last_not_of(" \t\r\n") + 1);
+		if (!uri.empty()) {
+			uris.push_back(uri);
+		}
+	}
+	return uris;
+}
+
+auto va::load_config_snapshot(const char* cfg_file, const char* pgie_config_file) -> va::ConfigSnapshot {
+	va::ConfigSnapshot snapshot {};
+	YAML::Node root = YAML::LoadFile(cfg_file);
+	for (const auto& group : root) {
+		std::string name = group.first.as<std::string>();
+		if (name == "source-list") {
+			snapshot.m_sources = split_source_list(group.second["list"].as<std::string>(""));
+			continue;
+		}
+		YAML::Emitter emitter;
+		emitter << group.second;
+		snapshot.m_groups[name] = emitter.c_str();
+	}
+
+	std::ifstream pgie { pgie_config_file, std::ios::binary };
+	snapshot.m_pgie_config.assign(std::istreambuf_iterator<char> { pgie }, std::istreambuf_iterator<char> {});
+	return snapshot;
+}
+
+auto va::ReloadPlan::empty() const -> bool {
+	return !m_streammux && !m_osd && !m_tiler && !m_sink && !m_pgie && !m_source_policy &&
+		m_removed_sources.empty() && m_added_sources.empty() && m_restart_groups.empty();
+}
+
+auto va::plan_reload(const va::ConfigSnapshot& running, const va::ConfigSnapshot& next) -> va::ReloadPlan {
+	va::ReloadPlan plan {};
+
+	std::set<std::string> names;
+	for (const auto& group : running.m_groups) {
+		names.insert(group.first);
+	}
+	for (const auto& group : next.m_groups) {
+		names.insert(group.first);
+	}
+	for (const std::string& name : names) {
+		auto before = running.m_groups.find(name);
+		auto after = next.m_groups.find(name);
+		bool changed = before == running.m_groups.end() || after == next.m_groups.end() || before->second != after->second;
+		if (!changed) {
+			continue;
+		}
+		if (name == "streammux") {
+			plan.m_streammux = true;
+		} else if (name == "osd") {
+			plan.m_osd = true;
+		} else if (name == "tiler") {
+			plan.m_tiler = true;
+		} else if (name == "sink") {
+			plan.m_sink = true;
+		} else if (name == "source-policy") {
+			plan.m_source_policy = true;
+		} else {
+			plan.m_restart_groups.push_back(name);
+		}
+	}
+	plan.m_pgie = running.m_pgie_config != next.m_pgie_config;
+
+	/* uris still wanted keep their slot, as many times as they are listed */
+	std::multiset<std::string> wanted { next.m_sources.begin(), next.m_sources.end() };
+	plan.m_sources = running.m_sources;
+	for (guint i = 0; i < plan.m_sources.size(); ++i) {
+		if (plan.m_sources[i].empty()) {
+			continue;
+		}
+		auto it = wanted.find(plan.m_sources[i]);
+		if (it != wanted.end()) {
+			wanted.erase(it);
+		} else {
+			plan.m_removed_sources.push_back(i);
+			plan.m_sources[i].clear();
+		}
+	}
+
+	/* what is left is new, in file order */
+	for (const std::string& uri : next.m_sources) {
+		auto it = wanted.find(uri);
+		if (it == wanted.end()) {
+			continue;
+		}
+		wanted.erase(it);
+		auto slot = std::find(plan.m_sources.begin(), plan.m_sources.end(), std::string {});
+		if (slot == plan.m_sources.end()) {
+			slot = plan.m_sources.insert(plan.m_sources.end(), std::string {});
+		}
+		*slot = uri;
+		plan.m_added_sources.emplace_back(static_cast<guint>(slot - plan.m_sources.begin()), uri);
+	}
+
+	/* trailing free slots are dropped so the tiler grid can shrink */
+	while (!plan.m_sources.empty() && plan.m_sources.back().empty()) {
+		plan.m_sources.pop_back();
+	}
+	return plan;
+}
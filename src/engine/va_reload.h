@@ -0,0 +1,63 @@
+#ifndef VA_ENGINE_RELOAD_H_
+#define VA_ENGINE_RELOAD_H_
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glib.h>
+
+namespace va {
+/**
+ * The parts of the yml config the engine can apply while running, as last
+ * loaded or applied
+ */
+struct ConfigSnapshot {
+	/* canonical yaml of every top level group except the source list */
+	std::map<std::string, std::string> m_groups;
+	/* source uri per source id, an empty uri is a free slot */
+	std::vector<std::string> m_sources;
+	/* contents of the nvinfer config file */
+	std::string m_pgie_config;
+};
+
+/**
+ * Read cfg_file and the nvinfer config it refers to. Sources are listed in
+ * file order, slots are only assigned by plan_reload.
+ */
+auto load_config_snapshot(const char* cfg_file, const char* pgie_config_file) -> ConfigSnapshot;
+
+/**
+ * What has to change to go from the running config to the new one
+ */
+struct ReloadPlan {
+	/* property-only changes, applied to the live elements */
+	bool m_streammux = false;
+	bool m_osd = false;
+	bool m_tiler = false;
+	bool m_sink = false;
+	bool m_pgie = false;
+	/* decode policies, applied by rebuilding the sources whose policy changed */
+	bool m_source_policy = false;
+	/* source bins to tear down, then to build, by source id */
+	std::vector<guint> m_removed_sources;
+	std::vector<std::pair<guint, std::string>> m_added_sources;
+	/* changed groups that are only read at startup */
+	std::vector<std::string> m_restart_groups;
+	/* source slots after the reload */
+	std::vector<std::string> m_sources;
+
+	auto empty() const -> bool;
+};
+
+/**
+ * Diff the new config against the running one. Sources whose uri is still
+ * listed keep their source id, so streams that did not change are neither
+ * rebuilt nor renumbered; new uris take the lowest free ids.
+ */
+auto plan_reload(const ConfigSnapshot& running, const ConfigSnapshot& next) -> ReloadPlan;
+
+} // namespace va
+
+#endif
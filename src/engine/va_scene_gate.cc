@@ -0,0 +1,206 @@
+#include "va_scene_gate.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <yaml-cpp/yaml.h>
+
+#include "va_trace.h"
+
+auto va::parse_scene_gate_config(const char* cfg_file, const char* group) -> va::SceneGateConfig {
+	va::SceneGateConfig config {};
+	YAML::Node node = YAML::LoadFile(cfg_file)[group];
+	if (!node) {
+		return config;
+	}
+	config.enable = node["enable"].as<int>(config.enable) != 0;
+	config.signature_width = std::max(1u, node["signature-width"].as<guint>(config.signature_width));
+	config.signature_height = std::max(1u, node["signature-height"].as<guint>(config.signature_height));
+	config.rows_per_block = std::clamp(node["rows-per-block"].as<guint>(config.rows_per_block), 1u, 255u);
+	config.block_threshold = std::min(255u, node["block-threshold"].as<guint>(config.block_threshold));
+	config.min_changed_blocks = std::max(1u, node["min-changed-blocks"].as<guint>(config.min_changed_blocks));
+	config.refresh_sec = node["refresh-sec"].as<double>(config.refresh_sec);
+	config.max_pending = node["max-pending"].as<guint>(config.max_pending);
+	config.kernels = node["kernels"].as<std::string>(config.kernels);
+	return config;
+}
+
+va::SceneGate::SceneGate(const va::SceneGateConfig& config) :
+	m_config(config),
+	m_kernels(va::luma_kernels_by_name(config.kernels)),
+	m_refresh_ns(static_cast<guint64>(std::max(0.0, config.refresh_sec) * 1e9))
+{
+	if (!m_kernels) {
+		throw std::invalid_argument("Scene gate: no " + config.kernels + " kernels on this cpu. Exiting.\n");
+	}
+	g_print("Scene gate: %ux%u signature, %s kernels, static under %u changed blocks, refresh every %.1f s\n",
+			m_config.signature_width, m_config.signature_height, m_kernels->name, m_config.min_changed_blocks, m_config.refresh_sec);
+}
+
+auto va::SceneGate::set_sink(std::function<void(guint, va::FrameMetadata&)> sink) -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	m_sink = std::move(sink);
+}
+
+auto va::SceneGate::m_source(guint source_id) -> Source& {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	std::unique_ptr<Source>& source = m_sources[source_id];
+	if (!source) {
+		source = std::make_unique<Source>();
+	}
+	return *source;
+}
+
+/**
+ * Signature of the luma plane of frame into source.m_signature. Device memory
+ * is read with one strided copy of the sampled rows.
+ */
+auto va::SceneGate::m_signature(Source& source, const va::FrameView& frame) -> bool {
+	VA_TRACE_SCOPE("scene_gate.signature");
+	if (frame.format == va::FrameView::Format::RGBA || !frame.planes[0] || frame.width == 0 || frame.height == 0) {
+		return false;
+	}
+	guint sig_width = std::min(m_config.signature_width, frame.width);
+	guint sig_height = std::min(m_config.signature_height, frame.height);
+	guint rows_per_block = std::max(1u, std::min(m_config.rows_per_block, frame.height / sig_height));
+	va::LumaSampling sampling = va::luma_sampling(frame.height, sig_height, rows_per_block);
+
+	const guint8* rows = frame.planes[0] + static_cast<gsize>(sampling.first) * frame.pitches[0];
+	gsize pitch = static_cast<gsize>(frame.pitches[0]) * sampling.step;
+	if (frame.device) {
+		source.m_rows.resize(static_cast<gsize>(frame.width) * sampling.rows);
+		if (!va::copy_plane(source.m_rows.data(), rows, pitch, frame.width, sampling.rows, true)) {
+			return false;
+		}
+		rows = source.m_rows.data();
+		pitch = frame.width;
+	}
+	source.m_acc.resize(frame.width);
+	source.m_signature.resize(sig_width * sig_height);
+	va::luma_signature(*m_kernels, rows, pitch, frame.width, sig_width, sig_height, rows_per_block,
+			source.m_acc.data(), source.m_signature.data());
+	return true;
+}
+
+/**
+ * Whether the frame of source_id at pts goes to inference. Frames without a
+ * signature (RGBA, unreadable memory) always do.
+ */
+auto va::SceneGate::decide(guint source_id, const va::FrameView& frame, bool pts_valid, guint64 pts, guint* changed_blocks) -> Decision {
+	VA_TRACE_SCOPE("scene_gate.decide");
+	Source& source = m_source(source_id);
+	bool have_signature = m_signature(source, frame);
+	guint changed = static_cast<guint>(source.m_signature.size());
+	Decision decision = Decision::INFER;
+	if (have_signature && pts_valid && source.m_have_reference && source.m_reference.size() == source.m_signature.size() &&
+			pts >= source.m_reference_pts) {
+		changed = m_kernels->count_changed(source.m_signature.data(), source.m_reference.data(), source.m_signature.size(), m_config.block_threshold);
+		if (changed < m_config.min_changed_blocks) {
+			decision = pts - source.m_reference_pts >= m_refresh_ns ? Decision::REFRESH : Decision::SKIP;
+		}
+	}
+	if (changed_blocks) {
+		*changed_blocks = changed;
+	}
+
+	if (decision != Decision::SKIP) {
+		/* the next frames are compared with this one */
+		source.m_reference.swap(source.m_signature);
+		source.m_have_reference = have_signature;
+		source.m_reference_pts = pts;
+		++(decision == Decision::REFRESH ? source.m_refreshed : source.m_inferred);
+	} else {
+		++source.m_skipped;
+	}
+
+	std::lock_guard<std::mutex> lock { m_mutex };
+	if (decision != Decision::SKIP) {
+		source.m_admitted_pts = pts;
+		source.m_admitted = true;
+	} else if (source.m_sunk && source.m_sunk_pts == source.m_admitted_pts && source.m_pending.empty()) {
+		/* nothing of this source between here and the probe */
+		m_sink_reused(source_id, source, pts);
+	} else {
+		source.m_pending.push_back(pts);
+		if (source.m_pending.size() > m_config.max_pending) {
+			source.m_pending.pop_front();
+			++source.m_pending_dropped;
+		}
+	}
+	return decision;
+}
+
+/**
+ * Sink an inferred frame from the probe thread, after the skipped frames of
+ * its source that came before it, and keep its detections for the next ones
+ */
+auto va::SceneGate::sink_inferred(guint source_id, guint64 pts, va::FrameMetadata& frame_meta) -> void {
+	VA_TRACE_SCOPE("scene_gate.sink");
+	std::lock_guard<std::mutex> lock { m_mutex };
+	auto found = m_sources.find(source_id);
+	if (found == m_sources.end()) {
+		if (m_sink) {
+			m_sink(source_id, frame_meta);
+		}
+		return;
+	}
+	Source& source = *found->second;
+	while (!source.m_pending.empty() && source.m_pending.front() < pts) {
+		if (source.m_sunk) {
+			m_sink_reused(source_id, source, source.m_pending.front());
+		} else {
+			++source.m_pending_dropped;
+		}
+		source.m_pending.pop_front();
+	}
+	if (m_sink) {
+		m_sink(source_id, frame_meta);
+	}
+	source.m_last = frame_meta;
+	source.m_sunk_pts = pts;
+	source.m_sunk_ntp = frame_meta.timestamp;
+	source.m_sunk = true;
+	if (source.m_admitted && source.m_sunk_pts == source.m_admitted_pts) {
+		for (guint64 pending_pts : source.m_pending) {
+			m_sink_reused(source_id, source, pending_pts);
+		}
+		source.m_pending.clear();
+	}
+}
+
+/**
+ * The detections of the last inferred frame, at the time of pts. Called
+ * under m_mutex.
+ */
+auto va::SceneGate::m_sink_reused(guint source_id, Source& source, guint64 pts) -> void {
+	guint64 timestamp = source.m_sunk_ntp + (pts > source.m_sunk_pts ? pts - source.m_sunk_pts : 0);
+	va::FrameMetadata frame_meta = source.m_last;
+	frame_meta.timestamp = timestamp;
+	for (va::ObjectMetadata& object_meta : frame_meta.va_object_meta_list) {
+		object_meta.timestamp = timestamp;
+	}
+	if (m_sink) {
+		m_sink(source_id, frame_meta);
+	}
+	++source.m_reused;
+}
+
+/**
+ * Forget a source, once its bin is stopped
+ */
+auto va::SceneGate::remove_source(guint source_id) -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	m_sources.erase(source_id);
+}
+
+auto va::SceneGate::print_stats() -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	for (const auto& entry : m_sources) {
+		const Source& source = *entry.second;
+		guint64 inferred = source.m_inferred + source.m_refreshed;
+		guint64 total = inferred + source.m_skipped;
+		g_print("Source %u scene gate: %lu inferred (%lu refreshes), %lu skipped (%.1f%%), %lu sunk with reused detections, %lu dropped\n",
+				entry.first, (gulong)inferred, (gulong)source.m_refreshed, (gulong)source.m_skipped,
+				total ? 100.0 * source.m_skipped / total : 0.0, (gulong)source.m_reused, (gulong)source.m_pending_dropped);
+	}
+}
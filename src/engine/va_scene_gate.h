@@ -0,0 +1,115 @@
+#ifndef VA_ENGINE_SCENE_GATE_H_
+#define VA_ENGINE_SCENE_GATE_H_
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+#include "va_frame_view.h"
+#include "va_luma_kernels.h"
+#include "va_object_meta.h"
+
+namespace va {
+/**
+ * Scene gate settings, read from the "scene-gate" group of the yml file
+ */
+struct SceneGateConfig {
+	bool enable = false;
+	/* blocks of the luma signature */
+	guint signature_width = 64;
+	guint signature_height = 36;
+	/* luma rows read per block row, at most 255 */
+	guint rows_per_block = 4;
+	/* mean luma difference, 0-255, at which a block counts as changed */
+	guint block_threshold = 10;
+	/* frames with fewer changed blocks than this are static */
+	guint min_changed_blocks = 4;
+	/* static sources still go to inference this often, in stream time */
+	double refresh_sec = 5.0;
+	/* skipped frames waiting for the inferred frames before them */
+	guint max_pending = 256;
+	/* auto, scalar, sse2, avx2 or neon */
+	std::string kernels = "auto";
+};
+
+auto parse_scene_gate_config(const char* cfg_file, const char* group) -> SceneGateConfig;
+
+/**
+ * Skips inference on frames that look like the last frame inferred.
+ *
+ * decide() runs on the streaming thread of a source, on its decoded frames
+ * right before the muxer. It reads a few luma rows per block row, copying only
+ * those off the GPU, and reduces them to a signature of block means with the
+ * SIMD kernels of va_luma_kernels.h. A frame is skipped when fewer than
+ * min_changed_blocks blocks moved away from the signature of the last
+ * inferred frame, so slow drift adds up until it is inferred. A static source
+ * is still inferred every refresh_sec.
+ *
+ * Skipped frames get the detections of the last inferred frame of their
+ * source. They go to the sink in order with the inferred ones: inferred frames
+ * pass through sink_inferred() on the probe thread, skipped frames queue until
+ * the frames inferred before them are sunk. Every sink call is made under one
+ * lock, so the sinks still see a single writer.
+ */
+struct SceneGate {
+	enum class Decision { INFER, REFRESH, SKIP };
+
+	struct Source {
+		/* owned by the streaming thread of the source */
+		std::vector<guint8> m_signature;
+		std::vector<guint8> m_reference;
+		std::vector<guint8> m_rows;
+		std::vector<guint16> m_acc;
+		bool m_have_reference = false;
+		guint64 m_reference_pts = 0;
+
+		/* under m_mutex */
+		guint64 m_admitted_pts = 0;
+		bool m_admitted = false;
+		guint64 m_sunk_pts = 0;
+		bool m_sunk = false;
+		guint64 m_sunk_ntp = 0;
+		va::FrameMetadata m_last { "", 0 };
+		std::deque<guint64> m_pending;
+
+		std::atomic<guint64> m_inferred { 0 };
+		std::atomic<guint64> m_refreshed { 0 };
+		std::atomic<guint64> m_skipped { 0 };
+		std::atomic<guint64> m_reused { 0 };
+		std::atomic<guint64> m_pending_dropped { 0 };
+	};
+
+	SceneGateConfig m_config;
+	const va::LumaKernels* m_kernels;
+	guint64 m_refresh_ns;
+	std::function<void(guint, va::FrameMetadata&)> m_sink;
+
+	std::mutex m_mutex;
+	std::map<guint, std::unique_ptr<Source>> m_sources;
+
+	SceneGate(const SceneGateConfig& config);
+
+	SceneGate(const SceneGate& other) = delete;
+	SceneGate& operator=(const SceneGate& other) = delete;
+
+	auto set_sink(std::function<void(guint, va::FrameMetadata&)> sink) -> void;
+	auto decide(guint source_id, const va::FrameView& frame, bool pts_valid, guint64 pts, guint* changed_blocks = nullptr) -> Decision;
+	auto sink_inferred(guint source_id, guint64 pts, va::FrameMetadata& frame_meta) -> void;
+	auto remove_source(guint source_id) -> void;
+	auto print_stats() -> void;
+
+	auto m_source(guint source_id) -> Source&;
+	auto m_signature(Source& source, const va::FrameView& frame) -> bool;
+	auto m_sink_reused(guint source_id, Source& source, guint64 pts) -> void;
+};
+
+} // namespace va
+
+#endif
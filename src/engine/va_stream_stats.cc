@@ -0,0 +1,92 @@
+#include "va_stream_stats.h"
+
+#include <algorithm>
+
+va::StreamStats::StreamStats(guint max_sources)
+	: m_max_sources(std::max(1u, max_sources)),
+	m_frames(new std::atomic<guint64>[m_max_sources]),
+	m_latency(new std::atomic<guint64>[LATENCY_BUCKETS]) {
+	for (guint i = 0; i < m_max_sources; ++i) {
+		m_frames[i] = 0;
+	}
+	for (guint i = 0; i < LATENCY_BUCKETS; ++i) {
+		m_latency[i] = 0;
+	}
+}
+
+/**
+ * Count one frame. Source ids past max_sources share the last counter.
+ */
+auto va::StreamStats::record(guint source_id, guint64 ntp_timestamp, guint objects) -> void {
+	m_frames[std::min(source_id, m_max_sources - 1)].fetch_add(1, std::memory_order_relaxed);
+	m_objects.fetch_add(objects, std::memory_order_relaxed);
+	guint64 now = static_cast<guint64>(g_get_real_time()) * 1000;
+	if (ntp_timestamp == 0 || ntp_timestamp > now) {
+		return;
+	}
+	guint64 bucket = std::min<guint64>((now - ntp_timestamp) / 1000000, LATENCY_BUCKETS - 1);
+	m_latency[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+auto va::StreamStats::snapshot() const -> va::StreamStatsSnapshot {
+	va::StreamStatsSnapshot snapshot {};
+	snapshot.time = g_get_monotonic_time();
+	snapshot.frames.resize(m_max_sources);
+	for (guint i = 0; i < m_max_sources; ++i) {
+		snapshot.frames[i] = m_frames[i].load(std::memory_order_relaxed);
+	}
+	snapshot.objects = m_objects.load(std::memory_order_relaxed);
+	snapshot.latency.resize(LATENCY_BUCKETS);
+	for (guint i = 0; i < LATENCY_BUCKETS; ++i) {
+		snapshot.latency[i] = m_latency[i].load(std::memory_order_relaxed);
+	}
+	return snapshot;
+}
+
+/* upper edge of the bucket holding the p-th frame, in ms */
+static auto latency_percentile(const std::vector<guint64>& buckets, guint64 total, double p) -> double {
+	if (total == 0) {
+		return 0.0;
+	}
+	guint64 rank = std::max<guint64>(1, static_cast<guint64>(p * total + 0.5));
+	guint64 seen = 0;
+	for (size_t i = 0; i < buckets.size(); ++i) {
+		seen += buckets[i];
+		if (seen >= rank) {
+			return static_cast<double>(i + 1);
+		}
+	}
+	return static_cast<double>(buckets.size());
+}
+
+auto va::stream_window(const va::StreamStatsSnapshot& from, const va::StreamStatsSnapshot& to) -> va::StreamWindow {
+	va::StreamWindow window {};
+	window.seconds = (to.time - from.time) / 1e6;
+	window.objects = to.objects - from.objects;
+
+	guint64 slowest = G_MAXUINT64;
+	for (size_t i = 0; i < to.frames.size(); ++i) {
+		guint64 frames = to.frames[i] - (i < from.frames.size() ? from.frames[i] : 0);
+		window.frames += frames;
+		if (frames > 0) {
+			++window.active_sources;
+			slowest = std::min(slowest, frames);
+		}
+	}
+	if (window.active_sources > 0 && window.seconds > 0) {
+		window.min_source_fps = slowest / window.seconds;
+	}
+
+	std::vector<guint64> latency(to.latency.size());
+	guint64 total = 0;
+	for (size_t i = 0; i < latency.size(); ++i) {
+		latency[i] = to.latency[i] - (i < from.latency.size() ? from.latency[i] : 0);
+		total += latency[i];
+		if (latency[i] > 0) {
+			window.latency_max_ms = static_cast<double>(i + 1);
+		}
+	}
+	window.latency_p50_ms = latency_percentile(latency, total, 0.50);
+	window.latency_p99_ms = latency_percentile(latency, total, 0.99);
+	return window;
+}
@@ -0,0 +1,65 @@
+#ifndef VA_ENGINE_STREAM_STATS_H_
+#define VA_ENGINE_STREAM_STATS_H_
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <glib.h>
+
+namespace va {
+/**
+ * Counts at one point in time, see StreamStats::snapshot
+ */
+struct StreamStatsSnapshot {
+	/* monotonic, in us */
+	gint64 time = 0;
+	std::vector<guint64> frames;
+	guint64 objects = 0;
+	/* frames by latency, 1 ms per bucket */
+	std::vector<guint64> latency;
+};
+
+/**
+ * What happened between two snapshots
+ */
+struct StreamWindow {
+	double seconds = 0.0;
+	guint64 frames = 0;
+	guint64 objects = 0;
+	/* sources with at least one frame, and the fps of the slowest of them */
+	guint active_sources = 0;
+	double min_source_fps = 0.0;
+	double latency_p50_ms = 0.0;
+	double latency_p99_ms = 0.0;
+	double latency_max_ms = 0.0;
+};
+
+auto stream_window(const StreamStatsSnapshot& from, const StreamStatsSnapshot& to) -> StreamWindow;
+
+/**
+ * Frames, objects and latency the metadata probe sees, per source. Latency
+ * is from the muxer stamping the frame (ntp_timestamp, system time) to the
+ * probe. Counters only ever grow; readers diff two snapshots.
+ */
+struct StreamStats {
+	/* the last bucket takes everything from 10 s up */
+	static constexpr guint LATENCY_BUCKETS = 10000;
+
+	guint m_max_sources;
+	std::unique_ptr<std::atomic<guint64>[]> m_frames;
+	std::unique_ptr<std::atomic<guint64>[]> m_latency;
+	std::atomic<guint64> m_objects { 0 };
+
+	StreamStats(guint max_sources);
+
+	StreamStats(const StreamStats& other) = delete;
+	StreamStats& operator=(const StreamStats& other) = delete;
+
+	auto record(guint source_id, guint64 ntp_timestamp, guint objects) -> void;
+	auto snapshot() const -> StreamStatsSnapshot;
+};
+
+} // namespace va
+
+#endif
@@ -0,0 +1,97 @@
+#include "va_synthetic_source.h"
+
+#include <sstream>
+#include <stdexcept>
+
+#define SYNTHETIC_SCHEME "synthetic://"
+
+auto va::is_synthetic_uri(const std::string& uri) -> bool {
+	return uri.compare(0, sizeof(SYNTHETIC_SCHEME) - 1, SYNTHETIC_SCHEME) == 0;
+}
+
+static auto parse_count(const std::string& uri, const std::string& key, const std::string& value, guint min) -> guint {
+	size_t end = 0;
+	unsigned long count = 0;
+	try {
+		count = std::stoul(value, &end);
+	} catch (std::exception&) {
+		end = 0;
+	}
+	if (end == 0 || end != value.size() || count < min || count > G_MAXUINT) {
+		throw std::invalid_argument("Invalid " + key + " in " + uri + "\n");
+	}
+	return static_cast<guint>(count);
+}
+
+auto va::parse_synthetic_uri(const std::string& uri) -> va::SyntheticSource {
+	if (!is_synthetic_uri(uri)) {
+		throw std::invalid_argument("Not a synthetic source: " + uri + "\n");
+	}
+	va::SyntheticSource source {};
+	std::string rest = uri.substr(sizeof(SYNTHETIC_SCHEME) - 1);
+	size_t query = rest.find('?');
+	source.kind = rest.substr(0, query);
+	if (source.kind != "testsrc" && source.kind != "file") {
+		throw std::invalid_argument("Unknown synthetic source kind in " + uri + "\n");
+	}
+
+	std::stringstream stream { query == std::string::npos ? std::string {} : rest.substr(query + 1) };
+	std::string item;
+	while (std::getline(stream, item, '&')) {
+		if (item.empty()) {
+			continue;
+		}
+		size_t equals = item.find('=');
+		std::string key = item.substr(0, equals);
+		std::string value = equals == std::string::npos ? std::string {} : item.substr(equals + 1);
+		if (key == "width") {
+			source.width = parse_count(uri, key, value, 16);
+		} else if (key == "height") {
+			source.height = parse_count(uri, key, value, 16);
+		} else if (key == "fps") {
+			source.fps = parse_count(uri, key, value, 1);
+		} else if (key == "jitter-ms") {
+			source.jitter_ms = parse_count(uri, key, value, 0);
+		} else if (key == "pattern" && !value.empty()) {
+			source.pattern = value;
+		} else if (key == "location" && !value.empty()) {
+			source.location = value;
+		} else {
+			throw std::invalid_argument("Invalid " + key + " in " + uri + "\n");
+		}
+	}
+	if (source.kind == "file" && source.location.empty()) {
+		throw std::invalid_argument("Synthetic file source without a location: " + uri + "\n");
+	}
+	return source;
+}
+
+auto va::format_synthetic_uri(const va::SyntheticSource& source) -> std::string {
+	std::ostringstream uri;
+	uri << SYNTHETIC_SCHEME << source.kind << '?';
+	if (source.kind == "file") {
+		uri << "location=" << source.location;
+	} else {
+		uri << "width=" << source.width << "&height=" << source.height << "&fps=" << source.fps << "&pattern=" << source.pattern;
+	}
+	if (source.jitter_ms > 0) {
+		uri << "&jitter-ms=" << source.jitter_ms;
+	}
+	return uri.str();
+}
+
+va::SourceJitter::SourceJitter(guint jitter_ms, guint seed)
+	: m_max_us(static_cast<guint64>(jitter_ms) * 1000), m_state(seed * 2654435761u | 1u) { }
+
+/**
+ * Sleep a uniformly random 0..jitter, xorshift is plenty for a delay
+ */
+auto va::SourceJitter::hold() -> void {
+	if (m_max_us == 0) {
+		return;
+	}
+	m_state ^= m_state << 13;
+	m_state ^= m_state >> 17;
+	m_state ^= m_state << 5;
+	g_usleep(static_cast<gulong>(m_state % (m_max_us + 1)));
+}
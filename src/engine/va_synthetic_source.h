@@ -0,0 +1,51 @@
+#ifndef VA_ENGINE_SYNTHETIC_SOURCE_H_
+#define VA_ENGINE_SYNTHETIC_SOURCE_H_
+
+#include <string>
+
+#include <glib.h>
+
+namespace va {
+/**
+ * A source the engine makes up instead of reading, for load tests:
+ *
+ *   synthetic://testsrc?width=1280&height=720&fps=25&pattern=ball&jitter-ms=5
+ *   synthetic://file?location=file:///samples/sample_1080p_h264.mp4&jitter-ms=5
+ *
+ * testsrc is a live videotestsrc of the given size and rate, file plays a
+ * local file in a loop at its own size and rate. Both hold every frame back
+ * by a random 0..jitter-ms before it reaches the muxer.
+ */
+struct SyntheticSource {
+	/* testsrc or file */
+	std::string kind = "testsrc";
+	guint width = 1920;
+	guint height = 1080;
+	guint fps = 30;
+	/* videotestsrc pattern, e.g. smpte, ball or snow */
+	std::string pattern = "smpte";
+	/* uri of the file kind */
+	std::string location;
+	guint jitter_ms = 0;
+};
+
+auto is_synthetic_uri(const std::string& uri) -> bool;
+/* throws std::invalid_argument on an unknown kind, key or value */
+auto parse_synthetic_uri(const std::string& uri) -> SyntheticSource;
+auto format_synthetic_uri(const SyntheticSource& source) -> std::string;
+
+/**
+ * Random delay of a source's frames, on its streaming thread
+ */
+struct SourceJitter {
+	guint64 m_max_us;
+	guint32 m_state;
+
+	SourceJitter(guint jitter_ms, guint seed);
+
+	auto hold() -> void;
+};
+
+} // namespace va
+
+#endif
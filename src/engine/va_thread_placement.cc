@@ -0,0 +1,336 @@
+#include "va_thread_placement.h"
+
+#include <dirent.h>
+#include <fnmatch.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <glib.h>
+#include <yaml-cpp/yaml.h>
+
+/* the placement of place_thread() */
+static std::atomic<va::ThreadPlacement*> placement_in_use { nullptr };
+
+static auto memory_policy_mode(const std::string& policy) -> int {
+	if (policy == "default") {
+		return -1;
+	} else if (policy == "local") {
+		return MPOL_LOCAL;
+	} else if (policy == "preferred") {
+		return MPOL_PREFERRED;
+	} else if (policy == "bind") {
+		return MPOL_BIND;
+	} else if (policy == "interleave") {
+		return MPOL_INTERLEAVE;
+	}
+	throw std::invalid_argument("thread-placement memory-policy is default, local, preferred, bind or interleave\n");
+}
+
+auto va::parse_thread_placement_config(const char* cfg_file, const char* group) -> va::ThreadPlacementConfig {
+	va::ThreadPlacementConfig config {};
+	YAML::Node node = YAML::LoadFile(cfg_file)[group];
+	if (!node) {
+		return config;
+	}
+	config.enable = node["enable"].as<int>(config.enable) != 0;
+	config.memory_policy = node["memory-policy"].as<std::string>(config.memory_policy);
+	memory_policy_mode(config.memory_policy);
+	for (const YAML::Node& rule_node : node["rules"]) {
+		va::ThreadRule rule {};
+		rule.threads = rule_node["threads"].as<std::string>("*");
+		rule.cpus = rule_node["cpus"].as<std::string>(rule.cpus);
+		rule.node = rule_node["node"].as<int>(rule.node);
+		rule.memory_policy = rule_node["memory-policy"].as<std::string>(rule.memory_policy);
+		if (!rule.memory_policy.empty()) {
+			memory_policy_mode(rule.memory_policy);
+		}
+		config.rules.push_back(rule);
+	}
+	return config;
+}
+
+auto va::parse_cpu_list(const std::string& text, cpu_set_t& cpus) -> bool {
+	CPU_ZERO(&cpus);
+	const char* p = text.c_str();
+	while (*p) {
+		char* end;
+		long first = std::strtol(p, &end, 10);
+		if (end == p || first < 0 || first >= CPU_SETSIZE) {
+			return false;
+		}
+		long last = first;
+		p = end;
+		if (*p == '-') {
+			last = std::strtol(p + 1, &end, 10);
+			if (end == p + 1 || last < first || last >= CPU_SETSIZE) {
+				return false;
+			}
+			p = end;
+		}
+		for (long cpu = first; cpu <= last; ++cpu) {
+			CPU_SET(cpu, &cpus);
+		}
+		while (*p == ',' || *p == ' ' || *p == '\n') {
+			++p;
+		}
+	}
+	return CPU_COUNT(&cpus) > 0;
+}
+
+auto va::format_cpu_list(const cpu_set_t& cpus) -> std::string {
+	std::string text;
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (!CPU_ISSET(cpu, &cpus)) {
+			continue;
+		}
+		int last = cpu;
+		while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &cpus)) {
+			++last;
+		}
+		text += (text.empty() ? "" : ",") + std::to_string(cpu);
+		if (last > cpu) {
+			text += "-" + std::to_string(last);
+		}
+		cpu = last;
+	}
+	return text;
+}
+
+/**
+ * Cpus of every node under /sys/devices/system/node, all cpus on node 0 on
+ * kernels without numa
+ */
+static auto read_numa_nodes(const cpu_set_t& online) -> std::map<int, cpu_set_t> {
+	std::map<int, cpu_set_t> nodes;
+	if (DIR* dir = opendir("/sys/devices/system/node")) {
+		while (struct dirent* entry = readdir(dir)) {
+			int node;
+			char extra;
+			if (sscanf(entry->d_name, "node%d%c", &node, &extra) != 1) {
+				continue;
+			}
+			std::ifstream file { std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist" };
+			std::string line;
+			cpu_set_t cpus;
+			if (std::getline(file, line) && va::parse_cpu_list(line, cpus)) {
+				nodes[node] = cpus;
+			}
+		}
+		closedir(dir);
+	}
+	if (nodes.empty()) {
+		nodes[0] = online;
+	}
+	return nodes;
+}
+
+va::ThreadPlacement::ThreadPlacement(const va::ThreadPlacementConfig& config) : m_config(config) {
+	cpu_set_t allowed;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		throw std::runtime_error("Thread placement: unable to read the cpus of this process. Exiting.\n");
+	}
+	m_node_cpus = read_numa_nodes(allowed);
+
+	for (const va::ThreadRule& thread_rule : m_config.rules) {
+		Rule rule {};
+		rule.rule = thread_rule;
+		CPU_ZERO(&rule.cpus);
+		if (!thread_rule.cpus.empty()) {
+			if (!va::parse_cpu_list(thread_rule.cpus, rule.cpus)) {
+				throw std::invalid_argument("Thread placement: " + thread_rule.threads + " has a malformed cpu list. Exiting.\n");
+			}
+			rule.has_cpus = true;
+		}
+		if (thread_rule.node >= 0) {
+			auto found = m_node_cpus.find(thread_rule.node);
+			if (found == m_node_cpus.end()) {
+				throw std::invalid_argument("Thread placement: " + thread_rule.threads + " is on node " +
+						std::to_string(thread_rule.node) + ", which this machine does not have. Exiting.\n");
+			}
+			if (!rule.has_cpus) {
+				rule.cpus = found->second;
+				rule.has_cpus = true;
+			}
+			rule.nodes.push_back(thread_rule.node);
+		} else if (rule.has_cpus) {
+			for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+				int node = CPU_ISSET(cpu, &rule.cpus) ? m_node_of(cpu) : -1;
+				if (node >= 0 && std::find(rule.nodes.begin(), rule.nodes.end(), node) == rule.nodes.end()) {
+					rule.nodes.push_back(node);
+				}
+			}
+		}
+		if (rule.has_cpus) {
+			cpu_set_t usable;
+			CPU_AND(&usable, &rule.cpus, &allowed);
+			if (CPU_COUNT(&usable) == 0) {
+				throw std::invalid_argument("Thread placement: none of the cpus of " + thread_rule.threads +
+						" are available to this process. Exiting.\n");
+			}
+		}
+		rule.mode = memory_policy_mode(thread_rule.memory_policy.empty() ? m_config.memory_policy : thread_rule.memory_policy);
+		if (rule.mode != -1 && rule.mode != MPOL_LOCAL && rule.nodes.empty()) {
+			throw std::invalid_argument("Thread placement: " + thread_rule.threads + " needs a node or cpus for its memory policy. Exiting.\n");
+		}
+		m_rules.push_back(rule);
+	}
+	g_print("Thread placement: %zu rules, %zu numa nodes\n", m_rules.size(), m_node_cpus.size());
+}
+
+va::ThreadPlacement::~ThreadPlacement() {
+	va::ThreadPlacement* self = this;
+	placement_in_use.compare_exchange_strong(self, nullptr);
+}
+
+auto va::ThreadPlacement::m_match(const std::string& role) const -> int {
+	for (size_t i = 0; i < m_rules.size(); ++i) {
+		if (fnmatch(m_rules[i].rule.threads.c_str(), role.c_str(), 0) == 0) {
+			return static_cast<int>(i);
+		}
+	}
+	return -1;
+}
+
+auto va::ThreadPlacement::m_node_of(int cpu) const -> int {
+	for (const auto& entry : m_node_cpus) {
+		if (cpu >= 0 && CPU_ISSET(cpu, &entry.second)) {
+			return entry.first;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Pin the calling thread by the first rule matching role. Returns false when
+ * the kernel refused part of it; the thread keeps running where it was.
+ */
+auto va::ThreadPlacement::place(const std::string& role) -> bool {
+	Placed placed { role, static_cast<pid_t>(syscall(SYS_gettid)), m_match(role), "" };
+	if (placed.rule >= 0) {
+		const Rule& rule = m_rules[placed.rule];
+		if (rule.has_cpus) {
+			int error = pthread_setaffinity_np(pthread_self(), sizeof(rule.cpus), &rule.cpus);
+			if (error != 0) {
+				placed.error = std::string("affinity: ") + strerror(error);
+			}
+		}
+		if (rule.mode != -1) {
+			int max_node = rule.nodes.empty() ? 0 : *std::max_element(rule.nodes.begin(), rule.nodes.end());
+			std::vector<unsigned long> mask(max_node / (8 * sizeof(unsigned long)) + 1, 0);
+			for (int node : rule.nodes) {
+				mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+			}
+			bool local = rule.mode == MPOL_LOCAL;
+			if (syscall(SYS_set_mempolicy, rule.mode, local ? nullptr : mask.data(), local ? 0 : mask.size() * 8 * sizeof(unsigned long) + 1) != 0) {
+				placed.error += (placed.error.empty() ? "" : ", ") + std::string("memory policy: ") + strerror(errno);
+			}
+		}
+	}
+	bool ok = placed.error.empty();
+	if (!ok) {
+		g_printerr("Thread placement: %s only partly placed, %s\n", role.c_str(), placed.error.c_str());
+	}
+
+	std::lock_guard<std::mutex> lock { m_mutex };
+	/* pooled threads enter again with their next task */
+	for (Placed& thread : m_threads) {
+		if (thread.tid == placed.tid) {
+			thread = std::move(placed);
+			return ok;
+		}
+	}
+	m_threads.push_back(std::move(placed));
+	return ok;
+}
+
+auto va::ThreadPlacement::leave() -> void {
+	pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+	std::lock_guard<std::mutex> lock { m_mutex };
+	for (auto it = m_threads.begin(); it != m_threads.end(); ++it) {
+		if (it->tid == tid) {
+			m_threads.erase(it);
+			return;
+		}
+	}
+}
+
+/**
+ * The cpu tid last ran on, field 39 of /proc/self/task/<tid>/stat
+ */
+static auto last_cpu(pid_t tid) -> int {
+	std::ifstream file { "/proc/self/task/" + std::to_string(tid) + "/stat" };
+	std::string stat;
+	if (!std::getline(file, stat)) {
+		return -1;
+	}
+	/* the command name may hold spaces, fields are counted after it */
+	size_t end = stat.rfind(')');
+	if (end == std::string::npos) {
+		return -1;
+	}
+	const char* p = stat.c_str() + end + 1;
+	for (int field = 2; field < 39 && *p; ++p) {
+		if (*p == ' ') {
+			++field;
+		}
+	}
+	return *p ? std::atoi(p) : -1;
+}
+
+/**
+ * Where every placed thread is allowed to run and where it ran last
+ */
+auto va::ThreadPlacement::print_report() -> void {
+	std::lock_guard<std::mutex> lock { m_mutex };
+	g_print("Thread placement of %zu threads:\n", m_threads.size());
+	g_print("  %-28s %8s %-16s %-14s %6s %5s %s\n", "role", "tid", "rule", "cpus", "on cpu", "node", "memory");
+	for (const Placed& thread : m_threads) {
+		cpu_set_t cpus;
+		std::string allowed = sched_getaffinity(thread.tid, sizeof(cpus), &cpus) == 0 ? va::format_cpu_list(cpus) : "gone";
+		int cpu = last_cpu(thread.tid);
+		std::string rule = thread.rule >= 0 ? m_rules[thread.rule].rule.threads : "-";
+		std::string memory = "-";
+		if (thread.rule >= 0) {
+			const ThreadRule& thread_rule = m_rules[thread.rule].rule;
+			memory = thread_rule.memory_policy.empty() ? m_config.memory_policy : thread_rule.memory_policy;
+		}
+		g_print("  %-28s %8d %-16s %-14s %6d %5d %s%s%s\n", thread.role.c_str(), thread.tid, rule.c_str(), allowed.c_str(),
+				cpu, m_node_of(cpu), memory.c_str(), thread.error.empty() ? "" : ", ", thread.error.c_str());
+	}
+}
+
+auto va::set_thread_placement(va::ThreadPlacement* placement) -> void {
+	placement_in_use.store(placement, std::memory_order_release);
+}
+
+auto va::thread_name(const std::string& role) -> std::string {
+	std::string name = role;
+	if (name.rfind("source-bin-", 0) == 0) {
+		name = "src" + name.substr(11);
+	}
+	return name.substr(0, 15);
+}
+
+auto va::place_thread(const std::string& role) -> void {
+	pthread_setname_np(pthread_self(), va::thread_name(role).c_str());
+	if (va::ThreadPlacement* placement = placement_in_use.load(std::memory_order_acquire)) {
+		placement->place(role);
+	}
+}
+
+auto va::leave_thread() -> void {
+	if (va::ThreadPlacement* placement = placement_in_use.load(std::memory_order_acquire)) {
+		placement->leave();
+	}
+}
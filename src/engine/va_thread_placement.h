@@ -0,0 +1,104 @@
+#ifndef VA_ENGINE_THREAD_PLACEMENT_H_
+#define VA_ENGINE_THREAD_PLACEMENT_H_
+
+#include <sched.h>
+#include <sys/types.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace va {
+/**
+ * Where the threads whose role matches a glob pattern run
+ */
+struct ThreadRule {
+	/* glob on the role, e.g. "queue*", "source-bin-*" or "journal-*" */
+	std::string threads;
+	/* cpu list such as "0-7,16-23", all cpus of node when empty */
+	std::string cpus;
+	/* numa node for cpus and memory, -1 for the nodes of cpus */
+	int node = -1;
+	/* default, local, preferred, bind or interleave, the group's when empty */
+	std::string memory_policy;
+};
+
+/**
+ * Thread placement settings, read from the "thread-placement" group of the
+ * yml file. The first rule matching a role applies.
+ */
+struct ThreadPlacementConfig {
+	bool enable = false;
+	std::string memory_policy = "local";
+	std::vector<ThreadRule> rules;
+};
+
+auto parse_thread_placement_config(const char* cfg_file, const char* group) -> ThreadPlacementConfig;
+
+/* "0-3,8" to cpus, false on a malformed list */
+auto parse_cpu_list(const std::string& text, cpu_set_t& cpus) -> bool;
+auto format_cpu_list(const cpu_set_t& cpus) -> std::string;
+
+/**
+ * Names threads after their role and pins them by rule: a cpu affinity and
+ * a numa memory policy, applied by the thread itself when it starts.
+ *
+ * Roles are the element name for GStreamer streaming threads ("queue1", or
+ * "source-bin-00/<element>" inside a source bin), placed from a bus sync
+ * handler on STREAM_STATUS enter, and fixed names for the worker threads of
+ * the other modules ("journal-writer", "publisher", ...). "main" is the
+ * thread that builds the pipeline; threads nobody places, such as those
+ * nvinfer starts itself, inherit its affinity.
+ */
+struct ThreadPlacement {
+	struct Rule {
+		ThreadRule rule;
+		bool has_cpus = false;
+		cpu_set_t cpus;
+		int mode = -1;
+		std::vector<int> nodes;
+	};
+
+	struct Placed {
+		std::string role;
+		pid_t tid;
+		/* index of the rule applied, -1 when none matched */
+		int rule;
+		std::string error;
+	};
+
+	ThreadPlacementConfig m_config;
+	std::vector<Rule> m_rules;
+	/* cpu list of every numa node */
+	std::map<int, cpu_set_t> m_node_cpus;
+
+	std::mutex m_mutex;
+	std::vector<Placed> m_threads;
+
+	ThreadPlacement(const ThreadPlacementConfig& config);
+	~ThreadPlacement();
+
+	ThreadPlacement(const ThreadPlacement& other) = delete;
+	ThreadPlacement& operator=(const ThreadPlacement& other) = delete;
+
+	auto place(const std::string& role) -> bool;
+	auto leave() -> void;
+	auto print_report() -> void;
+
+	auto m_match(const std::string& role) const -> int;
+	auto m_node_of(int cpu) const -> int;
+};
+
+/* the placement worker threads use, nullptr for naming them only */
+auto set_thread_placement(ThreadPlacement* placement) -> void;
+/* name the calling thread after role and place it by the rules in use */
+auto place_thread(const std::string& role) -> void;
+/* the calling thread stops serving its role, e.g. a pooled streaming thread */
+auto leave_thread() -> void;
+/* at most 15 characters: "source-bin-03/queue" is "src03/queue" */
+auto thread_name(const std::string& role) -> std::string;
+
+} // namespace va
+
+#endif
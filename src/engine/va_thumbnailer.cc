@@ -0,0 +1,407 @@
+#include "va_thumbnailer.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include <jpeglib.h>
+#include <yaml-cpp/yaml.h>
+
+#include "va_thread_placement.h"
+#include "va_trace.h"
+
+/* grid cells per side that tell untracked objects of a class apart */
+#define THUMBNAIL_UNTRACKED_GRID 8
+
+auto va::parse_thumbnail_config(const char* cfg_file, const char* group) -> va::ThumbnailConfig {
+	va::ThumbnailConfig config {};
+	YAML::Node node = YAML::LoadFile(cfg_file)[group];
+	if (!node) {
+		return config;
+	}
+	config.enable = node["enable"].as<int>(config.enable) != 0;
+	config.directory = node["directory"].as<std::string>(config.directory);
+	config.window_sec = node["window-sec"].as<guint>(config.window_sec);
+	config.min_improvement = node["min-improvement"].as<double>(config.min_improvement);
+	config.min_box = node["min-box"].as<guint>(config.min_box);
+	config.padding = node["padding"].as<double>(config.padding);
+	config.max_copies_per_sec = node["max-copies-per-sec"].as<guint>(config.max_copies_per_sec);
+	config.max_encodes_per_sec = node["max-encodes-per-sec"].as<guint>(config.max_encodes_per_sec);
+	config.workers = std::max(1u, node["workers"].as<guint>(config.workers));
+	config.max_pending = node["max-pending"].as<guint>(config.max_pending);
+	config.quality = node["quality"].as<int>(config.quality);
+	if (node["classes"]) {
+		config.classes = node["classes"].as<std::vector<int>>();
+	}
+	return config;
+}
+
+va::RateLimit::RateLimit(double rate) : m_rate(rate), m_tokens(rate), m_last(std::chrono::steady_clock::now()) { }
+
+auto va::RateLimit::take() -> bool {
+	auto now = std::chrono::steady_clock::now();
+	m_tokens = std::min(m_rate, m_tokens + m_rate * std::chrono::duration<double>(now - m_last).count());
+	m_last = now;
+	if (m_tokens < 1.0) {
+		return false;
+	}
+	m_tokens -= 1.0;
+	return true;
+}
+
+va::Thumbnailer::Thumbnailer(const va::ThumbnailConfig& config) :
+	m_config(config),
+	m_window_ns(config.window_sec * 1000000000ull),
+	m_copy_limit(config.max_copies_per_sec),
+	m_encode_limit(config.max_encodes_per_sec)
+{
+	if (g_mkdir_with_parents(m_config.directory.c_str(), 0755) != 0) {
+		throw std::runtime_error("Thumbnailer: unable to create " + m_config.directory + ". Exiting.\n");
+	}
+	for (guint i = 0; i < std::max(1u, m_config.workers); ++i) {
+		m_workers.emplace_back(&va::Thumbnailer::m_encode_loop, this);
+	}
+	g_print("Thumbnailer: one per object every %u s into %s, %u encoders\n",
+			m_config.window_sec, m_config.directory.c_str(), (guint)m_workers.size());
+}
+
+va::Thumbnailer::~Thumbnailer() {
+	flush();
+	{
+		std::lock_guard<std::mutex> lock { m_mutex };
+		m_stop = true;
+	}
+	m_cond.notify_all();
+	for (std::thread& worker : m_workers) {
+		worker.join();
+	}
+	guint64 encoded = m_encoded;
+	g_print("Thumbnailer: %lu offered, %lu copies (%lu over the cap), %lu encoded (%lu dropped, %lu failed), %lu bytes, %.2f ms per encode\n",
+			(unsigned long)m_offered.load(), (unsigned long)m_copies.load(), (unsigned long)m_copies_dropped.load(),
+			(unsigned long)encoded, (unsigned long)m_encodes_dropped.load(), (unsigned long)m_failed.load(),
+			(unsigned long)m_bytes_written.load(), encoded ? m_encode_us / 1000.0 / encoded : 0.0);
+}
+
+auto va::Thumbnailer::set_database(va::Database* _va_database) -> void {
+	m_va_database = _va_database;
+	try {
+		m_va_database->create_snapshot_table();
+	} catch (sql::SQLException& e) {
+		std::cout << "# ERR: SQLException in " << __FILE__;
+		std::cout << "(" << __FUNCTION__ << ")" << std::endl;
+		std::cout << "# ERR: " << e.what();
+		std::cout << " (MySQL error code: " << e.getErrorCode();
+		std::cout << ", SQLState: " << e.getSQLState() << " )" << std::endl;
+		m_va_database = nullptr;
+	}
+}
+
+/**
+ * Consider a detection for the thumbnail of its object. Called on the probe
+ * thread; copies the crop only if it beats the one held for the window.
+ */
+auto va::Thumbnailer::offer(guint source_id, const std::string& video_file, const va::FrameView& frame, const va::ThumbnailCandidate& candidate) -> void {
+	VA_TRACE_SCOPE("thumbnail.offer");
+	if (std::find(m_config.classes.begin(), m_config.classes.end(), candidate.class_id) == m_config.classes.end() ||
+		candidate.width < m_config.min_box || candidate.height < m_config.min_box || !frame.width || !frame.height) {
+		return;
+	}
+	++m_offered;
+
+	guint64 key = candidate.object_id;
+	if (key == THUMBNAIL_UNTRACKED_ID) {
+		guint cell_x = std::min<guint>(THUMBNAIL_UNTRACKED_GRID - 1, (candidate.left + candidate.width / 2) * THUMBNAIL_UNTRACKED_GRID / frame.width);
+		guint cell_y = std::min<guint>(THUMBNAIL_UNTRACKED_GRID - 1, (candidate.top + candidate.height / 2) * THUMBNAIL_UNTRACKED_GRID / frame.height);
+		/* top bit set keeps these apart from tracker ids */
+		key = (1ull << 63) | (static_cast<guint64>(candidate.class_id) << 16) | (cell_y * THUMBNAIL_UNTRACKED_GRID + cell_x);
+	}
+	Held& held = m_held[{ source_id, key }];
+	if (candidate.timestamp >= held.window_start + m_window_ns) {
+		m_release(held);
+		held.window_start = candidate.timestamp;
+		held.score = 0.0;
+	}
+
+	double score = candidate.width * candidate.height * candidate.confidence;
+	if (held.crop && score < held.score * m_config.min_improvement) {
+		return;
+	}
+	if (!m_copy_limit.take()) {
+		++m_copies_dropped;
+		return;
+	}
+	std::unique_ptr<Crop> crop = m_copy(frame, candidate);
+	if (!crop) {
+		return;
+	}
+	++m_copies;
+	crop->source_id = source_id;
+	crop->video_file = video_file;
+	held.crop = std::move(crop);
+	held.score = score;
+}
+
+/**
+ * Hand the crops of closed windows to the encoders. Cheap to call for every
+ * batch, it looks at the held crops once a second.
+ */
+auto va::Thumbnailer::sweep(guint64 now) -> void {
+	if (now < m_last_sweep + 1000000000ull) {
+		return;
+	}
+	m_last_sweep = now;
+	for (auto it = m_held.begin(); it != m_held.end();) {
+		if (now >= it->second.window_start + m_window_ns) {
+			m_release(it->second);
+			it = m_held.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+/**
+ * Encode every held crop now, on shutdown or at the end of a stream
+ */
+auto va::Thumbnailer::flush() -> void {
+	for (auto& entry : m_held) {
+		m_release(entry.second);
+	}
+	m_held.clear();
+}
+
+/**
+ * Copy the padded box, and nothing else, out of the frame
+ */
+auto va::Thumbnailer::m_copy(const va::FrameView& frame, const va::ThumbnailCandidate& candidate) -> std::unique_ptr<Crop> {
+	VA_TRACE_SCOPE("thumbnail.copy");
+	double pad_x = candidate.width * m_config.padding;
+	double pad_y = candidate.height * m_config.padding;
+	guint x0 = std::clamp(std::floor(candidate.left - pad_x), 0.0, static_cast<double>(frame.width));
+	guint y0 = std::clamp(std::floor(candidate.top - pad_y), 0.0, static_cast<double>(frame.height));
+	guint x1 = std::clamp(std::ceil(candidate.left + candidate.width + pad_x), 0.0, static_cast<double>(frame.width));
+	guint y1 = std::clamp(std::ceil(candidate.top + candidate.height + pad_y), 0.0, static_cast<double>(frame.height));
+	/* chroma is subsampled 2x2, keep the crop on even pixels */
+	if (frame.format != va::FrameView::Format::RGBA) {
+		x0 &= ~1u;
+		y0 &= ~1u;
+		x1 &= ~1u;
+		y1 &= ~1u;
+	}
+	if (x1 < x0 + 2 || y1 < y0 + 2) {
+		return nullptr;
+	}
+
+	std::unique_ptr<Crop> crop = std::make_unique<Crop>();
+	crop->detection = candidate;
+	crop->format = frame.format;
+	crop->width = x1 - x0;
+	crop->height = y1 - y0;
+	guint w = crop->width;
+	guint h = crop->height;
+	bool copied = true;
+	switch (frame.format) {
+		case va::FrameView::Format::NV12: {
+			crop->data.resize(w * h + w * (h / 2));
+			guint8* uv = crop->data.data() + w * h;
+			copied = va::copy_plane(crop->data.data(), frame.planes[0] + y0 * frame.pitches[0] + x0, frame.pitches[0], w, h, frame.device) &&
+				va::copy_plane(uv, frame.planes[1] + (y0 / 2) * frame.pitches[1] + x0, frame.pitches[1], w, h / 2, frame.device);
+			break;
+		}
+		case va::FrameView::Format::I420: {
+			crop->data.resize(w * h + 2 * (w / 2) * (h / 2));
+			guint8* u = crop->data.data() + w * h;
+			guint8* v = u + (w / 2) * (h / 2);
+			copied = va::copy_plane(crop->data.data(), frame.planes[0] + y0 * frame.pitches[0] + x0, frame.pitches[0], w, h, frame.device) &&
+				va::copy_plane(u, frame.planes[1] + (y0 / 2) * frame.pitches[1] + x0 / 2, frame.pitches[1], w / 2, h / 2, frame.device) &&
+				va::copy_plane(v, frame.planes[2] + (y0 / 2) * frame.pitches[2] + x0 / 2, frame.pitches[2], w / 2, h / 2, frame.device);
+			break;
+		}
+		case va::FrameView::Format::RGBA:
+			crop->data.resize(w * h * 4);
+			copied = va::copy_plane(crop->data.data(), frame.planes[0] + y0 * frame.pitches[0] + x0 * 4, frame.pitches[0], w * 4, h, frame.device);
+			break;
+	}
+	return copied ? std::move(crop) : nullptr;
+}
+
+/**
+ * Queue the held crop for encoding, within the encode cap
+ */
+auto va::Thumbnailer::m_release(Held& held) -> void {
+	if (!held.crop) {
+		return;
+	}
+	std::unique_ptr<Crop> crop = std::move(held.crop);
+	if (!m_encode_limit.take()) {
+		++m_encodes_dropped;
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock { m_mutex };
+		if (m_pending.size() >= m_config.max_pending) {
+			++m_encodes_dropped;
+			return;
+		}
+		m_pending.push_back(std::move(crop));
+	}
+	m_cond.notify_one();
+}
+
+auto va::Thumbnailer::m_encode_loop() -> void {
+	va::place_thread("thumbnail-encoder");
+	for (;;) {
+		std::unique_ptr<Crop> crop;
+		{
+			std::unique_lock<std::mutex> lock { m_mutex };
+			m_cond.wait(lock, [this] { return m_stop || !m_pending.empty(); });
+			if (m_pending.empty()) {
+				break;
+			}
+			crop = std::move(m_pending.front());
+			m_pending.pop_front();
+		}
+		auto start = std::chrono::steady_clock::now();
+		if (m_encode(*crop)) {
+			++m_encoded;
+			m_encode_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		} else {
+			++m_failed;
+		}
+	}
+}
+
+struct JpegError {
+	struct jpeg_error_mgr mgr;
+	jmp_buf jump;
+};
+
+static auto jpeg_error_exit(j_common_ptr cinfo) -> void {
+	JpegError* error = reinterpret_cast<JpegError*>(cinfo->err);
+	(*cinfo->err->output_message)(cinfo);
+	longjmp(error->jump, 1);
+}
+
+/**
+ * Write crop to file as JPEG. 4:2:0 input goes in as YCbCr, so libjpeg does
+ * no color conversion.
+ */
+static auto write_jpeg(FILE* file, const va::Thumbnailer::Crop& crop, int quality) -> bool {
+	guint w = crop.width;
+	guint h = crop.height;
+	std::vector<guint8> row(w * 3);
+	struct jpeg_compress_struct cinfo;
+	JpegError error;
+	cinfo.err = jpeg_std_error(&error.mgr);
+	error.mgr.error_exit = jpeg_error_exit;
+	if (setjmp(error.jump)) {
+		jpeg_destroy_compress(&cinfo);
+		return false;
+	}
+	jpeg_create_compress(&cinfo);
+	jpeg_stdio_dest(&cinfo, file);
+	cinfo.image_width = w;
+	cinfo.image_height = h;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = crop.format == va::FrameView::Format::RGBA ? JCS_RGB : JCS_YCbCr;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, quality, TRUE);
+	jpeg_start_compress(&cinfo, TRUE);
+
+	const guint8* y_plane = crop.data.data();
+	const guint8* chroma = y_plane + w * h;
+	while (cinfo.next_scanline < h) {
+		guint line = cinfo.next_scanline;
+		guint8* out = row.data();
+		switch (crop.format) {
+			case va::FrameView::Format::NV12: {
+				const guint8* uv = chroma + (line / 2) * w;
+				for (guint x = 0; x < w; ++x) {
+					*out++ = y_plane[line * w + x];
+					*out++ = uv[(x / 2) * 2];
+					*out++ = uv[(x / 2) * 2 + 1];
+				}
+				break;
+			}
+			case va::FrameView::Format::I420: {
+				const guint8* u = chroma + (line / 2) * (w / 2);
+				const guint8* v = chroma + (w / 2) * (h / 2) + (line / 2) * (w / 2);
+				for (guint x = 0; x < w; ++x) {
+					*out++ = y_plane[line * w + x];
+					*out++ = u[x / 2];
+					*out++ = v[x / 2];
+				}
+				break;
+			}
+			case va::FrameView::Format::RGBA: {
+				const guint8* rgba = y_plane + line * w * 4;
+				for (guint x = 0; x < w; ++x) {
+					*out++ = rgba[x * 4];
+					*out++ = rgba[x * 4 + 1];
+					*out++ = rgba[x * 4 + 2];
+				}
+				break;
+			}
+		}
+		JSAMPROW rows[1] = { row.data() };
+		jpeg_write_scanlines(&cinfo, rows, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	return true;
+}
+
+/**
+ * <directory>/source-00/<timestamp>-<label>-<object id>.jpg, written under a
+ * temporary name first so readers never see half a file. Untracked objects
+ * are named after the position of their box instead of an id.
+ */
+auto va::Thumbnailer::m_encode(const Crop& crop) -> bool {
+	VA_TRACE_SCOPE("thumbnail.encode");
+	gchar dir_name[32];
+	g_snprintf(dir_name, sizeof(dir_name), "source-%02u", crop.source_id);
+	std::string dir = m_config.directory + "/" + dir_name;
+	if (g_mkdir_with_parents(dir.c_str(), 0755) != 0) {
+		return false;
+	}
+	std::string label = crop.detection.label;
+	std::replace_if(label.begin(), label.end(), [](char c) { return !std::isalnum(static_cast<unsigned char>(c)); }, '-');
+	std::string id = crop.detection.object_id != THUMBNAIL_UNTRACKED_ID ? std::to_string(crop.detection.object_id)
+			: "at-" + std::to_string(static_cast<long>(crop.detection.left)) + "x" + std::to_string(static_cast<long>(crop.detection.top));
+	std::string path = dir + "/" + std::to_string(crop.detection.timestamp) + "-" + label + "-" + id + ".jpg";
+	std::string part = path + ".part";
+
+	FILE* file = fopen(part.c_str(), "wb");
+	if (!file) {
+		g_printerr("Thumbnailer: unable to open %s\n", part.c_str());
+		return false;
+	}
+	bool written = write_jpeg(file, crop, m_config.quality);
+	long bytes = ftell(file);
+	written = fclose(file) == 0 && written && rename(part.c_str(), path.c_str()) == 0;
+	if (!written) {
+		remove(part.c_str());
+		return false;
+	}
+	m_bytes_written += bytes;
+
+	if (m_va_database) {
+		const va::ThumbnailCandidate& d = crop.detection;
+		va::ObjectMetadata object_meta { d.label, d.class_id, d.left, d.top, d.width, d.height, d.timestamp };
+		try {
+			m_va_database->insert_snapshot(crop.video_file, object_meta, d.object_id, d.confidence, path);
+		} catch (sql::SQLException& e) {
+			std::cout << "# ERR: SQLException in " << __FILE__;
+			std::cout << "(" << __FUNCTION__ << ")" << std::endl;
+			std::cout << "# ERR: " << e.what();
+			std::cout << " (MySQL error code: " << e.getErrorCode();
+			std::cout << ", SQLState: " << e.getSQLState() << " )" << std::endl;
+		}
+	}
+	return true;
+}
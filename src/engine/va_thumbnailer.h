@@ -0,0 +1,150 @@
+#ifndef VA_ENGINE_THUMBNAILER_H_
+#define VA_ENGINE_THUMBNAILER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <glib.h>
+
+#include "va_database.h"
+#include "va_frame_view.h"
+
+/* object_id of detections without a tracker, as in nvdsmeta.h */
+#define THUMBNAIL_UNTRACKED_ID G_MAXUINT64
+
+namespace va {
+/**
+ * Thumbnail settings, read from the "thumbnails" group of the yml file
+ */
+struct ThumbnailConfig {
+	bool enable = false;
+	std::string directory = "thumbnails";
+	/* at most one thumbnail per object per window */
+	guint window_sec = 10;
+	/* a new crop replaces the held one when its score (area x confidence) is this much higher */
+	double min_improvement = 1.25;
+	/* boxes with a smaller side, in pixels, are not worth a thumbnail */
+	guint min_box = 32;
+	/* margin around the box, as a fraction of its size */
+	double padding = 0.1;
+	guint max_copies_per_sec = 100;
+	guint max_encodes_per_sec = 20;
+	guint workers = 2;
+	/* crops waiting for an encoder, more are dropped */
+	guint max_pending = 64;
+	int quality = 85;
+	std::vector<int> classes { 0, 2 };
+};
+
+auto parse_thumbnail_config(const char* cfg_file, const char* group) -> ThumbnailConfig;
+
+/**
+ * A detection offered for a thumbnail, box in frame pixels
+ */
+struct ThumbnailCandidate {
+	guint64 object_id = THUMBNAIL_UNTRACKED_ID;
+	int class_id = 0;
+	std::string label;
+	float confidence = 0.0f;
+	double left = 0.0;
+	double top = 0.0;
+	double width = 0.0;
+	double height = 0.0;
+	guint64 timestamp = 0;
+};
+
+/**
+ * Tokens per second, for the copy and encode caps
+ */
+struct RateLimit {
+	double m_rate;
+	double m_tokens;
+	std::chrono::steady_clock::time_point m_last;
+
+	RateLimit(double rate);
+	auto take() -> bool;
+};
+
+/**
+ * Keeps one snapshot per detected object and time window.
+ *
+ * offer() runs on the probe thread for every detection. It only copies the
+ * crop region out of the frame, and only when the detection scores clearly
+ * better than the crop already held for that object in the current window.
+ * When the window closes, the best crop goes to a pool of encoder threads
+ * that write it as JPEG and record it in the snapshot table. Objects are told
+ * apart by tracker id, or by class and a coarse grid cell without a tracker.
+ * Copies and encodes are capped per second; what goes over is counted.
+ */
+struct Thumbnailer {
+	struct Crop {
+		guint source_id;
+		std::string video_file;
+		ThumbnailCandidate detection;
+		FrameView::Format format;
+		guint width;
+		guint height;
+		/* planes packed one after the other, without padding */
+		std::vector<guint8> data;
+	};
+
+	struct Held {
+		guint64 window_start = 0;
+		double score = 0.0;
+		std::unique_ptr<Crop> crop;
+	};
+
+	ThumbnailConfig m_config;
+	guint64 m_window_ns;
+	va::Database* m_va_database = nullptr;
+
+	/* owned by the probe thread */
+	std::map<std::pair<guint, guint64>, Held> m_held;
+	guint64 m_last_sweep = 0;
+	RateLimit m_copy_limit;
+	RateLimit m_encode_limit;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::deque<std::unique_ptr<Crop>> m_pending;
+	bool m_stop = false;
+	std::vector<std::thread> m_workers;
+
+	std::atomic<guint64> m_offered { 0 };
+	std::atomic<guint64> m_copies { 0 };
+	std::atomic<guint64> m_copies_dropped { 0 };
+	std::atomic<guint64> m_encoded { 0 };
+	std::atomic<guint64> m_encodes_dropped { 0 };
+	std::atomic<guint64> m_failed { 0 };
+	std::atomic<guint64> m_encode_us { 0 };
+	std::atomic<guint64> m_bytes_written { 0 };
+
+	Thumbnailer(const ThumbnailConfig& config);
+	~Thumbnailer();
+
+	Thumbnailer(const Thumbnailer& other) = delete;
+	Thumbnailer& operator=(const Thumbnailer& other) = delete;
+
+	auto set_database(va::Database* _va_database) -> void;
+	auto offer(guint source_id, const std::string& video_file, const FrameView& frame, const ThumbnailCandidate& candidate) -> void;
+	auto sweep(guint64 now) -> void;
+	auto flush() -> void;
+
+	auto m_copy(const FrameView& frame, const ThumbnailCandidate& candidate) -> std::unique_ptr<Crop>;
+	auto m_release(Held& held) -> void;
+	auto m_encode_loop() -> void;
+	auto m_encode(const Crop& crop) -> bool;
+};
+
+} // namespace va
+
+#endif
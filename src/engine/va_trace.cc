@@ -0,0 +1,115 @@
+#include "va_trace.h"
+
+#ifdef VA_ENABLE_TRACE
+
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+thread_local va::TraceBuffer* va::trace_thread_buffer = nullptr;
+
+/* buffers outlive their threads so late exports still see them */
+static std::mutex trace_mutex;
+static std::vector<va::TraceBuffer*> trace_buffers;
+
+/* tick / clock pair taken at the first span, ticks are converted to time
+ * against a second pair taken at export */
+static uint64_t trace_origin_ticks = 0;
+static std::chrono::steady_clock::time_point trace_origin_time;
+
+auto va::trace_register_thread() -> va::TraceBuffer* {
+	va::TraceBuffer* buffer = new va::TraceBuffer {};
+	buffer->m_tid = static_cast<uint32_t>(syscall(SYS_gettid));
+	pthread_getname_np(pthread_self(), buffer->m_thread_name, sizeof(buffer->m_thread_name));
+
+	std::lock_guard<std::mutex> lock { trace_mutex };
+	if (trace_buffers.empty()) {
+		trace_origin_time = std::chrono::steady_clock::now();
+		trace_origin_ticks = va::trace_ticks();
+	}
+	trace_buffers.push_back(buffer);
+	va::trace_thread_buffer = buffer;
+	return buffer;
+}
+
+/**
+ * Zero length event, exported as an instant marker
+ */
+auto va::trace_instant(const char* name) -> void {
+	va::trace_record(name, va::trace_ticks(), 0);
+}
+
+/**
+ * Write every buffered event to path as Chrome trace JSON, returns the number
+ * of events written. Safe to call while other threads keep tracing.
+ */
+auto va::trace_export(const std::string& path) -> size_t {
+	std::lock_guard<std::mutex> lock { trace_mutex };
+	if (trace_buffers.empty()) {
+		return 0;
+	}
+
+	/* make sure the calibration interval is long enough to be accurate */
+	auto now = std::chrono::steady_clock::now();
+	if (now - trace_origin_time < std::chrono::milliseconds(10)) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		now = std::chrono::steady_clock::now();
+	}
+	uint64_t now_ticks = va::trace_ticks();
+	double ns_per_tick = std::chrono::duration<double, std::nano>(now - trace_origin_time).count() / (now_ticks - trace_origin_ticks);
+	auto to_us = [ns_per_tick](uint64_t ticks) {
+		return static_cast<double>(static_cast<int64_t>(ticks - trace_origin_ticks)) * ns_per_tick / 1000.0;
+	};
+
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file) {
+		return 0;
+	}
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	int pid = getpid();
+	size_t written = 0;
+	std::vector<va::TraceEvent> events;
+	for (va::TraceBuffer* buffer : trace_buffers) {
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				written ? ",\n" : "", pid, buffer->m_tid, buffer->m_thread_name);
+		++written;
+
+		uint64_t head = buffer->m_head.load(std::memory_order_acquire);
+		uint64_t first = head > VA_TRACE_BUFFER_EVENTS ? head - VA_TRACE_BUFFER_EVENTS : 0;
+		events.clear();
+		for (uint64_t i = first; i < head; ++i) {
+			events.push_back(buffer->m_events[i & (VA_TRACE_BUFFER_EVENTS - 1)]);
+		}
+		/* drop what the writer overwrote while we copied, including the slot of
+		 * the event it may be writing right now; the fence keeps the copy
+		 * above from being ordered after this load */
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t after = buffer->m_head.load(std::memory_order_relaxed);
+		uint64_t valid = after + 1 > VA_TRACE_BUFFER_EVENTS ? after + 1 - VA_TRACE_BUFFER_EVENTS : 0;
+		size_t skip = valid > first ? std::min<uint64_t>(valid - first, events.size()) : 0;
+
+		for (size_t i = skip; i < events.size(); ++i) {
+			const va::TraceEvent& event = events[i];
+			if (event.end == 0) {
+				fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u}",
+						event.name, to_us(event.start), pid, buffer->m_tid);
+			} else {
+				fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u}",
+						event.name, to_us(event.start), (event.end - event.start) * ns_per_tick / 1000.0, pid, buffer->m_tid);
+			}
+			++written;
+		}
+	}
+	fprintf(file, "\n]}\n");
+	fclose(file);
+	return written;
+}
+
+#endif
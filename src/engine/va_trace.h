@@ -0,0 +1,112 @@
+#ifndef VA_ENGINE_TRACE_H_
+#define VA_ENGINE_TRACE_H_
+
+/**
+ * Scoped trace spans, exported as Chrome trace JSON (chrome://tracing or
+ * ui.perfetto.dev).
+ *
+ *   VA_TRACE_SCOPE("db.insert");      span from here to the end of the scope
+ *   VA_TRACE_INSTANT("state-changed"); zero length marker
+ *   VA_TRACE_EXPORT("trace.json");    write what the buffers hold
+ *
+ * Names must be string literals. Without -DVA_ENABLE_TRACE (make ENABLE_TRACE=1)
+ * the macros expand to nothing. With it, a span costs two cycle counter reads
+ * and one store into a per-thread ring buffer; the newest
+ * VA_TRACE_BUFFER_EVENTS spans of every thread are kept.
+ */
+#ifdef VA_ENABLE_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* per thread, a power of two */
+#ifndef VA_TRACE_BUFFER_EVENTS
+#define VA_TRACE_BUFFER_EVENTS (64 * 1024)
+#endif
+
+#define VA_TRACE_CONCAT_(a, b) a##b
+#define VA_TRACE_CONCAT(a, b) VA_TRACE_CONCAT_(a, b)
+#define VA_TRACE_SCOPE(name) va::TraceScope VA_TRACE_CONCAT(va_trace_scope_, __LINE__) { name }
+#define VA_TRACE_INSTANT(name) va::trace_instant(name)
+#define VA_TRACE_EXPORT(path) va::trace_export(path)
+
+namespace va {
+struct TraceEvent {
+	const char* name;
+	uint64_t start;
+	uint64_t end;
+};
+
+/**
+ * Ring of the events of one thread. Only the owning thread writes; the
+ * exporter copies events and drops those the writer may have overwritten
+ * meanwhile, so neither side ever waits.
+ */
+struct TraceBuffer {
+	std::atomic<uint64_t> m_head { 0 };
+	uint32_t m_tid = 0;
+	char m_thread_name[16] = { };
+	TraceEvent m_events[VA_TRACE_BUFFER_EVENTS];
+};
+
+extern thread_local TraceBuffer* trace_thread_buffer;
+
+auto trace_register_thread() -> TraceBuffer*;
+auto trace_instant(const char* name) -> void;
+auto trace_export(const std::string& path) -> size_t;
+
+/**
+ * Raw cycle counter, converted to time at export
+ */
+inline auto trace_ticks() -> uint64_t {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	uint64_t ticks;
+	asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+	return ticks;
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline auto trace_record(const char* name, uint64_t start, uint64_t end) -> void {
+	TraceBuffer* buffer = trace_thread_buffer;
+	if (!buffer) {
+		buffer = trace_register_thread();
+	}
+	uint64_t head = buffer->m_head.load(std::memory_order_relaxed);
+	buffer->m_events[head & (VA_TRACE_BUFFER_EVENTS - 1)] = TraceEvent { name, start, end };
+	buffer->m_head.store(head + 1, std::memory_order_release);
+}
+
+struct TraceScope {
+	const char* m_name;
+	uint64_t m_start;
+
+	explicit TraceScope(const char* name) : m_name(name), m_start(trace_ticks()) { }
+	~TraceScope() {
+		trace_record(m_name, m_start, trace_ticks());
+	}
+
+	TraceScope(const TraceScope& other) = delete;
+	TraceScope& operator=(const TraceScope& other) = delete;
+};
+
+} // namespace va
+
+#else
+
+#define VA_TRACE_SCOPE(name) ((void)0)
+#define VA_TRACE_INSTANT(name) ((void)0)
+#define VA_TRACE_EXPORT(path) ((void)0)
+
+#endif
+
+#endif
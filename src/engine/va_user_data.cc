@@ -1,8 +1,64 @@
 #include "va_user_data.h"
 
+#include "va_trace.h"
+
 va::UserData::UserData(va::Database* _va_database, int _save_interval)
 	: va_database(_va_database), frame_count(0), save_interval(_save_interval) { }
 
 va::UserData::UserData(va::Database* _va_database) : va_database(_va_database) {}
 
 va::UserData::~UserData() { }
+
+auto va::UserData::has_sink() const -> bool {
+	return va_database || va_detection_cache || va_journal || va_publisher || va_heatmap;
+}
+
+/**
+ * Hand one frame of detections to the sinks. Called from the metadata probe,
+ * and by tools that replay detections without a pipeline.
+ */
+auto va::UserData::sink_frame(guint source_id, va::FrameMetadata& frame_meta) -> void {
+	VA_TRACE_SCOPE("sink_frame");
+	/* every frame goes to the hot store, only sampled ones to the database */
+	if (va_detection_cache) {
+		va_detection_cache->push(source_id, frame_meta);
+	}
+	if (va_publisher) {
+		va_publisher->publish(source_id, frame_meta);
+	}
+	if (va_heatmap) {
+		va_heatmap->add_frame(source_id, frame_meta);
+	}
+
+	/* count the frame and reset the count to 0 if it reachs save_interval */
+	++frame_count;
+	if (frame_count >= save_interval) {
+		/* the journal keeps database stalls and outages off this thread */
+		if (va_journal) {
+			va_journal->append(frame_meta);
+		} else if (va_database) {
+			va_database->insert(&frame_meta);
+		}
+		frame_count = 0;
+	}
+}
+
+auto va::UserData::source_uri(guint source_id) const -> std::string {
+	std::shared_ptr<const std::vector<std::string>> uris = std::atomic_load(&source_uris);
+	if (!uris || source_id >= uris->size()) {
+		return {};
+	}
+	return (*uris)[source_id];
+}
+
+/**
+ * The chunks of a recorded file are named by the file
+ */
+auto va::UserData::set_source_uris(std::vector<std::string> uris) -> void {
+	for (std::string& uri : uris) {
+		if (va::is_chunk_uri(uri)) {
+			uri = va::parse_chunk_uri(uri).location;
+		}
+	}
+	std::atomic_store(&source_uris, std::shared_ptr<const std::vector<std::string>> { std::make_shared<std::vector<std::string>>(std::move(uris)) });
+}
@@ -1,7 +1,20 @@
 #ifndef VA_ENGINE_USER_DATA_H_
 #define VA_ENGINE_USER_DATA_H_
 
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "va_clip_recorder.h"
 #include "va_database.h"
+#include "va_detection_cache.h"
+#include "va_file_chunks.h"
+#include "va_heatmap.h"
+#include "va_journal.h"
+#include "va_publisher.h"
+#include "va_scene_gate.h"
+#include "va_stream_stats.h"
+#include "va_thumbnailer.h"
 
 namespace va {
 /**
@@ -12,6 +25,18 @@ struct UserData {
 	int frame_count;
 	int save_interval;
 	std::string video_file;
+	va::DetectionCache* va_detection_cache = nullptr;
+	va::Journal* va_journal = nullptr;
+	va::Publisher* va_publisher = nullptr;
+	va::ClipRecorder* va_clip_recorder = nullptr;
+	va::Thumbnailer* va_thumbnailer = nullptr;
+	va::SceneGate* va_scene_gate = nullptr;
+	va::Heatmap* va_heatmap = nullptr;
+	va::StreamStats* va_stream_stats = nullptr;
+	va::ChunkMerger* va_chunk_merger = nullptr;
+	/* uri of every source, indexed by source id. Replaced as a whole when
+	 * sources are added or removed at runtime, read by the probe. */
+	std::shared_ptr<const std::vector<std::string>> source_uris;
 
 	// copy constructor and assignment
 	UserData(const UserData& other) = default;
@@ -24,6 +49,11 @@ struct UserData {
 	UserData(va::Database* _va_database, int _save_interval);
 	UserData(va::Database* _va_database);
 	~UserData();
+
+	auto has_sink() const -> bool;
+	auto sink_frame(guint source_id, va::FrameMetadata& frame_meta) -> void;
+	auto source_uri(guint source_id) const -> std::string;
+	auto set_source_uris(std::vector<std::string> uris) -> void;
 };
 
 } // namespace va
@@ -1,12 +1,33 @@
 #include <iostream>
 #include <memory>
 
+#include "va_clip_recorder.h"
 #include "va_database.h"
+#include "va_detection_cache.h"
 #include "va_engine.h"
+#include "va_heatmap.h"
+#include "va_journal.h"
 #include "va_object_meta.h"
+#include "va_publisher.h"
+#include "va_query_server.h"
+#include "va_retention.h"
+#include "va_scene_gate.h"
+#include "va_thread_placement.h"
+#include "va_thumbnailer.h"
 
 auto main(int argc, char** argv) -> int {
 	try {
+		/* pin threads to cpus and numa nodes, before any of them starts */
+		std::unique_ptr<va::ThreadPlacement> thread_placement;
+		if (argc > 1 && (g_str_has_suffix(argv[1], ".yml") || g_str_has_suffix(argv[1], ".yaml"))) {
+			va::ThreadPlacementConfig placement_config = va::parse_thread_placement_config(argv[1], "thread-placement");
+			if (placement_config.enable) {
+				thread_placement = std::make_unique<va::ThreadPlacement>(placement_config);
+				va::set_thread_placement(thread_placement.get());
+			}
+		}
+		va::place_thread("main");
+
 		std::string url { "tcp://127.0.0.1:3306" };
 		std::string username { "root" };
 		std::string password { "example" } ;
@@ -17,6 +38,80 @@ auto main(int argc, char** argv) -> int {
 
 		std::unique_ptr<va::Engine> engine { std::make_unique<va::Engine>(argc, argv) };
 		engine->set_database(&db);
+		engine->set_thread_placement(thread_placement.get());
+
+		/* answer queries on recent detections from memory */
+		std::unique_ptr<va::DetectionCache> detection_cache;
+		/* and to other processes, on a loopback port */
+		std::unique_ptr<va::QueryServer> query_server;
+		/* buffer database writes on local disk */
+		std::unique_ptr<va::Journal> journal;
+		/* stream detections to a remote aggregator */
+		std::unique_ptr<va::Publisher> publisher;
+		/* compact and expire old rows in the background */
+		std::unique_ptr<va::Retention> retention;
+		/* write the video around detections of interest to files */
+		std::unique_ptr<va::ClipRecorder> clip_recorder;
+		/* save the best crop of each detected object as JPEG */
+		std::unique_ptr<va::Thumbnailer> thumbnailer;
+		/* skip inference on frames that did not change */
+		std::unique_ptr<va::SceneGate> scene_gate;
+		/* count where objects are, per source */
+		std::unique_ptr<va::Heatmap> heatmap;
+		if (g_str_has_suffix(argv[1], ".yml") || g_str_has_suffix(argv[1], ".yaml")) {
+			va::JournalConfig journal_config = va::parse_journal_config(argv[1], "journal");
+			if (journal_config.enable) {
+				journal = std::make_unique<va::Journal>(journal_config, &db);
+				engine->set_journal(journal.get());
+			}
+
+			va::RetentionConfig retention_config = va::parse_retention_config(argv[1], "retention");
+			if (retention_config.enable) {
+				retention = std::make_unique<va::Retention>(retention_config, &db);
+			}
+
+			va::PublisherConfig publisher_config = va::parse_publisher_config(argv[1], "publisher");
+			if (publisher_config.enable) {
+				publisher = std::make_unique<va::Publisher>(publisher_config);
+				engine->set_publisher(publisher.get());
+			}
+
+			va::ClipRecorderConfig clip_config = va::parse_clip_recorder_config(argv[1], "clip-recorder");
+			if (clip_config.enable) {
+				clip_recorder = std::make_unique<va::ClipRecorder>(clip_config);
+				engine->set_clip_recorder(clip_recorder.get());
+			}
+
+			va::ThumbnailConfig thumbnail_config = va::parse_thumbnail_config(argv[1], "thumbnails");
+			if (thumbnail_config.enable) {
+				thumbnailer = std::make_unique<va::Thumbnailer>(thumbnail_config);
+				thumbnailer->set_database(&db);
+				engine->set_thumbnailer(thumbnailer.get());
+			}
+
+			va::SceneGateConfig scene_gate_config = va::parse_scene_gate_config(argv[1], "scene-gate");
+			if (scene_gate_config.enable) {
+				scene_gate = std::make_unique<va::SceneGate>(scene_gate_config);
+				engine->set_scene_gate(scene_gate.get());
+			}
+
+			va::HeatmapConfig heatmap_config = va::parse_heatmap_config(argv[1], "heatmap");
+			if (heatmap_config.enable) {
+				heatmap = std::make_unique<va::Heatmap>(heatmap_config);
+				heatmap->set_database(&db);
+				engine->set_heatmap(heatmap.get());
+			}
+
+			va::DetectionCacheConfig cache_config = va::parse_detection_cache_config(argv[1], "detection-cache");
+			if (cache_config.enable) {
+				detection_cache = std::make_unique<va::DetectionCache>(cache_config);
+				detection_cache->set_database(&db);
+				engine->set_detection_cache(detection_cache.get());
+				if (cache_config.query_port) {
+					query_server = std::make_unique<va::QueryServer>(detection_cache.get(), cache_config.query_port);
+				}
+			}
+		}
 		engine->run();
 	} catch (std::invalid_argument& e) {
 		g_printerr("%s", e.what());
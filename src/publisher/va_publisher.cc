@@ -0,0 +1,214 @@
+#include "va_publisher.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <stdexcept>
+
+#include <yaml-cpp/yaml.h>
+
+#include "va_thread_placement.h"
+#include "va_trace.h"
+
+auto va::parse_publisher_config(const char* cfg_file, const char* group) -> va::PublisherConfig {
+	va::PublisherConfig config {};
+	YAML::Node node = YAML::LoadFile(cfg_file)[group];
+	if (!node) {
+		return config;
+	}
+	config.enable = node["enable"].as<int>(config.enable) != 0;
+	config.host = node["host"].as<std::string>(config.host);
+	config.port = node["port"].as<guint>(config.port);
+	config.batch_max_bytes = node["batch-max-bytes"].as<gsize>(config.batch_max_bytes);
+	config.batch_max_ms = node["batch-max-ms"].as<guint>(config.batch_max_ms);
+	config.backlog_max_mb = node["backlog-max-mb"].as<gsize>(config.backlog_max_mb);
+	config.compression = node["compression"].as<std::string>(config.compression);
+	config.reconnect_ms = node["reconnect-ms"].as<guint>(config.reconnect_ms);
+	return config;
+}
+
+va::Publisher::Publisher(const va::PublisherConfig& config) :
+	m_config(config),
+	m_codec(va::parse_wire_codec(config.compression))
+{
+	if (!va::wire_codec_available(m_codec)) {
+		throw std::invalid_argument("Publisher compression " + config.compression + " is not built in, see WITH_LZ4 / WITH_ZSTD\n");
+	}
+	m_sender = std::thread { &va::Publisher::m_send_loop, this };
+	g_print("Publisher: sending to %s:%u\n", m_config.host.c_str(), m_config.port);
+}
+
+va::Publisher::~Publisher() {
+	{
+		std::lock_guard<std::mutex> lock { m_mutex };
+		m_stop = true;
+	}
+	m_cond.notify_all();
+	m_sender.join();
+	if (m_socket >= 0) {
+		close(m_socket);
+	}
+	g_print("Publisher: sent %lu batches, %lu bytes, %lu detections, dropped %lu detections\n",
+			(unsigned long)m_sent_batches.load(), (unsigned long)m_sent_bytes.load(),
+			(unsigned long)m_sent_detections.load(), (unsigned long)m_dropped_detections.load());
+}
+
+/**
+ * Move the open batch to the backlog, dropping the oldest batches to stay
+ * under backlog_max_mb. Called with m_mutex held.
+ */
+auto va::Publisher::m_seal() -> void {
+	if (m_open.empty()) {
+		return;
+	}
+	gsize size = m_open.size();
+	gsize max_bytes = m_config.backlog_max_mb * 1024 * 1024;
+	while (!m_backlog.empty() && m_backlog_bytes + size > max_bytes) {
+		m_backlog_bytes -= m_backlog.front().encoder.size();
+		m_dropped_detections += m_backlog.front().detection_count;
+		m_backlog.pop_front();
+	}
+	m_backlog.push_back(Sealed { m_sequence++, m_open.detection_count(), std::move(m_open) });
+	m_backlog_bytes += size;
+	m_open = va::WireEncoder {};
+}
+
+/**
+ * Encode a frame into the open batch, cheap enough for the probe thread
+ */
+auto va::Publisher::publish(guint source_id, const va::FrameMetadata& frame_meta) -> void {
+	VA_TRACE_SCOPE("publisher.publish");
+	if (frame_meta.va_object_meta_list.empty()) {
+		return;
+	}
+	bool sealed = false;
+	{
+		std::lock_guard<std::mutex> lock { m_mutex };
+		if (m_open.empty()) {
+			m_open_since = std::chrono::steady_clock::now();
+		}
+		m_open.add_frame(source_id, frame_meta);
+		if (m_open.size() >= m_config.batch_max_bytes) {
+			m_seal();
+			sealed = true;
+		}
+	}
+	if (sealed) {
+		m_cond.notify_one();
+	}
+}
+
+auto va::Publisher::m_connect() -> bool {
+	struct addrinfo hints = { };
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo* addresses = nullptr;
+	std::string port = std::to_string(m_config.port);
+	if (getaddrinfo(m_config.host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+		return false;
+	}
+
+	for (struct addrinfo* address = addresses; address; address = address->ai_next) {
+		int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (fd < 0) {
+			continue;
+		}
+		if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			/* a stalled peer must not hold the sender forever */
+			struct timeval timeout = { 5, 0 };
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+			m_socket = fd;
+			break;
+		}
+		close(fd);
+	}
+	freeaddrinfo(addresses);
+	return m_socket >= 0;
+}
+
+auto va::Publisher::m_send(const std::vector<uint8_t>& data) -> bool {
+	const uint8_t* cursor = data.data();
+	size_t left = data.size();
+	while (left > 0) {
+		ssize_t sent = send(m_socket, cursor, left, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		cursor += sent;
+		left -= sent;
+	}
+	return true;
+}
+
+auto va::Publisher::m_send_loop() -> void {
+	va::place_thread("publisher");
+	std::vector<uint8_t> wire;
+	bool connected_once = false;
+	for (;;) {
+		Sealed batch;
+		{
+			std::unique_lock<std::mutex> lock { m_mutex };
+			m_cond.wait_for(lock, std::chrono::milliseconds(m_config.batch_max_ms), [this] {
+				return m_stop || !m_backlog.empty();
+			});
+			if (!m_open.empty() && (m_stop ||
+					std::chrono::steady_clock::now() - m_open_since >= std::chrono::milliseconds(m_config.batch_max_ms))) {
+				m_seal();
+			}
+			if (m_backlog.empty()) {
+				if (m_stop) {
+					break;
+				}
+				continue;
+			}
+			if (m_stop && m_socket < 0) {
+				/* nothing to send to, what is left is dropped */
+				break;
+			}
+			batch = std::move(m_backlog.front());
+			m_backlog.pop_front();
+			m_backlog_bytes -= batch.encoder.size();
+		}
+
+		wire.clear();
+		batch.encoder.finish(batch.sequence, m_codec, &wire);
+
+		while (m_socket < 0 || !m_send(wire)) {
+			if (m_socket >= 0) {
+				g_printerr("Publisher: connection to %s:%u lost: %s\n", m_config.host.c_str(), m_config.port, strerror(errno));
+				close(m_socket);
+				m_socket = -1;
+			}
+			if (m_connect()) {
+				g_print("Publisher: %s %s:%u\n", connected_once ? "reconnected to" : "connected to", m_config.host.c_str(), m_config.port);
+				connected_once = true;
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock { m_mutex };
+			if (m_cond.wait_for(lock, std::chrono::milliseconds(m_config.reconnect_ms), [this] { return m_stop; })) {
+				m_dropped_detections += batch.detection_count;
+				break;
+			}
+		}
+		if (m_socket >= 0) {
+			++m_sent_batches;
+			m_sent_bytes += wire.size();
+			m_sent_detections += batch.detection_count;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock { m_mutex };
+	for (const Sealed& batch : m_backlog) {
+		m_dropped_detections += batch.detection_count;
+	}
+}
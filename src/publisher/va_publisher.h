@@ -0,0 +1,88 @@
+#ifndef VA_PUBLISHER_PUBLISHER_H_
+#define VA_PUBLISHER_PUBLISHER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glib.h>
+
+#include "va_object_meta.h"
+#include "va_wire_format.h"
+
+namespace va {
+/**
+ * Publisher settings, read from the "publisher" group of the yml file
+ */
+struct PublisherConfig {
+	bool enable = false;
+	std::string host = "127.0.0.1";
+	guint port = 9400;
+	gsize batch_max_bytes = 64 * 1024;
+	guint batch_max_ms = 200;
+	gsize backlog_max_mb = 64;
+	std::string compression = "none";
+	guint reconnect_ms = 1000;
+};
+
+auto parse_publisher_config(const char* cfg_file, const char* group) -> PublisherConfig;
+
+/**
+ * Streams detections to a remote aggregator in the compact wire format.
+ *
+ * publish() encodes the frame into the open batch on the caller's thread. A
+ * batch is sealed when it reaches batch_max_bytes or is batch_max_ms old, and
+ * a sender thread compresses and writes sealed batches to a TCP connection,
+ * reconnecting after failures. Sealed batches wait in a backlog bounded by
+ * backlog_max_mb, the oldest batch is dropped when it is full.
+ */
+struct Publisher {
+	struct Sealed {
+		uint64_t sequence;
+		uint32_t detection_count;
+		va::WireEncoder encoder;
+	};
+
+	PublisherConfig m_config;
+	va::WireCodec m_codec;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	va::WireEncoder m_open;
+	std::chrono::steady_clock::time_point m_open_since;
+	std::deque<Sealed> m_backlog;
+	gsize m_backlog_bytes = 0;
+	uint64_t m_sequence = 0;
+	bool m_stop = false;
+
+	std::atomic<uint64_t> m_sent_batches { 0 };
+	std::atomic<uint64_t> m_sent_bytes { 0 };
+	std::atomic<uint64_t> m_sent_detections { 0 };
+	std::atomic<uint64_t> m_dropped_detections { 0 };
+
+	/* owned by the sender thread */
+	int m_socket = -1;
+	std::thread m_sender;
+
+	Publisher(const PublisherConfig& config);
+	~Publisher();
+
+	Publisher(const Publisher& other) = delete;
+	Publisher& operator=(const Publisher& other) = delete;
+
+	auto publish(guint source_id, const va::FrameMetadata& frame_meta) -> void;
+
+	auto m_seal() -> void;
+	auto m_connect() -> bool;
+	auto m_send(const std::vector<uint8_t>& data) -> bool;
+	auto m_send_loop() -> void;
+};
+
+} // namespace va
+
+#endif
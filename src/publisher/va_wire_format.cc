@@ -0,0 +1,317 @@
+#include "va_wire_format.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef VA_WITH_LZ4
+#include <lz4.h>
+#endif
+#ifdef VA_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+/* refuse batches bigger than this when decoding a corrupt stream */
+#define WIRE_MAX_BATCH_SIZE (64 * 1024 * 1024)
+
+static auto put_varint(std::vector<uint8_t>* out, uint64_t value) -> void {
+	while (value >= 0x80) {
+		out->push_back(static_cast<uint8_t>(value) | 0x80);
+		value >>= 7;
+	}
+	out->push_back(static_cast<uint8_t>(value));
+}
+
+static auto get_varint(const uint8_t** data, const uint8_t* end, uint64_t* value) -> bool {
+	uint64_t result = 0;
+	for (int shift = 0; shift < 64 && *data < end; shift += 7) {
+		uint8_t byte = *(*data)++;
+		result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			*value = result;
+			return true;
+		}
+	}
+	return false;
+}
+
+static auto zigzag(int64_t value) -> uint64_t {
+	return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+static auto unzigzag(uint64_t value) -> int64_t {
+	return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+static auto quantize(double pixels) -> uint64_t {
+	return pixels <= 0.0 ? 0 : static_cast<uint64_t>(std::lround(pixels));
+}
+
+template <typename T>
+static auto put_le(uint8_t* out, T value) -> void {
+	std::memcpy(out, &value, sizeof(T));
+}
+
+template <typename T>
+static auto get_le(const uint8_t* data) -> T {
+	T value;
+	std::memcpy(&value, data, sizeof(T));
+	return value;
+}
+
+auto va::parse_wire_codec(const std::string& name) -> va::WireCodec {
+	if (name == "none" || name.empty()) {
+		return va::WireCodec::NONE;
+	}
+	if (name == "lz4") {
+		return va::WireCodec::LZ4;
+	}
+	if (name == "zstd") {
+		return va::WireCodec::ZSTD;
+	}
+	throw std::invalid_argument("Unknown compression: " + name + "\n");
+}
+
+auto va::wire_codec_available(va::WireCodec codec) -> bool {
+	switch (codec) {
+		case va::WireCodec::NONE:
+			return true;
+#ifdef VA_WITH_LZ4
+		case va::WireCodec::LZ4:
+			return true;
+#endif
+#ifdef VA_WITH_ZSTD
+		case va::WireCodec::ZSTD:
+			return true;
+#endif
+		default:
+			return false;
+	}
+}
+
+auto va::WireEncoder::add_frame(guint source_id, const va::FrameMetadata& frame_meta) -> void {
+	uint64_t timestamp_us = frame_meta.timestamp / 1000;
+	if (m_frame_count == 0) {
+		m_base_us = timestamp_us;
+		m_last_us = timestamp_us;
+	}
+	if (std::none_of(m_sources.begin(), m_sources.end(), [source_id](const auto& source) { return source.first == source_id; })) {
+		m_sources.emplace_back(source_id, frame_meta.video_file);
+	}
+
+	put_varint(&m_frames, source_id);
+	put_varint(&m_frames, zigzag(static_cast<int64_t>(timestamp_us - m_last_us)));
+	put_varint(&m_frames, frame_meta.va_object_meta_list.size());
+	for (const va::ObjectMetadata& object_meta : frame_meta.va_object_meta_list) {
+		put_varint(&m_frames, static_cast<uint64_t>(std::max(object_meta.class_id, 0)));
+		put_varint(&m_frames, quantize(object_meta.left));
+		put_varint(&m_frames, quantize(object_meta.top));
+		put_varint(&m_frames, quantize(object_meta.width));
+		put_varint(&m_frames, quantize(object_meta.height));
+	}
+	m_last_us = timestamp_us;
+	++m_frame_count;
+	m_detection_count += frame_meta.va_object_meta_list.size();
+}
+
+/**
+ * Append the framed batch to out, compressed with codec when that helps
+ */
+auto va::WireEncoder::finish(uint64_t sequence, va::WireCodec codec, std::vector<uint8_t>* out) const -> void {
+	std::vector<uint8_t> payload;
+	payload.reserve(m_frames.size() + 64 * m_sources.size() + 32);
+	put_varint(&payload, sequence);
+	put_varint(&payload, m_base_us);
+	put_varint(&payload, m_sources.size());
+	for (const auto& source : m_sources) {
+		put_varint(&payload, source.first);
+		put_varint(&payload, source.second.size());
+		payload.insert(payload.end(), source.second.begin(), source.second.end());
+	}
+	put_varint(&payload, m_frame_count);
+	payload.insert(payload.end(), m_frames.begin(), m_frames.end());
+
+	size_t header = out->size();
+	out->resize(header + WIRE_HEADER_SIZE);
+	va::WireCodec used = va::WireCodec::NONE;
+	size_t wire_size = payload.size();
+
+#ifdef VA_WITH_LZ4
+	if (codec == va::WireCodec::LZ4) {
+		out->resize(header + WIRE_HEADER_SIZE + LZ4_compressBound(payload.size()));
+		int compressed = LZ4_compress_default(
+			reinterpret_cast<const char*>(payload.data()),
+			reinterpret_cast<char*>(out->data() + header + WIRE_HEADER_SIZE),
+			payload.size(),
+			out->size() - header - WIRE_HEADER_SIZE
+		);
+		if (compressed > 0 && static_cast<size_t>(compressed) < payload.size()) {
+			used = va::WireCodec::LZ4;
+			wire_size = compressed;
+		}
+	}
+#endif
+#ifdef VA_WITH_ZSTD
+	if (codec == va::WireCodec::ZSTD) {
+		out->resize(header + WIRE_HEADER_SIZE + ZSTD_compressBound(payload.size()));
+		size_t compressed = ZSTD_compress(
+			out->data() + header + WIRE_HEADER_SIZE,
+			out->size() - header - WIRE_HEADER_SIZE,
+			payload.data(),
+			payload.size(),
+			3
+		);
+		if (!ZSTD_isError(compressed) && compressed < payload.size()) {
+			used = va::WireCodec::ZSTD;
+			wire_size = compressed;
+		}
+	}
+#endif
+	(void)codec;
+
+	if (used == va::WireCodec::NONE) {
+		out->resize(header + WIRE_HEADER_SIZE);
+		out->insert(out->end(), payload.begin(), payload.end());
+	} else {
+		out->resize(header + WIRE_HEADER_SIZE + wire_size);
+	}
+
+	uint8_t* head = out->data() + header;
+	put_le<uint32_t>(head, WIRE_MAGIC);
+	head[4] = WIRE_VERSION;
+	head[5] = static_cast<uint8_t>(used);
+	put_le<uint16_t>(head + 6, 0);
+	put_le<uint32_t>(head + 8, payload.size());
+	put_le<uint32_t>(head + 12, wire_size);
+}
+
+auto va::WireEncoder::clear() -> void {
+	m_frames.clear();
+	m_sources.clear();
+	m_frame_count = 0;
+	m_detection_count = 0;
+}
+
+auto va::WireEncoder::empty() const -> bool {
+	return m_frame_count == 0;
+}
+
+/**
+ * Approximate encoded size, before compression
+ */
+auto va::WireEncoder::size() const -> size_t {
+	return m_frames.size();
+}
+
+auto va::WireEncoder::detection_count() const -> uint32_t {
+	return m_detection_count;
+}
+
+static auto decode_payload(const uint8_t* data, const uint8_t* end, va::WireBatch* batch) -> bool {
+	uint64_t base_us, source_count, frame_count;
+	if (!get_varint(&data, end, &batch->sequence) || !get_varint(&data, end, &base_us) || !get_varint(&data, end, &source_count)) {
+		return false;
+	}
+
+	std::vector<std::pair<guint, std::string>> sources;
+	for (uint64_t i = 0; i < source_count; ++i) {
+		uint64_t source_id, length;
+		if (!get_varint(&data, end, &source_id) || !get_varint(&data, end, &length) || static_cast<uint64_t>(end - data) < length) {
+			return false;
+		}
+		sources.emplace_back(source_id, std::string { reinterpret_cast<const char*>(data), length });
+		data += length;
+	}
+
+	if (!get_varint(&data, end, &frame_count)) {
+		return false;
+	}
+	batch->frames.clear();
+	batch->detection_count = 0;
+	uint64_t timestamp_us = base_us;
+	for (uint64_t i = 0; i < frame_count; ++i) {
+		uint64_t source_id, delta, object_count;
+		if (!get_varint(&data, end, &source_id) || !get_varint(&data, end, &delta) || !get_varint(&data, end, &object_count)) {
+			return false;
+		}
+		timestamp_us += unzigzag(delta);
+
+		std::string name;
+		for (const auto& source : sources) {
+			if (source.first == source_id) {
+				name = source.second;
+				break;
+			}
+		}
+		va::WireFrame frame { static_cast<guint>(source_id), va::FrameMetadata { name, timestamp_us * 1000 } };
+		for (uint64_t k = 0; k < object_count; ++k) {
+			uint64_t class_id, left, top, width, height;
+			if (!get_varint(&data, end, &class_id) || !get_varint(&data, end, &left) || !get_varint(&data, end, &top) ||
+					!get_varint(&data, end, &width) || !get_varint(&data, end, &height)) {
+				return false;
+			}
+			frame.frame_meta.va_object_meta_list.emplace_back(
+				std::string {}, static_cast<int>(class_id), left, top, width, height, timestamp_us * 1000
+			);
+		}
+		batch->detection_count += object_count;
+		batch->frames.push_back(std::move(frame));
+	}
+	return data == end;
+}
+
+auto va::wire_decode(const uint8_t* data, size_t size, va::WireBatch* batch) -> long {
+	if (size < WIRE_HEADER_SIZE) {
+		return 0;
+	}
+	if (get_le<uint32_t>(data) != WIRE_MAGIC || data[4] != WIRE_VERSION) {
+		return -1;
+	}
+	va::WireCodec codec = static_cast<va::WireCodec>(data[5]);
+	uint32_t raw_size = get_le<uint32_t>(data + 8);
+	uint32_t wire_size = get_le<uint32_t>(data + 12);
+	if (raw_size > WIRE_MAX_BATCH_SIZE || wire_size > WIRE_MAX_BATCH_SIZE) {
+		return -1;
+	}
+	if (size < WIRE_HEADER_SIZE + wire_size) {
+		return 0;
+	}
+	batch->wire_size = WIRE_HEADER_SIZE + wire_size;
+	batch->raw_size = raw_size;
+
+	const uint8_t* payload = data + WIRE_HEADER_SIZE;
+	std::vector<uint8_t> raw;
+	switch (codec) {
+		case va::WireCodec::NONE:
+			if (raw_size != wire_size) {
+				return -1;
+			}
+			break;
+#ifdef VA_WITH_LZ4
+		case va::WireCodec::LZ4:
+			raw.resize(raw_size);
+			if (LZ4_decompress_safe(reinterpret_cast<const char*>(payload), reinterpret_cast<char*>(raw.data()), wire_size, raw_size) != static_cast<int>(raw_size)) {
+				return -1;
+			}
+			payload = raw.data();
+			break;
+#endif
+#ifdef VA_WITH_ZSTD
+		case va::WireCodec::ZSTD:
+			raw.resize(raw_size);
+			if (ZSTD_decompress(raw.data(), raw_size, payload, wire_size) != raw_size) {
+				return -1;
+			}
+			payload = raw.data();
+			break;
+#endif
+		default:
+			return -1;
+	}
+
+	if (!decode_payload(payload, payload + raw_size, batch)) {
+		return -1;
+	}
+	return WIRE_HEADER_SIZE + wire_size;
+}
@@ -0,0 +1,87 @@
+#ifndef VA_PUBLISHER_WIRE_FORMAT_H_
+#define VA_PUBLISHER_WIRE_FORMAT_H_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glib.h>
+
+#include "va_object_meta.h"
+
+/* "VAWB" little endian */
+#define WIRE_MAGIC 0x42574156u
+#define WIRE_VERSION 1
+#define WIRE_HEADER_SIZE 16
+
+namespace va {
+enum class WireCodec : uint8_t {
+	NONE = 0,
+	LZ4 = 1,
+	ZSTD = 2,
+};
+
+auto parse_wire_codec(const std::string& name) -> WireCodec;
+auto wire_codec_available(WireCodec codec) -> bool;
+
+/**
+ * Frame of detections as decoded from the wire
+ */
+struct WireFrame {
+	guint source_id;
+	va::FrameMetadata frame_meta;
+};
+
+/**
+ * Decoded batch
+ */
+struct WireBatch {
+	uint64_t sequence = 0;
+	uint32_t wire_size = 0;
+	uint32_t raw_size = 0;
+	uint32_t detection_count = 0;
+	std::vector<WireFrame> frames;
+};
+
+/**
+ * Builds one batch of frames in the compact wire format.
+ *
+ * Batch layout, all integers are LEB128 varints unless noted:
+ *   header (16 bytes, little endian): u32 magic, u8 version, u8 codec,
+ *     u16 reserved, u32 raw payload size, u32 payload size on the wire
+ *   payload (possibly compressed):
+ *     sequence, base timestamp (us), source count,
+ *       { source id, name length, name bytes } per source in the batch
+ *     frame count,
+ *       { source id, zigzag timestamp delta to the previous frame (us),
+ *         object count, { class id, left, top, width, height } }
+ * Boxes are quantized to whole pixels and object labels are left to the
+ * receiver (class id only), the batch is self-describing so a reconnect
+ * needs no handshake.
+ */
+struct WireEncoder {
+	std::vector<uint8_t> m_frames;
+	std::vector<std::pair<guint, std::string>> m_sources;
+	uint64_t m_base_us = 0;
+	uint64_t m_last_us = 0;
+	uint32_t m_frame_count = 0;
+	uint32_t m_detection_count = 0;
+
+	auto add_frame(guint source_id, const va::FrameMetadata& frame_meta) -> void;
+	auto finish(uint64_t sequence, WireCodec codec, std::vector<uint8_t>* out) const -> void;
+	auto clear() -> void;
+	auto empty() const -> bool;
+	auto size() const -> size_t;
+	auto detection_count() const -> uint32_t;
+};
+
+/**
+ * Decode the batch at the start of data. Returns the bytes consumed, 0 if data
+ * does not hold a full batch yet and -1 if the stream is corrupt.
+ */
+auto wire_decode(const uint8_t* data, size_t size, WireBatch* batch) -> long;
+
+} // namespace va
+
+#endif
@@ -0,0 +1,287 @@
+/**
+ * Query latency of the detection cache. --sources streams of --objects
+ * detections at --fps are pushed for --fill-sec of history and then live, in
+ * real time, while --readers threads ask "what did source X see in the last
+ * --window-sec" as fast as they can for --seconds. Reports queries/s and the
+ * latency percentiles of query(), and with --server the round trip of the
+ * same question through a QueryServer on a loopback port.
+ *
+ * With --database, another run asks for windows that end before what the
+ * cache still holds, to time the fall through to select_range (the bench://
+ * sources usually have no rows there, so this is the index lookup alone).
+ *
+ *   $ ./va_cache_bench --sources 16 --readers 4 --window-sec 300
+ *   $ ./va_cache_bench --server --readers 1
+ *   $ ./va_cache_bench --database va --window-sec 60
+ */
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glib.h>
+
+#include "va_database.h"
+#include "va_detection_cache.h"
+#include "va_query_server.h"
+
+struct BenchOptions {
+	guint sources = 16;
+	guint objects = 10;
+	guint fps = 30;
+	guint fill_sec = 300;
+	guint window_sec = 300;
+	guint readers = 4;
+	guint seconds = 10;
+	guint retention_sec = 300;
+	gsize memory_cap_mb = 256;
+	bool server = false;
+	std::string url { "tcp://127.0.0.1:3306" };
+	std::string username { "root" };
+	std::string password { "example" };
+	std::string database;
+};
+
+static auto now_ns() -> guint64 {
+	return static_cast<guint64>(g_get_real_time()) * 1000;
+}
+
+static auto make_frame(guint source_id, guint objects, guint64 timestamp) -> va::FrameMetadata {
+	va::FrameMetadata frame_meta { "bench://" + std::to_string(source_id), timestamp };
+	for (guint i = 0; i < objects; ++i) {
+		frame_meta.va_object_meta_list.emplace_back(i % 2 ? "Person" : "Car", i % 2 ? 2 : 0,
+				40.0 * i, 20.0 * i, 64.0, 128.0, timestamp);
+	}
+	return frame_meta;
+}
+
+struct Latencies {
+	std::vector<double> us;
+	guint64 detections = 0;
+};
+
+static auto print_latencies(const char* name, std::vector<Latencies>& per_reader, double seconds) -> void {
+	Latencies all;
+	for (Latencies& latencies : per_reader) {
+		all.us.insert(all.us.end(), latencies.us.begin(), latencies.us.end());
+		all.detections += latencies.detections;
+	}
+	if (all.us.empty()) {
+		return;
+	}
+	std::sort(all.us.begin(), all.us.end());
+	auto at = [&all](double p) {
+		return all.us[std::min(all.us.size() - 1, static_cast<size_t>(p * all.us.size()))];
+	};
+	g_print("%-10s %12.0f %10.1f %10.1f %10.1f %10.1f %14.0f\n", name, all.us.size() / seconds, at(0.50), at(0.99),
+			at(0.999), all.us.back(), static_cast<double>(all.detections) / all.us.size());
+}
+
+/**
+ * One line request, read until the newline of the reply
+ */
+static auto round_trip(int fd, const std::string& request, std::string* reply) -> bool {
+	if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+		return false;
+	}
+	reply->clear();
+	char chunk[65536];
+	while (reply->empty() || reply->back() != '\n') {
+		ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+		if (received <= 0) {
+			return false;
+		}
+		reply->append(chunk, received);
+	}
+	return true;
+}
+
+static auto connect_loopback(guint port) -> int {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in address = { };
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+	if (fd < 0 || connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0) {
+		g_printerr("Unable to connect to the query server: %s\n", strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+/**
+ * readers threads asking for windows of window_ns that end back_ns before the
+ * newest frame, for seconds
+ */
+static auto run_readers(va::DetectionCache* cache, const BenchOptions& options, guint64 window_ns, guint64 back_ns,
+		guint port, const char* name) -> void {
+	std::atomic<bool> done { false };
+	std::vector<Latencies> per_reader(options.readers);
+	std::vector<std::thread> readers;
+	for (guint i = 0; i < options.readers; ++i) {
+		readers.emplace_back([&, i] {
+			int fd = port ? connect_loopback(port) : -1;
+			if (port && fd < 0) {
+				return;
+			}
+			std::string reply;
+			Latencies& latencies = per_reader[i];
+			for (guint query = i; !done.load(std::memory_order_relaxed); ++query) {
+				guint source_id = query % options.sources;
+				guint64 to = now_ns() - back_ns;
+				guint64 from = to - window_ns;
+				auto start = std::chrono::steady_clock::now();
+				if (fd >= 0) {
+					std::string request = std::to_string(source_id) + " " + std::to_string(from) + " " + std::to_string(to) + "\n";
+					if (!round_trip(fd, request, &reply)) {
+						break;
+					}
+					latencies.detections += std::count(reply.begin(), reply.end(), '{') - 1;
+				} else {
+					latencies.detections += cache->query(source_id, from, to).size();
+				}
+				latencies.us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+			}
+			if (fd >= 0) {
+				close(fd);
+			}
+		});
+	}
+	std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+	done = true;
+	for (std::thread& reader : readers) {
+		reader.join();
+	}
+	print_latencies(name, per_reader, options.seconds);
+}
+
+auto main(int argc, char** argv) -> int {
+	static struct option long_options[] = {
+		{ "sources", required_argument, nullptr, 's' },
+		{ "objects", required_argument, nullptr, 'o' },
+		{ "fps", required_argument, nullptr, 'f' },
+		{ "fill-sec", required_argument, nullptr, 'F' },
+		{ "window-sec", required_argument, nullptr, 'w' },
+		{ "readers", required_argument, nullptr, 'r' },
+		{ "seconds", required_argument, nullptr, 'S' },
+		{ "retention-sec", required_argument, nullptr, 'R' },
+		{ "memory-cap-mb", required_argument, nullptr, 'm' },
+		{ "server", no_argument, nullptr, 'q' },
+		{ "url", required_argument, nullptr, 'U' },
+		{ "user", required_argument, nullptr, 'u' },
+		{ "password", required_argument, nullptr, 'p' },
+		{ "database", required_argument, nullptr, 'D' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 }
+	};
+	BenchOptions options;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+		switch (opt) {
+			case 's': options.sources = std::max(1ul, std::stoul(optarg)); break;
+			case 'o': options.objects = std::stoul(optarg); break;
+			case 'f': options.fps = std::max(1ul, std::stoul(optarg)); break;
+			case 'F': options.fill_sec = std::stoul(optarg); break;
+			case 'w': options.window_sec = std::max(1ul, std::stoul(optarg)); break;
+			case 'r': options.readers = std::max(1ul, std::stoul(optarg)); break;
+			case 'S': options.seconds = std::max(1ul, std::stoul(optarg)); break;
+			case 'R': options.retention_sec = std::stoul(optarg); break;
+			case 'm': options.memory_cap_mb = std::stoul(optarg); break;
+			case 'q': options.server = true; break;
+			case 'U': options.url = optarg; break;
+			case 'u': options.username = optarg; break;
+			case 'p': options.password = optarg; break;
+			case 'D': options.database = optarg; break;
+			default:
+				g_printerr("Usage: %s [--sources <n>] [--objects <n>] [--fps <n>] [--fill-sec <s>] [--window-sec <s>] "
+						"[--readers <n>] [--seconds <s>] [--retention-sec <s>] [--memory-cap-mb <mb>] [--server] "
+						"[--url <url> --user <name> --password <password> --database <name>]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	try {
+		va::DetectionCacheConfig config;
+		config.enable = true;
+		config.retention_sec = options.retention_sec;
+		config.memory_cap_mb = options.memory_cap_mb;
+		config.max_sources = options.sources;
+		va::DetectionCache cache { config };
+		std::unique_ptr<va::Database> db;
+		if (!options.database.empty()) {
+			db = std::make_unique<va::Database>(options.url, options.username, options.password, options.database, false);
+			cache.set_database(db.get());
+		}
+		for (guint i = 0; i < options.sources; ++i) {
+			cache.set_source_name(i, "bench://" + std::to_string(i));
+		}
+
+		/* history, then live frames at fps from one writer thread, as the probe does */
+		guint64 frame_ns = 1000000000ULL / options.fps;
+		guint64 start = now_ns() - static_cast<guint64>(options.fill_sec) * 1000000000ULL;
+		guint64 next = start;
+		for (; next < now_ns(); next += frame_ns) {
+			for (guint i = 0; i < options.sources; ++i) {
+				cache.push(i, make_frame(i, options.objects, next));
+			}
+		}
+		g_print("%u sources, %u detections per frame at %u fps, %u s of history, %u s retention\n", options.sources,
+				options.objects, options.fps, options.fill_sec, options.retention_sec);
+
+		std::atomic<bool> done { false };
+		std::thread writer { [&] {
+			while (!done.load(std::memory_order_relaxed)) {
+				for (guint64 now = now_ns(); next <= now; next += frame_ns) {
+					for (guint i = 0; i < options.sources; ++i) {
+						cache.push(i, make_frame(i, options.objects, next));
+					}
+				}
+				std::this_thread::sleep_for(std::chrono::nanoseconds(frame_ns));
+			}
+		} };
+
+		std::unique_ptr<va::QueryServer> server;
+		if (options.server) {
+			server = std::make_unique<va::QueryServer>(&cache, 0);
+		}
+
+		guint64 window_ns = static_cast<guint64>(options.window_sec) * 1000000000ULL;
+		g_print("\n%u readers, windows of %u s, %u s per run\n", options.readers, options.window_sec, options.seconds);
+		g_print("%-10s %12s %10s %10s %10s %10s %14s\n", "run", "queries/s", "p50 us", "p99 us", "p99.9 us", "max us", "detections/q");
+		run_readers(&cache, options, window_ns, 0, 0, "memory");
+		if (server) {
+			run_readers(&cache, options, window_ns, 0, server->port(), "server");
+		}
+		if (db) {
+			/* ends before the retention window, every row comes from the database */
+			run_readers(&cache, options, window_ns, static_cast<guint64>(options.retention_sec) * 1000000000ULL + window_ns,
+					0, "database");
+		}
+
+		server.reset();
+		done = true;
+		writer.join();
+	} catch (std::exception& e) {
+		g_printerr("%s", e.what());
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,257 @@
+/**
+ * Runs the engine over long recordings in parallel. Every MP4 given is
+ * indexed for keyframes and split into --chunks time ranges (see
+ * va_file_chunks.h) that run as chunk:// sources in the same muxer batch.
+ * Detections are stamped with their time in the file, counted from the
+ * creation time of the file or --start, and reach the sinks in file order.
+ * A chunk that fails is restarted up to --retries times.
+ *
+ * Everything but the sources and the batch size comes from --config.
+ * Detections go to the database, through the journal with --journal, or
+ * nowhere with --dry-run. With --sweep the files run with 1, 2, 4 ...
+ * --chunks chunks, dry, and the wall time is reported against chunk count.
+ *
+ *   $ ./va_chunks --chunks 8 /recordings/cam-1.mp4 /recordings/cam-2.mp4
+ *   $ ./va_chunks --chunks 16 --start 1700000000 --journal file:///recordings/cam-1.mp4
+ *   $ ./va_chunks --chunks 16 --sweep /recordings/cam-1.mp4
+ */
+#include <getopt.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+#include <yaml-cpp/yaml.h>
+
+#include "va_database.h"
+#include "va_engine.h"
+#include "va_file_chunks.h"
+#include "va_journal.h"
+#include "va_stream_stats.h"
+
+struct ChunksOptions {
+	std::string config { "configs/config.yml" };
+	guint chunks = 4;
+	guint retries = 2;
+	/* epoch seconds of the start of every file, 0 for its creation time */
+	guint64 start = 0;
+	bool sweep = false;
+	bool dry_run = false;
+	bool journal = false;
+	std::string url { "tcp://127.0.0.1:3306" };
+	std::string username { "root" };
+	std::string password { "example" };
+	std::string database { "va" };
+	std::vector<std::string> files;
+};
+
+/**
+ * A file given on the command line, indexed
+ */
+struct Recording {
+	std::string uri;
+	va::KeyframeIndex index;
+	guint64 base_ns;
+};
+
+struct RunResult {
+	guint chunks;
+	double wall_sec;
+	guint64 frames;
+	guint64 objects;
+};
+
+static auto usage(const char* name) -> void {
+	g_printerr(
+		"Usage: %s [options] <file.mp4 | file:///file.mp4> ...\n"
+		"  --config <yml>         base config (default configs/config.yml)\n"
+		"  --chunks <n>           time ranges per file (default 4)\n"
+		"  --retries <n>          restarts of a failed chunk (default 2)\n"
+		"  --start <epoch s>      wall time of the start of the files (default their creation time)\n"
+		"  --sweep                dry runs with 1, 2, 4 ... --chunks chunks\n"
+		"  --dry-run              detections go nowhere\n"
+		"  --journal              write through the journal of --config\n"
+		"  --url <url> --user <name> --password <password> --database <name>\n"
+		"                         database (default tcp://127.0.0.1:3306, root, example, va)\n", name);
+}
+
+static auto parse_options(int argc, char** argv) -> ChunksOptions {
+	static struct option long_options[] = {
+		{ "config", required_argument, nullptr, 'c' },
+		{ "chunks", required_argument, nullptr, 'n' },
+		{ "retries", required_argument, nullptr, 'r' },
+		{ "start", required_argument, nullptr, 's' },
+		{ "sweep", no_argument, nullptr, 'S' },
+		{ "dry-run", no_argument, nullptr, 'd' },
+		{ "journal", no_argument, nullptr, 'J' },
+		{ "url", required_argument, nullptr, 'U' },
+		{ "user", required_argument, nullptr, 'u' },
+		{ "password", required_argument, nullptr, 'p' },
+		{ "database", required_argument, nullptr, 'D' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 }
+	};
+	ChunksOptions options;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+		switch (opt) {
+			case 'c': options.config = optarg; break;
+			case 'n': options.chunks = std::stoul(optarg); break;
+			case 'r': options.retries = std::stoul(optarg); break;
+			case 's': options.start = std::stoull(optarg); break;
+			case 'S': options.sweep = true; break;
+			case 'd': options.dry_run = true; break;
+			case 'J': options.journal = true; break;
+			case 'U': options.url = optarg; break;
+			case 'u': options.username = optarg; break;
+			case 'p': options.password = optarg; break;
+			case 'D': options.database = optarg; break;
+			default:
+				usage(argv[0]);
+				throw std::invalid_argument("invalid argument\n");
+		}
+	}
+	for (int i = optind; i < argc; ++i) {
+		options.files.emplace_back(argv[i]);
+	}
+	if (options.files.empty() || options.chunks == 0) {
+		usage(argv[0]);
+		throw std::invalid_argument("at least one file and one chunk are needed\n");
+	}
+	return options;
+}
+
+/**
+ * Index a file given as a path or a file:// uri
+ */
+static auto index_recording(const std::string& file, const ChunksOptions& options) -> Recording {
+	std::string path = file.compare(0, 7, "file://") == 0 ? file.substr(7) : file;
+	char absolute[PATH_MAX];
+	if (!realpath(path.c_str(), absolute)) {
+		throw std::runtime_error("Unable to find " + path + "\n");
+	}
+	Recording recording;
+	recording.uri = std::string { "file://" } + absolute;
+	recording.index = va::index_keyframes(absolute);
+	recording.base_ns = options.start ? options.start * 1000000000ull : recording.index.creation_time_ns;
+	g_print("%s: %.1f s, %zu keyframes%s\n", recording.uri.c_str(), recording.index.duration_ns / 1e9,
+			recording.index.keyframes_ns.size(), recording.base_ns ? "" : ", no creation time, stamped from 0");
+	return recording;
+}
+
+/**
+ * The base config with every recording split into chunks, all in one batch
+ */
+static auto write_config(const ChunksOptions& options, const std::vector<Recording>& recordings, guint chunks,
+		const std::string& path) -> guint {
+	YAML::Node config = YAML::LoadFile(options.config);
+	std::string list;
+	guint sources = 0;
+	for (const Recording& recording : recordings) {
+		for (va::FileChunk& chunk : va::split_file(recording.uri, recording.index, chunks, recording.base_ns)) {
+			chunk.retries = options.retries;
+			list += va::format_chunk_uri(chunk) + ";";
+			++sources;
+		}
+	}
+	config["source-list"]["list"] = list;
+	config["streammux"]["batch-size"] = sources;
+	config["streammux"]["live-source"] = 0;
+	std::ofstream file { path };
+	file << config << "\n";
+	if (!file) {
+		throw std::runtime_error("Unable to write " + path + "\n");
+	}
+	return sources;
+}
+
+static auto run(char* name, const ChunksOptions& options, const std::vector<Recording>& recordings, guint chunks,
+		const std::string& config_path, va::Database* db, va::Journal* journal) -> RunResult {
+	guint sources = write_config(options, recordings, chunks, config_path);
+	va::StreamStats stats { sources };
+	std::vector<char*> engine_argv = { name, const_cast<char*>(config_path.c_str()), nullptr };
+	va::Engine engine { 2, engine_argv.data() };
+	engine.set_stream_stats(&stats);
+	if (journal) {
+		engine.set_journal(journal);
+	} else if (db) {
+		engine.set_database(db);
+	}
+
+	gint64 start = g_get_monotonic_time();
+	engine.run();
+	RunResult result {};
+	result.chunks = chunks;
+	result.wall_sec = (g_get_monotonic_time() - start) / 1e6;
+	va::StreamStatsSnapshot snapshot = stats.snapshot();
+	for (guint64 frames : snapshot.frames) {
+		result.frames += frames;
+	}
+	result.objects = snapshot.objects;
+	return result;
+}
+
+static auto print_result(const RunResult& result, double media_sec, const RunResult* first) -> void {
+	double speedup = first ? first->wall_sec / result.wall_sec : 1.0;
+	g_print("%8u %10.1f %10.1f %12lu %10.1f %10lu %8.2f %10.2f\n", result.chunks, result.wall_sec, media_sec / result.wall_sec,
+			(gulong)result.frames, result.frames / result.wall_sec, (gulong)result.objects, speedup,
+			first ? speedup * first->chunks / result.chunks : 1.0);
+}
+
+auto main(int argc, char** argv) -> int {
+	try {
+		ChunksOptions options = parse_options(argc, argv);
+		/* fakesink, no display needed */
+		g_setenv("PERF_MODE", "1", TRUE);
+
+		std::vector<Recording> recordings;
+		double media_sec = 0.0;
+		for (const std::string& file : options.files) {
+			recordings.push_back(index_recording(file, options));
+			media_sec += recordings.back().index.duration_ns / 1e9;
+		}
+
+		std::unique_ptr<va::Database> db;
+		std::unique_ptr<va::Journal> journal;
+		if (!options.sweep && !options.dry_run) {
+			db = std::make_unique<va::Database>(options.url, options.username, options.password, options.database, false);
+			if (options.journal) {
+				va::JournalConfig journal_config = va::parse_journal_config(options.config.c_str(), "journal");
+				journal = std::make_unique<va::Journal>(journal_config, db.get());
+			}
+		}
+
+		std::string config_path = std::string { g_get_tmp_dir() } + "/va_chunks_" + std::to_string(getpid()) + ".yml";
+		std::vector<guint> steps;
+		for (guint chunks = options.sweep ? 1 : options.chunks; chunks < options.chunks; chunks *= 2) {
+			steps.push_back(chunks);
+		}
+		steps.push_back(options.chunks);
+
+		std::vector<RunResult> results;
+		for (guint chunks : steps) {
+			results.push_back(run(argv[0], options, recordings, chunks, config_path, db.get(), journal.get()));
+		}
+		std::remove(config_path.c_str());
+
+		g_print("\n%zu files, %.1f s of video\n", recordings.size(), media_sec);
+		g_print("%8s %10s %10s %12s %10s %10s %8s %10s\n", "chunks", "wall s", "x real", "frames", "frames/s", "objects",
+				"speedup", "efficiency");
+		for (const RunResult& result : results) {
+			print_result(result, media_sec, options.sweep ? &results.front() : nullptr);
+		}
+		return EXIT_SUCCESS;
+	} catch (std::invalid_argument& e) {
+		g_printerr("%s", e.what());
+		return EXIT_FAILURE;
+	} catch (std::exception& e) {
+		g_printerr("%s", e.what());
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,160 @@
+/**
+ * Run the clip recorder on a local file without a GPU: the file is parsed,
+ * not decoded, and clips are triggered at the given stream times instead of
+ * by detections.
+ *
+ *   $ ./va_clip --input samples/sample_1080p_h264.mp4 --at 8 --at 9.5 --at 30
+ *   $ ./va_clip --input sample.h264 --at 10 --pre 3 --post 3 --format mkv --directory clips
+ */
+#include <getopt.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gst/gst.h>
+#include <glib.h>
+
+#include "va_clip_recorder.h"
+
+struct ClipTool {
+	va::ClipRecorder* recorder;
+	GMainLoop* loop;
+	GstElement* pipeline;
+	/* trigger times in ns, ascending, consumed from the front */
+	std::vector<guint64> triggers;
+	size_t next = 0;
+	gsize peak_ring_bytes = 0;
+};
+
+/**
+ * Added after the recorder's own probe, so the packet is in the ring already
+ */
+static auto trigger_probe(GstPad* pad, GstPadProbeInfo* info, gpointer data) -> GstPadProbeReturn {
+	ClipTool* tool = static_cast<ClipTool*>(data);
+	GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	GstClockTime ts = GST_BUFFER_DTS_OR_PTS(buffer);
+	tool->peak_ring_bytes = std::max(tool->peak_ring_bytes, tool->recorder->ring_bytes());
+	while (GST_CLOCK_TIME_IS_VALID(ts) && tool->next < tool->triggers.size() && ts >= tool->triggers[tool->next]) {
+		bool started = tool->recorder->trigger(0, "manual");
+		g_print("Trigger at %.3f s: %s, ring %zu bytes\n", ts / 1e9, started ? "recording" : "nothing to record",
+				tool->recorder->ring_bytes());
+		++tool->next;
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+static auto cb_parsebin_pad_added(GstElement* parsebin, GstPad* pad, gpointer data) -> void {
+	ClipTool* tool = static_cast<ClipTool*>(data);
+	GstCaps* caps = gst_pad_query_caps(pad, nullptr);
+	const gchar* media = gst_structure_get_name(gst_caps_get_structure(caps, 0));
+	bool video = g_str_has_prefix(media, "video/");
+	gst_caps_unref(caps);
+	if (!video) {
+		return;
+	}
+
+	GstElement* sink = gst_element_factory_make("fakesink", nullptr);
+	g_object_set(G_OBJECT(sink), "sync", FALSE, NULL);
+	gst_bin_add(GST_BIN(tool->pipeline), sink);
+	gst_element_sync_state_with_parent(sink);
+	GstPad* sink_pad = gst_element_get_static_pad(sink, "sink");
+	if (gst_pad_link(pad, sink_pad) != GST_PAD_LINK_OK) {
+		g_printerr("Unable to link %s\n", media);
+	}
+	gst_object_unref(sink_pad);
+
+	tool->recorder->attach(pad, 0);
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, trigger_probe, tool, NULL);
+}
+
+static auto bus_call(GstBus* bus, GstMessage* msg, gpointer data) -> gboolean {
+	ClipTool* tool = static_cast<ClipTool*>(data);
+	if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+		GError* error = nullptr;
+		gchar* debug = nullptr;
+		gst_message_parse_error(msg, &error, &debug);
+		g_printerr("ERROR from element %s: %s\n", GST_OBJECT_NAME(msg->src), error->message);
+		g_clear_error(&error);
+		g_free(debug);
+		g_main_loop_quit(tool->loop);
+	} else if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS) {
+		g_main_loop_quit(tool->loop);
+	}
+	return TRUE;
+}
+
+auto main(int argc, char** argv) -> int {
+	static struct option long_options[] = {
+		{ "input", required_argument, nullptr, 'i' },
+		{ "at", required_argument, nullptr, 'a' },
+		{ "pre", required_argument, nullptr, 'p' },
+		{ "post", required_argument, nullptr, 'P' },
+		{ "format", required_argument, nullptr, 'f' },
+		{ "directory", required_argument, nullptr, 'd' },
+		{ "ring-mb", required_argument, nullptr, 'r' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 }
+	};
+	std::string input;
+	std::vector<guint64> triggers;
+	va::ClipRecorderConfig config {};
+	config.enable = true;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+		switch (opt) {
+			case 'i': input = optarg; break;
+			case 'a': triggers.push_back(static_cast<guint64>(std::stod(optarg) * GST_SECOND)); break;
+			case 'p': config.pre_sec = std::stoul(optarg); break;
+			case 'P': config.post_sec = std::stoul(optarg); break;
+			case 'f': config.format = optarg; break;
+			case 'd': config.directory = optarg; break;
+			case 'r': config.ring_mb = std::stoul(optarg); break;
+			default:
+				g_printerr("Usage: %s --input <file> --at <sec> [--at <sec> ...] [--pre <sec>] [--post <sec>] "
+						"[--format mp4|mkv] [--directory <dir>] [--ring-mb <n>]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (input.empty() || triggers.empty()) {
+		g_printerr("Need --input and at least one --at\n");
+		return EXIT_FAILURE;
+	}
+	std::sort(triggers.begin(), triggers.end());
+
+	gst_init(&argc, &argv);
+	try {
+		va::ClipRecorder recorder { config };
+		ClipTool tool { &recorder, g_main_loop_new(nullptr, FALSE), gst_pipeline_new("va-clip"), triggers };
+
+		GstElement* filesrc = gst_element_factory_make("filesrc", nullptr);
+		GstElement* parsebin = gst_element_factory_make("parsebin", nullptr);
+		if (!filesrc || !parsebin) {
+			throw std::runtime_error("filesrc or parsebin could not be created. Exiting.\n");
+		}
+		g_object_set(G_OBJECT(filesrc), "location", input.c_str(), NULL);
+		gst_bin_add_many(GST_BIN(tool.pipeline), filesrc, parsebin, NULL);
+		gst_element_link(filesrc, parsebin);
+		g_signal_connect(G_OBJECT(parsebin), "pad-added", G_CALLBACK(cb_parsebin_pad_added), &tool);
+
+		GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(tool.pipeline));
+		guint bus_watch_id = gst_bus_add_watch(bus, bus_call, &tool);
+		gst_object_unref(bus);
+
+		gst_element_set_state(tool.pipeline, GST_STATE_PLAYING);
+		g_main_loop_run(tool.loop);
+		gst_element_set_state(tool.pipeline, GST_STATE_NULL);
+		g_print("Peak ring: %zu bytes\n", tool.peak_ring_bytes);
+
+		g_source_remove(bus_watch_id);
+		gst_object_unref(tool.pipeline);
+		g_main_loop_unref(tool.loop);
+		/* the recorder writes what is still recording and waits for the writer */
+	} catch (std::exception& e) {
+		g_printerr("%s", e.what());
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
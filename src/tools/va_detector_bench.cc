@@ -0,0 +1,204 @@
+/**
+ * Throughput of the cpu detector backend. First the preprocessing kernels
+ * alone, every set this cpu runs on --frames frames at the network size,
+ * checked against scalar. Then the network: for 1, 2, 4 ... up to --workers
+ * workers, each with its own detector, inferring batches of random frames
+ * for --seconds. Reports frames/s, the cores that took (user + system time
+ * over wall time) and frames/s per core, which is what sizes a cpu-only box.
+ *
+ * The network and the detector settings come from the "detector" group of
+ * --config; --workers, --threads-per-worker, --batch-size and --kernels
+ * override them. Needs a build with WITH_OPENCV=1 past the kernels.
+ *
+ *   $ ./va_detector_bench --workers 16 --seconds 20
+ *   $ ./va_detector_bench --threads-per-worker 4 --batch-size 1 --kernels scalar
+ */
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glib.h>
+
+#include "va_detector.h"
+
+struct BenchOptions {
+	std::string config = "configs/config.yml";
+	guint workers = 0;
+	guint threads_per_worker = 0;
+	guint batch_size = 0;
+	std::string kernels;
+	guint frames = 200;
+	guint seconds = 10;
+};
+
+static auto now_s() -> double {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* user + system time of the process */
+static auto cpu_s() -> double {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static auto random_frames(guint count, size_t size) -> std::vector<std::vector<guint8>> {
+	guint32 state = 0x9e3779b9;
+	std::vector<std::vector<guint8>> frames(count, std::vector<guint8>(size));
+	for (std::vector<guint8>& frame : frames) {
+		for (guint8& byte : frame) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			byte = static_cast<guint8>(state);
+		}
+	}
+	return frames;
+}
+
+/**
+ * Mpixels/s of every kernel set, false when one differs from scalar
+ */
+static auto bench_kernels(const va::DetectorConfig& config, const std::vector<std::vector<guint8>>& frames) -> bool {
+	size_t pixels = static_cast<size_t>(config.input_width) * config.input_height;
+	std::vector<float> planes(pixels * 3);
+	std::vector<float> reference(pixels * 3);
+	const va::DetectorKernels* scalar = va::detector_kernels_by_name("scalar");
+	scalar->rgbx_to_planes(frames[0].data(), pixels, config.net_scale_factor, &reference[0], &reference[pixels], &reference[pixels * 2]);
+
+	bool mismatch = false;
+	g_print("%-8s %14s %10s\n", "kernels", "Mpixels/s", "ms/frame");
+	for (const va::DetectorKernels* kernels : va::detector_kernels_available()) {
+		double start = now_s();
+		for (const std::vector<guint8>& frame : frames) {
+			kernels->rgbx_to_planes(frame.data(), pixels, config.net_scale_factor, &planes[0], &planes[pixels], &planes[pixels * 2]);
+		}
+		double seconds = now_s() - start;
+		g_print("%-8s %14.1f %10.3f\n", kernels->name, frames.size() * pixels / seconds / 1e6, seconds * 1e3 / frames.size());
+		kernels->rgbx_to_planes(frames[0].data(), pixels, config.net_scale_factor, &planes[0], &planes[pixels], &planes[pixels * 2]);
+		mismatch |= planes != reference;
+	}
+	return !mismatch;
+}
+
+/**
+ * workers threads inferring for seconds, each with its own detector
+ */
+static auto bench_workers(const va::DetectorConfig& config, guint workers, guint seconds,
+		const std::vector<std::vector<guint8>>& frames) -> void {
+	std::vector<std::unique_ptr<va::Detector>> detectors;
+	for (guint i = 0; i < workers; ++i) {
+		detectors.push_back(va::make_cpu_detector(config));
+	}
+
+	std::atomic<bool> done { false };
+	std::atomic<guint64> inferred { 0 };
+	std::atomic<guint64> objects { 0 };
+	std::vector<std::thread> threads;
+	double start = now_s();
+	double start_cpu = cpu_s();
+	for (guint i = 0; i < workers; ++i) {
+		threads.emplace_back([&, i] {
+			std::vector<const guint8*> batch;
+			std::vector<std::vector<va::Detection>> detections;
+			for (size_t next = i; !done.load(std::memory_order_relaxed);) {
+				batch.clear();
+				for (guint j = 0; j < config.batch_size; ++j, ++next) {
+					batch.push_back(frames[next % frames.size()].data());
+				}
+				detectors[i]->detect(batch, &detections);
+				inferred += batch.size();
+				for (const std::vector<va::Detection>& frame_detections : detections) {
+					objects += frame_detections.size();
+				}
+			}
+		});
+	}
+	std::this_thread::sleep_for(std::chrono::seconds(seconds));
+	done = true;
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	double wall = now_s() - start;
+	double cores = (cpu_s() - start_cpu) / wall;
+	double fps = inferred / wall;
+	g_print("%8u %12.1f %8.2f %14.1f %14.1f\n", workers, fps, cores, cores > 0.0 ? fps / cores : 0.0,
+			inferred ? static_cast<double>(objects) / inferred : 0.0);
+}
+
+auto main(int argc, char** argv) -> int {
+	static struct option long_options[] = {
+		{ "config", required_argument, nullptr, 'c' },
+		{ "workers", required_argument, nullptr, 'w' },
+		{ "threads-per-worker", required_argument, nullptr, 't' },
+		{ "batch-size", required_argument, nullptr, 'b' },
+		{ "kernels", required_argument, nullptr, 'k' },
+		{ "frames", required_argument, nullptr, 'f' },
+		{ "seconds", required_argument, nullptr, 's' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 }
+	};
+	BenchOptions options;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+		switch (opt) {
+			case 'c': options.config = optarg; break;
+			case 'w': options.workers = std::stoul(optarg); break;
+			case 't': options.threads_per_worker = std::max(1ul, std::stoul(optarg)); break;
+			case 'b': options.batch_size = std::max(1ul, std::stoul(optarg)); break;
+			case 'k': options.kernels = optarg; break;
+			case 'f': options.frames = std::max(1ul, std::stoul(optarg)); break;
+			case 's': options.seconds = std::max(1ul, std::stoul(optarg)); break;
+			default:
+				g_printerr("Usage: %s [--config <yml>] [--workers <n>] [--threads-per-worker <n>] [--batch-size <n>] "
+						"[--kernels <name>] [--frames <n>] [--seconds <n>]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	try {
+		va::DetectorConfig config = va::parse_detector_config(options.config.c_str(), "detector");
+		if (options.threads_per_worker) {
+			config.threads_per_worker = options.threads_per_worker;
+		}
+		if (options.batch_size) {
+			config.batch_size = options.batch_size;
+		}
+		if (!options.kernels.empty()) {
+			config.kernels = options.kernels;
+		}
+		guint max_workers = options.workers ? options.workers : (config.workers ? config.workers
+				: std::max(1u, std::thread::hardware_concurrency() / config.threads_per_worker));
+
+		std::vector<std::vector<guint8>> frames = random_frames(options.frames,
+				static_cast<size_t>(config.input_width) * config.input_height * 4);
+		g_print("%u frames of %ux%u\n", options.frames, config.input_width, config.input_height);
+		if (!bench_kernels(config, frames)) {
+			g_printerr("Kernel sets converted differently\n");
+			return EXIT_FAILURE;
+		}
+
+		g_print("\n%s, batches of %u, %u threads per worker, %s kernels, %u s per step\n", config.model_file.c_str(),
+				config.batch_size, config.threads_per_worker, config.kernels.c_str(), options.seconds);
+		g_print("%8s %12s %8s %14s %14s\n", "workers", "frames/s", "cores", "frames/s/core", "objects/frame");
+		for (guint workers = 1;; workers = std::min(workers * 2, max_workers)) {
+			bench_workers(config, workers, options.seconds, frames);
+			if (workers == max_workers) {
+				break;
+			}
+		}
+	} catch (std::exception& e) {
+		g_printerr("%s", e.what());
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,295 @@
+/**
+ * Luma kernels of the scene gate on the CPU. Without --input, times every
+ * kernel set this cpu runs on a synthetic frame, in MPix/s, and checks each
+ * against the scalar one. With --input, replays a recorded y4m file through
+ * the gate and reports what it would have skipped.
+ *
+ *   $ ./va_gate_bench --width 1920 --height 1080 --iterations 500
+ *   $ ffmpeg -i corridor.mp4 -pix_fmt yuv420p corridor.y4m
+ *   $ ./va_gate_bench --input corridor.y4m --min-changed-blocks 4 --refresh 5 --verbose
+ */
+#include <getopt.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+#include "va_luma_kernels.h"
+#include "va_scene_gate.h"
+
+struct BenchOptions {
+	guint width = 1920;
+	guint height = 1080;
+	guint iterations = 200;
+	std::string input;
+	bool verbose = false;
+};
+
+static auto now_ns() -> double {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* noise with some structure, so block means differ */
+static auto synthetic_frame(guint width, guint height, guint32 seed) -> std::vector<guint8> {
+	std::vector<guint8> frame(static_cast<gsize>(width) * height);
+	guint32 state = seed | 1;
+	for (guint y = 0; y < height; ++y) {
+		for (guint x = 0; x < width; ++x) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			frame[static_cast<gsize>(y) * width + x] = static_cast<guint8>(((x / 40 + y / 30) * 23 + (state & 31)) & 255);
+		}
+	}
+	return frame;
+}
+
+static auto signature(const va::LumaKernels& kernels, const std::vector<guint8>& frame, guint width, guint height,
+		guint sig_width, guint sig_height, guint rows_per_block, std::vector<guint16>& acc, std::vector<guint8>& out) -> void {
+	va::LumaSampling sampling = va::luma_sampling(height, sig_height, rows_per_block);
+	acc.resize(width);
+	out.resize(sig_width * sig_height);
+	va::luma_signature(kernels, frame.data() + static_cast<gsize>(sampling.first) * width, static_cast<gsize>(width) * sampling.step,
+			width, sig_width, sig_height, rows_per_block, acc.data(), out.data());
+}
+
+/**
+ * MPix/s of every kernel set, over the whole frame and as the gate samples it
+ */
+static auto run_synthetic(const BenchOptions& options, const va::SceneGateConfig& config) -> int {
+	guint width = options.width;
+	guint height = options.height;
+	if (width < config.signature_width || height < config.signature_height || height / config.signature_height < config.rows_per_block) {
+		g_printerr("%ux%u is too small for a %ux%u signature of %u rows per block\n",
+				width, height, config.signature_width, config.signature_height, config.rows_per_block);
+		return EXIT_FAILURE;
+	}
+	std::vector<guint8> frame = synthetic_frame(width, height, 1);
+	std::vector<guint8> other = synthetic_frame(width, height, 2);
+	std::vector<guint16> acc;
+	std::vector<guint8> reference_full, reference_gate, out;
+	/* every row, as many rows per block as the frame has */
+	guint full_rows = std::min(255u, height / config.signature_height);
+	const va::LumaKernels& scalar = va::luma_kernels_scalar();
+	signature(scalar, frame, width, height, config.signature_width, config.signature_height, full_rows, acc, reference_full);
+	signature(scalar, frame, width, height, config.signature_width, config.signature_height, config.rows_per_block, acc, reference_gate);
+	gsize changed_reference = scalar.count_changed(frame.data(), other.data(), frame.size(), config.block_threshold);
+	guint64 sad_reference = scalar.sad(frame.data(), other.data(), frame.size());
+
+	double mpix = static_cast<double>(width) * height / 1e6;
+	bool mismatch = false;
+	g_print("%ux%u frame, %ux%u signature, %u iterations\n", width, height, config.signature_width, config.signature_height, options.iterations);
+	g_print("%-8s %14s %14s %12s %14s %14s\n", "kernels", "full MPix/s", "gate MPix/s", "gate us", "changed GB/s", "sad GB/s");
+	for (const va::LumaKernels* kernels : va::luma_kernels_available()) {
+		double start = now_ns();
+		for (guint i = 0; i < options.iterations; ++i) {
+			signature(*kernels, frame, width, height, config.signature_width, config.signature_height, full_rows, acc, out);
+		}
+		double full_ns = (now_ns() - start) / options.iterations;
+		mismatch |= out != reference_full;
+
+		start = now_ns();
+		for (guint i = 0; i < options.iterations; ++i) {
+			signature(*kernels, frame, width, height, config.signature_width, config.signature_height, config.rows_per_block, acc, out);
+		}
+		double gate_ns = (now_ns() - start) / options.iterations;
+		mismatch |= out != reference_gate;
+
+		gsize changed = 0;
+		start = now_ns();
+		for (guint i = 0; i < options.iterations; ++i) {
+			changed = kernels->count_changed(frame.data(), other.data(), frame.size(), config.block_threshold);
+		}
+		double changed_ns = (now_ns() - start) / options.iterations;
+		mismatch |= changed != changed_reference;
+
+		guint64 sad = 0;
+		start = now_ns();
+		for (guint i = 0; i < options.iterations; ++i) {
+			sad = kernels->sad(frame.data(), other.data(), frame.size());
+		}
+		double sad_ns = (now_ns() - start) / options.iterations;
+		mismatch |= sad != sad_reference;
+
+		g_print("%-8s %14.0f %14.0f %12.1f %14.2f %14.2f\n", kernels->name, mpix / (full_ns / 1e9), mpix / (gate_ns / 1e9),
+				gate_ns / 1e3, frame.size() / changed_ns, frame.size() / sad_ns);
+	}
+	if (mismatch) {
+		g_printerr("Kernels disagree with the scalar ones\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * y4m header: W, H, F and C of "YUV4MPEG2 W1920 H1080 F30:1 Ip A1:1 C420jpeg"
+ */
+static auto parse_y4m_header(const std::string& line, guint& width, guint& height, double& fps, bool& mono) -> bool {
+	if (line.rfind("YUV4MPEG2", 0) != 0) {
+		return false;
+	}
+	width = height = 0;
+	fps = 30.0;
+	mono = false;
+	gchar** tokens = g_strsplit(line.c_str(), " ", -1);
+	for (gchar** token = tokens; *token; ++token) {
+		guint num = 0, den = 0;
+		if ((*token)[0] == 'W') {
+			width = std::strtoul(*token + 1, nullptr, 10);
+		} else if ((*token)[0] == 'H') {
+			height = std::strtoul(*token + 1, nullptr, 10);
+		} else if ((*token)[0] == 'F' && sscanf(*token + 1, "%u:%u", &num, &den) == 2 && num && den) {
+			fps = static_cast<double>(num) / den;
+		} else if ((*token)[0] == 'C') {
+			if (g_str_has_prefix(*token + 1, "mono")) {
+				mono = true;
+			} else if (!g_str_has_prefix(*token + 1, "420")) {
+				g_strfreev(tokens);
+				return false;
+			}
+		}
+	}
+	g_strfreev(tokens);
+	return width && height;
+}
+
+static auto read_line(FILE* file, std::string& line) -> bool {
+	line.clear();
+	int c;
+	while ((c = fgetc(file)) != EOF && c != '\n') {
+		line.push_back(static_cast<char>(c));
+	}
+	return c != EOF || !line.empty();
+}
+
+/**
+ * Every frame of the file through a scene gate, as one source
+ */
+static auto run_replay(const BenchOptions& options, const va::SceneGateConfig& config) -> int {
+	FILE* file = fopen(options.input.c_str(), "rb");
+	if (!file) {
+		g_printerr("Unable to open %s\n", options.input.c_str());
+		return EXIT_FAILURE;
+	}
+	std::string line;
+	guint width = 0, height = 0;
+	double fps = 30.0;
+	bool mono = false;
+	if (!read_line(file, line) || !parse_y4m_header(line, width, height, fps, mono)) {
+		g_printerr("%s is not 4:2:0 or mono y4m\n", options.input.c_str());
+		fclose(file);
+		return EXIT_FAILURE;
+	}
+	gsize chroma = mono ? 0 : 2 * static_cast<gsize>((width + 1) / 2) * ((height + 1) / 2);
+	std::vector<guint8> luma(static_cast<gsize>(width) * height);
+	std::vector<guint8> skip(chroma);
+
+	va::SceneGate gate { config };
+	va::FrameView view;
+	view.format = va::FrameView::Format::I420;
+	view.width = width;
+	view.height = height;
+	view.planes[0] = luma.data();
+	view.pitches[0] = width;
+
+	const va::LumaKernels& scalar = va::luma_kernels_scalar();
+	std::vector<guint16> acc;
+	std::vector<guint8> expected, actual;
+	guint64 frames = 0, skipped = 0, refreshed = 0, mismatches = 0;
+	double gate_ns = 0.0;
+	while (read_line(file, line) && line.rfind("FRAME", 0) == 0) {
+		if (fread(luma.data(), 1, luma.size(), file) != luma.size() || fread(skip.data(), 1, chroma, file) != chroma) {
+			break;
+		}
+		guint64 pts = static_cast<guint64>(frames * 1e9 / fps);
+		guint changed = 0;
+		double start = now_ns();
+		va::SceneGate::Decision decision = gate.decide(0, view, true, pts, &changed);
+		gate_ns += now_ns() - start;
+
+		/* the kernels in use against the scalar ones, on real frames */
+		signature(scalar, luma, width, height, config.signature_width, config.signature_height, config.rows_per_block, acc, expected);
+		signature(*gate.m_kernels, luma, width, height, config.signature_width, config.signature_height, config.rows_per_block, acc, actual);
+		mismatches += expected != actual;
+
+		skipped += decision == va::SceneGate::Decision::SKIP;
+		refreshed += decision == va::SceneGate::Decision::REFRESH;
+		if (options.verbose) {
+			g_print("frame %6lu %10.3f s %5u changed %s\n", (gulong)frames, pts / 1e9, changed,
+					decision == va::SceneGate::Decision::SKIP ? "skip" : decision == va::SceneGate::Decision::REFRESH ? "refresh" : "infer");
+		}
+		++frames;
+	}
+	fclose(file);
+
+	double mpix = static_cast<double>(width) * height / 1e6;
+	g_print("%s: %ux%u, %lu frames, %lu inferred (%lu refreshes), %lu skipped (%.1f%%)\n", options.input.c_str(), width, height,
+			(gulong)frames, (gulong)(frames - skipped), (gulong)refreshed, (gulong)skipped, frames ? 100.0 * skipped / frames : 0.0);
+	if (frames) {
+		g_print("%s kernels: %.1f us per frame, %.0f MPix/s of frames gated\n", gate.m_kernels->name, gate_ns / frames / 1e3,
+				mpix * frames / (gate_ns / 1e9));
+	}
+	if (mismatches) {
+		g_printerr("%lu frames where the kernels disagree with the scalar ones\n", (gulong)mismatches);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+auto main(int argc, char** argv) -> int {
+	static struct option long_options[] = {
+		{ "width", required_argument, nullptr, 'W' },
+		{ "height", required_argument, nullptr, 'H' },
+		{ "iterations", required_argument, nullptr, 'n' },
+		{ "input", required_argument, nullptr, 'i' },
+		{ "kernels", required_argument, nullptr, 'k' },
+		{ "signature", required_argument, nullptr, 's' },
+		{ "rows-per-block", required_argument, nullptr, 'r' },
+		{ "block-threshold", required_argument, nullptr, 't' },
+		{ "min-changed-blocks", required_argument, nullptr, 'm' },
+		{ "refresh", required_argument, nullptr, 'R' },
+		{ "verbose", no_argument, nullptr, 'v' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 }
+	};
+	BenchOptions options;
+	va::SceneGateConfig config {};
+	config.enable = true;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+		switch (opt) {
+			case 'W': options.width = std::stoul(optarg); break;
+			case 'H': options.height = std::stoul(optarg); break;
+			case 'n': options.iterations = std::max(1ul, std::stoul(optarg)); break;
+			case 'i': options.input = optarg; break;
+			case 'k': config.kernels = optarg; break;
+			case 's':
+				if (sscanf(optarg, "%ux%u", &config.signature_width, &config.signature_height) != 2) {
+					g_printerr("--signature takes <width>x<height>\n");
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'r': config.rows_per_block = std::clamp(std::stoul(optarg), 1ul, 255ul); break;
+			case 't': config.block_threshold = std::min(255ul, std::stoul(optarg)); break;
+			case 'm': config.min_changed_blocks = std::stoul(optarg); break;
+			case 'R': config.refresh_sec = std::stod(optarg); break;
+			case 'v': options.verbose = true; break;
+			default:
+				g_printerr("Usage: %s [--width <n>] [--height <n>] [--iterations <n>] [--input <file.y4m>] [--kernels <name>] "
+						"[--signature <w>x<h>] [--rows-per-block <n>] [--block-threshold <n>] [--min-changed-blocks <n>] "
+						"[--refresh <sec>] [--verbose]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	try {
+		return options.input.empty() ? run_synthetic(options, config) : run_replay(options, config);
+	} catch (std::exception& e) {
+		g_printerr("%s", e.what());
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,211 @@
+/**
+ * Heatmap accumulation on one core. Feeds every kernel set this cpu runs with
+ * --sources streams of --boxes moving boxes at --fps for --seconds of stream
+ * time, as fast as it can, while a reader thread takes snapshots of every
+ * source every --reader-ms. --snapshot-ms 0 publishes on every frame. Reports
+ * the rate against real time and checks that every kernel set counts the
+ * same.
+ *
+ *   $ ./va_heatmap_bench --sources 64 --fps 30 --seconds 60 --boxes 20
+ *   $ ./va_heatmap_bench --snapshot-ms 0 --reader-ms 0 --kernels avx2
+ */
+#include <getopt.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glib.h>
+
+#include "va_heatmap.h"
+
+struct BenchOptions {
+	guint sources = 64;
+	guint fps = 30;
+	guint seconds = 60;
+	guint boxes = 20;
+	guint snapshot_ms = 1000;
+	/* pause of the reader between two snapshots of every source */
+	guint reader_ms = 10;
+	std::string kernels = "all";
+};
+
+static auto now_ns() -> double {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static auto next_random(guint32& state) -> float {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return (state & 0xffffff) / static_cast<float>(0x1000000);
+}
+
+/**
+ * Boxes of people and vehicles walking across the frame, some partly outside
+ * of it
+ */
+struct Walker {
+	va::HeatmapBox box;
+	float dx;
+	float dy;
+};
+
+static auto make_walkers(guint count, guint32 seed) -> std::vector<Walker> {
+	guint32 state = seed | 1;
+	std::vector<Walker> walkers(count);
+	for (Walker& walker : walkers) {
+		walker.box.width = 0.02f + 0.13f * next_random(state);
+		walker.box.height = 0.05f + 0.25f * next_random(state);
+		walker.box.left = -0.1f + 1.1f * next_random(state);
+		walker.box.top = -0.1f + 1.1f * next_random(state);
+		walker.dx = (next_random(state) - 0.5f) * 0.01f;
+		walker.dy = (next_random(state) - 0.5f) * 0.005f;
+	}
+	return walkers;
+}
+
+static auto step(std::vector<Walker>& walkers, std::vector<va::HeatmapBox>& boxes) -> void {
+	boxes.clear();
+	for (Walker& walker : walkers) {
+		walker.box.left += walker.dx;
+		walker.box.top += walker.dy;
+		if (walker.box.left < -0.1f || walker.box.left > 1.0f) {
+			walker.dx = -walker.dx;
+		}
+		if (walker.box.top < -0.1f || walker.box.top > 1.0f) {
+			walker.dy = -walker.dy;
+		}
+		boxes.push_back(walker.box);
+	}
+}
+
+struct RunResult {
+	double seconds = 0.0;
+	guint64 snapshots = 0;
+	std::vector<std::vector<guint32>> grids;
+};
+
+static auto run(const BenchOptions& options, const va::HeatmapKernels& kernels) -> RunResult {
+	va::HeatmapConfig config {};
+	config.enable = true;
+	config.max_sources = options.sources;
+	config.store = "none";
+	config.kernels = kernels.name;
+	config.snapshot_ms = options.snapshot_ms;
+	va::Heatmap heatmap { config };
+
+	std::vector<std::vector<Walker>> walkers;
+	for (guint source_id = 0; source_id < options.sources; ++source_id) {
+		walkers.push_back(make_walkers(options.boxes, source_id + 1));
+	}
+	std::vector<std::string> uris;
+	for (guint source_id = 0; source_id < options.sources; ++source_id) {
+		uris.push_back("bench://" + std::to_string(source_id));
+	}
+
+	std::atomic<bool> done { false };
+	RunResult result;
+	std::thread reader { [&] {
+		va::HeatmapSnapshot snapshot;
+		while (!done.load(std::memory_order_relaxed)) {
+			for (guint source_id = 0; source_id < options.sources; ++source_id) {
+				result.snapshots += heatmap.snapshot(source_id, snapshot);
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(options.reader_ms));
+		}
+	} };
+
+	std::vector<va::HeatmapBox> boxes;
+	guint64 frames = static_cast<guint64>(options.fps) * options.seconds;
+	double start = now_ns();
+	for (guint64 frame = 0; frame < frames; ++frame) {
+		guint64 timestamp = frame * 1000000000ull / options.fps;
+		for (guint source_id = 0; source_id < options.sources; ++source_id) {
+			step(walkers[source_id], boxes);
+			heatmap.add_frame(source_id, uris[source_id], timestamp, boxes.data(), boxes.size());
+		}
+	}
+	result.seconds = (now_ns() - start) / 1e9;
+	done = true;
+	reader.join();
+
+	for (const std::unique_ptr<va::Heatmap::Source>& source : heatmap.m_sources) {
+		result.grids.push_back(source->m_live);
+	}
+	return result;
+}
+
+auto main(int argc, char** argv) -> int {
+	static struct option long_options[] = {
+		{ "sources", required_argument, nullptr, 's' },
+		{ "fps", required_argument, nullptr, 'f' },
+		{ "seconds", required_argument, nullptr, 't' },
+		{ "boxes", required_argument, nullptr, 'b' },
+		{ "snapshot-ms", required_argument, nullptr, 'p' },
+		{ "reader-ms", required_argument, nullptr, 'r' },
+		{ "kernels", required_argument, nullptr, 'k' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 }
+	};
+	BenchOptions options;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+		switch (opt) {
+			case 's': options.sources = std::max(1ul, std::stoul(optarg)); break;
+			case 'f': options.fps = std::max(1ul, std::stoul(optarg)); break;
+			case 't': options.seconds = std::max(1ul, std::stoul(optarg)); break;
+			case 'b': options.boxes = std::stoul(optarg); break;
+			case 'p': options.snapshot_ms = std::stoul(optarg); break;
+			case 'r': options.reader_ms = std::stoul(optarg); break;
+			case 'k': options.kernels = optarg; break;
+			default:
+				g_printerr("Usage: %s [--sources <n>] [--fps <n>] [--seconds <n>] [--boxes <n>] [--snapshot-ms <n>] "
+						"[--reader-ms <n>] [--kernels <name>|all]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<const va::HeatmapKernels*> kernel_sets;
+	if (options.kernels == "all") {
+		kernel_sets = va::heatmap_kernels_available();
+	} else if (const va::HeatmapKernels* kernels = va::heatmap_kernels_by_name(options.kernels)) {
+		kernel_sets.push_back(kernels);
+	} else {
+		g_printerr("No %s kernels on this cpu\n", options.kernels.c_str());
+		return EXIT_FAILURE;
+	}
+
+	guint64 frames = static_cast<guint64>(options.sources) * options.fps * options.seconds;
+	guint64 boxes = frames * options.boxes;
+	g_print("%u sources at %u fps for %u s, %u boxes per frame: %lu frames, %lu boxes\n",
+			options.sources, options.fps, options.seconds, options.boxes, (gulong)frames, (gulong)boxes);
+	g_print("%-8s %12s %14s %10s %12s %16s\n", "kernels", "frames/s", "boxes/s", "ns/box", "x real time", "snapshots/s");
+	std::vector<std::vector<guint32>> reference;
+	bool mismatch = false;
+	try {
+		for (const va::HeatmapKernels* kernels : kernel_sets) {
+			RunResult result = run(options, *kernels);
+			g_print("%-8s %12.0f %14.0f %10.1f %12.1f %16.0f\n", kernels->name, frames / result.seconds, boxes / result.seconds,
+					boxes ? result.seconds * 1e9 / boxes : 0.0, options.seconds / result.seconds, result.snapshots / result.seconds);
+			if (reference.empty()) {
+				reference = std::move(result.grids);
+			} else {
+				mismatch |= result.grids != reference;
+			}
+		}
+	} catch (std::exception& e) {
+		g_printerr("%s", e.what());
+		return EXIT_FAILURE;
+	}
+	if (mismatch) {
+		g_printerr("Kernel sets counted different grids\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,269 @@
+/**
+ * Tail latency of a chain of threads handing frames down bounded queues, the
+ * shape of the pipeline between its queue elements, with and without thread
+ * placement. Each stage reads and writes every cache line of the payload,
+ * and --noise threads stream memory the way a busy database client does.
+ * The chain runs once unpinned and once placed by the "thread-placement"
+ * group of --config. The roles are "producer", "stage-1".."stage-N" and
+ * "noise-1".."noise-N"; without --config, producer and stages go to the node
+ * of cpu 0 and the noise to the last node.
+ *
+ *   $ ./va_placement_bench --stages 5 --rate 2000 --seconds 10 --noise 4
+ *   $ ./va_placement_bench --config configs/config.yml --payload-kb 512
+ */
+#include <getopt.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glib.h>
+
+#include "va_thread_placement.h"
+
+struct BenchOptions {
+	guint stages = 5;
+	guint rate = 2000;
+	guint seconds = 10;
+	guint payload_kb = 256;
+	guint noise = 2;
+	guint queue = 16;
+	std::string config;
+};
+
+struct Item {
+	double start_ns;
+	guint8* payload;
+};
+
+/**
+ * Like a queue element: blocks the producer when full, the consumer when empty
+ */
+struct BoundedQueue {
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::deque<Item> m_items;
+	size_t m_capacity;
+	bool m_closed = false;
+
+	BoundedQueue(size_t capacity) : m_capacity(capacity) { }
+
+	auto push(Item item) -> void {
+		std::unique_lock<std::mutex> lock { m_mutex };
+		m_cond.wait(lock, [this] { return m_items.size() < m_capacity; });
+		m_items.push_back(item);
+		m_cond.notify_all();
+	}
+
+	auto pop(Item& item) -> bool {
+		std::unique_lock<std::mutex> lock { m_mutex };
+		m_cond.wait(lock, [this] { return !m_items.empty() || m_closed; });
+		if (m_items.empty()) {
+			return false;
+		}
+		item = m_items.front();
+		m_items.pop_front();
+		m_cond.notify_all();
+		return true;
+	}
+
+	auto close() -> void {
+		std::lock_guard<std::mutex> lock { m_mutex };
+		m_closed = true;
+		m_cond.notify_all();
+	}
+};
+
+static auto now_ns() -> double {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static auto percentile(std::vector<double>& samples, double p) -> double {
+	if (samples.empty()) {
+		return 0.0;
+	}
+	size_t index = std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()));
+	std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+	return samples[index];
+}
+
+/* one read and one write per cache line, as a stage that looks at the frame */
+static auto touch(guint8* payload, size_t size) -> void {
+	for (size_t i = 0; i < size; i += 64) {
+		payload[i] = static_cast<guint8>(payload[i] + 1);
+	}
+}
+
+/**
+ * End to end latency of every item, in us. running is called while every
+ * thread is still up, after the last item was sent.
+ */
+static auto run(const BenchOptions& options, std::function<void()> running) -> std::vector<double> {
+	size_t payload_size = static_cast<size_t>(options.payload_kb) * 1024;
+	std::vector<std::unique_ptr<BoundedQueue>> queues;
+	for (guint i = 0; i <= options.stages; ++i) {
+		queues.push_back(std::make_unique<BoundedQueue>(options.queue));
+	}
+	/* payloads the last stage hands back to the producer */
+	BoundedQueue free_payloads { static_cast<size_t>(options.queue) * (options.stages + 1) };
+	std::vector<std::vector<guint8>> payloads(static_cast<size_t>(options.queue) * (options.stages + 1));
+	std::vector<double> latencies;
+	std::atomic<bool> done { false };
+
+	std::vector<std::thread> noise;
+	for (guint i = 0; i < options.noise; ++i) {
+		noise.emplace_back([&done, i] {
+			va::place_thread("noise-" + std::to_string(i + 1));
+			std::vector<guint8> from(64 << 20, 1), to(64 << 20);
+			while (!done.load(std::memory_order_relaxed)) {
+				std::memcpy(to.data(), from.data(), from.size());
+			}
+		});
+	}
+
+	std::vector<std::thread> stages;
+	for (guint i = 0; i < options.stages; ++i) {
+		stages.emplace_back([&, i] {
+			va::place_thread("stage-" + std::to_string(i + 1));
+			bool last = i + 1 == options.stages;
+			Item item;
+			while (queues[i]->pop(item)) {
+				touch(item.payload, payload_size);
+				if (last) {
+					latencies.push_back((now_ns() - item.start_ns) / 1e3);
+					free_payloads.push(item);
+				} else {
+					queues[i + 1]->push(item);
+				}
+			}
+			if (!last) {
+				queues[i + 1]->close();
+			}
+		});
+	}
+
+	std::thread producer { [&] {
+		va::place_thread("producer");
+		/* first touched here, so the payloads live on the producer's node */
+		for (std::vector<guint8>& payload : payloads) {
+			payload.assign(payload_size, 0);
+			free_payloads.push(Item { 0.0, payload.data() });
+		}
+		guint64 items = static_cast<guint64>(options.rate) * options.seconds;
+		double interval_ns = 1e9 / options.rate;
+		double start = now_ns();
+		for (guint64 n = 0; n < items; ++n) {
+			double due = start + n * interval_ns;
+			while (now_ns() < due) {
+				std::this_thread::yield();
+			}
+			Item item;
+			free_payloads.pop(item);
+			item.start_ns = now_ns();
+			touch(item.payload, payload_size);
+			queues[0]->push(item);
+		}
+		if (running) {
+			running();
+		}
+		queues[0]->close();
+	} };
+
+	producer.join();
+	for (std::thread& stage : stages) {
+		stage.join();
+	}
+	done = true;
+	for (std::thread& thread : noise) {
+		thread.join();
+	}
+	return latencies;
+}
+
+static auto report(const char* name, std::vector<double> latencies, double& p99) -> void {
+	double p50 = percentile(latencies, 0.50);
+	double p90 = percentile(latencies, 0.90);
+	p99 = percentile(latencies, 0.99);
+	double p999 = percentile(latencies, 0.999);
+	double max = latencies.empty() ? 0.0 : *std::max_element(latencies.begin(), latencies.end());
+	g_print("%-10s %10zu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, latencies.size(), p50, p90, p99, p999, max);
+}
+
+/**
+ * Producer and stages on the node of cpu 0, the noise on the last node
+ */
+static auto default_placement() -> va::ThreadPlacementConfig {
+	va::ThreadPlacementConfig config {};
+	config.enable = true;
+	va::ThreadPlacement machine { config };
+	int first = machine.m_node_of(0) < 0 ? machine.m_node_cpus.begin()->first : machine.m_node_of(0);
+	int last = machine.m_node_cpus.rbegin()->first;
+	config.rules.push_back(va::ThreadRule { "producer", "", first, "" });
+	config.rules.push_back(va::ThreadRule { "stage-*", "", first, "" });
+	config.rules.push_back(va::ThreadRule { "noise-*", "", last, "" });
+	return config;
+}
+
+auto main(int argc, char** argv) -> int {
+	static struct option long_options[] = {
+		{ "stages", required_argument, nullptr, 's' },
+		{ "rate", required_argument, nullptr, 'r' },
+		{ "seconds", required_argument, nullptr, 't' },
+		{ "payload-kb", required_argument, nullptr, 'p' },
+		{ "noise", required_argument, nullptr, 'n' },
+		{ "queue", required_argument, nullptr, 'q' },
+		{ "config", required_argument, nullptr, 'c' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 }
+	};
+	BenchOptions options;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+		switch (opt) {
+			case 's': options.stages = std::max(1ul, std::stoul(optarg)); break;
+			case 'r': options.rate = std::max(1ul, std::stoul(optarg)); break;
+			case 't': options.seconds = std::max(1ul, std::stoul(optarg)); break;
+			case 'p': options.payload_kb = std::max(1ul, std::stoul(optarg)); break;
+			case 'n': options.noise = std::stoul(optarg); break;
+			case 'q': options.queue = std::max(1ul, std::stoul(optarg)); break;
+			case 'c': options.config = optarg; break;
+			default:
+				g_printerr("Usage: %s [--stages <n>] [--rate <items/s>] [--seconds <n>] [--payload-kb <n>] [--noise <threads>] "
+						"[--queue <n>] [--config <yml>]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	try {
+		va::ThreadPlacementConfig config = options.config.empty() ? default_placement() :
+				va::parse_thread_placement_config(options.config.c_str(), "thread-placement");
+		va::ThreadPlacement placement { config };
+		g_print("%u stages, %u items/s for %u s, %u KB payloads, %u noise threads\n",
+				options.stages, options.rate, options.seconds, options.payload_kb, options.noise);
+		g_print("%-10s %10s %10s %10s %10s %10s %10s\n", "threads", "items", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+		double unpinned_p99 = 0.0, pinned_p99 = 0.0;
+		report("unpinned", run(options, nullptr), unpinned_p99);
+
+		va::set_thread_placement(&placement);
+		std::vector<double> latencies = run(options, [&placement] { placement.print_report(); });
+		va::set_thread_placement(nullptr);
+		report("pinned", latencies, pinned_p99);
+		if (pinned_p99 > 0.0) {
+			g_print("p99 unpinned / pinned: %.2f\n", unpinned_p99 / pinned_p99);
+		}
+	} catch (std::exception& e) {
+		g_printerr("%s", e.what());
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+/**
+ * Stand-in aggregator for the detection publisher. Accepts publisher
+ * connections, decodes every batch and prints once per second what arrived:
+ * detections/s, bytes on the wire per detection, compression ratio and
+ * end-to-end latency (receive time minus detection timestamp, meaningful when
+ * sender and receiver clocks agree, e.g. on one host).
+ *
+ *   $ ./va_receiver --port 9400
+ *   $ ./va_replay --no-db --sources 64 --speed 10 --config configs/config.yml
+ */
+#include <getopt.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "va_wire_format.h"
+
+struct ReceiverStats {
+	std::mutex mutex;
+	uint64_t batches = 0;
+	uint64_t frames = 0;
+	uint64_t detections = 0;
+	uint64_t wire_bytes = 0;
+	uint64_t raw_bytes = 0;
+	uint64_t gaps = 0;
+	std::vector<double> latencies_ms;
+};
+
+static auto now_ns() -> uint64_t {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static auto serve_connection(int fd, ReceiverStats* stats) -> void {
+	std::vector<uint8_t> buffer;
+	std::vector<uint8_t> chunk(256 * 1024);
+	va::WireBatch batch;
+	uint64_t expected_sequence = 0;
+	bool first = true;
+
+	for (;;) {
+		ssize_t received = recv(fd, chunk.data(), chunk.size(), 0);
+		if (received <= 0) {
+			break;
+		}
+		buffer.insert(buffer.end(), chunk.begin(), chunk.begin() + received);
+
+		size_t offset = 0;
+		for (;;) {
+			long consumed = va::wire_decode(buffer.data() + offset, buffer.size() - offset, &batch);
+			if (consumed < 0) {
+				g_printerr("Corrupt stream, closing connection\n");
+				close(fd);
+				return;
+			}
+			if (consumed == 0) {
+				break;
+			}
+			offset += consumed;
+
+			uint64_t received_at = now_ns();
+			std::lock_guard<std::mutex> lock { stats->mutex };
+			/* a restarted or reconnected publisher may skip sequence numbers
+			 * when its backlog overflowed */
+			if (!first && batch.sequence != expected_sequence) {
+				++stats->gaps;
+			}
+			first = false;
+			expected_sequence = batch.sequence + 1;
+			++stats->batches;
+			stats->frames += batch.frames.size();
+			stats->detections += batch.detection_count;
+			stats->wire_bytes += batch.wire_size;
+			stats->raw_bytes += batch.raw_size;
+			for (const va::WireFrame& frame : batch.frames) {
+				if (frame.frame_meta.timestamp <= received_at) {
+					stats->latencies_ms.push_back((received_at - frame.frame_meta.timestamp) / 1e6);
+				}
+			}
+		}
+		buffer.erase(buffer.begin(), buffer.begin() + offset);
+	}
+	close(fd);
+}
+
+static auto report(ReceiverStats* stats, double seconds) -> void {
+	std::lock_guard<std::mutex> lock { stats->mutex };
+	if (stats->batches == 0) {
+		return;
+	}
+	std::vector<double>& latencies = stats->latencies_ms;
+	std::sort(latencies.begin(), latencies.end());
+	auto at = [&latencies](double p) {
+		return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+	};
+	double per_detection = stats->detections ? static_cast<double>(stats->wire_bytes) / stats->detections : 0.0;
+	g_print("%8.0f det/s %8.0f frames/s %10.0f B/s %6.2f B/det ratio %4.2f latency p50 %7.1f ms p99 %7.1f ms gaps %lu\n",
+			stats->detections / seconds, stats->frames / seconds, stats->wire_bytes / seconds, per_detection,
+			stats->wire_bytes ? static_cast<double>(stats->raw_bytes + 16 * stats->batches) / stats->wire_bytes : 0.0,
+			at(0.50), at(0.99), (unsigned long)stats->gaps);
+	stats->batches = stats->frames = stats->detections = stats->wire_bytes = stats->raw_bytes = 0;
+	latencies.clear();
+}
+
+auto main(int argc, char** argv) -> int {
+	static struct option long_options[] = {
+		{ "port", required_argument, nullptr, 'p' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 }
+	};
+	int port = 9400;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+		if (opt == 'p') {
+			port = std::stoi(optarg);
+		} else {
+			g_printerr("Usage: %s [--port <port>]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	int listener = socket(AF_INET6, SOCK_STREAM, 0);
+	int one = 1;
+	int zero = 0;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+	struct sockaddr_in6 address = { };
+	address.sin6_family = AF_INET6;
+	address.sin6_addr = in6addr_any;
+	address.sin6_port = htons(port);
+	if (listener < 0 || bind(listener, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0) {
+		g_printerr("Unable to listen on port %d: %s\n", port, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	g_print("Listening on port %d\n", port);
+
+	ReceiverStats stats;
+	std::thread reporter { [&stats] {
+		for (;;) {
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+			report(&stats, 1.0);
+		}
+	} };
+	reporter.detach();
+
+	for (;;) {
+		int fd = accept(listener, nullptr, nullptr);
+		if (fd < 0) {
+			continue;
+		}
+		std::thread { serve_connection, fd, &stats }.detach();
+	}
+}
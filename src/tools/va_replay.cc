@@ -0,0 +1,495 @@
+/**
+ * Replay recorded or synthetic detections through the same sink path as the
+ * metadata probe (va::UserData::sink_frame), at a multiple of real time, and
+ * report what the sinks sustain. Needs no GPU, only the database.
+ *
+ *   $ ./va_replay --sources 64 --objects 20 --speed 10 --duration 60
+ *   $ ./va_replay --sources 16 --ramp --config configs/config.yml
+ *   $ ./va_replay --input detections.tsv --speed 50
+ *
+ * Recorded input is the tab separated output of
+ *   mysql --batch -e "SELECT video_file, object_label, class_id, box_left, box_top,
+ *       box_width, box_height, timestamp FROM va.metadata ORDER BY timestamp"
+ */
+#include <getopt.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "va_database.h"
+#include "va_detection_cache.h"
+#include "va_journal.h"
+#include "va_object_meta.h"
+#include "va_publisher.h"
+#include "va_retention.h"
+#include "va_user_data.h"
+
+using Clock = std::chrono::steady_clock;
+
+static const char* labels[4] = { "Car", "Bicycle", "Person", "Roadsign" };
+
+struct ReplayOptions {
+	std::string input;
+	std::string config;
+	std::string url { "tcp://127.0.0.1:3306" };
+	std::string username { "root" };
+	std::string password { "example" };
+	std::string database { "va" };
+	bool use_database = true;
+	bool sync = false;
+	guint sources = 4;
+	guint objects = 10;
+	std::vector<std::pair<int, double>> class_mix { { 0, 0.6 }, { 2, 0.3 }, { 1, 0.1 } };
+	double fps = 30.0;
+	double motion = 4.0;
+	double speed = 1.0;
+	double duration = 30.0;
+	int save_interval = 60;
+	bool ramp = false;
+	double max_speed = 1024.0;
+	double step_sec = 10.0;
+};
+
+struct SourceFrame {
+	guint source_id;
+	va::FrameMetadata frame_meta;
+};
+
+/**
+ * Random walk of objects per source, boxes bounce inside a 1920x1080 frame
+ */
+struct SyntheticSource {
+	struct Object {
+		int class_id;
+		double left, top, width, height, vx, vy;
+	};
+	std::vector<Object> objects;
+};
+
+struct StepResult {
+	double speed;
+	double target_fps;
+	double achieved_fps;
+	double rows_per_sec;
+	double sampled_rows_per_sec;
+	double db_rows_per_sec;
+	double p50_us, p95_us, p99_us, max_us;
+	uint64_t backlog_bytes;
+};
+
+static auto usage(const char* name) -> void {
+	g_printerr(
+		"Usage: %s [options]\n"
+		"  --input <tsv>          replay recorded detections instead of synthetic ones\n"
+		"  --sources <n>          synthetic sources (default 4)\n"
+		"  --objects <n>          objects per frame (default 10)\n"
+		"  --classes <id:w,...>   class mix, e.g. 0:0.6,2:0.3,1:0.1\n"
+		"  --fps <f>              frames per second per source (default 30)\n"
+		"  --motion <px>          max object speed in pixels per frame (default 4)\n"
+		"  --speed <x>            multiple of real time (default 1)\n"
+		"  --duration <s>         stream seconds to replay (default 30)\n"
+		"  --save-interval <n>    frames between database writes (default 60)\n"
+		"  --ramp                 double the speed every step until the sinks saturate\n"
+		"  --max-speed <x>        ramp limit (default 1024)\n"
+		"  --step-sec <s>         wall seconds per ramp step (default 10)\n"
+		"  --config <yml>         take journal / detection-cache / publisher / retention settings from a config file\n"
+		"  --url <url> --user <u> --password <p> --database <db>\n"
+		"  --sync                 create the tables first if they are missing\n"
+		"  --no-db                only drive the in-memory sinks\n",
+		name
+	);
+}
+
+static auto parse_class_mix(const std::string& text) -> std::vector<std::pair<int, double>> {
+	std::vector<std::pair<int, double>> mix;
+	std::stringstream stream { text };
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		size_t colon = item.find(':');
+		if (colon == std::string::npos) {
+			throw std::invalid_argument("invalid class mix: " + text + "\n");
+		}
+		mix.emplace_back(std::stoi(item.substr(0, colon)), std::stod(item.substr(colon + 1)));
+	}
+	return mix;
+}
+
+static auto parse_options(int argc, char** argv) -> ReplayOptions {
+	static struct option long_options[] = {
+		{ "input", required_argument, nullptr, 'i' },
+		{ "sources", required_argument, nullptr, 'n' },
+		{ "objects", required_argument, nullptr, 'o' },
+		{ "classes", required_argument, nullptr, 'c' },
+		{ "fps", required_argument, nullptr, 'f' },
+		{ "motion", required_argument, nullptr, 'm' },
+		{ "speed", required_argument, nullptr, 's' },
+		{ "duration", required_argument, nullptr, 'd' },
+		{ "save-interval", required_argument, nullptr, 'v' },
+		{ "ramp", no_argument, nullptr, 'r' },
+		{ "max-speed", required_argument, nullptr, 'x' },
+		{ "step-sec", required_argument, nullptr, 't' },
+		{ "config", required_argument, nullptr, 'g' },
+		{ "url", required_argument, nullptr, 'U' },
+		{ "user", required_argument, nullptr, 'u' },
+		{ "password", required_argument, nullptr, 'p' },
+		{ "database", required_argument, nullptr, 'D' },
+		{ "sync", no_argument, nullptr, 'S' },
+		{ "no-db", no_argument, nullptr, 'N' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 }
+	};
+
+	ReplayOptions options {};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+		switch (opt) {
+			case 'i': options.input = optarg; break;
+			case 'n': options.sources = std::stoul(optarg); break;
+			case 'o': options.objects = std::stoul(optarg); break;
+			case 'c': options.class_mix = parse_class_mix(optarg); break;
+			case 'f': options.fps = std::stod(optarg); break;
+			case 'm': options.motion = std::stod(optarg); break;
+			case 's': options.speed = std::stod(optarg); break;
+			case 'd': options.duration = std::stod(optarg); break;
+			case 'v': options.save_interval = std::stoi(optarg); break;
+			case 'r': options.ramp = true; break;
+			case 'x': options.max_speed = std::stod(optarg); break;
+			case 't': options.step_sec = std::stod(optarg); break;
+			case 'g': options.config = optarg; break;
+			case 'U': options.url = optarg; break;
+			case 'u': options.username = optarg; break;
+			case 'p': options.password = optarg; break;
+			case 'D': options.database = optarg; break;
+			case 'S': options.sync = true; break;
+			case 'N': options.use_database = false; break;
+			default:
+				usage(argv[0]);
+				throw std::invalid_argument("invalid argument\n");
+		}
+	}
+	if (options.sources == 0 || options.fps <= 0 || options.speed <= 0 || options.save_interval <= 0) {
+		throw std::invalid_argument("sources, fps, speed and save-interval must be positive\n");
+	}
+	return options;
+}
+
+/**
+ * Load recorded rows and group them into frames, one source per video_file
+ */
+static auto load_recording(const std::string& path, std::vector<std::string>* source_names) -> std::vector<SourceFrame> {
+	std::ifstream file { path };
+	if (!file) {
+		throw std::runtime_error("Unable to open " + path + "\n");
+	}
+	std::map<std::string, guint> source_ids;
+	std::vector<SourceFrame> frames;
+	std::string line;
+	while (std::getline(file, line)) {
+		std::vector<std::string> fields;
+		std::stringstream stream { line };
+		std::string field;
+		while (std::getline(stream, field, '\t')) {
+			fields.push_back(field);
+		}
+		/* skip the header and malformed rows */
+		if (fields.size() != 8 || fields[7] == "timestamp") {
+			continue;
+		}
+
+		auto inserted = source_ids.emplace(fields[0], source_ids.size());
+		if (inserted.second) {
+			source_names->push_back(fields[0]);
+		}
+		guint source_id = inserted.first->second;
+		guint64 timestamp = std::stoull(fields[7]);
+
+		if (frames.empty() || frames.back().source_id != source_id || frames.back().frame_meta.timestamp != timestamp) {
+			frames.push_back(SourceFrame { source_id, va::FrameMetadata { fields[0], timestamp } });
+		}
+		frames.back().frame_meta.va_object_meta_list.emplace_back(
+			fields[1], std::stoi(fields[2]), std::stod(fields[3]), std::stod(fields[4]),
+			std::stod(fields[5]), std::stod(fields[6]), timestamp
+		);
+	}
+	if (frames.empty()) {
+		throw std::runtime_error("No detections in " + path + "\n");
+	}
+	std::stable_sort(frames.begin(), frames.end(), [](const SourceFrame& a, const SourceFrame& b) {
+		return a.frame_meta.timestamp < b.frame_meta.timestamp;
+	});
+	return frames;
+}
+
+/**
+ * Produces frames in stream-time order, either from a recording (looped, with
+ * timestamps shifted on every pass) or from synthetic sources
+ */
+struct FrameGenerator {
+	const ReplayOptions& m_options;
+	std::vector<SourceFrame> m_recording;
+	std::vector<SyntheticSource> m_sources;
+	std::vector<std::string> m_source_names;
+	std::mt19937 m_random { 42 };
+	std::discrete_distribution<int> m_class_pick;
+	size_t m_position = 0;
+	guint64 m_frame_index = 0;
+	guint64 m_loop_offset = 0;
+	guint64 m_start_timestamp;
+
+	FrameGenerator(const ReplayOptions& options) : m_options(options) {
+		m_start_timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+		if (!options.input.empty()) {
+			m_recording = load_recording(options.input, &m_source_names);
+			return;
+		}
+
+		std::vector<double> weights;
+		for (const auto& mix : options.class_mix) {
+			weights.push_back(mix.second);
+		}
+		m_class_pick = std::discrete_distribution<int>(weights.begin(), weights.end());
+		std::uniform_real_distribution<double> x(0, 1800), y(0, 1000), size(20, 200), velocity(-options.motion, options.motion);
+		m_sources.resize(options.sources);
+		for (guint i = 0; i < options.sources; ++i) {
+			m_source_names.push_back("synthetic://source-" + std::to_string(i));
+			for (guint k = 0; k < options.objects; ++k) {
+				int class_id = options.class_mix[m_class_pick(m_random)].first;
+				m_sources[i].objects.push_back({ class_id, x(m_random), y(m_random), size(m_random), size(m_random), velocity(m_random), velocity(m_random) });
+			}
+		}
+	}
+
+	auto sources() const -> size_t {
+		return m_source_names.size();
+	}
+
+	/* stream time of the next frame, relative to the first one */
+	auto next_offset_ns() const -> guint64 {
+		if (!m_recording.empty()) {
+			return m_loop_offset + m_recording[m_position].frame_meta.timestamp - m_recording.front().frame_meta.timestamp;
+		}
+		return static_cast<guint64>((m_frame_index / m_sources.size()) * 1e9 / m_options.fps);
+	}
+
+	auto next(SourceFrame* frame) -> void {
+		if (!m_recording.empty()) {
+			*frame = m_recording[m_position];
+			guint64 shift = m_loop_offset;
+			frame->frame_meta.timestamp += shift;
+			for (va::ObjectMetadata& object_meta : frame->frame_meta.va_object_meta_list) {
+				object_meta.timestamp += shift;
+			}
+			if (++m_position == m_recording.size()) {
+				const va::FrameMetadata& last = m_recording.back().frame_meta;
+				m_loop_offset += last.timestamp - m_recording.front().frame_meta.timestamp + static_cast<guint64>(1e9 / m_options.fps);
+				m_position = 0;
+			}
+			return;
+		}
+
+		guint source_id = m_frame_index % m_sources.size();
+		guint64 timestamp = m_start_timestamp + next_offset_ns();
+		frame->source_id = source_id;
+		frame->frame_meta = va::FrameMetadata { m_source_names[source_id], timestamp };
+		for (SyntheticSource::Object& object : m_sources[source_id].objects) {
+			object.left += object.vx;
+			object.top += object.vy;
+			if (object.left < 0 || object.left + object.width > 1920) {
+				object.vx = -object.vx;
+			}
+			if (object.top < 0 || object.top + object.height > 1080) {
+				object.vy = -object.vy;
+			}
+			frame->frame_meta.va_object_meta_list.emplace_back(
+				labels[object.class_id & 3], object.class_id, object.left, object.top, object.width, object.height, timestamp
+			);
+		}
+		++m_frame_index;
+	}
+};
+
+static auto percentile(std::vector<double>& samples, double p) -> double {
+	if (samples.empty()) {
+		return 0.0;
+	}
+	size_t index = std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()));
+	std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+	return samples[index];
+}
+
+/**
+ * Feed frames at speed x real time for wall_sec seconds (or stream_sec of
+ * stream time, whichever ends first)
+ */
+static auto run_step(
+	FrameGenerator& generator,
+	va::UserData& va_user_data,
+	double speed,
+	double wall_sec,
+	double stream_sec
+) -> StepResult {
+	std::vector<double> latencies;
+	uint64_t frames = 0, rows = 0, sampled_rows = 0, db_rows = 0;
+	uint64_t replayed_before = va_user_data.va_journal ? va_user_data.va_journal->m_replayed_rows.load() : 0;
+
+	guint64 stream_start = generator.next_offset_ns();
+	Clock::time_point wall_start = Clock::now();
+	Clock::time_point wall_end = wall_start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(wall_sec));
+	SourceFrame frame { 0, va::FrameMetadata { std::string {}, 0 } };
+
+	for (;;) {
+		guint64 stream_offset = generator.next_offset_ns() - stream_start;
+		if (stream_offset > stream_sec * 1e9) {
+			break;
+		}
+		Clock::time_point due = wall_start + std::chrono::nanoseconds(static_cast<guint64>(stream_offset / speed));
+		Clock::time_point now = Clock::now();
+		if (now >= wall_end) {
+			break;
+		}
+		if (due > now) {
+			std::this_thread::sleep_until(due);
+		}
+
+		generator.next(&frame);
+		size_t objects = frame.frame_meta.va_object_meta_list.size();
+
+		Clock::time_point begin = Clock::now();
+		va_user_data.sink_frame(frame.source_id, frame.frame_meta);
+		latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+
+		++frames;
+		rows += objects;
+		/* sink_frame resets frame_count when the frame was written out */
+		if (va_user_data.frame_count == 0 && (va_user_data.va_journal || va_user_data.va_database)) {
+			sampled_rows += objects;
+		}
+	}
+
+	double elapsed = std::chrono::duration<double>(Clock::now() - wall_start).count();
+	double stream_elapsed = (generator.next_offset_ns() - stream_start) / 1e9;
+	/* without a journal the insert is synchronous, with one it lags behind */
+	db_rows = sampled_rows;
+	if (va_user_data.va_journal) {
+		db_rows = va_user_data.va_journal->m_replayed_rows.load() - replayed_before;
+	}
+
+	StepResult result {};
+	result.speed = speed;
+	result.target_fps = (stream_elapsed > 0 ? frames / stream_elapsed : 0) * speed;
+	result.achieved_fps = frames / elapsed;
+	result.rows_per_sec = rows / elapsed;
+	result.sampled_rows_per_sec = sampled_rows / elapsed;
+	result.db_rows_per_sec = db_rows / elapsed;
+	result.p50_us = percentile(latencies, 0.50);
+	result.p95_us = percentile(latencies, 0.95);
+	result.p99_us = percentile(latencies, 0.99);
+	result.max_us = latencies.empty() ? 0.0 : *std::max_element(latencies.begin(), latencies.end());
+	result.backlog_bytes = va_user_data.va_journal ? va_user_data.va_journal->backlog_bytes() : 0;
+	return result;
+}
+
+static auto print_result(const StepResult& result) -> void {
+	g_print("%8.1fx %12.0f %12.0f %12.0f %12.0f %9.1f %9.1f %9.1f %9.1f %12lu\n",
+			result.speed, result.target_fps, result.achieved_fps, result.rows_per_sec, result.db_rows_per_sec,
+			result.p50_us, result.p95_us, result.p99_us, result.max_us, (unsigned long)result.backlog_bytes);
+}
+
+auto main(int argc, char** argv) -> int {
+	try {
+		ReplayOptions options = parse_options(argc, argv);
+
+		std::unique_ptr<va::Database> db;
+		if (options.use_database) {
+			db = std::make_unique<va::Database>(options.url, options.username, options.password, options.database, options.sync);
+		}
+		va::UserData va_user_data { db.get(), options.save_interval };
+
+		std::unique_ptr<va::Journal> journal;
+		std::unique_ptr<va::DetectionCache> detection_cache;
+		std::unique_ptr<va::Publisher> publisher;
+		std::unique_ptr<va::Retention> retention;
+		if (!options.config.empty()) {
+			va::JournalConfig journal_config = va::parse_journal_config(options.config.c_str(), "journal");
+			if (journal_config.enable && db) {
+				journal = std::make_unique<va::Journal>(journal_config, db.get());
+				va_user_data.va_journal = journal.get();
+			}
+			va::RetentionConfig retention_config = va::parse_retention_config(options.config.c_str(), "retention");
+			if (retention_config.enable && db) {
+				retention = std::make_unique<va::Retention>(retention_config, db.get());
+			}
+			va::PublisherConfig publisher_config = va::parse_publisher_config(options.config.c_str(), "publisher");
+			if (publisher_config.enable) {
+				publisher = std::make_unique<va::Publisher>(publisher_config);
+				va_user_data.va_publisher = publisher.get();
+			}
+			va::DetectionCacheConfig cache_config = va::parse_detection_cache_config(options.config.c_str(), "detection-cache");
+			if (cache_config.enable) {
+				detection_cache = std::make_unique<va::DetectionCache>(cache_config);
+				detection_cache->set_database(db.get());
+				va_user_data.va_detection_cache = detection_cache.get();
+			}
+		}
+
+		FrameGenerator generator { options };
+		va_user_data.set_source_uris({ generator.m_source_names.begin(), generator.m_source_names.begin() + generator.sources() });
+		for (size_t i = 0; i < generator.sources(); ++i) {
+			if (detection_cache) {
+				detection_cache->set_source_name(i, generator.m_source_names[i]);
+			}
+		}
+
+		g_print("Replaying %zu sources, save interval %d, journal %s, cache %s, publisher %s\n", generator.sources(),
+				options.save_interval, journal ? "on" : "off", detection_cache ? "on" : "off", publisher ? "on" : "off");
+		g_print("%9s %12s %12s %12s %12s %9s %9s %9s %9s %12s\n", "speed", "target fps", "fps", "rows/s",
+				"db rows/s", "p50 us", "p95 us", "p99 us", "max us", "backlog B");
+
+		if (!options.ramp) {
+			print_result(run_step(generator, va_user_data, options.speed, G_MAXUINT, options.duration));
+			return EXIT_SUCCESS;
+		}
+
+		/* the sinks are saturated once the driver cannot keep the target rate or
+		 * the database commits clearly fewer rows than it is offered */
+		StepResult last_sustained {};
+		bool saturated = false;
+		for (double speed = options.speed; speed <= options.max_speed; speed *= 2) {
+			StepResult result = run_step(generator, va_user_data, speed, options.step_sec, G_MAXUINT);
+			print_result(result);
+			bool keeps_up = result.achieved_fps >= 0.95 * result.target_fps;
+			bool drains = result.db_rows_per_sec >= 0.9 * result.sampled_rows_per_sec;
+			if (!keeps_up || !drains) {
+				saturated = true;
+				break;
+			}
+			last_sustained = result;
+		}
+		if (saturated && last_sustained.speed > 0) {
+			g_print("Saturation: %.1fx real time, %.0f frames/s, %.0f rows/s, %.0f db rows/s\n",
+					last_sustained.speed, last_sustained.achieved_fps, last_sustained.rows_per_sec, last_sustained.db_rows_per_sec);
+		} else if (saturated) {
+			g_print("Saturation: below %.1fx real time\n", options.speed);
+		} else {
+			g_print("Not saturated up to %.1fx real time\n", options.max_speed);
+		}
+	} catch (std::invalid_argument& e) {
+		g_printerr("%s", e.what());
+		return EXIT_FAILURE;
+	} catch (std::exception& e) {
+		g_printerr("%s", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
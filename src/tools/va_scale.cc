@@ -0,0 +1,422 @@
+/**
+ * How many sources one box takes. Runs the engine's pipeline and metadata
+ * probe on N synthetic sources (a live videotestsrc or a looped local file,
+ * see va_synthetic_source.h), N growing every step, and records what the
+ * probe sees, CPU, RSS and the journal backlog per step. Stops at the knee:
+ * the first step where the slowest source falls behind its frame rate or the
+ * p99 latency from the muxer to the probe goes over the limit.
+ *
+ * With --soak-hours it runs one N for hours instead, reports every
+ * --report-sec, and fails when RSS keeps growing faster than --max-growth-mb-h.
+ *
+ * Everything but the sources, the batch size and the detector backend comes
+ * from --config. Of the optional modules only the journal is wired in, with
+ * --journal. PERF_MODE=1 is set for a fakesink.
+ *
+ *   $ ./va_scale --sources 1 --max-sources 64 --width 1920 --height 1080 --fps 30
+ *   $ ./va_scale --file file:///samples/sample_1080p_h264.mp4 --step 4 --detector nvinfer
+ *   $ ./va_scale --soak-hours 8 --sources 16 --jitter-ms 10 --journal
+ */
+#include <getopt.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glib.h>
+#include <yaml-cpp/yaml.h>
+
+#include "va_database.h"
+#include "va_engine.h"
+#include "va_journal.h"
+#include "va_stream_stats.h"
+#include "va_synthetic_source.h"
+
+struct ScaleOptions {
+	std::string config { "configs/config.yml" };
+	va::SyntheticSource source {};
+	std::string detector { "none" };
+	guint sources = 1;
+	guint max_sources = 64;
+	/* sources added per step, 0 to double */
+	guint step = 0;
+	double warmup_sec = 10.0;
+	double sample_sec = 30.0;
+	double min_efficiency = 0.95;
+	double max_latency_ms = 200.0;
+	double soak_hours = 0.0;
+	double report_sec = 60.0;
+	double max_growth_mb_h = 16.0;
+	bool journal = false;
+	std::string url { "tcp://127.0.0.1:3306" };
+	std::string username { "root" };
+	std::string password { "example" };
+	std::string database { "va" };
+};
+
+struct Usage {
+	gint64 time;
+	double cpu_sec;
+	double rss_mb;
+};
+
+struct StepResult {
+	guint sources;
+	va::StreamWindow window;
+	double expected_fps;
+	double cores;
+	double rss_mb;
+	uint64_t backlog_bytes;
+};
+
+static auto usage(const char* name) -> void {
+	g_printerr(
+		"Usage: %s [options]\n"
+		"  --config <yml>         base config (default configs/config.yml)\n"
+		"  --file <uri>           loop a local file instead of videotestsrc\n"
+		"  --width <px> --height <px> --fps <n> --pattern <name>\n"
+		"                         videotestsrc frames (default 1920x1080 at 30, smpte); --fps is the\n"
+		"                         rate a looped file is expected to keep\n"
+		"  --jitter-ms <ms>       hold frames back up to this long, at random\n"
+		"  --detector <backend>   none, nvinfer or cpu (default none)\n"
+		"  --sources <n>          first step (default 1)\n"
+		"  --max-sources <n>      last step (default 64)\n"
+		"  --step <n>             sources added per step, 0 to double (default 0)\n"
+		"  --warmup-sec <s>       before sampling a step (default 10)\n"
+		"  --sample-sec <s>       sampled per step (default 30)\n"
+		"  --min-efficiency <f>   slowest source fps over --fps under which a step is past the knee (default 0.95)\n"
+		"  --max-latency-ms <ms>  p99 over which a step is past the knee (default 200)\n"
+		"  --soak-hours <h>       run --sources for this long instead of stepping\n"
+		"  --report-sec <s>       soak report interval (default 60)\n"
+		"  --max-growth-mb-h <f>  soak fails when RSS grows faster (default 16)\n"
+		"  --journal              write detections through the journal of --config, for its backlog\n"
+		"  --url <url> --user <u> --password <p> --database <db>\n",
+		name
+	);
+}
+
+static auto parse_options(int argc, char** argv) -> ScaleOptions {
+	static struct option long_options[] = {
+		{ "config", required_argument, nullptr, 'g' },
+		{ "file", required_argument, nullptr, 'F' },
+		{ "width", required_argument, nullptr, 'W' },
+		{ "height", required_argument, nullptr, 'H' },
+		{ "fps", required_argument, nullptr, 'f' },
+		{ "pattern", required_argument, nullptr, 'P' },
+		{ "jitter-ms", required_argument, nullptr, 'j' },
+		{ "detector", required_argument, nullptr, 'd' },
+		{ "sources", required_argument, nullptr, 'n' },
+		{ "max-sources", required_argument, nullptr, 'x' },
+		{ "step", required_argument, nullptr, 's' },
+		{ "warmup-sec", required_argument, nullptr, 'w' },
+		{ "sample-sec", required_argument, nullptr, 't' },
+		{ "min-efficiency", required_argument, nullptr, 'e' },
+		{ "max-latency-ms", required_argument, nullptr, 'l' },
+		{ "soak-hours", required_argument, nullptr, 'k' },
+		{ "report-sec", required_argument, nullptr, 'r' },
+		{ "max-growth-mb-h", required_argument, nullptr, 'm' },
+		{ "journal", no_argument, nullptr, 'J' },
+		{ "url", required_argument, nullptr, 'U' },
+		{ "user", required_argument, nullptr, 'u' },
+		{ "password", required_argument, nullptr, 'p' },
+		{ "database", required_argument, nullptr, 'D' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 }
+	};
+
+	ScaleOptions options {};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+		switch (opt) {
+			case 'g': options.config = optarg; break;
+			case 'F': options.source.kind = "file"; options.source.location = optarg; break;
+			case 'W': options.source.width = std::stoul(optarg); break;
+			case 'H': options.source.height = std::stoul(optarg); break;
+			case 'f': options.source.fps = std::stoul(optarg); break;
+			case 'P': options.source.pattern = optarg; break;
+			case 'j': options.source.jitter_ms = std::stoul(optarg); break;
+			case 'd': options.detector = optarg; break;
+			case 'n': options.sources = std::stoul(optarg); break;
+			case 'x': options.max_sources = std::stoul(optarg); break;
+			case 's': options.step = std::stoul(optarg); break;
+			case 'w': options.warmup_sec = std::stod(optarg); break;
+			case 't': options.sample_sec = std::stod(optarg); break;
+			case 'e': options.min_efficiency = std::stod(optarg); break;
+			case 'l': options.max_latency_ms = std::stod(optarg); break;
+			case 'k': options.soak_hours = std::stod(optarg); break;
+			case 'r': options.report_sec = std::stod(optarg); break;
+			case 'm': options.max_growth_mb_h = std::stod(optarg); break;
+			case 'J': options.journal = true; break;
+			case 'U': options.url = optarg; break;
+			case 'u': options.username = optarg; break;
+			case 'p': options.password = optarg; break;
+			case 'D': options.database = optarg; break;
+			default:
+				usage(argv[0]);
+				throw std::invalid_argument("invalid argument\n");
+		}
+	}
+	if (options.sources == 0 || options.max_sources < options.sources || options.source.fps == 0 ||
+			options.sample_sec <= 0 || options.report_sec <= 0) {
+		throw std::invalid_argument("sources, fps, sample-sec and report-sec must be positive, max-sources at least sources\n");
+	}
+	/* the uri parser is the one place that knows what a valid source is */
+	va::parse_synthetic_uri(va::format_synthetic_uri(options.source));
+	return options;
+}
+
+static auto usage_now() -> Usage {
+	struct rusage rusage {};
+	getrusage(RUSAGE_SELF, &rusage);
+	Usage now {};
+	now.time = g_get_monotonic_time();
+	now.cpu_sec = rusage.ru_utime.tv_sec + rusage.ru_stime.tv_sec + (rusage.ru_utime.tv_usec + rusage.ru_stime.tv_usec) / 1e6;
+	long pages = 0, resident = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm) {
+		if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+			resident = 0;
+		}
+		fclose(statm);
+	}
+	now.rss_mb = resident * static_cast<double>(sysconf(_SC_PAGESIZE)) / (1 << 20);
+	return now;
+}
+
+static auto sleep_sec(double seconds) -> void {
+	std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+}
+
+/**
+ * The base config with n copies of the synthetic source, batched together
+ */
+static auto write_config(const ScaleOptions& options, guint sources, const std::string& path) -> void {
+	YAML::Node config = YAML::LoadFile(options.config);
+	std::string uri = va::format_synthetic_uri(options.source);
+	std::string list;
+	for (guint i = 0; i < sources; ++i) {
+		list += uri + ";";
+	}
+	config["source-list"]["list"] = list;
+	config["streammux"]["batch-size"] = sources;
+	config["streammux"]["live-source"] = options.source.kind == "testsrc" ? 1 : 0;
+	config["detector"]["backend"] = options.detector;
+	std::ofstream file { path };
+	file << config << "\n";
+	if (!file) {
+		throw std::runtime_error("Unable to write " + path + "\n");
+	}
+}
+
+/**
+ * An engine running on its own thread, torn down when this goes out of scope
+ */
+struct EngineRun {
+	std::string m_config_path;
+	std::vector<char*> m_argv;
+	std::unique_ptr<va::Engine> m_engine;
+	std::thread m_thread;
+	std::atomic<bool> m_returned { false };
+
+	EngineRun(char* name, const std::string& config_path, va::StreamStats* stats, va::Journal* journal)
+		: m_config_path(config_path) {
+		m_argv = { name, const_cast<char*>(m_config_path.c_str()), nullptr };
+		m_engine = std::make_unique<va::Engine>(2, m_argv.data());
+		m_engine->set_stream_stats(stats);
+		m_engine->set_journal(journal);
+		m_thread = std::thread([this] {
+			try {
+				m_engine->run();
+			} catch (std::exception& e) {
+				g_printerr("%s", e.what());
+			}
+			m_returned = true;
+		});
+	}
+
+	/* a quit before the engine is in its main loop is lost, so ask until it returns */
+	~EngineRun() {
+		while (!m_returned) {
+			m_engine->stop();
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		m_thread.join();
+	}
+};
+
+static auto print_header() -> void {
+	g_print("%8s %10s %10s %10s %8s %8s %8s %7s %9s %12s\n", "sources", "expected", "fps", "min src", "p50 ms",
+			"p99 ms", "max ms", "cores", "rss MB", "backlog B");
+}
+
+static auto print_result(const StepResult& result) -> void {
+	g_print("%8u %10.1f %10.1f %10.2f %8.0f %8.0f %8.0f %7.2f %9.1f %12lu\n", result.sources, result.expected_fps,
+			result.window.seconds > 0 ? result.window.frames / result.window.seconds : 0.0, result.window.min_source_fps,
+			result.window.latency_p50_ms, result.window.latency_p99_ms, result.window.latency_max_ms, result.cores,
+			result.rss_mb, (unsigned long)result.backlog_bytes);
+}
+
+static auto measure(guint sources, const ScaleOptions& options, const va::StreamStatsSnapshot& from_stats,
+		const va::StreamStatsSnapshot& to_stats, const Usage& from, const Usage& to, va::Journal* journal) -> StepResult {
+	StepResult result {};
+	result.sources = sources;
+	result.window = va::stream_window(from_stats, to_stats);
+	result.expected_fps = static_cast<double>(sources) * options.source.fps;
+	double wall = (to.time - from.time) / 1e6;
+	result.cores = wall > 0 ? (to.cpu_sec - from.cpu_sec) / wall : 0.0;
+	result.rss_mb = to.rss_mb;
+	result.backlog_bytes = journal ? journal->backlog_bytes() : 0;
+	return result;
+}
+
+/* past the knee: a source stalled or fell behind, or latency went over the limit */
+static auto past_knee(const StepResult& result, const ScaleOptions& options) -> bool {
+	return result.window.active_sources < result.sources ||
+		result.window.min_source_fps < options.min_efficiency * options.source.fps ||
+		result.window.latency_p99_ms > options.max_latency_ms;
+}
+
+static auto run_steps(char* name, const ScaleOptions& options, const std::string& config_path, va::Journal* journal) -> void {
+	print_header();
+	StepResult last_sustained {};
+	bool saturated = false;
+	for (guint sources = options.sources; sources <= options.max_sources;
+			sources = options.step ? sources + options.step : sources * 2) {
+		write_config(options, sources, config_path);
+		va::StreamStats stats { sources };
+		StepResult result {};
+		{
+			EngineRun run { name, config_path, &stats, journal };
+			sleep_sec(options.warmup_sec);
+			va::StreamStatsSnapshot from_stats = stats.snapshot();
+			Usage from = usage_now();
+			sleep_sec(options.sample_sec);
+			result = measure(sources, options, from_stats, stats.snapshot(), from, usage_now(), journal);
+			if (run.m_returned) {
+				g_printerr("The engine stopped on its own at %u sources\n", sources);
+			}
+		}
+		print_result(result);
+		if (past_knee(result, options)) {
+			saturated = true;
+			break;
+		}
+		last_sustained = result;
+	}
+	if (saturated && last_sustained.sources > 0) {
+		g_print("Knee: %u sources, %.1f frames/s, p99 %.0f ms, %.2f cores, %.1f MB\n", last_sustained.sources,
+				last_sustained.window.frames / last_sustained.window.seconds, last_sustained.window.latency_p99_ms,
+				last_sustained.cores, last_sustained.rss_mb);
+	} else if (saturated) {
+		g_print("Knee: below %u sources\n", options.sources);
+	} else {
+		g_print("No knee up to %u sources\n", options.max_sources);
+	}
+	g_print("RSS after the last teardown: %.1f MB\n", usage_now().rss_mb);
+}
+
+/**
+ * Least squares slope of RSS over time, MB per hour
+ */
+static auto growth_per_hour(const std::vector<std::pair<double, double>>& samples) -> double {
+	if (samples.size() < 2) {
+		return 0.0;
+	}
+	double mean_x = 0.0, mean_y = 0.0;
+	for (const auto& sample : samples) {
+		mean_x += sample.first;
+		mean_y += sample.second;
+	}
+	mean_x /= samples.size();
+	mean_y /= samples.size();
+	double covariance = 0.0, variance = 0.0;
+	for (const auto& sample : samples) {
+		covariance += (sample.first - mean_x) * (sample.second - mean_y);
+		variance += (sample.first - mean_x) * (sample.first - mean_x);
+	}
+	return variance > 0 ? covariance / variance : 0.0;
+}
+
+static auto run_soak(char* name, const ScaleOptions& options, const std::string& config_path, va::Journal* journal) -> bool {
+	write_config(options, options.sources, config_path);
+	va::StreamStats stats { options.sources };
+	double before_mb = usage_now().rss_mb;
+	/* hours since the start and RSS, past the first tenth of the soak */
+	std::vector<std::pair<double, double>> samples;
+	guint stalled = 0;
+	{
+		EngineRun run { name, config_path, &stats, journal };
+		sleep_sec(options.warmup_sec);
+		g_print("Soak: %u sources for %.1f h\n", options.sources, options.soak_hours);
+		print_header();
+		Usage start = usage_now();
+		Usage last = start;
+		va::StreamStatsSnapshot last_stats = stats.snapshot();
+		while (!run.m_returned && (last.time - start.time) / 3.6e9 < options.soak_hours) {
+			sleep_sec(options.report_sec);
+			Usage now = usage_now();
+			va::StreamStatsSnapshot now_stats = stats.snapshot();
+			StepResult result = measure(options.sources, options, last_stats, now_stats, last, now, journal);
+			print_result(result);
+			if (result.window.active_sources < options.sources) {
+				++stalled;
+			}
+			double hours = (now.time - start.time) / 3.6e9;
+			if (hours >= 0.1 * options.soak_hours) {
+				samples.emplace_back(hours, now.rss_mb);
+			}
+			last = now;
+			last_stats = std::move(now_stats);
+		}
+		if (run.m_returned) {
+			g_printerr("The engine stopped on its own\n");
+			++stalled;
+		}
+	}
+	double growth = growth_per_hour(samples);
+	g_print("RSS growth %.2f MB/h over %zu samples, %.1f MB before start, %.1f MB after teardown, %u reports with a stalled source\n",
+			growth, samples.size(), before_mb, usage_now().rss_mb, stalled);
+	return growth <= options.max_growth_mb_h && stalled == 0;
+}
+
+auto main(int argc, char** argv) -> int {
+	try {
+		ScaleOptions options = parse_options(argc, argv);
+		/* fakesink, no display needed */
+		g_setenv("PERF_MODE", "1", TRUE);
+
+		std::unique_ptr<va::Database> db;
+		std::unique_ptr<va::Journal> journal;
+		if (options.journal) {
+			va::JournalConfig journal_config = va::parse_journal_config(options.config.c_str(), "journal");
+			db = std::make_unique<va::Database>(options.url, options.username, options.password, options.database, false);
+			journal = std::make_unique<va::Journal>(journal_config, db.get());
+		}
+
+		std::string config_path = std::string { g_get_tmp_dir() } + "/va_scale_" + std::to_string(getpid()) + ".yml";
+		g_print("%s, detector %s, journal %s\n", va::format_synthetic_uri(options.source).c_str(), options.detector.c_str(),
+				journal ? "on" : "off");
+		bool passed = true;
+		if (options.soak_hours > 0) {
+			passed = run_soak(argv[0], options, config_path, journal.get());
+		} else {
+			run_steps(argv[0], options, config_path, journal.get());
+		}
+		std::remove(config_path.c_str());
+		return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+	} catch (std::invalid_argument& e) {
+		g_printerr("%s", e.what());
+		return EXIT_FAILURE;
+	} catch (std::exception& e) {
+		g_printerr("%s", e.what());
+		return EXIT_FAILURE;
+	}
+}
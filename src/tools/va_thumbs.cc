@@ -0,0 +1,204 @@
+/**
+ * Run the thumbnailer on a local file without a GPU: the file is decoded in
+ * software to I420 in host memory, and synthetic boxes drifting across the
+ * frame stand in for detections.
+ *
+ *   $ ./va_thumbs --input samples/sample_1080p_h264.mp4 --objects 8
+ *   $ ./va_thumbs --input sample.mp4 --objects 20 --untracked --window 2 --directory thumbs
+ */
+#include <getopt.h>
+
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#include <gst/gst.h>
+#include <glib.h>
+
+#include "va_thumbnailer.h"
+
+struct ThumbsTool {
+	va::Thumbnailer* thumbnailer;
+	GMainLoop* loop;
+	std::string video_file;
+	guint objects;
+	bool untracked;
+	guint64 frames = 0;
+};
+
+/**
+ * I420 as videoconvert lays it out without a video meta: rows padded to 4
+ * bytes, chroma planes right after luma
+ */
+static auto i420_view(const guint8* data, gint width, gint height) -> va::FrameView {
+	va::FrameView view;
+	view.format = va::FrameView::Format::I420;
+	view.width = width;
+	view.height = height;
+	view.pitches[0] = GST_ROUND_UP_4(width);
+	view.pitches[1] = GST_ROUND_UP_4(GST_ROUND_UP_2(width) / 2);
+	view.pitches[2] = view.pitches[1];
+	view.planes[0] = data;
+	view.planes[1] = view.planes[0] + view.pitches[0] * GST_ROUND_UP_2(height);
+	view.planes[2] = view.planes[1] + view.pitches[1] * (GST_ROUND_UP_2(height) / 2);
+	return view;
+}
+
+static auto frame_probe(GstPad* pad, GstPadProbeInfo* info, gpointer data) -> GstPadProbeReturn {
+	ThumbsTool* tool = static_cast<ThumbsTool*>(data);
+	GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	GstCaps* caps = gst_pad_get_current_caps(pad);
+	if (!caps) {
+		return GST_PAD_PROBE_OK;
+	}
+	gint width = 0, height = 0;
+	GstStructure* structure = gst_caps_get_structure(caps, 0);
+	gst_structure_get_int(structure, "width", &width);
+	gst_structure_get_int(structure, "height", &height);
+	gst_caps_unref(caps);
+
+	GstMapInfo map;
+	if (width <= 0 || height <= 0 || !gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+		return GST_PAD_PROBE_OK;
+	}
+	va::FrameView view = i420_view(map.data, width, height);
+	guint64 ts = GST_BUFFER_PTS(buffer);
+	guint64 frame = tool->frames++;
+	for (guint i = 0; i < tool->objects; ++i) {
+		/* each object crosses the frame in 10 s at 30 fps, growing and getting surer of itself on the way */
+		double progress = ((frame + i * 37) % 300) / 300.0;
+		va::ThumbnailCandidate candidate;
+		candidate.object_id = tool->untracked ? THUMBNAIL_UNTRACKED_ID : i;
+		candidate.class_id = i % 2 ? 2 : 0;
+		candidate.label = i % 2 ? "Person" : "Vehicle";
+		candidate.confidence = 0.4f + 0.5f * progress;
+		candidate.width = width * (0.05 + 0.1 * progress);
+		candidate.height = height * (0.1 + 0.15 * progress);
+		candidate.left = (width - candidate.width) * progress;
+		candidate.top = (height - candidate.height) * ((i * 0.618) - static_cast<guint>(i * 0.618));
+		candidate.timestamp = ts;
+		tool->thumbnailer->offer(0, tool->video_file, view, candidate);
+	}
+	gst_buffer_unmap(buffer, &map);
+	tool->thumbnailer->sweep(ts);
+	return GST_PAD_PROBE_OK;
+}
+
+static auto cb_decodebin_pad_added(GstElement* decodebin, GstPad* pad, gpointer data) -> void {
+	GstElement* convert = static_cast<GstElement*>(data);
+	GstCaps* caps = gst_pad_query_caps(pad, nullptr);
+	const gchar* media = gst_structure_get_name(gst_caps_get_structure(caps, 0));
+	bool video = g_str_has_prefix(media, "video/");
+	gst_caps_unref(caps);
+	if (!video) {
+		return;
+	}
+	GstPad* convert_pad = gst_element_get_static_pad(convert, "sink");
+	if (gst_pad_link(pad, convert_pad) != GST_PAD_LINK_OK) {
+		g_printerr("Unable to link %s\n", media);
+	}
+	gst_object_unref(convert_pad);
+}
+
+static auto bus_call(GstBus* bus, GstMessage* msg, gpointer data) -> gboolean {
+	ThumbsTool* tool = static_cast<ThumbsTool*>(data);
+	if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+		GError* error = nullptr;
+		gchar* debug = nullptr;
+		gst_message_parse_error(msg, &error, &debug);
+		g_printerr("ERROR from element %s: %s\n", GST_OBJECT_NAME(msg->src), error->message);
+		g_clear_error(&error);
+		g_free(debug);
+		g_main_loop_quit(tool->loop);
+	} else if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS) {
+		g_main_loop_quit(tool->loop);
+	}
+	return TRUE;
+}
+
+auto main(int argc, char** argv) -> int {
+	static struct option long_options[] = {
+		{ "input", required_argument, nullptr, 'i' },
+		{ "objects", required_argument, nullptr, 'o' },
+		{ "untracked", no_argument, nullptr, 'u' },
+		{ "window", required_argument, nullptr, 'w' },
+		{ "directory", required_argument, nullptr, 'd' },
+		{ "max-copies", required_argument, nullptr, 'c' },
+		{ "max-encodes", required_argument, nullptr, 'e' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 }
+	};
+	std::string input;
+	guint objects = 8;
+	bool untracked = false;
+	va::ThumbnailConfig config {};
+	config.enable = true;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+		switch (opt) {
+			case 'i': input = optarg; break;
+			case 'o': objects = std::stoul(optarg); break;
+			case 'u': untracked = true; break;
+			case 'w': config.window_sec = std::stoul(optarg); break;
+			case 'd': config.directory = optarg; break;
+			case 'c': config.max_copies_per_sec = std::stoul(optarg); break;
+			case 'e': config.max_encodes_per_sec = std::stoul(optarg); break;
+			default:
+				g_printerr("Usage: %s --input <file> [--objects <n>] [--untracked] [--window <sec>] [--directory <dir>] "
+						"[--max-copies <n>] [--max-encodes <n>]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (input.empty()) {
+		g_printerr("Need --input\n");
+		return EXIT_FAILURE;
+	}
+
+	gst_init(&argc, &argv);
+	try {
+		va::Thumbnailer thumbnailer { config };
+		ThumbsTool tool { &thumbnailer, g_main_loop_new(nullptr, FALSE), "file://" + input, objects, untracked };
+
+		GstElement* pipeline = gst_pipeline_new("va-thumbs");
+		GstElement* filesrc = gst_element_factory_make("filesrc", nullptr);
+		GstElement* decodebin = gst_element_factory_make("decodebin", nullptr);
+		GstElement* convert = gst_element_factory_make("videoconvert", nullptr);
+		GstElement* capsfilter = gst_element_factory_make("capsfilter", nullptr);
+		GstElement* sink = gst_element_factory_make("fakesink", nullptr);
+		if (!filesrc || !decodebin || !convert || !capsfilter || !sink) {
+			throw std::runtime_error("One element could not be created. Exiting.\n");
+		}
+		GstCaps* caps = gst_caps_from_string("video/x-raw, format=I420");
+		g_object_set(G_OBJECT(filesrc), "location", input.c_str(), NULL);
+		g_object_set(G_OBJECT(capsfilter), "caps", caps, NULL);
+		g_object_set(G_OBJECT(sink), "sync", FALSE, NULL);
+		gst_caps_unref(caps);
+		gst_bin_add_many(GST_BIN(pipeline), filesrc, decodebin, convert, capsfilter, sink, NULL);
+		if (!gst_element_link(filesrc, decodebin) || !gst_element_link_many(convert, capsfilter, sink, NULL)) {
+			throw std::runtime_error("Elements could not be linked. Exiting.\n");
+		}
+		g_signal_connect(G_OBJECT(decodebin), "pad-added", G_CALLBACK(cb_decodebin_pad_added), convert);
+
+		GstPad* sink_pad = gst_element_get_static_pad(sink, "sink");
+		gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, frame_probe, &tool, NULL);
+		gst_object_unref(sink_pad);
+
+		GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+		guint bus_watch_id = gst_bus_add_watch(bus, bus_call, &tool);
+		gst_object_unref(bus);
+
+		gst_element_set_state(pipeline, GST_STATE_PLAYING);
+		g_main_loop_run(tool.loop);
+		gst_element_set_state(pipeline, GST_STATE_NULL);
+		g_print("Frames: %lu\n", (unsigned long)tool.frames);
+
+		g_source_remove(bus_watch_id);
+		gst_object_unref(pipeline);
+		g_main_loop_unref(tool.loop);
+		/* the thumbnailer encodes what it still holds and prints its counters */
+	} catch (std::exception& e) {
+		g_printerr("%s", e.what());
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+/**
+ * Cost of a trace span. Times empty VA_TRACE_SCOPE spans on several threads
+ * at once and exports while they run, which is also a check that exporting
+ * never blocks or tears the writers.
+ *
+ *   $ make ENABLE_TRACE=1 va_trace_bench
+ *   $ ./va_trace_bench --threads 4 --spans 10000000 --output bench-trace.json
+ */
+#include <getopt.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glib.h>
+
+#include "va_trace.h"
+
+/* keeps the compiler from folding the span loop away */
+static std::atomic<uint64_t> sink { 0 };
+
+/* cpu time of the calling thread, so the result holds with more threads than cores */
+static auto thread_ns() -> double {
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static auto run_spans(uint64_t spans) -> double {
+	uint64_t local = 0;
+	double start = thread_ns();
+	for (uint64_t i = 0; i < spans; ++i) {
+		VA_TRACE_SCOPE("bench.span");
+		local += i;
+		asm volatile("" : : "r"(local) : "memory");
+	}
+	double elapsed = thread_ns() - start;
+	sink += local;
+	return elapsed / spans;
+}
+
+auto main(int argc, char** argv) -> int {
+	static struct option long_options[] = {
+		{ "threads", required_argument, nullptr, 't' },
+		{ "spans", required_argument, nullptr, 's' },
+		{ "output", required_argument, nullptr, 'o' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 }
+	};
+	unsigned threads = 4;
+	uint64_t spans = 10000000;
+	std::string output = "va-trace-bench.json";
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+		switch (opt) {
+			case 't': threads = std::stoul(optarg); break;
+			case 's': spans = std::stoull(optarg); break;
+			case 'o': output = optarg; break;
+			default:
+				g_printerr("Usage: %s [--threads <n>] [--spans <n per thread>] [--output <json>]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+#ifndef VA_ENABLE_TRACE
+	g_print("Built without ENABLE_TRACE, spans compile to nothing; this measures the bare loop\n");
+#endif
+
+	/* warm up the buffers so page faults are not counted */
+	run_spans(1 << 20);
+
+	std::vector<double> per_span(threads);
+	std::atomic<bool> done { false };
+	std::vector<std::thread> workers;
+	for (unsigned t = 0; t < threads; ++t) {
+		workers.emplace_back([t, spans, &per_span] {
+			run_spans(1 << 20);
+			per_span[t] = run_spans(spans);
+		});
+	}
+
+#ifdef VA_ENABLE_TRACE
+	/* export concurrently, as SIGUSR1 would */
+	std::thread exporter { [&done, &output] {
+		while (!done) {
+			VA_TRACE_EXPORT(output);
+			std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		}
+	} };
+#endif
+
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+	done = true;
+#ifdef VA_ENABLE_TRACE
+	exporter.join();
+	size_t events = VA_TRACE_EXPORT(output);
+	g_print("Wrote %zu events to %s\n", events, output.c_str());
+#endif
+
+	double worst = 0.0;
+	for (unsigned t = 0; t < threads; ++t) {
+		g_print("thread %u: %.1f ns per span\n", t, per_span[t]);
+		worst = std::max(worst, per_span[t]);
+	}
+	g_print("worst: %.1f ns per span\n", worst);
+	return EXIT_SUCCESS;
+}